@@ -22,6 +22,8 @@ extern "C" {
 #endif
 
 #define EVENT_TAG_MAP_FILE  "/system/etc/event-log-tags"
+/* precompiled index of a map file, made at build time */
+#define EVENT_TAG_MAP_INDEX_SUFFIX  ".idx"
 
 struct EventTagMap;
 typedef struct EventTagMap EventTagMap;
@@ -33,6 +35,14 @@ typedef struct EventTagMap EventTagMap;
  */
 EventTagMap* android_openEventTagMap(const char* fileName);
 
+/*
+ * Open the specified file as an event log tag map, parsing the text even
+ * if there is a current index next to it.
+ *
+ * Returns NULL on failure.
+ */
+EventTagMap* android_parseEventTagMap(const char* fileName);
+
 /*
  * Close the map.
  */
@@ -43,6 +53,13 @@ void android_closeEventTagMap(EventTagMap* map);
  */
 const char* android_lookupEventTag(const EventTagMap* map, int tag);
 
+/*
+ * Write the precompiled index of a map from android_parseEventTagMap(), to
+ * be named after its file with EVENT_TAG_MAP_INDEX_SUFFIX.  Returns 0 on
+ * success.
+ */
+int android_writeEventTagMapIndex(const EventTagMap* map, const char* fileName);
+
 #ifdef __cplusplus
 }
 #endif
@@ -434,18 +434,31 @@ extern "C" {
 
 /*
  * Log macro that allows you to specify a number for the priority.
+ *
+ * The priority and tag are evaluated once, the arguments only if the line
+ * is loggable.
  */
 #ifndef LOG_PRI
-#define LOG_PRI(priority, tag, ...) \
-    android_printLog(priority, tag, __VA_ARGS__)
+#define LOG_PRI(priority, tag, ...) ({ \
+    int __android_log_prio = (priority); \
+    const char *__android_log_tag = (tag); \
+    android_testLog(__android_log_prio, __android_log_tag) \
+        ? android_printLog(__android_log_prio, __android_log_tag, \
+                           __VA_ARGS__) \
+        : 0; })
 #endif
 
 /*
  * Log macro that allows you to pass in a varargs ("args" is a va_list).
  */
 #ifndef LOG_PRI_VA
-#define LOG_PRI_VA(priority, tag, fmt, args) \
-    android_vprintLog(priority, NULL, tag, fmt, args)
+#define LOG_PRI_VA(priority, tag, fmt, args) ({ \
+    int __android_log_prio = (priority); \
+    const char *__android_log_tag = (tag); \
+    android_testLog(__android_log_prio, __android_log_tag) \
+        ? android_vprintLog(__android_log_prio, NULL, __android_log_tag, \
+                            fmt, args) \
+        : 0; })
 #endif
 
 /*
@@ -534,8 +547,10 @@ typedef enum {
 #define android_btWriteLog(tag, type, payload, len) \
     __android_log_btwrite(tag, type, payload, len)
 
+#define android_testLog(prio, tag) \
+    __android_log_is_loggable(prio, tag)
+
 // TODO: remove these prototypes and their users
-#define android_testLog(prio, tag) (1)
 #define android_writevLog(vec,num) do{}while(0)
 #define android_write1Log(str,len) do{}while (0)
 #define android_setMinPriority(tag, prio) do{}while(0)
@@ -567,6 +582,13 @@ int __android_log_buf_print(int bufID, int prio, const char *tag, const char *fm
 #endif
     ;
 
+/*
+ * Whether a line at prio for tag would be logged, according to the
+ * log.tag.<tag> and log.tag properties. Checked by the LOG_PRI macros
+ * before anything is formatted.
+ */
+int __android_log_is_loggable(int prio, const char *tag);
+
 #ifdef __cplusplus
 }
 #endif
@@ -43,6 +43,19 @@ int __android_log_btwrite(int32_t tag, char type, const void *payload,
     size_t len);
 int __android_log_bswrite(int32_t tag, const char *payload);
 
+/*
+ * Opt-in staging of this process' log records in per-thread buffers, sent
+ * to logd in batches once a buffer fills, its oldest record is a quarter
+ * second old, or a record of WARN or above arrives. A background thread
+ * keeps to the quarter second for threads that stop logging. A thread's
+ * records stay in order, except one logged from a signal handler that
+ * interrupts the thread while it stages, which goes ahead of the staged
+ * ones. Returns the previous setting, or -ENOSYS if not supported.
+ */
+int __android_log_set_buffered(int enable);
+/* Send all staged records now, best effort; usable from crash handlers */
+void __android_log_flush(void);
+
 #ifdef __cplusplus
 }
 #endif
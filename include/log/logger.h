@@ -161,9 +161,34 @@ struct logger_list *android_logger_list_alloc_time(int mode,
                                                    log_time start,
                                                    pid_t pid);
 void android_logger_list_free(struct logger_list *logger_list);
+/*
+ * Have logd send only the entries selected, rather than everything to be
+ * filtered by the reader. Set up before the first read. A NULL or empty
+ * argument removes the selection. Return 0, or a negative errno; -ENOSYS
+ * if the logger can not select entries and the caller must filter. The
+ * selections together must fit in the command sent to logd, else the
+ * first android_logger_list_read() fails with -E2BIG.
+ *
+ * filter: logcat filterspecs, eg "ActivityManager:I *:S". Entries of the
+ *         event log are not subject to it.
+ * uids:   only entries logged by one of these uids.
+ * regex:  only entries whose message matches the POSIX extended regular
+ *         expression. Entries of the event log are not subject to it.
+ */
+int android_logger_list_set_filter(struct logger_list *logger_list,
+                                   const char *filter);
+int android_logger_list_set_uids(struct logger_list *logger_list,
+                                 const uid_t *uids, size_t count);
+int android_logger_list_set_regex(struct logger_list *logger_list,
+                                  const char *regex);
 /* In the purest sense, the following two are orthogonal interfaces */
 int android_logger_list_read(struct logger_list *logger_list,
                              struct log_msg *log_msg);
+/*
+ * Return 1 if the next android_logger_list_read() has an entry to hand
+ * back without waiting, 0 if it would wait for one, or a negative errno.
+ */
+int android_logger_list_pending(struct logger_list *logger_list);
 
 /* Multiple log_id_t opens */
 struct logger *android_logger_open(struct logger_list *logger_list,
@@ -135,6 +135,21 @@ char *android_log_formatLogLine (
     const AndroidLogEntry *p_line,
     size_t *p_outLength);
 
+/**
+ * Formats a binary log entry into a buffer, without the intermediate
+ * message buffer of android_log_processBinaryLogBuffer
+ *
+ * Returns the length written, not NUL terminated, 0 if the entry is
+ * filtered out, -ENOSPC if it does not fit in bufferSize, or -1 if it must
+ * take the general path whatever the room, as a multi-line message does.
+ */
+int android_log_formatBinaryLogLine(
+    AndroidLogFormat *p_format,
+    char *buffer,
+    size_t bufferSize,
+    struct logger_entry *buf,
+    const EventTagMap *map);
+
 
 /**
  * Either print or do not print log line, based on filter
@@ -62,6 +62,9 @@ public:
     int sendData(const void *data, int len);
     // iovec contents not preserved through call
     int sendDatav(struct iovec *iov, int iovcnt);
+    // Send each iovec as its own packet, for datagram and seqpacket
+    // sockets. Uses sendmmsg(2) to send many packets in one system call.
+    int sendPacketsv(struct iovec *iov, int iovcnt);
 
     // Optional reference counting.  Reference count starts at 1.  If
     // it's decremented to 0, it deletes itself.
@@ -82,6 +85,7 @@ private:
     // returns 0 if successful, -1 if there is a 0 byte write or if any
     // other error occurred (use errno to get the error)
     int sendDataLockedv(struct iovec *iov, int iovcnt);
+    int sendPacketsLockedv(struct iovec *iov, int iovcnt);
 };
 
 typedef android::sysutils::List<SocketClient *> SocketClientCollection;
@@ -20,6 +20,7 @@
 #ifndef LIBZIPARCHIVE_ZIPARCHIVE_H_
 #define LIBZIPARCHIVE_ZIPARCHIVE_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
 #include <utils/Compat.h>
@@ -74,6 +75,7 @@ struct ZipEntry {
 };
 
 typedef void* ZipArchiveHandle;
+typedef void* ZipEntryMapHandle;
 
 /*
  * Open a Zip archive, and sets handle to the value of the opaque
@@ -165,13 +167,73 @@ int32_t ExtractEntryToFile(ZipArchiveHandle handle, ZipEntry* entry, int fd);
  * Uncompress a given zip entry to the memory region at |begin| and of
  * size |size|. This size is expected to be the same as the *declared*
  * uncompressed length of the zip entry. It is an error if the *actual*
- * number of uncompressed bytes differs from this number.
+ * number of uncompressed bytes differs from this number, or if their
+ * crc32 differs from the entry's.
  *
  * Returns 0 on success and negative values on failure.
  */
 int32_t ExtractToMemory(ZipArchiveHandle handle, ZipEntry* entry,
                         uint8_t* begin, uint32_t size);
 
+/*
+ * Called with successive pieces of an entry's uncompressed data. Returns
+ * true to carry on, false to stop.
+ */
+typedef bool (*ProcessZipEntryFunction)(const uint8_t* buf, size_t buf_size,
+                                        void* cookie);
+
+/*
+ * Uncompress a given zip entry and pass its contents to |func|, in order
+ * and in pieces of no more than 32K, along with |cookie|. Memory use does
+ * not depend on the size of the entry.
+ *
+ * The crc32 and length of the data are checked only once all of it has
+ * been seen, so nothing should be done with it that can't be undone
+ * until this returns 0.
+ *
+ * Returns 0 on success and negative values on failure, including when
+ * |func| returns false.
+ */
+int32_t ProcessZipEntryContents(ZipArchiveHandle handle, ZipEntry* entry,
+                                ProcessZipEntryFunction func, void* cookie);
+
+/*
+ * Uncompress |count| entries, as if by ExtractToMemory(handle, &entries[i],
+ * begins[i], sizes[i]) for each i, using up to |num_threads| threads
+ * including the calling one. The result of each extraction is stored
+ * in |results[i]|.
+ *
+ * A handle may also be shared by threads calling FindEntry and
+ * ExtractToMemory directly, as long as each uses its own ZipEntry.
+ *
+ * Returns 0 if every entry was extracted, and the first negative
+ * value in |results| otherwise.
+ */
+int32_t ExtractEntriesToMemory(ZipArchiveHandle handle, ZipEntry* entries,
+                               uint8_t** begins, const uint32_t* sizes,
+                               int32_t* results, size_t count,
+                               size_t num_threads);
+
+/*
+ * Map the data of a stored (uncompressed) entry read-only, so that it
+ * can be used in place without being copied. On success |*data| points
+ * at the |entry->uncompressed_length| bytes of the entry, which remain
+ * valid until |*map| is passed to ReleaseEntryMap. An empty entry sets
+ * both to NULL.
+ *
+ * The data are not checked against |entry->crc32|.
+ *
+ * Returns 0 on success and negative values on failure, including when
+ * the entry is compressed.
+ */
+int32_t MapStoredEntry(ZipArchiveHandle handle, const ZipEntry* entry,
+                       ZipEntryMapHandle* map, const uint8_t** data);
+
+/*
+ * Release a mapping made by MapStoredEntry.
+ */
+void ReleaseEntryMap(ZipEntryMapHandle map);
+
 int GetFileDescriptor(const ZipArchiveHandle handle);
 
 const char* ErrorCodeString(int32_t error_code);
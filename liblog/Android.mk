@@ -21,6 +21,7 @@ liblog_sources := logd_write.c
 else
 liblog_sources := logd_write_kern.c
 endif
+liblog_sources += log_is_loggable.c
 
 # some files must not be compiled when building against Mingw
 # they correspond to features not used by our host development tools
@@ -85,4 +86,28 @@ LOCAL_WHOLE_STATIC_LIBRARIES := liblog
 LOCAL_CFLAGS := -Werror
 include $(BUILD_SHARED_LIBRARY)
 
+ifndef WITH_MINGW
+# Precompiled index of the event log tags, see android_openEventTagMap()
+# ========================================================
+include $(CLEAR_VARS)
+LOCAL_MODULE := event-log-tags-index
+LOCAL_SRC_FILES := event_tag_index.c
+LOCAL_STATIC_LIBRARIES := liblog
+LOCAL_CFLAGS := -Werror
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := event-log-tags.idx
+LOCAL_MODULE_CLASS := ETC
+LOCAL_MODULE_PATH := $(TARGET_OUT_ETC)
+include $(BUILD_SYSTEM)/base_rules.mk
+
+event_log_tags_index_tool := $(HOST_OUT_EXECUTABLES)/event-log-tags-index$(HOST_EXECUTABLE_SUFFIX)
+$(LOCAL_BUILT_MODULE): PRIVATE_TOOL := $(event_log_tags_index_tool)
+$(LOCAL_BUILT_MODULE): $(TARGET_OUT_ETC)/event-log-tags $(event_log_tags_index_tool)
+	@echo "Event log tags index: $@"
+	$(hide) mkdir -p $(dir $@)
+	$(hide) $(PRIVATE_TOOL) $< $@
+endif
+
 include $(call first-makefiles-under,$(LOCAL_PATH))
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Build time tool: event-log-tags-index <event-log-tags> <index>
+ *
+ * Parses the event log tag map once, so that android_openEventTagMap()
+ * on the device can map the result instead of parsing it again. The text
+ * is always parsed, an index left from an earlier build is never read.
+ */
+
+#include <stdio.h>
+
+#include <log/event_tag_map.h>
+
+int main(int argc, char **argv)
+{
+    EventTagMap *map;
+    int ret;
+
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <event-log-tags> <index>\n", argv[0]);
+        return 2;
+    }
+
+    map = android_parseEventTagMap(argv[1]);
+    if (map == NULL) {
+        return 1;
+    }
+    ret = android_writeEventTagMapIndex(map, argv[2]);
+    android_closeEventTagMap(map);
+
+    return ret ? 1 : 0;
+}
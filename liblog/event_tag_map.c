@@ -17,9 +17,13 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <log/event_tag_map.h>
 #include <log/log.h>
@@ -34,6 +38,34 @@ typedef struct EventTag {
     const char*     tagStr;
 } EventTag;
 
+/*
+ * Precompiled index, EVENT_TAG_MAP_INDEX_SUFFIX next to the text file.
+ * Little endian: the header, numTags entries sorted by tag index, then the
+ * NUL terminated tag strings; the file ends in a NUL.
+ */
+#define INDEX_MAGIC "EvtTagIx"
+#define INDEX_VERSION 2
+
+/* of the text file the index was made from */
+typedef struct EventTagSource {
+    uint64_t        size;
+    int64_t         mtime;          /* seconds */
+    uint32_t        checksum;       /* FNV-1a of the text */
+    uint32_t        reserved;
+} EventTagSource;
+
+typedef struct EventTagIndexHeader {
+    char            magic[8];
+    uint32_t        version;
+    uint32_t        numTags;
+    EventTagSource  source;
+} EventTagIndexHeader;
+
+typedef struct EventTagIndexEntry {
+    uint32_t        tagIndex;
+    uint32_t        tagOffset;      /* of the string, from the file start */
+} EventTagIndexEntry;
+
 /*
  * Map.
  */
@@ -45,9 +77,16 @@ struct EventTagMap {
     /* array of event tags, sorted numerically by tag index */
     EventTag*       tagArray;
     int             numTags;
+
+    /* or, when loaded from an index, its entries in the mapping */
+    const EventTagIndexEntry* indexArray;
+
+    /* the text as it was before parsing, when parsed */
+    EventTagSource  source;
 };
 
 /* fwd */
+static uint32_t checksumText(const char* cp, size_t len);
 static int processFile(EventTagMap* map);
 static int countMapLines(const EventTagMap* map);
 static int parseMapLines(EventTagMap* map);
@@ -55,15 +94,136 @@ static int scanTagLine(char** pData, EventTag* tag, int lineNum);
 static int sortTags(EventTagMap* map);
 
 
+/*
+ * Whether the index was made from the text file as it is now. The sizes
+ * must match, then either the modification times or the checksums: the
+ * time is lost when the file is copied into a system image, the checksum
+ * then costs one read of the text, still well below parsing it.
+ */
+static int isCurrentIndex(const EventTagSource* indexed, int fd,
+    const struct stat* source)
+{
+    void* addr;
+    uint32_t checksum;
+
+    if (indexed->size != (uint64_t)source->st_size)
+        return 0;
+    if (indexed->mtime == (int64_t)source->st_mtime)
+        return 1;
+    if (source->st_size == 0)
+        return indexed->checksum == checksumText(NULL, 0);
+
+    addr = mmap(NULL, source->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED)
+        return 0;
+    checksum = checksumText(addr, source->st_size);
+    munmap(addr, source->st_size);
+    return indexed->checksum == checksum;
+}
+
+/*
+ * Map the index of fileName, if it is there and was made from the file as
+ * it is now. Nothing is parsed, a bad index is only bounds checked.
+ */
+static EventTagMap* openIndex(const char* fileName)
+{
+    EventTagMap* newTagMap = NULL;
+    const EventTagIndexHeader* header;
+    struct stat source, st;
+    char* indexName;
+    void* addr;
+    size_t len;
+    int fd, sourceFd;
+
+    sourceFd = open(fileName, O_RDONLY);
+    if (sourceFd < 0)
+        return NULL;
+    if ((fstat(sourceFd, &source) < 0)
+            || ((uint64_t)source.st_size > SIZE_MAX)) {
+        close(sourceFd);
+        return NULL;
+    }
+
+    indexName = malloc(strlen(fileName) + sizeof(EVENT_TAG_MAP_INDEX_SUFFIX));
+    if (indexName == NULL) {
+        close(sourceFd);
+        return NULL;
+    }
+    strcpy(indexName, fileName);
+    strcat(indexName, EVENT_TAG_MAP_INDEX_SUFFIX);
+    fd = open(indexName, O_RDONLY);
+    free(indexName);
+    if (fd < 0) {
+        close(sourceFd);
+        return NULL;
+    }
+
+    if ((fstat(fd, &st) < 0) || (st.st_size < (off_t)sizeof(*header))
+            || ((uint64_t)st.st_size > SIZE_MAX)) {
+        close(fd);
+        close(sourceFd);
+        return NULL;
+    }
+    len = st.st_size;
+    addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        close(sourceFd);
+        return NULL;
+    }
+
+    header = addr;
+    if (memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic))
+            || (header->version != INDEX_VERSION)
+            || (header->numTags > ((len - sizeof(*header))
+                                      / sizeof(EventTagIndexEntry)))
+            || (((const char*)addr)[len - 1] != '\0')
+            || !isCurrentIndex(&header->source, sourceFd, &source))
+        goto fail;
+    close(sourceFd);
+
+    newTagMap = calloc(1, sizeof(EventTagMap));
+    if (newTagMap == NULL)
+        goto fail;
+    newTagMap->mapAddr = addr;
+    newTagMap->mapLen = len;
+    newTagMap->numTags = header->numTags;
+    newTagMap->indexArray = (const EventTagIndexEntry*)(header + 1);
+    return newTagMap;
+
+fail:
+    munmap(addr, len);
+    close(sourceFd);
+    return NULL;
+}
+
 /*
  * Open the map file and allocate a structure to manage it.
  *
- * We create a private mapping because we want to terminate the log tag
- * strings with '\0'.
+ * The precompiled index is used when there is a current one, otherwise
+ * the text is parsed.
  */
 EventTagMap* android_openEventTagMap(const char* fileName)
 {
     EventTagMap* newTagMap;
+
+    newTagMap = openIndex(fileName);
+    if (newTagMap != NULL)
+        return newTagMap;
+
+    return android_parseEventTagMap(fileName);
+}
+
+/*
+ * Parse the map file, never looking at its index.
+ *
+ * We create a private mapping of the text, because we want to terminate
+ * the log tag strings with '\0'.
+ */
+EventTagMap* android_parseEventTagMap(const char* fileName)
+{
+    EventTagMap* newTagMap;
+    struct stat st;
     off_t end;
     int fd = -1;
 
@@ -94,9 +254,15 @@ EventTagMap* android_openEventTagMap(const char* fileName)
     }
     newTagMap->mapLen = end;
 
+    newTagMap->source.size = end;
+    if (fstat(fd, &st) == 0)
+        newTagMap->source.mtime = st.st_mtime;
+    newTagMap->source.checksum = checksumText(newTagMap->mapAddr, end);
+
     if (processFile(newTagMap) != 0)
         goto fail;
 
+    close(fd);
     return newTagMap;
 
 fail:
@@ -114,7 +280,9 @@ void android_closeEventTagMap(EventTagMap* map)
     if (map == NULL)
         return;
 
-    munmap(map->mapAddr, map->mapLen);
+    if (map->mapAddr != NULL)
+        munmap(map->mapAddr, map->mapLen);
+    free(map->tagArray);
     free(map);
 }
 
@@ -130,6 +298,25 @@ const char* android_lookupEventTag(const EventTagMap* map, int tag)
     lo = 0;
     hi = map->numTags-1;
 
+    if (map->indexArray != NULL) {
+        while (lo <= hi) {
+            const EventTagIndexEntry* entry;
+
+            mid = (lo+hi)/2;
+            entry = &map->indexArray[mid];
+            if (entry->tagIndex < (unsigned int)tag) {
+                lo = mid + 1;
+            } else if (entry->tagIndex > (unsigned int)tag) {
+                hi = mid - 1;
+            } else if (entry->tagOffset < map->mapLen) {
+                return (const char*)map->mapAddr + entry->tagOffset;
+            } else {
+                break;
+            }
+        }
+        return NULL;
+    }
+
     while (lo <= hi) {
         int cmp;
 
@@ -152,6 +339,73 @@ const char* android_lookupEventTag(const EventTagMap* map, int tag)
 
 
 
+/*
+ * Write the index for a map parsed from its text file, to be found by
+ * android_openEventTagMap() next to it.
+ *
+ * Returns 0 on success.
+ */
+int android_writeEventTagMapIndex(const EventTagMap* map, const char* fileName)
+{
+    EventTagIndexHeader header;
+    EventTagIndexEntry entry;
+    uint32_t offset;
+    FILE* fp;
+    int i;
+
+    if (map->tagArray == NULL)
+        return -1;
+
+    fp = fopen(fileName, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: unable to create '%s': %s\n",
+            OUT_TAG, fileName, strerror(errno));
+        return -1;
+    }
+
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.numTags = map->numTags;
+    header.source = map->source;
+    fwrite(&header, sizeof(header), 1, fp);
+
+    offset = sizeof(header) + map->numTags * sizeof(entry);
+    for (i = 0; i < map->numTags; i++) {
+        entry.tagIndex = map->tagArray[i].tagIndex;
+        entry.tagOffset = offset;
+        fwrite(&entry, sizeof(entry), 1, fp);
+        offset += strlen(map->tagArray[i].tagStr) + 1;
+    }
+    for (i = 0; i < map->numTags; i++) {
+        fwrite(map->tagArray[i].tagStr, strlen(map->tagArray[i].tagStr) + 1,
+               1, fp);
+    }
+    /* an empty map still ends in a NUL */
+    if (map->numTags == 0)
+        fputc('\0', fp);
+
+    if (ferror(fp) | fclose(fp)) {
+        fprintf(stderr, "%s: unable to write '%s'\n", OUT_TAG, fileName);
+        unlink(fileName);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * 32-bit FNV-1a of the text, recorded in the index to tell it is current.
+ */
+static uint32_t checksumText(const char* cp, size_t len)
+{
+    uint32_t hash = 2166136261U;
+
+    while (len--) {
+        hash ^= (unsigned char)*cp++;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
 /*
  * Determine whether "c" is a whitespace char.
  */
@@ -0,0 +1,273 @@
+/*
+** Copyright 2014, The Android Open Source Project
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <android/log.h>
+#include <log/log.h>
+
+#if defined(__BIONIC__)
+
+#define _REALLY_INCLUDE_SYS__SYSTEM_PROPERTIES_H_
+#include <sys/_system_properties.h>
+
+/*
+ * A log.tag.<tag> or persist.log.tag.<tag> property sets the lowest
+ * priority logged for <tag>, log.tag and persist.log.tag for all others.
+ * The first letter of the value, as in logcat filterspecs, is the level.
+ * Without any of them everything is logged.
+ */
+#define LOG_TAG_PREFIX "log.tag"
+#define LOG_TAG_PERSIST_PREFIX "persist." LOG_TAG_PREFIX
+
+/*
+ * Decisions are cached per tag against the serial of the property area,
+ * which moves on every property change. Only newer bionic exports that
+ * serial, against an older one nothing is cached and every call reads
+ * the properties. A tag too long for a
+ * log.tag.<tag> property, over LOG_TAG_MAX, has no level of its own and
+ * is not cached. The others are held in the entries themselves: a writer
+ * claims an entry by making its sequence odd, a reader that sees the
+ * sequence odd or moved on takes it as a miss. A tag has LOG_CACHE_PROBE
+ * entries to choose from, once all of them hold other tags the next in
+ * turn is evicted, so any number of tags is served by the fixed table.
+ */
+#define LOG_CACHE_SIZE 256 /* power of two */
+#define LOG_CACHE_PROBE 8 /* power of two */
+#define LOG_TAG_MAX (PROP_NAME_MAX - sizeof(LOG_TAG_PREFIX "."))
+
+struct cache {
+    volatile uint32_t serial;
+    volatile int prio;
+};
+
+struct tag_cache {
+    volatile uint32_t seq;
+    struct cache level;
+    char tag[LOG_TAG_MAX + 1];  /* last byte always '\0' */
+};
+
+extern unsigned int __system_property_area_serial(void)
+    __attribute__((__weak__));
+
+static struct tag_cache cache[LOG_CACHE_SIZE];
+static struct cache cache_global;
+static volatile unsigned cache_victim;
+
+/* Returns the level named by a property value, or 0 if it names none */
+static int value_to_prio(const char *value)
+{
+    switch (value[0]) {
+    case 'V': return ANDROID_LOG_VERBOSE;
+    case 'D': return ANDROID_LOG_DEBUG;
+    case 'I': return ANDROID_LOG_INFO;
+    case 'W': return ANDROID_LOG_WARN;
+    case 'E': return ANDROID_LOG_ERROR;
+    case 'F': /* FALLTHRU */
+    case 'A': return ANDROID_LOG_FATAL;
+    case 'S': return ANDROID_LOG_SILENT;
+    }
+    return 0;
+}
+
+static int property_to_prio(const char *prefix, const char *tag)
+{
+    char key[PROP_NAME_MAX];
+    char value[PROP_VALUE_MAX];
+    size_t len = strlen(prefix);
+
+    if (tag) {
+        if ((len + 1 + strlen(tag)) >= sizeof(key)) {
+            return 0;
+        }
+        memcpy(key, prefix, len);
+        key[len] = '.';
+        strcpy(key + len + 1, tag);
+    } else {
+        memcpy(key, prefix, len + 1);
+    }
+
+    if (__system_property_get(key, value) <= 0) {
+        return 0;
+    }
+    return value_to_prio(value);
+}
+
+static int tag_to_prio(const char *tag)
+{
+    int prio = property_to_prio(LOG_TAG_PREFIX, tag);
+
+    if (!prio) {
+        prio = property_to_prio(LOG_TAG_PERSIST_PREFIX, tag);
+    }
+    return prio;
+}
+
+/* Store a decision, the level is published before the serial it is good for */
+static int cache_set(struct cache *c, uint32_t serial, int prio)
+{
+    c->prio = prio;
+    __sync_synchronize();
+    c->serial = serial;
+    return prio;
+}
+
+/*
+ * A racing update for an older serial can briefly leave that level beside
+ * the current serial; it is corrected by the next property change, and a
+ * level that is stale by one change is no worse than not having seen it.
+ */
+static int cache_get(struct cache *c, uint32_t serial)
+{
+    if (c->serial != serial) {
+        return -1;
+    }
+    __sync_synchronize();
+    return c->prio;
+}
+
+/* Returns the hash of tag, its length in *len */
+static uint32_t tag_hash(const char *tag, size_t *len)
+{
+    uint32_t hash = 5381;
+    const unsigned char *cp;
+
+    for (cp = (const unsigned char *)tag; *cp; ++cp) {
+        hash = (hash * 33) ^ *cp;
+    }
+    *len = cp - (const unsigned char *)tag;
+    return hash;
+}
+
+/*
+ * The entry holding tag, with its level for serial in *prio, -1 if it has
+ * none. NULL if tag is not cached, or its entry is being rewritten.
+ */
+static struct tag_cache *cache_find(const char *tag, uint32_t hash,
+                                    uint32_t serial, int *prio)
+{
+    size_t i;
+
+    *prio = -1;
+    for (i = 0; i < LOG_CACHE_PROBE; ++i) {
+        struct tag_cache *c = &cache[(hash + i) & (LOG_CACHE_SIZE - 1)];
+        uint32_t seq = c->seq;
+        int level;
+
+        if (seq & 1) {
+            continue;
+        }
+        __sync_synchronize();
+        if (strcmp(c->tag, tag)) {
+            continue;
+        }
+        /* the sequence orders the level and the serial */
+        level = (c->level.serial == serial) ? c->level.prio : -1;
+        __sync_synchronize();
+        if (c->seq != seq) {
+            return NULL;
+        }
+        *prio = level;
+        return c;
+    }
+    return NULL;
+}
+
+/*
+ * Store the level of tag in c, its entry, else in a free entry, else in
+ * place of another tag. Given up if another thread is writing the entry.
+ */
+static void cache_store(struct tag_cache *c, const char *tag, uint32_t hash,
+                        uint32_t serial, int prio)
+{
+    uint32_t seq;
+    size_t i;
+
+    if (!c) {
+        for (i = 0; i < LOG_CACHE_PROBE; ++i) {
+            c = &cache[(hash + i) & (LOG_CACHE_SIZE - 1)];
+            if (!c->tag[0]) {
+                break;
+            }
+        }
+        if (i == LOG_CACHE_PROBE) {
+            i = cache_victim++ & (LOG_CACHE_PROBE - 1);
+            c = &cache[(hash + i) & (LOG_CACHE_SIZE - 1)];
+        }
+    }
+
+    seq = c->seq;
+    if ((seq & 1) || !__sync_bool_compare_and_swap(&c->seq, seq, seq + 1)) {
+        return;
+    }
+    strcpy(c->tag, tag);
+    c->level.prio = prio;
+    c->level.serial = serial;
+    __sync_synchronize();
+    c->seq = seq + 2;
+}
+
+int __android_log_is_loggable(int prio, const char *tag)
+{
+    uint32_t serial;
+    struct tag_cache *c;
+    uint32_t hash;
+    size_t len;
+    int level;
+
+    if (!__system_property_area_serial) {
+        level = (tag && *tag) ? tag_to_prio(tag) : 0;
+        if (!level) {
+            level = tag_to_prio(NULL);
+        }
+        return prio >= (level ? level : ANDROID_LOG_VERBOSE);
+    }
+
+    serial = __system_property_area_serial();
+    if (tag && *tag) {
+        hash = tag_hash(tag, &len);
+        if (len <= LOG_TAG_MAX) {
+            c = cache_find(tag, hash, serial, &level);
+            if (level < 0) {
+                level = tag_to_prio(tag);
+                cache_store(c, tag, hash, serial, level);
+            }
+            if (level) {
+                return prio >= level;
+            }
+        }
+    }
+
+    level = cache_get(&cache_global, serial);
+    if (level < 0) {
+        level = cache_set(&cache_global, serial, tag_to_prio(NULL));
+    }
+    return prio >= (level ? level : ANDROID_LOG_VERBOSE);
+}
+
+#else
+
+/* Off device there are no properties, the fake log device does its own
+ * filtering on ANDROID_LOG_TAGS. */
+int __android_log_is_loggable(int prio __attribute__((__unused__)),
+                              const char *tag __attribute__((__unused__)))
+{
+    return 1;
+}
+
+#endif
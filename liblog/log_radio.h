@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LIBLOG_LOG_RADIO_H
+#define _LIBLOG_LOG_RADIO_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Radio tags logged to other buffers are moved to the radio log, and
+ * renamed to inform third party apps/ril/radio.. to use Rlog or RLOG.
+ * The table and the bitmap of first characters are built at compile time
+ * from log_radio_tags.h.
+ */
+#define LOG_RADIO_BIT(c) \
+    ((((unsigned char)(c) >> 6) == LOG_RADIO_WORD) \
+        ? (UINT64_C(1) << ((unsigned char)(c) & 63)) : 0)
+#define LOG_RADIO_TAG(c, tag) | LOG_RADIO_BIT(c)
+#define LOG_RADIO_PREFIX(c, tag) | LOG_RADIO_BIT(c)
+
+#define LOG_RADIO_WORD 0
+static const uint64_t radio_first0 = 0
+#include "log_radio_tags.h"
+    ;
+#undef LOG_RADIO_WORD
+#define LOG_RADIO_WORD 1
+static const uint64_t radio_first1 = 0
+#include "log_radio_tags.h"
+    ;
+#undef LOG_RADIO_WORD
+
+#undef LOG_RADIO_TAG
+#undef LOG_RADIO_PREFIX
+
+static const struct {
+    char first;
+    char prefix;
+    unsigned char len;
+    const char *tag;
+} radio_tags[] = {
+#define LOG_RADIO_TAG(c, tag) { c, 0, sizeof(tag) - 1, tag },
+#define LOG_RADIO_PREFIX(c, tag) { c, 1, sizeof(tag) - 1, tag },
+#include "log_radio_tags.h"
+#undef LOG_RADIO_TAG
+#undef LOG_RADIO_PREFIX
+};
+
+#define RADIO_TAG_PREFIX "use-Rlog/RLOG-"
+
+/* Returns NULL if tag stays, or its radio log name written to buf */
+static inline const char *radio_tag(const char *tag, char *buf, size_t len)
+{
+    unsigned char c = tag[0];
+    size_t i, n;
+
+    /* tags starting with a character above 127 are never radio tags */
+    if (!(((c < 64) ? radio_first0 : (c < 128) ? radio_first1 : 0)
+            & (UINT64_C(1) << (c & 63)))) {
+        return NULL;
+    }
+
+    for (i = 0; i < sizeof(radio_tags) / sizeof(radio_tags[0]); ++i) {
+        if ((radio_tags[i].first != tag[0])
+                || (radio_tags[i].tag[1] != tag[1])) {
+            continue;
+        }
+        if (radio_tags[i].prefix
+                ? strncmp(tag, radio_tags[i].tag, radio_tags[i].len)
+                : strcmp(tag, radio_tags[i].tag)) {
+            continue;
+        }
+
+        /* same as snprintf(buf, len, RADIO_TAG_PREFIX "%s", tag) */
+        n = strlen(tag);
+        if (n > (len - sizeof(RADIO_TAG_PREFIX))) {
+            n = len - sizeof(RADIO_TAG_PREFIX);
+        }
+        memcpy(buf, RADIO_TAG_PREFIX, sizeof(RADIO_TAG_PREFIX) - 1);
+        memcpy(buf + sizeof(RADIO_TAG_PREFIX) - 1, tag, n);
+        buf[sizeof(RADIO_TAG_PREFIX) - 1 + n] = '\0';
+        return buf;
+    }
+
+    return NULL;
+}
+
+#endif /* _LIBLOG_LOG_RADIO_H */
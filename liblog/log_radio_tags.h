@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Tags written to the main log by radio code that belongs in the radio
+ * log. Included by log_radio.h with LOG_RADIO_TAG and LOG_RADIO_PREFIX
+ * defined; no include guard.
+ *
+ *  LOG_RADIO_TAG(first, tag)     matches tag exactly
+ *  LOG_RADIO_PREFIX(first, tag)  matches any tag that starts with tag
+ *
+ * first must be the first character of tag, it selects the entries that
+ * are compared at all. Other tags cost a single bit test.
+ */
+
+LOG_RADIO_TAG('H', "HTC_RIL")
+LOG_RADIO_PREFIX('R', "RIL")
+LOG_RADIO_PREFIX('I', "IMS")
+LOG_RADIO_TAG('A', "AT")
+LOG_RADIO_TAG('G', "GSM")
+LOG_RADIO_TAG('S', "STK")
+LOG_RADIO_TAG('C', "CDMA")
+LOG_RADIO_TAG('P', "PHONE")
+LOG_RADIO_TAG('S', "SMS")
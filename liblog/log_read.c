@@ -14,6 +14,7 @@
 ** limitations under the License.
 */
 
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
@@ -241,9 +242,15 @@ struct logger_list {
     unsigned int tail;
     log_time start;
     pid_t pid;
+    char *filter;  /* selection logd applies for us, see */
+    char *uids;    /* android_logger_list_set_filter() and friends */
+    char *regex;
     int sock;
 };
 
+/* logdr command, lids= and selections included */
+#define LOGDR_COMMAND_MAX 1024
+
 struct logger {
     struct listnode node;
     struct logger_list *top;
@@ -506,6 +513,94 @@ struct logger_list *android_logger_list_alloc_time(int mode,
     return logger_list;
 }
 
+/* Replace a selection, before the first read */
+static int set_selection(struct logger_list *logger_list, char **field,
+                         char *value)
+{
+    if (!logger_list || (logger_list->sock >= 0)) {
+        free(value);
+        return -EINVAL;
+    }
+    free(*field);
+    *field = value;
+    return 0;
+}
+
+int android_logger_list_set_filter(struct logger_list *logger_list,
+                                   const char *filterspec)
+{
+    char *filter, *cp;
+    const char *in;
+
+    if (!filterspec) {
+        return set_selection(logger_list, &logger_list->filter, NULL);
+    }
+    if (strlen(filterspec) >= (LOGDR_COMMAND_MAX / 4)) {
+        return -E2BIG;
+    }
+    filter = malloc(strlen(filterspec) + 1);
+    if (!filter) {
+        return -ENOMEM;
+    }
+    /* whitespace separated for logcat, comma separated on the wire */
+    for (in = filterspec, cp = filter; *in; ++in) {
+        if (isspace(*in) || (*in == ',')) {
+            if ((cp != filter) && (cp[-1] != ',')) {
+                *cp++ = ',';
+            }
+        } else if (isprint(*in)) {
+            *cp++ = *in;
+        } else {
+            free(filter);
+            return -EINVAL;
+        }
+    }
+    *cp = '\0';
+    return set_selection(logger_list, &logger_list->filter, filter);
+}
+
+int android_logger_list_set_uids(struct logger_list *logger_list,
+                                 const uid_t *uids, size_t count)
+{
+    char *list, *cp;
+    size_t i, len = count * 11 + 1;
+
+    if (!count) {
+        return set_selection(logger_list, &logger_list->uids, NULL);
+    }
+    if (len >= (LOGDR_COMMAND_MAX / 4)) {
+        return -E2BIG;
+    }
+    list = malloc(len);
+    if (!list) {
+        return -ENOMEM;
+    }
+    for (i = 0, cp = list; i < count; ++i) {
+        cp += snprintf(cp, len - (cp - list), "%s%u", i ? "," : "", uids[i]);
+    }
+    return set_selection(logger_list, &logger_list->uids, list);
+}
+
+int android_logger_list_set_regex(struct logger_list *logger_list,
+                                  const char *regex)
+{
+    char *copy = NULL;
+
+    if (regex) {
+        if (strlen(regex) >= (LOGDR_COMMAND_MAX / 2)) {
+            return -E2BIG;
+        }
+        if (strpbrk(regex, "\n\r")) {
+            return -EINVAL;
+        }
+        copy = strdup(regex);
+        if (!copy) {
+            return -ENOMEM;
+        }
+    }
+    return set_selection(logger_list, &logger_list->regex, copy);
+}
+
 /* android_logger_list_register unimplemented, no use case */
 /* android_logger_list_unregister unimplemented, no use case */
 
@@ -585,7 +680,7 @@ int android_logger_list_read(struct logger_list *logger_list,
     }
 
     if (logger_list->sock < 0) {
-        char buffer[256], *cp, c;
+        char buffer[LOGDR_COMMAND_MAX], *cp, c;
 
         int sock = socket_local_client("logdr",
                                        ANDROID_SOCKET_NAMESPACE_RESERVED,
@@ -636,6 +731,38 @@ int android_logger_list_read(struct logger_list *logger_list,
             cp += ret;
         }
 
+        if (logger_list->filter) {
+            ret = snprintf(cp, remaining, " filter=%s", logger_list->filter);
+            ret = min(ret, remaining);
+            remaining -= ret;
+            cp += ret;
+        }
+
+        if (logger_list->uids) {
+            ret = snprintf(cp, remaining, " uids=%s", logger_list->uids);
+            ret = min(ret, remaining);
+            remaining -= ret;
+            cp += ret;
+        }
+
+        /* must be last, takes the rest of the command */
+        if (logger_list->regex) {
+            ret = snprintf(cp, remaining, " regex=%s", logger_list->regex);
+            ret = min(ret, remaining);
+            remaining -= ret;
+            cp += ret;
+        }
+
+        /*
+         * logd reads the command in one go into a buffer of the same size,
+         * the selections together must leave room for the terminator
+         * rather than have their tail silently cut off.
+         */
+        if (remaining <= 0) {
+            close(sock);
+            return -E2BIG;
+        }
+
         if (logger_list->mode & O_NONBLOCK) {
             /* Deal with an unresponsive logd */
             sigaction(SIGALRM, &ignore, &old_sigaction);
@@ -703,6 +830,29 @@ int android_logger_list_read(struct logger_list *logger_list,
     return ret;
 }
 
+int android_logger_list_pending(struct logger_list *logger_list)
+{
+    struct pollfd p;
+    int ret;
+
+    if (!logger_list) {
+        return -EINVAL;
+    }
+    if (logger_list->sock < 0) {
+        return 0;
+    }
+
+    p.fd = logger_list->sock;
+    p.events = POLLIN;
+    p.revents = 0;
+    ret = TEMP_FAILURE_RETRY(poll(&p, 1, 0));
+    if (ret < 0) {
+        return -errno;
+    }
+    /* an error or hangup is reported by the read without waiting too */
+    return ret > 0;
+}
+
 /* Close all the logs */
 void android_logger_list_free(struct logger_list *logger_list)
 {
@@ -720,5 +870,8 @@ void android_logger_list_free(struct logger_list *logger_list)
         close (logger_list->sock);
     }
 
+    free(logger_list->filter);
+    free(logger_list->uids);
+    free(logger_list->regex);
     free(logger_list);
 }
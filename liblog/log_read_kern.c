@@ -311,6 +311,26 @@ struct logger_list *android_logger_list_alloc_time(int mode,
     return android_logger_list_alloc(mode, 0, pid);
 }
 
+/* the kernel logger can not select entries, the reader filters */
+int android_logger_list_set_filter(struct logger_list *logger_list __unused,
+                                   const char *filter __unused)
+{
+    return -ENOSYS;
+}
+
+int android_logger_list_set_uids(struct logger_list *logger_list __unused,
+                                 const uid_t *uids __unused,
+                                 size_t count __unused)
+{
+    return -ENOSYS;
+}
+
+int android_logger_list_set_regex(struct logger_list *logger_list __unused,
+                                  const char *regex __unused)
+{
+    return -ENOSYS;
+}
+
 /* android_logger_list_register unimplemented, no use case */
 /* android_logger_list_unregister unimplemented, no use case */
 
@@ -724,6 +744,34 @@ done:
     return ret;
 }
 
+int android_logger_list_pending(struct logger_list *logger_list)
+{
+    struct logger *logger;
+    struct pollfd p;
+    int ret;
+
+    if (!logger_list) {
+        return -ENODEV;
+    }
+    if (logger_list->valid_entry || logger_list->queued_lines) {
+        return 1;
+    }
+
+    logger_for_each(logger, logger_list) {
+        p.fd = logger->fd;
+        p.events = POLLIN;
+        p.revents = 0;
+        ret = TEMP_FAILURE_RETRY(poll(&p, 1, 0));
+        if (ret < 0) {
+            return -errno;
+        }
+        if (ret > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 /* Close all the logs */
 void android_logger_list_free(struct logger_list *logger_list)
 {
@@ -18,6 +18,8 @@
 #ifdef HAVE_PTHREADS
 #include <pthread.h>
 #endif
+#include <sched.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -47,6 +49,8 @@
 #include "fake_log_device.h"
 #endif
 
+#include "log_radio.h"
+
 static int __write_to_log_init(log_id_t, struct iovec *vec, size_t nr);
 static int (*write_to_log)(log_id_t, struct iovec *vec, size_t nr) = __write_to_log_init;
 #ifdef HAVE_PTHREADS
@@ -137,6 +141,350 @@ static int __write_to_log_initialize()
     return ret;
 }
 
+#if !FAKE_LOG_DEVICE && defined(HAVE_PTHREADS)
+/*
+ * Optional staging of records, see __android_log_set_buffered(). Each
+ * thread gathers its records in its own buffer, which is sent with a
+ * single sendmmsg(), one datagram per record as logd expects. The owner
+ * claims the buffer while it uses it, other threads only flush the buffers
+ * they can claim. An owner that finds its buffer being flushed waits for
+ * the flush, which does not block, so that its records stay in order.
+ * There are no locks on the logging path, but for waking the flusher
+ * thread, which sends the records a thread that stopped logging still
+ * holds once they are LOG_STAGE_MS old.
+ */
+#define LOG_STAGE_SIZE (16 * 1024)
+#define LOG_STAGE_RECORDS 32
+#define LOG_STAGE_MS 250 /* oldest record held at most */
+
+/* log_stage.busy */
+#define LOG_STAGE_FREE 0
+#define LOG_STAGE_OWNER 1   /* claimed by the thread it belongs to */
+#define LOG_STAGE_OTHER 2   /* claimed by another thread to flush it */
+
+struct log_stage {
+    struct log_stage *next;     /* log_stages, under log_stage_lock */
+    volatile int busy;
+    size_t used;
+    size_t count;
+    struct timespec first;      /* realtime of the oldest record */
+    struct iovec vec[LOG_STAGE_RECORDS];
+    char data[LOG_STAGE_SIZE];
+};
+
+static volatile int log_stage_enabled;
+static pthread_once_t log_stage_once = PTHREAD_ONCE_INIT;
+static pthread_key_t log_stage_key;
+static pthread_mutex_t log_stage_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_stage_cond = PTHREAD_COND_INITIALIZER;
+static struct log_stage *log_stages;
+static int log_stage_flusher;           /* started, under log_stage_lock */
+static volatile int log_stage_idle = 1; /* flusher has no record to wait for */
+
+/* caller owns s */
+static void __log_stage_flush(struct log_stage *s)
+{
+    struct mmsghdr msgs[LOG_STAGE_RECORDS];
+    size_t i, sent;
+    int ret, retry = 1;
+
+    memset(msgs, 0, sizeof(msgs[0]) * s->count);
+    for (i = 0; i < s->count; ++i) {
+        msgs[i].msg_hdr.msg_iov = &s->vec[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    /* as for a single record, what logd can not take is lost */
+    for (sent = 0; sent < s->count;) {
+        ret = sendmmsg(logd_fd, msgs + sent, s->count - sent, 0);
+        if (ret > 0) {
+            sent += ret;
+            continue;
+        }
+        if ((ret < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if ((ret < 0) && (errno == ENOTCONN) && retry) {
+            retry = 0;
+            pthread_mutex_lock(&log_init_lock);
+            ret = __write_to_log_initialize();
+            pthread_mutex_unlock(&log_init_lock);
+            if (ret == 0) {
+                continue;
+            }
+        }
+        break;
+    }
+
+    s->used = 0;
+    s->count = 0;
+}
+
+/*
+ * Claim the calling thread's own buffer, waiting for a flush by another
+ * thread. Returns 0 if the thread holds it already, logging from a signal
+ * handler while staging a record: that record is written directly, ahead
+ * of those staged.
+ */
+static int __log_stage_claim(struct log_stage *s)
+{
+    int busy;
+
+    while ((busy = __sync_val_compare_and_swap(&s->busy, LOG_STAGE_FREE,
+                                               LOG_STAGE_OWNER))
+            != LOG_STAGE_FREE) {
+        if (busy == LOG_STAGE_OWNER) {
+            return 0;
+        }
+        sched_yield();
+    }
+    return 1;
+}
+
+static void __log_stage_destroy(void *arg)
+{
+    struct log_stage *s = arg, **p;
+
+    if (__log_stage_claim(s) && s->count) {
+        __log_stage_flush(s);
+    }
+
+    pthread_mutex_lock(&log_stage_lock);
+    for (p = &log_stages; *p; p = &(*p)->next) {
+        if (*p == s) {
+            *p = s->next;
+            break;
+        }
+    }
+    /* __android_log_flush() holds the lock while it walks the buffers */
+    pthread_mutex_unlock(&log_stage_lock);
+
+    free(s);
+}
+
+/*
+ * Sends the records staged for LOG_STAGE_MS. Sleeps until the oldest one
+ * is due, or until a thread stages a record while there is none to wait
+ * for. A buffer its owner is using is looked at again shortly, the owner
+ * only flushes it itself if its deadline has passed.
+ */
+static void *__log_stage_flusher(void *arg __unused)
+{
+    struct log_stage *s;
+    struct timespec now, wake;
+    sigset_t mask;
+    long ms, wait_ms;
+
+    sigfillset(&mask);
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+
+    pthread_mutex_lock(&log_stage_lock);
+    for (;;) {
+        log_stage_idle = 1;
+        __sync_synchronize();
+
+        clock_gettime(CLOCK_REALTIME, &now);
+        wait_ms = -1;
+        for (s = log_stages; s; s = s->next) {
+            if (!s->count) {
+                continue;
+            }
+            if (!__sync_bool_compare_and_swap(&s->busy, LOG_STAGE_FREE,
+                                              LOG_STAGE_OTHER)) {
+                ms = LOG_STAGE_MS / 10;
+            } else if (!s->count) {
+                s->busy = LOG_STAGE_FREE;
+                continue;
+            } else {
+                ms = LOG_STAGE_MS
+                   - ((now.tv_sec - s->first.tv_sec) * 1000
+                          + (now.tv_nsec - s->first.tv_nsec) / 1000000);
+                if ((now.tv_sec < s->first.tv_sec) || (ms <= 0)) {
+                    __log_stage_flush(s);
+                    s->busy = LOG_STAGE_FREE;
+                    continue;
+                }
+                s->busy = LOG_STAGE_FREE;
+            }
+            if ((wait_ms < 0) || (ms < wait_ms)) {
+                wait_ms = ms;
+            }
+        }
+
+        if (wait_ms >= 0) {
+            log_stage_idle = 0;
+            wake.tv_sec = now.tv_sec + wait_ms / 1000;
+            wake.tv_nsec = now.tv_nsec + (wait_ms % 1000) * 1000000;
+            if (wake.tv_nsec >= 1000000000) {
+                wake.tv_nsec -= 1000000000;
+                ++wake.tv_sec;
+            }
+            pthread_cond_timedwait(&log_stage_cond, &log_stage_lock, &wake);
+        } else {
+            pthread_cond_wait(&log_stage_cond, &log_stage_lock);
+        }
+    }
+
+    return NULL;
+}
+
+/* a thread staged a record while the flusher was idle */
+static void __log_stage_wake(void)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    pthread_mutex_lock(&log_stage_lock);
+    if (log_stage_flusher) {
+        pthread_cond_signal(&log_stage_cond);
+    } else {
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        log_stage_flusher = !pthread_create(&thread, &attr,
+                                            __log_stage_flusher, NULL);
+        pthread_attr_destroy(&attr);
+        if (!log_stage_flusher) {
+            log_stage_idle = 1; /* try again with the next record */
+        }
+    }
+    pthread_mutex_unlock(&log_stage_lock);
+}
+
+/*
+ * Across fork() log_stage_lock is held, so no other thread is flushing a
+ * buffer. The forking thread sends what it has staged, a child must not
+ * send it again. Nor may the child send what other threads of the parent
+ * had staged: it keeps only its own buffer, empty, and starts a flusher
+ * thread of its own when needed.
+ */
+static void __log_stage_prefork(void)
+{
+    struct log_stage *s;
+
+    pthread_mutex_lock(&log_stage_lock);
+    s = pthread_getspecific(log_stage_key);
+    if (s && __sync_bool_compare_and_swap(&s->busy, LOG_STAGE_FREE,
+                                          LOG_STAGE_OTHER)) {
+        if (s->count) {
+            __log_stage_flush(s);
+        }
+        s->busy = LOG_STAGE_FREE;
+    }
+}
+
+static void __log_stage_postfork_parent(void)
+{
+    pthread_mutex_unlock(&log_stage_lock);
+}
+
+static void __log_stage_postfork_child(void)
+{
+    struct log_stage *self = pthread_getspecific(log_stage_key);
+    struct log_stage *s, *next;
+
+    for (s = log_stages; s; s = next) {
+        next = s->next;
+        if (s != self) {
+            free(s);
+        }
+    }
+    log_stages = self;
+    if (self) {
+        self->next = NULL;
+        self->used = 0;
+        self->count = 0;
+    }
+
+    log_stage_flusher = 0;
+    log_stage_idle = 1;
+    pthread_cond_init(&log_stage_cond, NULL);
+    pthread_mutex_unlock(&log_stage_lock);
+}
+
+static void __log_stage_init(void)
+{
+    pthread_key_create(&log_stage_key, __log_stage_destroy);
+    pthread_atfork(__log_stage_prefork, __log_stage_postfork_parent,
+                   __log_stage_postfork_child);
+    atexit(__android_log_flush);
+}
+
+/*
+ * Stage a record, vec holds the header and the payload. Returns the size of
+ * the payload, or -EBUSY if the record has to be written directly.
+ */
+static int __write_to_log_staged(log_id_t log_id, struct iovec *vec, size_t nr,
+                                 const struct timespec *ts)
+{
+    struct log_stage *s = pthread_getspecific(log_stage_key);
+    size_t i, size, header, staged;
+    char *cp;
+    int prio, first;
+
+    if (!s) {
+        s = calloc(1, sizeof(*s));
+        if (!s) {
+            return -EBUSY;
+        }
+        pthread_mutex_lock(&log_stage_lock);
+        s->next = log_stages;
+        log_stages = s;
+        pthread_mutex_unlock(&log_stage_lock);
+        pthread_setspecific(log_stage_key, s);
+    }
+
+    if (!__log_stage_claim(s)) {
+        return -EBUSY;
+    }
+
+    for (size = 0, i = 0; i < nr; ++i) {
+        size += vec[i].iov_len;
+    }
+    if (s->count && (((s->used + size) > LOG_STAGE_SIZE)
+                  || (s->count >= LOG_STAGE_RECORDS))) {
+        __log_stage_flush(s);
+    }
+
+    cp = s->data + s->used;
+    for (i = 0; i < nr; ++i) {
+        memcpy(cp, vec[i].iov_base, vec[i].iov_len);
+        cp += vec[i].iov_len;
+    }
+    s->vec[s->count].iov_base = s->data + s->used;
+    s->vec[s->count].iov_len = size;
+    first = !s->count;
+    if (first) {
+        s->first = *ts;
+    }
+    s->used += size;
+    ++s->count;
+
+    /* warnings and worse, and anything for the crash log, go at once */
+    header = sizeof_log_id_t + sizeof(uint16_t) + sizeof(log_time);
+    prio = ANDROID_LOG_INFO;
+    if ((log_id != LOG_ID_EVENTS) && (nr > 3) && vec[3].iov_len) {
+        prio = *(const unsigned char *)vec[3].iov_base;
+    }
+    if ((prio >= ANDROID_LOG_WARN) || (log_id == LOG_ID_CRASH)
+            || (ts->tv_sec < s->first.tv_sec)
+            || (((ts->tv_sec - s->first.tv_sec) * 1000
+                   + (ts->tv_nsec - s->first.tv_nsec) / 1000000)
+                >= LOG_STAGE_MS)) {
+        __log_stage_flush(s);
+    }
+
+    staged = s->count;
+    s->busy = LOG_STAGE_FREE;
+
+    if (first && staged
+            && __sync_bool_compare_and_swap(&log_stage_idle, 1, 0)) {
+        __log_stage_wake();
+    }
+
+    return size - header;
+}
+#endif
+
 static int __write_to_log_kernel(log_id_t log_id, struct iovec *vec, size_t nr)
 {
     ssize_t ret;
@@ -227,6 +575,15 @@ static int __write_to_log_kernel(log_id_t log_id, struct iovec *vec, size_t nr)
         }
     }
 
+#ifdef HAVE_PTHREADS
+    if (log_stage_enabled) {
+        ret = __write_to_log_staged(log_id, newVec, i, &ts);
+        if (ret != -EBUSY) {
+            return ret;
+        }
+    }
+#endif
+
     /*
      * The write below could be lost, but will never block.
      *
@@ -314,24 +671,16 @@ int __android_log_write(int prio, const char *tag, const char *msg)
     struct iovec vec[3];
     log_id_t log_id = LOG_ID_MAIN;
     char tmp_tag[32];
+    const char *radio;
 
     if (!tag)
         tag = "";
 
     /* XXX: This needs to go! */
-    if (!strcmp(tag, "HTC_RIL") ||
-        !strncmp(tag, "RIL", 3) || /* Any log tag with "RIL" as the prefix */
-        !strncmp(tag, "IMS", 3) || /* Any log tag with "IMS" as the prefix */
-        !strcmp(tag, "AT") ||
-        !strcmp(tag, "GSM") ||
-        !strcmp(tag, "STK") ||
-        !strcmp(tag, "CDMA") ||
-        !strcmp(tag, "PHONE") ||
-        !strcmp(tag, "SMS")) {
-            log_id = LOG_ID_RADIO;
-            /* Inform third party apps/ril/radio.. to use Rlog or RLOG */
-            snprintf(tmp_tag, sizeof(tmp_tag), "use-Rlog/RLOG-%s", tag);
-            tag = tmp_tag;
+    radio = radio_tag(tag, tmp_tag, sizeof(tmp_tag));
+    if (radio) {
+        log_id = LOG_ID_RADIO;
+        tag = radio;
     }
 
 #if __BIONIC__
@@ -354,25 +703,18 @@ int __android_log_buf_write(int bufID, int prio, const char *tag, const char *ms
 {
     struct iovec vec[3];
     char tmp_tag[32];
+    const char *radio;
 
     if (!tag)
         tag = "";
 
     /* XXX: This needs to go! */
-    if ((bufID != LOG_ID_RADIO) &&
-         (!strcmp(tag, "HTC_RIL") ||
-        !strncmp(tag, "RIL", 3) || /* Any log tag with "RIL" as the prefix */
-        !strncmp(tag, "IMS", 3) || /* Any log tag with "IMS" as the prefix */
-        !strcmp(tag, "AT") ||
-        !strcmp(tag, "GSM") ||
-        !strcmp(tag, "STK") ||
-        !strcmp(tag, "CDMA") ||
-        !strcmp(tag, "PHONE") ||
-        !strcmp(tag, "SMS"))) {
+    if (bufID != LOG_ID_RADIO) {
+        radio = radio_tag(tag, tmp_tag, sizeof(tmp_tag));
+        if (radio) {
             bufID = LOG_ID_RADIO;
-            /* Inform third party apps/ril/radio.. to use Rlog or RLOG */
-            snprintf(tmp_tag, sizeof(tmp_tag), "use-Rlog/RLOG-%s", tag);
-            tag = tmp_tag;
+            tag = radio;
+        }
     }
 
     vec[0].iov_base   = (unsigned char *) &prio;
@@ -497,3 +839,47 @@ int __android_log_bswrite(int32_t tag, const char *payload)
 
     return write_to_log(LOG_ID_EVENTS, vec, 4);
 }
+
+int __android_log_set_buffered(int enable)
+{
+#if FAKE_LOG_DEVICE || !defined(HAVE_PTHREADS)
+    (void)enable;
+    return -ENOSYS;
+#else
+    int previous = log_stage_enabled;
+
+    pthread_once(&log_stage_once, __log_stage_init);
+    log_stage_enabled = !!enable;
+    if (previous && !enable) {
+        __android_log_flush();
+    }
+    return previous;
+#endif
+}
+
+/*
+ * Send what every thread has staged. Best effort, safe to call from a
+ * fatal signal handler: buffers in use, or a registry that is locked, are
+ * left alone rather than waited for.
+ */
+void __android_log_flush(void)
+{
+#if !FAKE_LOG_DEVICE && defined(HAVE_PTHREADS)
+    struct log_stage *s;
+
+    if (pthread_mutex_trylock(&log_stage_lock)) {
+        return;
+    }
+    for (s = log_stages; s; s = s->next) {
+        if (!__sync_bool_compare_and_swap(&s->busy, LOG_STAGE_FREE,
+                                          LOG_STAGE_OTHER)) {
+            continue;
+        }
+        if (s->count) {
+            __log_stage_flush(s);
+        }
+        s->busy = LOG_STAGE_FREE;
+    }
+    pthread_mutex_unlock(&log_stage_lock);
+#endif
+}
@@ -55,6 +55,8 @@
 #define log_close(filedes) close(filedes)
 #endif
 
+#include "log_radio.h"
+
 static int __write_to_log_init(log_id_t, struct iovec *vec, size_t nr);
 static int (*write_to_log)(log_id_t, struct iovec *vec, size_t nr) = __write_to_log_init;
 #ifdef HAVE_PTHREADS
@@ -159,24 +161,16 @@ int __android_log_write(int prio, const char *tag, const char *msg)
     struct iovec vec[3];
     log_id_t log_id = LOG_ID_MAIN;
     char tmp_tag[32];
+    const char *radio;
 
     if (!tag)
         tag = "";
 
     /* XXX: This needs to go! */
-    if (!strcmp(tag, "HTC_RIL") ||
-        !strncmp(tag, "RIL", 3) || /* Any log tag with "RIL" as the prefix */
-        !strncmp(tag, "IMS", 3) || /* Any log tag with "IMS" as the prefix */
-        !strcmp(tag, "AT") ||
-        !strcmp(tag, "GSM") ||
-        !strcmp(tag, "STK") ||
-        !strcmp(tag, "CDMA") ||
-        !strcmp(tag, "PHONE") ||
-        !strcmp(tag, "SMS")) {
-            log_id = LOG_ID_RADIO;
-            /* Inform third party apps/ril/radio.. to use Rlog or RLOG */
-            snprintf(tmp_tag, sizeof(tmp_tag), "use-Rlog/RLOG-%s", tag);
-            tag = tmp_tag;
+    radio = radio_tag(tag, tmp_tag, sizeof(tmp_tag));
+    if (radio) {
+        log_id = LOG_ID_RADIO;
+        tag = radio;
     }
 
 #if __BIONIC__
@@ -199,25 +193,18 @@ int __android_log_buf_write(int bufID, int prio, const char *tag, const char *ms
 {
     struct iovec vec[3];
     char tmp_tag[32];
+    const char *radio;
 
     if (!tag)
         tag = "";
 
     /* XXX: This needs to go! */
-    if ((bufID != LOG_ID_RADIO) &&
-         (!strcmp(tag, "HTC_RIL") ||
-        !strncmp(tag, "RIL", 3) || /* Any log tag with "RIL" as the prefix */
-        !strncmp(tag, "IMS", 3) || /* Any log tag with "IMS" as the prefix */
-        !strcmp(tag, "AT") ||
-        !strcmp(tag, "GSM") ||
-        !strcmp(tag, "STK") ||
-        !strcmp(tag, "CDMA") ||
-        !strcmp(tag, "PHONE") ||
-        !strcmp(tag, "SMS"))) {
+    if (bufID != LOG_ID_RADIO) {
+        radio = radio_tag(tag, tmp_tag, sizeof(tmp_tag));
+        if (radio) {
             bufID = LOG_ID_RADIO;
-            /* Inform third party apps/ril/radio.. to use Rlog or RLOG */
-            snprintf(tmp_tag, sizeof(tmp_tag), "use-Rlog/RLOG-%s", tag);
-            tag = tmp_tag;
+            tag = radio;
+        }
     }
 
     vec[0].iov_base   = (unsigned char *) &prio;
@@ -342,3 +329,12 @@ int __android_log_bswrite(int32_t tag, const char *payload)
 
     return write_to_log(LOG_ID_EVENTS, vec, 4);
 }
+
+int __android_log_set_buffered(int enable __unused)
+{
+    return -ENOSYS;
+}
+
+void __android_log_flush(void)
+{
+}
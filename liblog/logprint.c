@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <log/logd.h>
 #include <log/logprint.h>
@@ -39,6 +40,10 @@ struct AndroidLogFormat_t {
     android_LogPriority global_pri;
     FilterInfo *filters;
     AndroidLogPrintFormat format;
+    /* entries come in bursts within the same second, keep its text */
+    time_t timeSec;
+    int timeValid;
+    char timeBuf[32];
 };
 
 static FilterInfo * filterinfo_new(const char * tag, android_LogPriority pri)
@@ -567,20 +572,18 @@ no_room:
     goto bail;
 }
 
-/**
- * Convert a binary log entry to ASCII form.
+/*
+ * Fill in the header of a binary log entry, and find its tag.
  *
- * For convenience we mimic the processLogBuffer API.  There is no
- * pre-defined output length for the binary data, since we're free to format
- * it however we choose, which means we can't really use a fixed-size buffer
- * here.
+ * If the map has no name for the tag, entry->tag is left NULL and the tag
+ * number is returned in *pTagIndex.
  */
-int android_log_processBinaryLogBuffer(struct logger_entry *buf,
-    AndroidLogEntry *entry, const EventTagMap* map, char* messageBuf,
-    int messageBufLen)
+static int android_log_binaryHeader(struct logger_entry *buf,
+    AndroidLogEntry *entry, const EventTagMap* map,
+    const unsigned char** pEventData, size_t* pInCount,
+    unsigned int* pTagIndex)
 {
     size_t inCount;
-    unsigned int tagIndex;
     const unsigned char* eventData;
 
     entry->tv_sec = buf->sec;
@@ -600,33 +603,30 @@ int android_log_processBinaryLogBuffer(struct logger_entry *buf,
     inCount = buf->len;
     if (inCount < 4)
         return -1;
-    tagIndex = get4LE(eventData);
+    *pTagIndex = get4LE(eventData);
     eventData += 4;
     inCount -= 4;
 
     if (map != NULL) {
-        entry->tag = android_lookupEventTag(map, tagIndex);
+        entry->tag = android_lookupEventTag(map, *pTagIndex);
     } else {
         entry->tag = NULL;
     }
 
-    /*
-     * If we don't have a map, or didn't find the tag number in the map,
-     * stuff a generated tag value into the start of the output buffer and
-     * shift the buffer pointers down.
-     */
-    if (entry->tag == NULL) {
-        int tagLen;
-
-        tagLen = snprintf(messageBuf, messageBufLen, "[%d]", tagIndex);
-        entry->tag = messageBuf;
-        messageBuf += tagLen+1;
-        messageBufLen -= tagLen+1;
-    }
+    *pEventData = eventData;
+    *pInCount = inCount;
+    return 0;
+}
 
-    /*
-     * Format the event log data into the buffer.
-     */
+/*
+ * Format the event log data of a binary log entry into messageBuf, and
+ * terminate it. The NUL byte does not count in *pMessageLen.
+ *
+ * Returns 0 on success, 1 if the text was truncated to fit, -1 on failure.
+ */
+static int android_log_binaryMessage(const unsigned char* eventData,
+    size_t inCount, char* messageBuf, int messageBufLen, size_t* pMessageLen)
+{
     char* outBuf = messageBuf;
     size_t outRemaining = messageBufLen-1;      /* leave one for nul byte */
     int result;
@@ -664,77 +664,136 @@ int android_log_processBinaryLogBuffer(struct logger_entry *buf,
      * entry->messageLen.
      */
     *outBuf = '\0';
-    entry->messageLen = outBuf - messageBuf;
-    assert(entry->messageLen == (messageBufLen-1) - outRemaining);
+    *pMessageLen = outBuf - messageBuf;
+    assert(*pMessageLen == (messageBufLen-1) - outRemaining);
+
+    return result;
+}
 
+/**
+ * Convert a binary log entry to ASCII form.
+ *
+ * For convenience we mimic the processLogBuffer API.  There is no
+ * pre-defined output length for the binary data, since we're free to format
+ * it however we choose, which means we can't really use a fixed-size buffer
+ * here.
+ */
+int android_log_processBinaryLogBuffer(struct logger_entry *buf,
+    AndroidLogEntry *entry, const EventTagMap* map, char* messageBuf,
+    int messageBufLen)
+{
+    size_t inCount;
+    unsigned int tagIndex;
+    const unsigned char* eventData;
+    size_t messageLen;
+
+    if (android_log_binaryHeader(buf, entry, map, &eventData, &inCount,
+                                 &tagIndex) < 0) {
+        return -1;
+    }
+
+    /*
+     * If we don't have a map, or didn't find the tag number in the map,
+     * stuff a generated tag value into the start of the output buffer and
+     * shift the buffer pointers down.
+     */
+    if (entry->tag == NULL) {
+        int tagLen;
+
+        tagLen = snprintf(messageBuf, messageBufLen, "[%d]", tagIndex);
+        entry->tag = messageBuf;
+        messageBuf += tagLen+1;
+        messageBufLen -= tagLen+1;
+    }
+
+    /*
+     * Format the event log data into the buffer.
+     */
+    if (android_log_binaryMessage(eventData, inCount, messageBuf,
+                                  messageBufLen, &messageLen) < 0) {
+        return -1;
+    }
+    entry->messageLen = messageLen;
     entry->message = messageBuf;
 
     return 0;
 }
 
-/**
- * Formats a log message into a buffer
+/*
+ * Get the current date/time in pretty form, once per second
  *
- * Uses defaultBuffer if it can, otherwise malloc()'s a new buffer
- * If return value != defaultBuffer, caller must call free()
- * Returns NULL on malloc error
+ * It's often useful when examining a log with "less" to jump to
+ * a specific point in the file by searching for the date/time stamp.
+ * For this reason it's very annoying to have regexp meta characters
+ * in the time stamp.  Don't use forward slashes, parenthesis,
+ * brackets, asterisks, or other special chars here.
  */
-
-char *android_log_formatLogLine (
-    AndroidLogFormat *p_format,
-    char *defaultBuffer,
-    size_t defaultBufferSize,
-    const AndroidLogEntry *entry,
-    size_t *p_outLength)
+static const char *android_log_formatTime(AndroidLogFormat *p_format,
+    time_t sec)
 {
 #if defined(HAVE_LOCALTIME_R)
     struct tm tmBuf;
 #endif
     struct tm* ptm;
-    char timeBuf[32];
-    char prefixBuf[128], suffixBuf[128];
-    char priChar;
-    int prefixSuffixIsHeaderFooter = 0;
-    char * ret = NULL;
 
-    priChar = filterPriToChar(entry->priority);
+    if (p_format->timeValid && (p_format->timeSec == sec)) {
+        return p_format->timeBuf;
+    }
 
-    /*
-     * Get the current date/time in pretty form
-     *
-     * It's often useful when examining a log with "less" to jump to
-     * a specific point in the file by searching for the date/time stamp.
-     * For this reason it's very annoying to have regexp meta characters
-     * in the time stamp.  Don't use forward slashes, parenthesis,
-     * brackets, asterisks, or other special chars here.
-     */
 #if defined(HAVE_LOCALTIME_R)
-    ptm = localtime_r(&(entry->tv_sec), &tmBuf);
+    ptm = localtime_r(&sec, &tmBuf);
 #else
-    ptm = localtime(&(entry->tv_sec));
+    ptm = localtime(&sec);
 #endif
     //strftime(timeBuf, sizeof(timeBuf), "%Y-%m-%d %H:%M:%S", ptm);
-    strftime(timeBuf, sizeof(timeBuf), "%m-%d %H:%M:%S", ptm);
+    strftime(p_format->timeBuf, sizeof(p_format->timeBuf),
+             "%m-%d %H:%M:%S", ptm);
+    p_format->timeSec = sec;
+    p_format->timeValid = 1;
 
-    /*
-     * Construct a buffer containing the log header and log message.
-     */
+    return p_format->timeBuf;
+}
+
+/*
+ * Construct the log header and footer of an entry, at most 127 characters
+ * each. Returns 1 if they wrap the whole message, 0 if every line of it.
+ */
+static int android_log_formatPrefixSuffix(AndroidLogFormat *p_format,
+    const AndroidLogEntry *entry, char *prefixBuf, size_t *pPrefixLen,
+    char *suffixBuf, size_t *pSuffixLen)
+{
+    const size_t bufSize = 128;
+    const char *timeBuf = "";
+    char priChar;
+    int prefixSuffixIsHeaderFooter = 0;
     size_t prefixLen, suffixLen;
 
+    priChar = filterPriToChar(entry->priority);
+
+    switch (p_format->format) {
+        case FORMAT_TIME:
+        case FORMAT_THREADTIME:
+        case FORMAT_LONG:
+            timeBuf = android_log_formatTime(p_format, entry->tv_sec);
+            break;
+        default:
+            break;
+    }
+
     switch (p_format->format) {
         case FORMAT_TAG:
-            prefixLen = snprintf(prefixBuf, sizeof(prefixBuf),
+            prefixLen = snprintf(prefixBuf, bufSize,
                 "%c/%-8s: ", priChar, entry->tag);
             strcpy(suffixBuf, "\n"); suffixLen = 1;
             break;
         case FORMAT_PROCESS:
-            prefixLen = snprintf(prefixBuf, sizeof(prefixBuf),
+            prefixLen = snprintf(prefixBuf, bufSize,
                 "%c(%5d) ", priChar, entry->pid);
-            suffixLen = snprintf(suffixBuf, sizeof(suffixBuf),
+            suffixLen = snprintf(suffixBuf, bufSize,
                 "  (%s)\n", entry->tag);
             break;
         case FORMAT_THREAD:
-            prefixLen = snprintf(prefixBuf, sizeof(prefixBuf),
+            prefixLen = snprintf(prefixBuf, bufSize,
                 "%c(%5d:%5d) ", priChar, entry->pid, entry->tid);
             strcpy(suffixBuf, "\n");
             suffixLen = 1;
@@ -746,21 +805,21 @@ char *android_log_formatLogLine (
             suffixLen = 1;
             break;
         case FORMAT_TIME:
-            prefixLen = snprintf(prefixBuf, sizeof(prefixBuf),
+            prefixLen = snprintf(prefixBuf, bufSize,
                 "%s.%03ld %c/%-8s(%5d): ", timeBuf, entry->tv_nsec / 1000000,
                 priChar, entry->tag, entry->pid);
             strcpy(suffixBuf, "\n");
             suffixLen = 1;
             break;
         case FORMAT_THREADTIME:
-            prefixLen = snprintf(prefixBuf, sizeof(prefixBuf),
+            prefixLen = snprintf(prefixBuf, bufSize,
                 "%s.%03ld %5d %5d %c %-8s: ", timeBuf, entry->tv_nsec / 1000000,
                 entry->pid, entry->tid, priChar, entry->tag);
             strcpy(suffixBuf, "\n");
             suffixLen = 1;
             break;
         case FORMAT_LONG:
-            prefixLen = snprintf(prefixBuf, sizeof(prefixBuf),
+            prefixLen = snprintf(prefixBuf, bufSize,
                 "[ %s.%03ld %5d:%5d %c/%-8s ]\n",
                 timeBuf, entry->tv_nsec / 1000000, entry->pid,
                 entry->tid, priChar, entry->tag);
@@ -770,7 +829,7 @@ char *android_log_formatLogLine (
             break;
         case FORMAT_BRIEF:
         default:
-            prefixLen = snprintf(prefixBuf, sizeof(prefixBuf),
+            prefixLen = snprintf(prefixBuf, bufSize,
                 "%c/%-8s(%5d): ", priChar, entry->tag, entry->pid);
             strcpy(suffixBuf, "\n");
             suffixLen = 1;
@@ -782,16 +841,114 @@ char *android_log_formatLogLine (
      * possibly causing heap corruption.  To avoid this we double check and
      * set the length at the maximum (size minus null byte)
      */
-    if(prefixLen >= sizeof(prefixBuf))
-        prefixLen = sizeof(prefixBuf) - 1;
-    if(suffixLen >= sizeof(suffixBuf))
-        suffixLen = sizeof(suffixBuf) - 1;
+    if(prefixLen >= bufSize)
+        prefixLen = bufSize - 1;
+    if(suffixLen >= bufSize)
+        suffixLen = bufSize - 1;
+
+    *pPrefixLen = prefixLen;
+    *pSuffixLen = suffixLen;
+    return prefixSuffixIsHeaderFooter;
+}
+
+/**
+ * Formats a binary log entry into a buffer
+ *
+ * Produces what android_log_processBinaryLogBuffer followed by
+ * android_log_formatLogLine would, with the event data formatted straight
+ * into place.
+ *
+ * Returns the length written, 0 if the filters drop the entry, -ENOSPC if
+ * it does not fit in bufferSize, and -1 if it needs the general path
+ * whatever the room (bad header, malformed payload, multi-line message).
+ */
+int android_log_formatBinaryLogLine(
+    AndroidLogFormat *p_format,
+    char *buffer,
+    size_t bufferSize,
+    struct logger_entry *buf,
+    const EventTagMap *map)
+{
+    AndroidLogEntry entry;
+    size_t inCount;
+    unsigned int tagIndex;
+    const unsigned char* eventData;
+    char tagBuf[16];
+    char prefixBuf[128], suffixBuf[128];
+    size_t prefixLen, suffixLen, messageLen;
+
+    if (android_log_binaryHeader(buf, &entry, map, &eventData, &inCount,
+                                 &tagIndex) < 0) {
+        return -1;
+    }
+    if (entry.tag == NULL) {
+        snprintf(tagBuf, sizeof(tagBuf), "[%d]", tagIndex);
+        entry.tag = tagBuf;
+    }
+
+    if (!android_log_shouldPrintLine(p_format, entry.tag, entry.priority)) {
+        return 0;
+    }
+
+    android_log_formatPrefixSuffix(p_format, &entry, prefixBuf, &prefixLen,
+                                   suffixBuf, &suffixLen);
+    if (bufferSize <= (prefixLen + suffixLen + 1)) {
+        return -ENOSPC;
+    }
+
+    switch (android_log_binaryMessage(eventData, inCount, buffer + prefixLen,
+                                      bufferSize - prefixLen - suffixLen,
+                                      &messageLen)) {
+    case 0:
+        break;
+    case 1: /* truncated */
+        return -ENOSPC;
+    default:
+        return -1;
+    }
+    /* a prefix goes on each line, unless it is a header */
+    if ((messageLen == 0) || memchr(buffer + prefixLen, '\n', messageLen)) {
+        return -1;
+    }
+
+    memcpy(buffer, prefixBuf, prefixLen);
+    memcpy(buffer + prefixLen + messageLen, suffixBuf, suffixLen);
+
+    return prefixLen + messageLen + suffixLen;
+}
+
+/**
+ * Formats a log message into a buffer
+ *
+ * Uses defaultBuffer if it can, otherwise malloc()'s a new buffer
+ * If return value != defaultBuffer, caller must call free()
+ * Returns NULL on malloc error
+ */
+
+char *android_log_formatLogLine (
+    AndroidLogFormat *p_format,
+    char *defaultBuffer,
+    size_t defaultBufferSize,
+    const AndroidLogEntry *entry,
+    size_t *p_outLength)
+{
+    char prefixBuf[128], suffixBuf[128];
+    int prefixSuffixIsHeaderFooter;
+    char * ret = NULL;
+    size_t prefixLen, suffixLen;
+
+    /*
+     * Construct a buffer containing the log header and log message.
+     */
+    prefixSuffixIsHeaderFooter = android_log_formatPrefixSuffix(p_format,
+            entry, prefixBuf, &prefixLen, suffixBuf, &suffixLen);
 
     /* the following code is tragically unreadable */
 
     size_t numLines;
     char *p;
     size_t bufferSize;
+    size_t lineLen;
     const char *pm;
 
     if (prefixSuffixIsHeaderFooter) {
@@ -824,39 +981,38 @@ char *android_log_formatLogLine (
         }
     }
 
-    ret[0] = '\0';       /* to start strcat off */
-
     p = ret;
     pm = entry->message;
 
     if (prefixSuffixIsHeaderFooter) {
-        strcat(p, prefixBuf);
+        memcpy(p, prefixBuf, prefixLen);
         p += prefixLen;
-        strncat(p, entry->message, entry->messageLen);
-        p += entry->messageLen;
-        strcat(p, suffixBuf);
+        lineLen = strnlen(entry->message, entry->messageLen);
+        memcpy(p, entry->message, lineLen);
+        p += lineLen;
+        memcpy(p, suffixBuf, suffixLen);
         p += suffixLen;
     } else {
         while(pm < (entry->message + entry->messageLen)) {
             const char *lineStart;
-            size_t lineLen;
             lineStart = pm;
 
             // Find the next end-of-line in message
             while (pm < (entry->message + entry->messageLen)
                     && *pm != '\n') pm++;
-            lineLen = pm - lineStart;
+            lineLen = strnlen(lineStart, pm - lineStart);
 
-            strcat(p, prefixBuf);
+            memcpy(p, prefixBuf, prefixLen);
             p += prefixLen;
-            strncat(p, lineStart, lineLen);
+            memcpy(p, lineStart, lineLen);
             p += lineLen;
-            strcat(p, suffixBuf);
+            memcpy(p, suffixBuf, suffixLen);
             p += suffixLen;
 
             if (*pm == '\n') pm++;
         }
     }
+    *p = '\0';
 
     if (p_outLength != NULL) {
         *p_outLength = p - ret;
@@ -14,9 +14,11 @@
  * limitations under the License.
  */
 
+#include <stdio.h>
 #include <sys/socket.h>
 #include <cutils/sockets.h>
 #include <log/log.h>
+#include <log/logd.h>
 #include <log/logger.h>
 #include <log/log_read.h>
 
@@ -71,6 +73,105 @@ static void BM_log_maximum(int iters) {
 }
 BENCHMARK(BM_log_maximum);
 
+/*
+ *	Measure the same as BM_log_maximum with the process buffering its
+ * records, expect one sendmmsg syscall in place of up to 32 writev, the
+ * difference to BM_log_maximum is the syscall and wakeup cost saved.
+ */
+static void BM_log_maximum_buffered(int iters) {
+    int previous = __android_log_set_buffered(1);
+
+    StartBenchmarkTiming();
+
+    for (int i = 0; i < iters; ++i) {
+        __android_log_print(ANDROID_LOG_INFO, "BM_log_maximum_buffered",
+                            "%d", i);
+    }
+    __android_log_flush();
+
+    StopBenchmarkTiming();
+
+    __android_log_set_buffered(previous > 0);
+}
+BENCHMARK(BM_log_maximum_buffered);
+
+/*
+ *	Measure the cost of a short __android_log_write with the syscall
+ * batched away, so that the tag routing to the radio log shows. The first
+ * uses tags that stay, the second one that is moved and renamed.
+ */
+static void BM_log_write_tag(int iters) {
+    static const char *tags[] = {
+        "ActivityManager", "SurfaceFlinger", "PackageManager", "Sensors",
+        "InputReader", "Choreographer", "AudioFlinger", "dalvikvm"
+    };
+    int previous = __android_log_set_buffered(1);
+
+    StartBenchmarkTiming();
+
+    for (int i = 0; i < iters; ++i) {
+        __android_log_write(ANDROID_LOG_INFO,
+                            tags[i % (sizeof(tags) / sizeof(tags[0]))], "");
+    }
+    __android_log_flush();
+
+    StopBenchmarkTiming();
+
+    __android_log_set_buffered(previous > 0);
+}
+BENCHMARK(BM_log_write_tag);
+
+static void BM_log_write_radio_tag(int iters) {
+    int previous = __android_log_set_buffered(1);
+
+    StartBenchmarkTiming();
+
+    for (int i = 0; i < iters; ++i) {
+        __android_log_write(ANDROID_LOG_INFO, "RILJ", "");
+    }
+    __android_log_flush();
+
+    StopBenchmarkTiming();
+
+    __android_log_set_buffered(previous > 0);
+}
+BENCHMARK(BM_log_write_radio_tag);
+
+/*
+ *	Measure __android_log_is_loggable, the check LOG_PRI makes before
+ * formatting. The first keeps to one cached tag, the second goes through
+ * 1024 tags, four times what its cache holds, and so measures eviction
+ * and the property lookups that follow.
+ */
+static void BM_is_loggable(int iters) {
+    StartBenchmarkTiming();
+
+    for (int i = 0; i < iters; ++i) {
+        __android_log_is_loggable(ANDROID_LOG_INFO, "BM_is_loggable");
+    }
+
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_is_loggable);
+
+static void BM_is_loggable_many_tags(int iters) {
+    static const int tags = 1024;
+    static char name[tags][24];
+
+    for (int i = 0; i < tags; ++i) {
+        snprintf(name[i], sizeof(name[i]), "BM_is_loggable.%d", i);
+    }
+
+    StartBenchmarkTiming();
+
+    for (int i = 0; i < iters; ++i) {
+        __android_log_is_loggable(ANDROID_LOG_INFO, name[i % tags]);
+    }
+
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_is_loggable_many_tags);
+
 /*
  *	Measure the time it takes to submit the android logging call using
  * discrete acquisition under light load. Expect this to be a pair of
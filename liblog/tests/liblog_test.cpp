@@ -16,7 +16,10 @@
 
 #include <fcntl.h>
 #include <inttypes.h>
+#include <sched.h>
 #include <signal.h>
+#include <sys/system_properties.h>
+#include <sys/wait.h>
 #include <gtest/gtest.h>
 #include <log/log.h>
 #include <log/logger.h>
@@ -594,6 +597,295 @@ TEST(liblog, dual_reader) {
     EXPECT_EQ(15, count2);
 }
 
+TEST(liblog, android_logger_list_set_filter) {
+    pid_t pid = getpid();
+    static const char keep[] = "liblog.filter.keep";
+    static const char drop[] = "liblog.filter.drop";
+
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_LT(0, __android_log_buf_print(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                             keep, "kept %d", i));
+        ASSERT_LT(0, __android_log_buf_print(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                             drop, "dropped %d", i));
+        ASSERT_LT(0, __android_log_buf_print(LOG_ID_MAIN, ANDROID_LOG_DEBUG,
+                                             keep, "too low %d", i));
+    }
+    usleep(1000000);
+
+    struct logger_list *logger_list;
+    ASSERT_TRUE(NULL != (logger_list = android_logger_list_open(
+        LOG_ID_MAIN, O_RDONLY | O_NDELAY, 1000, pid)));
+
+    EXPECT_EQ(0, android_logger_list_set_filter(logger_list,
+        "liblog.filter.keep:I *:S"));
+    EXPECT_EQ(0, android_logger_list_set_regex(logger_list, "^kept [0-9]$"));
+    EXPECT_GT(0, android_logger_list_set_filter(logger_list, "\x01"));
+
+    int kept = 0;
+    int other = 0;
+
+    for (;;) {
+        log_msg log_msg;
+        if (android_logger_list_read(logger_list, &log_msg) <= 0) {
+            break;
+        }
+
+        ASSERT_EQ(log_msg.entry.pid, pid);
+
+        AndroidLogEntry entry;
+        if (android_log_processLogBuffer(&log_msg.entry_v1, &entry)) {
+            ++other;
+            continue;
+        }
+        if (!strcmp(entry.tag, keep) && (entry.priority == ANDROID_LOG_INFO)
+                && !strncmp(entry.message, "kept ", 5)) {
+            ++kept;
+        } else {
+            ++other;
+        }
+    }
+
+    // too late once reading has started
+    EXPECT_EQ(-EINVAL, android_logger_list_set_filter(logger_list, NULL));
+
+    android_logger_list_close(logger_list);
+
+    EXPECT_LE(10, kept);
+    EXPECT_EQ(0, other);
+}
+
+TEST(liblog, android_logger_list_set_filter__E2BIG) {
+    // each is within its own limit, together they overflow the command
+    char filter[256] = "";
+    for (int i = 0; i < 17; ++i) {
+        strcat(filter, "liblog.e2big:I ");
+    }
+    char regex[512];
+    memset(regex, 'x', sizeof(regex) - 1);
+    regex[sizeof(regex) - 1] = '\0';
+    uid_t uids[23];
+    for (size_t i = 0; i < (sizeof(uids) / sizeof(uids[0])); ++i) {
+        uids[i] = 1000000000 + i;
+    }
+
+    struct logger_list *logger_list;
+    ASSERT_TRUE(NULL != (logger_list = android_logger_list_open(
+        LOG_ID_MAIN, O_RDONLY | O_NDELAY, 0, getpid())));
+
+    EXPECT_EQ(0, android_logger_list_set_filter(logger_list, filter));
+    EXPECT_EQ(0, android_logger_list_set_uids(logger_list, uids,
+        sizeof(uids) / sizeof(uids[0])));
+    EXPECT_EQ(0, android_logger_list_set_regex(logger_list, regex));
+
+    log_msg log_msg;
+    EXPECT_EQ(-E2BIG, android_logger_list_read(logger_list, &log_msg));
+
+    // not sent, so the selection can still be changed to fit
+    EXPECT_EQ(0, android_logger_list_set_regex(logger_list, NULL));
+    EXPECT_NE(-E2BIG, android_logger_list_read(logger_list, &log_msg));
+
+    android_logger_list_close(logger_list);
+}
+
+TEST(liblog, __android_log_is_loggable) {
+    static const char tag[] = "liblog.loggable";
+    static const char key[] = "log.tag.liblog.loggable";
+
+    ASSERT_EQ(0, __system_property_set(key, "I"));
+    EXPECT_FALSE(__android_log_is_loggable(ANDROID_LOG_DEBUG, tag));
+    EXPECT_TRUE(__android_log_is_loggable(ANDROID_LOG_INFO, tag));
+    EXPECT_TRUE(__android_log_is_loggable(ANDROID_LOG_FATAL, tag));
+
+    // cached decisions must follow a change of the property
+    ASSERT_EQ(0, __system_property_set(key, "S"));
+    usleep(100000);
+    EXPECT_FALSE(__android_log_is_loggable(ANDROID_LOG_FATAL, tag));
+
+    ASSERT_EQ(0, __system_property_set(key, "V"));
+    usleep(100000);
+    EXPECT_TRUE(__android_log_is_loggable(ANDROID_LOG_VERBOSE, tag));
+
+    // LOG_PRI does not format what is not loggable
+    ASSERT_EQ(0, __system_property_set(key, "S"));
+    usleep(100000);
+    int formatted = 0;
+    EXPECT_EQ(0, LOG_PRI(ANDROID_LOG_ERROR, tag, "%d", ++formatted));
+    EXPECT_EQ(0, formatted);
+
+    // and evaluates its priority and tag once, loggable or not
+    int evaluated = 0;
+    EXPECT_EQ(0, LOG_PRI((++evaluated, ANDROID_LOG_ERROR),
+                         (++evaluated, tag), "%d", ++formatted));
+    EXPECT_EQ(2, evaluated);
+    EXPECT_EQ(0, formatted);
+
+    ASSERT_EQ(0, __system_property_set(key, "V"));
+    usleep(100000);
+    evaluated = 0;
+    EXPECT_LT(0, LOG_PRI((++evaluated, ANDROID_LOG_ERROR),
+                         (++evaluated, tag), "%d", ++formatted));
+    EXPECT_EQ(2, evaluated);
+    EXPECT_EQ(1, formatted);
+
+    __system_property_set(key, "");
+}
+
+TEST(liblog, __android_log_is_loggable__many_tags) {
+    static const char key[] = "log.tag.liblog.many.7";
+    char tag[32];
+
+    // far more tags than the cache holds, the set one must still be found
+    ASSERT_EQ(0, __system_property_set(key, "S"));
+    usleep(100000);
+    for (int round = 0; round < 2; ++round) {
+        for (int i = 0; i < 1024; ++i) {
+            snprintf(tag, sizeof(tag), "liblog.many.%d", i);
+            EXPECT_EQ(i != 7, __android_log_is_loggable(ANDROID_LOG_FATAL,
+                                                       tag)) << tag;
+        }
+    }
+
+    __system_property_set(key, "");
+}
+
+// Main log messages of this process with the given tag, each passed to fn.
+// Returns how many, -1 if the log could not be read.
+static int read_tagged(const char *tag,
+                       void (*fn)(const char *message, void *arg), void *arg) {
+    struct logger_list *logger_list = android_logger_list_open(
+        LOG_ID_MAIN, O_RDONLY | O_NDELAY, 0, getpid());
+    if (!logger_list) {
+        return -1;
+    }
+
+    int count = 0;
+    for (;;) {
+        log_msg log_msg;
+        if (android_logger_list_read(logger_list, &log_msg) <= 0) {
+            break;
+        }
+
+        AndroidLogEntry entry;
+        if (android_log_processLogBuffer(&log_msg.entry_v1, &entry)
+                || strcmp(entry.tag, tag)) {
+            continue;
+        }
+        ++count;
+        if (fn) {
+            fn(entry.message, arg);
+        }
+    }
+
+    android_logger_list_close(logger_list);
+    return count;
+}
+
+TEST(liblog, __android_log_set_buffered__deadline) {
+    static const char tag[] = "liblog.buffered.deadline";
+
+    int previous = __android_log_set_buffered(1);
+    ASSERT_LE(0, previous);
+
+    // staged, no further record follows to send it
+    ASSERT_LT(0, __android_log_buf_print(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                         tag, "staged"));
+    // a quarter second at most, and time for logd
+    usleep(500000);
+
+    EXPECT_EQ(1, read_tagged(tag, NULL, NULL));
+
+    __android_log_set_buffered(previous);
+}
+
+static volatile bool flushing;
+
+static void *flush_thread(void * /*arg*/) {
+    while (flushing) {
+        __android_log_flush();
+        sched_yield();
+    }
+    return NULL;
+}
+
+static void check_order(const char *message, void *arg) {
+    int *last = static_cast<int *>(arg);
+    int value = atoi(message);
+
+    EXPECT_EQ(*last + 1, value);
+    *last = value;
+}
+
+TEST(liblog, __android_log_set_buffered__order) {
+    static const char tag[] = "liblog.buffered.order";
+    static const int count = 2000;
+
+    int previous = __android_log_set_buffered(1);
+    ASSERT_LE(0, previous);
+
+    // buffers claimed by another thread must not reorder the owner's records
+    pthread_t t;
+    flushing = true;
+    ASSERT_EQ(0, pthread_create(&t, NULL, flush_thread, NULL));
+    for (int i = 0; i < count; ++i) {
+        ASSERT_LT(0, __android_log_buf_print(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                             tag, "%d", i));
+        if (!(i % 32)) {
+            usleep(1000);
+        }
+    }
+    flushing = false;
+    ASSERT_EQ(0, pthread_join(t, NULL));
+    __android_log_flush();
+    usleep(1000000);
+
+    int last = -1;
+    EXPECT_EQ(count, read_tagged(tag, check_order, &last));
+    EXPECT_EQ(count - 1, last);
+
+    __android_log_set_buffered(previous);
+}
+
+static volatile bool staged;
+
+static void *stage_thread(void *arg) {
+    EXPECT_LT(0, __android_log_buf_print(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                         static_cast<const char *>(arg),
+                                         "staged"));
+    staged = true;
+    usleep(1000000);
+    return NULL;
+}
+
+TEST(liblog, __android_log_set_buffered__fork) {
+    static const char tag[] = "liblog.buffered.fork";
+
+    int previous = __android_log_set_buffered(1);
+    ASSERT_LE(0, previous);
+
+    // a record another thread still holds is the parent's to send
+    pthread_t t;
+    staged = false;
+    ASSERT_EQ(0, pthread_create(&t, NULL, stage_thread,
+                                const_cast<char *>(tag)));
+    while (!staged) {
+        usleep(1000);
+    }
+
+    pid_t pid = fork();
+    ASSERT_LE(0, pid);
+    if (!pid) {
+        __android_log_flush();
+        _exit(0);
+    }
+    ASSERT_EQ(pid, waitpid(pid, NULL, 0));
+    ASSERT_EQ(0, pthread_join(t, NULL));
+    usleep(500000);
+
+    EXPECT_EQ(1, read_tagged(tag, NULL, NULL));
+
+    __android_log_set_buffered(previous);
+}
+
 TEST(liblog, android_logger_get_) {
     struct logger_list * logger_list = android_logger_list_alloc(O_WRONLY, 0, 0);
 
@@ -224,6 +224,77 @@ int SocketClient::sendDataLockedv(struct iovec *iov, int iovcnt) {
     return ret;
 }
 
+int SocketClient::sendPacketsv(struct iovec *iov, int iovcnt) {
+    pthread_mutex_lock(&mWriteMutex);
+    int rc = sendPacketsLockedv(iov, iovcnt);
+    pthread_mutex_unlock(&mWriteMutex);
+
+    return rc;
+}
+
+int SocketClient::sendPacketsLockedv(struct iovec *iov, int iovcnt) {
+
+    if (mSocket < 0) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+
+    if (iovcnt <= 0) {
+        return 0;
+    }
+
+    int ret = 0;
+    int e = 0; // SLOGW and sigaction are not inert regarding errno
+    int current = 0;
+
+    struct sigaction new_action, old_action;
+    memset(&new_action, 0, sizeof(new_action));
+    new_action.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &new_action, &old_action);
+
+    static const int max_vlen = 64;
+    struct mmsghdr msgs[max_vlen];
+
+    while (current < iovcnt) {
+        int vlen = iovcnt - current;
+        if (vlen > max_vlen) {
+            vlen = max_vlen;
+        }
+        memset(msgs, 0, sizeof(msgs[0]) * vlen);
+        for (int i = 0; i < vlen; ++i) {
+            msgs[i].msg_hdr.msg_iov = iov + current + i;
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int rc = TEMP_FAILURE_RETRY(sendmmsg(mSocket, msgs, vlen, 0));
+        if ((rc < 0) && (errno == ENOSYS)) {
+            // kernel predates sendmmsg, one packet at a time
+            ssize_t n = TEMP_FAILURE_RETRY(writev(mSocket, iov + current, 1));
+            rc = (n > 0) ? 1 : n;
+        }
+
+        if (rc > 0) {
+            current += rc;
+            continue;
+        }
+
+        if (rc == 0) {
+            e = EIO;
+            SLOGW("0 length write :(");
+        } else {
+            e = errno;
+            SLOGW("write error (%s)", strerror(e));
+        }
+        ret = -1;
+        break;
+    }
+
+    sigaction(SIGPIPE, &old_action, &new_action);
+
+    errno = e;
+    return ret;
+}
+
 void SocketClient::incRef() {
     pthread_mutex_lock(&mRefCountMutex);
     mRefCount++;
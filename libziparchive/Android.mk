@@ -57,7 +57,7 @@ LOCAL_CFLAGS += \
     -Werror
 LOCAL_SRC_FILES := zip_archive_test.cc
 LOCAL_SHARED_LIBRARIES := liblog
-LOCAL_STATIC_LIBRARIES := libziparchive libz libgtest libgtest_main libutils
+LOCAL_STATIC_LIBRARIES := libziparchive libz libgtest libgtest_main libutils libcutils
 include $(BUILD_NATIVE_TEST)
 
 include $(CLEAR_VARS)
@@ -73,5 +73,40 @@ LOCAL_STATIC_LIBRARIES := libziparchive-host \
 	libgtest_host \
 	libgtest_main_host \
 	liblog \
-	libutils
+	libutils \
+	libcutils
 include $(BUILD_HOST_NATIVE_TEST)
+
+# Build benchmarks for the device. Run with:
+#   adb shell ziparchive-benchmarks
+include $(CLEAR_VARS)
+LOCAL_MODULE := ziparchive-benchmarks
+LOCAL_MODULE_TAGS := tests
+LOCAL_CPP_EXTENSION := .cc
+LOCAL_CFLAGS += -Wall -Werror
+LOCAL_SRC_FILES := zip_archive_benchmark.cc
+LOCAL_C_INCLUDES += ${includes}
+LOCAL_SHARED_LIBRARIES := liblog libutils
+LOCAL_STATIC_LIBRARIES := libziparchive libz
+LOCAL_C_INCLUDES += bionic bionic/libstdc++/include external/stlport/stlport
+LOCAL_SHARED_LIBRARIES += libstlport
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA_NATIVE_TESTS)/$(LOCAL_MODULE)
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := ziparchive-benchmarks-host
+LOCAL_MODULE_TAGS := tests
+LOCAL_CPP_EXTENSION := .cc
+LOCAL_CFLAGS += -Wall -Werror
+LOCAL_SRC_FILES := zip_archive_benchmark.cc
+LOCAL_C_INCLUDES += ${includes}
+LOCAL_STATIC_LIBRARIES := libziparchive-host \
+	libz \
+	liblog \
+	libutils \
+	libcutils
+LOCAL_LDLIBS := -lpthread
+ifeq ($(strip $(HOST_OS)),linux)
+LOCAL_LDLIBS += -lrt
+endif
+include $(BUILD_HOST_EXECUTABLE)
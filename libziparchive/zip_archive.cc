@@ -27,8 +27,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <utils/AndroidThreads.h>
 #include <utils/Compat.h>
+#include <utils/Condition.h>
 #include <utils/FileMap.h>
+#include <utils/Mutex.h>
 #include <zlib.h>
 
 #include <JNIHelp.h>  // TEMP_FAILURE_RETRY may or may not be in unistd
@@ -215,7 +218,9 @@ static const char* kErrorMessages[] = {
   "Inconsistent information",
   "Invalid entry name",
   "I/O Error",
-  "File mapping failed"
+  "File mapping failed",
+  "Unsupported compression method",
+  "Callback aborted"
 };
 
 static const int32_t kErrorMessageUpperBound = 0;
@@ -262,9 +267,22 @@ static const int32_t kIoError = -11;
 // We were not able to mmap the central directory or entry contents.
 static const int32_t kMmapFailed = -12;
 
-static const int32_t kErrorMessageLowerBound = -13;
+// The entry's compression method is not one we support, or not one
+// the requested operation supports.
+static const int32_t kUnsupportedMethod = -13;
+
+// The callback given to ProcessZipEntryContents asked us to stop.
+static const int32_t kCallbackAborted = -14;
+
+static const int32_t kErrorMessageLowerBound = -15;
 
 static const char kTempMappingFileName[] = "zip: ExtractFileToFile";
+static const char kEntryMappingFileName[] = "zip: MapEntry";
+
+// Deflated entries at least this long are inflated from a mapping of the
+// archive instead of being read into a buffer first. Below it the cost of
+// setting up and tearing down the mapping outweighs the copy.
+static const uint32_t kMinMappedInflateLength = 256 * 1024;
 
 /*
  * A Read-only Zip archive.
@@ -339,8 +357,45 @@ static android::FileMap* MapFileSegment(const int fd, const off64_t start,
   return file_map;
 }
 
-static int32_t CopyFileToFile(int fd, uint8_t* begin, const uint32_t length, uint64_t *crc_out) {
-  static const uint32_t kBufSize = 32768;
+#ifndef HAVE_PREAD
+static android::Mutex gReadLock;
+#endif
+
+// Attempts to read |len| bytes into |buf| at offset |off|.
+//
+// This method uses pread64 on platforms that support it and
+// lseek64 + read on platforms that don't. This implies that
+// callers should not rely on the |fd| offset being incremented
+// as a side effect of this call. On the latter the seek and read
+// are done under a lock, so that concurrent readers of the same
+// archive don't move the offset from under each other.
+static inline ssize_t ReadAtOffset(int fd, uint8_t* buf, size_t len,
+                                   off64_t off) {
+#ifdef HAVE_PREAD
+  return TEMP_FAILURE_RETRY(pread64(fd, buf, len, off));
+#else
+  // The only supported platform that doesn't support pread at the moment
+  // is Windows. Only recent versions of windows support unix like forks,
+  // and even there the semantics are quite different.
+  android::Mutex::Autolock lock(gReadLock);
+  if (lseek64(fd, off, SEEK_SET) != off) {
+    ALOGW("Zip: failed seek to offset %" PRId64, off);
+    return kIoError;
+  }
+
+  return TEMP_FAILURE_RETRY(read(fd, buf, len));
+#endif  // HAVE_PREAD
+}
+
+// Extracted data go either straight to the caller's buffer |begin|, or,
+// when |func| is set, through a buffer of our own to |func| a piece at a
+// time. Either way each piece is checksummed while it is in the cache.
+static const uint32_t kBufSize = 32768;
+
+static int32_t CopyFileToFile(int fd, off64_t offset, uint8_t* begin,
+                              const uint32_t length,
+                              ProcessZipEntryFunction func, void* cookie,
+                              uint64_t *crc_out) {
   uint8_t buf[kBufSize];
 
   uint32_t count = 0;
@@ -351,15 +406,18 @@ static int32_t CopyFileToFile(int fd, uint8_t* begin, const uint32_t length, uin
     // Safe conversion because kBufSize is narrow enough for a 32 bit signed
     // value.
     ssize_t get_size = (remaining > kBufSize) ? kBufSize : remaining;
-    ssize_t actual = TEMP_FAILURE_RETRY(read(fd, buf, get_size));
+    uint8_t* dest = func ? buf : begin + count;
+    ssize_t actual = ReadAtOffset(fd, dest, get_size, offset + count);
 
     if (actual != get_size) {
       ALOGW("CopyFileToFile: copy read failed (" ZD " vs " ZD ")", actual, get_size);
       return kIoError;
     }
 
-    memcpy(begin + count, buf, get_size);
-    crc = crc32(crc, buf, get_size);
+    crc = crc32(crc, dest, get_size);
+    if (func && !func(dest, get_size, cookie)) {
+      return kCallbackAborted;
+    }
     count += get_size;
   }
 
@@ -712,10 +770,10 @@ void CloseArchive(ZipArchiveHandle handle) {
   delete archive;
 }
 
-static int32_t UpdateEntryFromDataDescriptor(int fd,
+static int32_t UpdateEntryFromDataDescriptor(int fd, off64_t off,
                                              ZipEntry *entry) {
   uint8_t ddBuf[sizeof(DataDescriptor) + sizeof(DataDescriptor::kOptSignature)];
-  ssize_t actual = TEMP_FAILURE_RETRY(read(fd, ddBuf, sizeof(ddBuf)));
+  ssize_t actual = ReadAtOffset(fd, ddBuf, sizeof(ddBuf), off);
   if (actual != sizeof(ddBuf)) {
     return kIoError;
   }
@@ -731,29 +789,6 @@ static int32_t UpdateEntryFromDataDescriptor(int fd,
   return 0;
 }
 
-// Attempts to read |len| bytes into |buf| at offset |off|.
-//
-// This method uses pread64 on platforms that support it and
-// lseek64 + read on platforms that don't. This implies that
-// callers should not rely on the |fd| offset being incremented
-// as a side effect of this call.
-static inline ssize_t ReadAtOffset(int fd, uint8_t* buf, size_t len,
-                                   off64_t off) {
-#ifdef HAVE_PREAD
-  return TEMP_FAILURE_RETRY(pread64(fd, buf, len, off));
-#else
-  // The only supported platform that doesn't support pread at the moment
-  // is Windows. Only recent versions of windows support unix like forks,
-  // and even there the semantics are quite different.
-  if (lseek64(fd, off, SEEK_SET) != off) {
-    ALOGW("Zip: failed seek to offset %" PRId64, off);
-    return kIoError;
-  }
-
-  return TEMP_FAILURE_RETRY(read(fd, buf, len));
-#endif  // HAVE_PREAD
-}
-
 static int32_t FindEntry(const ZipArchive* archive, const int ent,
                          ZipEntry* data) {
   const uint16_t nameLen = archive->hash_table[ent].name_length;
@@ -970,18 +1005,25 @@ int32_t Next(void* cookie, ZipEntry* data, ZipEntryName* name) {
   return kIterationEnd;
 }
 
-static int32_t InflateToFile(int fd, const ZipEntry* entry,
+static int32_t InflateToFile(int fd, off64_t offset, const ZipEntry* entry,
                              uint8_t* begin, uint32_t length,
+                             ProcessZipEntryFunction func, void* cookie,
                              uint64_t* crc_out) {
   int32_t result = -1;
-  const uint32_t kBufSize = 32768;
   uint8_t read_buf[kBufSize];
   uint8_t write_buf[kBufSize];
+  // zlib refuses a NULL next_out even when there is nothing to write, as
+  // for an empty entry, so that still gets somewhere to point at.
+  uint8_t* const out = (func || length == 0) ? write_buf : begin;
+  uint64_t crc = 0;
+  android::FileMap* map = NULL;
   z_stream zstream;
   int zerr;
 
   /*
-   * Initialize the zlib stream struct.
+   * Initialize the zlib stream struct. Output is produced kBufSize at a
+   * time, either into write_buf or into successive windows of the
+   * caller's buffer, which is exactly as long as the declared length.
    */
   memset(&zstream, 0, sizeof(zstream));
   zstream.zalloc = Z_NULL;
@@ -989,8 +1031,8 @@ static int32_t InflateToFile(int fd, const ZipEntry* entry,
   zstream.opaque = Z_NULL;
   zstream.next_in = NULL;
   zstream.avail_in = 0;
-  zstream.next_out = (Bytef*) write_buf;
-  zstream.avail_out = kBufSize;
+  zstream.next_out = (Bytef*) out;
+  zstream.avail_out = 0;
   zstream.data_type = Z_UNKNOWN;
 
   /*
@@ -1012,12 +1054,27 @@ static int32_t InflateToFile(int fd, const ZipEntry* entry,
   const uint32_t uncompressed_length = entry->uncompressed_length;
 
   uint32_t compressed_length = entry->compressed_length;
-  uint32_t write_count = 0;
+
+  /*
+   * Large entries are inflated straight from a mapping of the archive
+   * rather than copied through read_buf. If the mapping can't be made
+   * we read as for small entries.
+   */
+  if (compressed_length >= kMinMappedInflateLength) {
+    map = MapFileSegment(fd, offset, compressed_length, true,
+                         kEntryMappingFileName);
+    if (map != NULL) {
+      zstream.next_in = reinterpret_cast<Bytef*>(map->getDataPtr());
+      zstream.avail_in = compressed_length;
+      compressed_length = 0;
+    }
+  }
+
   do {
     /* read as much as we can */
     if (zstream.avail_in == 0) {
       const ZD_TYPE getSize = (compressed_length > kBufSize) ? kBufSize : compressed_length;
-      const ZD_TYPE actual = TEMP_FAILURE_RETRY(read(fd, read_buf, getSize));
+      const ZD_TYPE actual = ReadAtOffset(fd, read_buf, getSize, offset);
       if (actual != getSize) {
         ALOGW("Zip: inflate read failed (" ZD " vs " ZD ")", actual, getSize);
         result = kIoError;
@@ -1025,13 +1082,30 @@ static int32_t InflateToFile(int fd, const ZipEntry* entry,
       }
 
       compressed_length -= getSize;
+      offset += getSize;
 
       zstream.next_in = read_buf;
       zstream.avail_in = getSize;
     }
 
+    /* move on to the next window of output */
+    if (zstream.avail_out == 0) {
+      const uint32_t remaining = length - zstream.total_out;
+      if (func) {
+        zstream.next_out = write_buf;
+      }
+      zstream.avail_out = (remaining > kBufSize) ? kBufSize : remaining;
+    }
+
     /* uncompress the data */
+    Bytef* const window = zstream.next_out;
     zerr = inflate(&zstream, Z_NO_FLUSH);
+    if (zerr == Z_BUF_ERROR && zstream.avail_out == 0) {
+      // The file might have declared a bogus length.
+      ALOGW("Zip: inflated data exceeds %" PRIu32 " bytes", length);
+      result = kInconsistentInformation;
+      goto z_bail;
+    }
     if (zerr != Z_OK && zerr != Z_STREAM_END) {
       ALOGW("Zip: inflate zerr=%d (nIn=%p aIn=%u nOut=%p aOut=%u)",
           zerr, zstream.next_in, zstream.avail_in,
@@ -1040,26 +1114,21 @@ static int32_t InflateToFile(int fd, const ZipEntry* entry,
       goto z_bail;
     }
 
-    /* write when we're full or when we're done */
-    if (zstream.avail_out == 0 ||
-      (zerr == Z_STREAM_END && zstream.avail_out != kBufSize)) {
-      const size_t write_size = zstream.next_out - write_buf;
-      // The file might have declared a bogus length.
-      if (write_size + write_count > length) {
+    /* checksum, and hand on, what we got */
+    const size_t produced = zstream.next_out - window;
+    crc = crc32(crc, window, produced);
+    if (func && (zstream.avail_out == 0 || zerr == Z_STREAM_END) &&
+        zstream.next_out != write_buf) {
+      if (!func(write_buf, zstream.next_out - write_buf, cookie)) {
+        result = kCallbackAborted;
         goto z_bail;
       }
-      memcpy(begin + write_count, write_buf, write_size);
-      write_count += write_size;
-
-      zstream.next_out = write_buf;
-      zstream.avail_out = kBufSize;
     }
   } while (zerr == Z_OK);
 
   assert(zerr == Z_STREAM_END);     /* other errors should've been caught */
 
-  // stream.adler holds the crc32 value for such streams.
-  *crc_out = zstream.adler;
+  *crc_out = crc;
 
   if (zstream.total_out != uncompressed_length || compressed_length != 0) {
     ALOGW("Zip: size mismatch on inflated file (%lu vs %" PRIu32 ")",
@@ -1072,45 +1141,68 @@ static int32_t InflateToFile(int fd, const ZipEntry* entry,
 
 z_bail:
   inflateEnd(&zstream);    /* free up any allocated structures */
+  if (map != NULL) {
+    map->release();
+  }
 
   return result;
 }
 
-int32_t ExtractToMemory(ZipArchiveHandle handle,
-                        ZipEntry* entry, uint8_t* begin, uint32_t size) {
+static int32_t ExtractToSink(ZipArchiveHandle handle, ZipEntry* entry,
+                             uint8_t* begin, uint32_t size,
+                             ProcessZipEntryFunction func, void* cookie) {
   ZipArchive* archive = (ZipArchive*) handle;
   const uint16_t method = entry->method;
-  off64_t data_offset = entry->offset;
+  const off64_t data_offset = entry->offset;
 
-  if (lseek64(archive->fd, data_offset, SEEK_SET) != data_offset) {
-    ALOGW("Zip: lseek to data at %" PRId64 " failed", (int64_t)data_offset);
-    return kIoError;
-  }
+  // All reads below are positional, the archive fd's offset is never
+  // used, so any number of threads may extract from one handle at once.
 
-  // this should default to kUnknownCompressionMethod.
-  int32_t return_value = -1;
+  int32_t return_value = kUnsupportedMethod;
   uint64_t crc = 0;
   if (method == kCompressStored) {
-    return_value = CopyFileToFile(archive->fd, begin, size, &crc);
+    // As for deflated entries, it's the declared length that's copied,
+    // the buffer only has to be large enough to hold it.
+    const uint32_t length = entry->uncompressed_length;
+    if (length > size) {
+      ALOGW("Zip: stored entry of %" PRIu32 " bytes exceeds %" PRIu32, length, size);
+      return kInconsistentInformation;
+    }
+    return_value = CopyFileToFile(archive->fd, data_offset, begin, length,
+                                  func, cookie, &crc);
   } else if (method == kCompressDeflated) {
-    return_value = InflateToFile(archive->fd, entry, begin, size, &crc);
+    return_value = InflateToFile(archive->fd, data_offset, entry, begin, size,
+                                 func, cookie, &crc);
+  }
+  if (return_value) {
+    return return_value;
   }
 
-  if (!return_value && entry->has_data_descriptor) {
-    return_value = UpdateEntryFromDataDescriptor(archive->fd, entry);
+  if (entry->has_data_descriptor) {
+    return_value = UpdateEntryFromDataDescriptor(archive->fd,
+        data_offset + entry->compressed_length, entry);
     if (return_value) {
       return return_value;
     }
   }
 
-  // TODO: Fix this check by passing the right flags to inflate2 so that
-  // it calculates the CRC for us.
-  if (entry->crc32 != crc && false) {
+  if (entry->crc32 != crc) {
     ALOGW("Zip: crc mismatch: expected %" PRIu32 ", was %" PRIu64, entry->crc32, crc);
     return kInconsistentInformation;
   }
 
-  return return_value;
+  return 0;
+}
+
+int32_t ExtractToMemory(ZipArchiveHandle handle,
+                        ZipEntry* entry, uint8_t* begin, uint32_t size) {
+  return ExtractToSink(handle, entry, begin, size, NULL, NULL);
+}
+
+int32_t ProcessZipEntryContents(ZipArchiveHandle handle, ZipEntry* entry,
+                                ProcessZipEntryFunction func, void* cookie) {
+  return ExtractToSink(handle, entry, NULL, entry->uncompressed_length,
+                       func, cookie);
 }
 
 int32_t ExtractEntryToFile(ZipArchiveHandle handle,
@@ -1151,6 +1243,126 @@ int32_t ExtractEntryToFile(ZipArchiveHandle handle,
   return error;
 }
 
+/*
+ * Work shared by the threads of one ExtractEntriesToMemory call. Entries
+ * are handed out one at a time, so a large entry doesn't hold up the
+ * small ones queued behind a fixed partition.
+ */
+struct ExtractWork {
+  ZipArchiveHandle handle;
+  ZipEntry* entries;
+  uint8_t** begins;
+  const uint32_t* sizes;
+  int32_t* results;
+  size_t count;
+
+  android::Mutex lock;
+  android::Condition done;
+  size_t next;
+  size_t running;
+
+  bool Take(size_t* index) {
+    android::Mutex::Autolock l(lock);
+    if (next >= count) {
+      return false;
+    }
+    *index = next++;
+    return true;
+  }
+
+  void Run() {
+    size_t i;
+    while (Take(&i)) {
+      results[i] = ExtractToMemory(handle, &entries[i], begins[i], sizes[i]);
+    }
+  }
+};
+
+static int ExtractWorker(void* arg) {
+  ExtractWork* work = reinterpret_cast<ExtractWork*>(arg);
+  work->Run();
+
+  android::Mutex::Autolock l(work->lock);
+  if (--work->running == 0) {
+    work->done.signal();
+  }
+  return 0;
+}
+
+int32_t ExtractEntriesToMemory(ZipArchiveHandle handle, ZipEntry* entries,
+                               uint8_t** begins, const uint32_t* sizes,
+                               int32_t* results, size_t count,
+                               size_t num_threads) {
+  ExtractWork work;
+  work.handle = handle;
+  work.entries = entries;
+  work.begins = begins;
+  work.sizes = sizes;
+  work.results = results;
+  work.count = count;
+  work.next = 0;
+  work.running = 0;
+
+  // The calling thread is one of the workers. A thread that fails to
+  // start is simply not there to help, the others pick up its share.
+  if (num_threads > count) {
+    num_threads = count;
+  }
+  for (size_t i = 1; i < num_threads; ++i) {
+    android::Mutex::Autolock l(work.lock);
+    ++work.running;
+    if (!android::createThreadEtc(ExtractWorker, &work, "zip: extract")) {
+      --work.running;
+    }
+  }
+
+  work.Run();
+
+  android::Mutex::Autolock l(work.lock);
+  while (work.running) {
+    work.done.wait(work.lock);
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    if (results[i]) {
+      return results[i];
+    }
+  }
+  return 0;
+}
+
+int32_t MapStoredEntry(ZipArchiveHandle handle, const ZipEntry* entry,
+                       ZipEntryMapHandle* map_out, const uint8_t** data) {
+  ZipArchive* archive = (ZipArchive*) handle;
+
+  if (entry->method != kCompressStored) {
+    return kUnsupportedMethod;
+  }
+
+  *map_out = NULL;
+  *data = NULL;
+  if (entry->uncompressed_length == 0) {
+    return 0;
+  }
+
+  android::FileMap* map = MapFileSegment(archive->fd, entry->offset,
+                                         entry->uncompressed_length, true,
+                                         kEntryMappingFileName);
+  if (map == NULL) {
+    return kMmapFailed;
+  }
+
+  *map_out = map;
+  *data = reinterpret_cast<const uint8_t*>(map->getDataPtr());
+  return 0;
+}
+
+void ReleaseEntryMap(ZipEntryMapHandle map) {
+  if (map != NULL) {
+    reinterpret_cast<android::FileMap*>(map)->release();
+  }
+}
+
 const char* ErrorCodeString(int32_t error_code) {
   if (error_code > kErrorMessageLowerBound && error_code < kErrorMessageUpperBound) {
     return kErrorMessages[error_code * -1];
@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Extraction benchmarks over a generated archive shaped like an APK:
+ * a large deflated classes.dex and native library, a stored
+ * resources.arsc, and many small stored images and deflated layouts.
+ *
+ *   ziparchive-benchmarks [iterations]
+ */
+
+#include "ziparchive/zip_archive.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <string>
+#include <vector>
+
+struct Entry {
+  std::string name;
+  bool deflate;
+  uint32_t length;
+};
+
+static void Put16(std::vector<uint8_t>& out, uint16_t value) {
+  out.push_back(value & 0xff);
+  out.push_back(value >> 8);
+}
+
+static void Put32(std::vector<uint8_t>& out, uint32_t value) {
+  Put16(out, value & 0xffff);
+  Put16(out, value >> 16);
+}
+
+// Text-like data that deflates to about a third of its size.
+static void MakeContents(std::vector<uint8_t>& data, uint32_t length,
+                         uint32_t seed) {
+  static const char* kWords[] = {
+    "android", "view", "layout", "string", "invoke", "virtual", "return",
+    "object", "class", "method", "field", "static", "const", "array",
+  };
+  data.clear();
+  while (data.size() < length) {
+    seed = seed * 1103515245 + 12345;
+    const char* word = kWords[(seed >> 16) % (sizeof(kWords) / sizeof(kWords[0]))];
+    data.insert(data.end(), word, word + strlen(word));
+    data.push_back((seed >> 8) & 0xff);
+  }
+  data.resize(length);
+}
+
+static bool Deflate(const std::vector<uint8_t>& in, std::vector<uint8_t>& out) {
+  z_stream zstream;
+  memset(&zstream, 0, sizeof(zstream));
+  if (deflateInit2(&zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+                   8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+  out.resize(deflateBound(&zstream, in.size()));
+  zstream.next_in = const_cast<Bytef*>(in.empty() ? NULL : &in[0]);
+  zstream.avail_in = in.size();
+  zstream.next_out = &out[0];
+  zstream.avail_out = out.size();
+  const int zerr = deflate(&zstream, Z_FINISH);
+  out.resize(zstream.total_out);
+  deflateEnd(&zstream);
+  return zerr == Z_STREAM_END;
+}
+
+static bool WriteArchive(int fd, const std::vector<Entry>& entries) {
+  std::vector<uint8_t> file;
+  std::vector<uint8_t> directory;
+  std::vector<uint8_t> contents;
+  std::vector<uint8_t> compressed;
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const Entry& entry = entries[i];
+    MakeContents(contents, entry.length, i);
+    const uint32_t crc = crc32(0, contents.empty() ? NULL : &contents[0],
+                               contents.size());
+    if (entry.deflate && !Deflate(contents, compressed)) {
+      return false;
+    }
+    const std::vector<uint8_t>& data = entry.deflate ? compressed : contents;
+    const uint16_t method = entry.deflate ? kCompressDeflated : kCompressStored;
+    const uint32_t local_offset = file.size();
+
+    Put32(file, 0x04034b50);
+    Put16(file, 20);
+    Put16(file, 0);
+    Put16(file, method);
+    Put32(file, 0);
+    Put32(file, crc);
+    Put32(file, data.size());
+    Put32(file, contents.size());
+    Put16(file, entry.name.size());
+    Put16(file, 0);
+    file.insert(file.end(), entry.name.begin(), entry.name.end());
+    file.insert(file.end(), data.begin(), data.end());
+
+    Put32(directory, 0x02014b50);
+    Put16(directory, 20);
+    Put16(directory, 20);
+    Put16(directory, 0);
+    Put16(directory, method);
+    Put32(directory, 0);
+    Put32(directory, crc);
+    Put32(directory, data.size());
+    Put32(directory, contents.size());
+    Put16(directory, entry.name.size());
+    Put16(directory, 0);
+    Put16(directory, 0);
+    Put16(directory, 0);
+    Put16(directory, 0);
+    Put32(directory, 0);
+    Put32(directory, local_offset);
+    directory.insert(directory.end(), entry.name.begin(), entry.name.end());
+  }
+
+  const uint32_t directory_offset = file.size();
+  file.insert(file.end(), directory.begin(), directory.end());
+  Put32(file, 0x06054b50);
+  Put16(file, 0);
+  Put16(file, 0);
+  Put16(file, entries.size());
+  Put16(file, entries.size());
+  Put32(file, directory.size());
+  Put32(file, directory_offset);
+  Put16(file, 0);
+
+  return TEMP_FAILURE_RETRY(write(fd, &file[0], file.size())) ==
+      static_cast<ssize_t>(file.size());
+}
+
+static std::vector<Entry> ApkEntries() {
+  std::vector<Entry> entries;
+  Entry entry;
+
+  entry.name = "AndroidManifest.xml";
+  entry.deflate = true;
+  entry.length = 8 * 1024;
+  entries.push_back(entry);
+
+  entry.name = "classes.dex";
+  entry.length = 8 * 1024 * 1024;
+  entries.push_back(entry);
+
+  entry.name = "lib/armeabi-v7a/libnative.so";
+  entry.length = 2 * 1024 * 1024;
+  entries.push_back(entry);
+
+  entry.name = "resources.arsc";
+  entry.deflate = false;
+  entry.length = 1024 * 1024;
+  entries.push_back(entry);
+
+  char name[64];
+  for (int i = 0; i < 400; ++i) {
+    snprintf(name, sizeof(name), "res/drawable-xhdpi/image_%d.png", i);
+    entry.name = name;
+    entry.deflate = false;
+    entry.length = 2 * 1024 + (i * 997) % (24 * 1024);
+    entries.push_back(entry);
+
+    snprintf(name, sizeof(name), "res/layout/layout_%d.xml", i);
+    entry.name = name;
+    entry.deflate = true;
+    entry.length = 1024 + (i * 331) % (4 * 1024);
+    entries.push_back(entry);
+  }
+
+  return entries;
+}
+
+static uint64_t NanoTime() {
+  struct timespec t;
+  t.tv_sec = t.tv_nsec = 0;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return static_cast<uint64_t>(t.tv_sec) * 1000000000ULL + t.tv_nsec;
+}
+
+static void Report(const char* name, int iterations, uint64_t ns,
+                   uint64_t bytes) {
+  printf("%-36s %10" PRIu64 " ns/op %10.1f MiB/s\n", name, ns / iterations,
+         (bytes * 1e9) / (ns * 1048576.0));
+}
+
+// Everything in the archive, the way a package installer would see it.
+static bool BM_extract_all(ZipArchiveHandle handle,
+                           const std::vector<Entry>& entries, int iterations) {
+  std::vector<uint8_t> buffer;
+  uint64_t bytes = 0;
+
+  const uint64_t start = NanoTime();
+  for (int i = 0; i < iterations; ++i) {
+    for (size_t j = 0; j < entries.size(); ++j) {
+      ZipEntry data;
+      if (FindEntry(handle, entries[j].name.c_str(), &data)) {
+        return false;
+      }
+      buffer.resize(data.uncompressed_length + 1);
+      if (ExtractToMemory(handle, &data, &buffer[0], data.uncompressed_length)) {
+        return false;
+      }
+      bytes += data.uncompressed_length;
+    }
+  }
+  Report("BM_extract_all", iterations, NanoTime() - start, bytes);
+  return true;
+}
+
+static bool BM_extract_one(ZipArchiveHandle handle, const char* entry_name,
+                           const char* name, int iterations) {
+  ZipEntry data;
+  if (FindEntry(handle, entry_name, &data)) {
+    return false;
+  }
+  std::vector<uint8_t> buffer(data.uncompressed_length);
+
+  const uint64_t start = NanoTime();
+  for (int i = 0; i < iterations; ++i) {
+    if (ExtractToMemory(handle, &data, &buffer[0], buffer.size())) {
+      return false;
+    }
+  }
+  Report(name, iterations, NanoTime() - start,
+         static_cast<uint64_t>(iterations) * buffer.size());
+  return true;
+}
+
+static bool Consume(const uint8_t* buf, size_t buf_size, void* cookie) {
+  uint32_t* sum = reinterpret_cast<uint32_t*>(cookie);
+  for (size_t i = 0; i < buf_size; i += 64) {
+    *sum += buf[i];
+  }
+  return true;
+}
+
+// An entry streamed through a callback, as when it is only hashed or
+// forwarded, with no buffer the size of the entry.
+static bool BM_process(ZipArchiveHandle handle, const char* entry_name,
+                       const char* name, int iterations) {
+  ZipEntry data;
+  if (FindEntry(handle, entry_name, &data)) {
+    return false;
+  }
+  uint32_t sum = 0;
+
+  const uint64_t start = NanoTime();
+  for (int i = 0; i < iterations; ++i) {
+    if (ProcessZipEntryContents(handle, &data, Consume, &sum)) {
+      return false;
+    }
+  }
+  Report(name, iterations, NanoTime() - start,
+         static_cast<uint64_t>(iterations) * data.uncompressed_length);
+  return true;
+}
+
+// A stored entry used in place; every page is touched so that the cost
+// of faulting the mapping in is counted.
+static bool BM_map_stored(ZipArchiveHandle handle, const char* entry_name,
+                          const char* name, int iterations) {
+  ZipEntry data;
+  if (FindEntry(handle, entry_name, &data)) {
+    return false;
+  }
+  uint32_t sum = 0;
+
+  const uint64_t start = NanoTime();
+  for (int i = 0; i < iterations; ++i) {
+    ZipEntryMapHandle map;
+    const uint8_t* begin;
+    if (MapStoredEntry(handle, &data, &map, &begin)) {
+      return false;
+    }
+    for (uint32_t j = 0; j < data.uncompressed_length; j += 4096) {
+      sum += begin[j];
+    }
+    ReleaseEntryMap(map);
+  }
+  Report(name, iterations, NanoTime() - start,
+         static_cast<uint64_t>(iterations) * data.uncompressed_length);
+  return sum != 1;  // keep the loads
+}
+
+int main(int argc, char** argv) {
+  const int iterations = (argc > 1) ? atoi(argv[1]) : 20;
+  if (iterations <= 0) {
+    fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  char path[] = "/data/local/tmp/ziparchive_benchmark_XXXXXX";
+  char host_path[] = "/tmp/ziparchive_benchmark_XXXXXX";
+  const char* file_name = path;
+  int fd = mkstemp(path);
+  if (fd == -1) {
+    file_name = host_path;
+    fd = mkstemp(host_path);
+  }
+  if (fd == -1) {
+    fprintf(stderr, "mkstemp: %s\n", strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  const std::vector<Entry> entries = ApkEntries();
+  const bool written = WriteArchive(fd, entries);
+  close(fd);
+  if (!written) {
+    fprintf(stderr, "failed to write %s\n", file_name);
+    unlink(file_name);
+    return EXIT_FAILURE;
+  }
+
+  ZipArchiveHandle handle;
+  int32_t error = OpenArchive(file_name, &handle);
+  unlink(file_name);
+  if (error) {
+    fprintf(stderr, "OpenArchive: %s\n", ErrorCodeString(error));
+    return EXIT_FAILURE;
+  }
+
+  const bool ok =
+      BM_extract_all(handle, entries, iterations) &&
+      BM_extract_one(handle, "classes.dex", "BM_extract_deflated_large", iterations) &&
+      BM_extract_one(handle, "res/layout/layout_7.xml", "BM_extract_deflated_small",
+                     iterations * 1000) &&
+      BM_extract_one(handle, "resources.arsc", "BM_extract_stored_large", iterations) &&
+      BM_extract_one(handle, "res/drawable-xhdpi/image_7.png", "BM_extract_stored_small",
+                     iterations * 1000) &&
+      BM_process(handle, "classes.dex", "BM_process_deflated_large", iterations) &&
+      BM_process(handle, "resources.arsc", "BM_process_stored_large", iterations) &&
+      BM_map_stored(handle, "resources.arsc", "BM_map_stored_large", iterations) &&
+      BM_map_stored(handle, "res/drawable-xhdpi/image_7.png", "BM_map_stored_small",
+                    iterations * 1000);
+
+  CloseArchive(handle);
+  if (!ok) {
+    fprintf(stderr, "extraction failed\n");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -18,11 +18,13 @@
 
 #include <errno.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <vector>
 
 #include <gtest/gtest.h>
+#include <zlib.h>
 
 static std::string test_data_dir;
 
@@ -149,6 +151,146 @@ TEST(ziparchive, ExtractToMemory) {
   CloseArchive(handle);
 }
 
+TEST(ziparchive, MapStoredEntry) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
+
+  // An entry that's stored.
+  ZipEntry data;
+  ZipEntryMapHandle map;
+  const uint8_t* begin;
+  ASSERT_EQ(0, FindEntry(handle, "b.txt", &data));
+  ASSERT_EQ(0, MapStoredEntry(handle, &data, &map, &begin));
+  ASSERT_EQ(sizeof(kBTxtContents), data.uncompressed_length);
+  ASSERT_EQ(0, memcmp(begin, kBTxtContents, sizeof(kBTxtContents)));
+  ReleaseEntryMap(map);
+
+  // An entry that's deflated can't be mapped.
+  ASSERT_EQ(0, FindEntry(handle, "a.txt", &data));
+  ASSERT_GT(0, MapStoredEntry(handle, &data, &map, &begin));
+
+  CloseArchive(handle);
+}
+
+static bool AppendToVector(const uint8_t* buf, size_t buf_size, void* cookie) {
+  std::vector<uint8_t>* contents = reinterpret_cast<std::vector<uint8_t>*>(cookie);
+  contents->insert(contents->end(), buf, buf + buf_size);
+  return true;
+}
+
+static bool Abort(const uint8_t*, size_t, void*) {
+  return false;
+}
+
+TEST(ziparchive, ProcessZipEntryContents) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
+
+  // An entry that's deflated.
+  ZipEntry data;
+  std::vector<uint8_t> contents;
+  ASSERT_EQ(0, FindEntry(handle, "a.txt", &data));
+  ASSERT_EQ(0, ProcessZipEntryContents(handle, &data, AppendToVector, &contents));
+  ASSERT_EQ(sizeof(kATxtContents), contents.size());
+  ASSERT_EQ(0, memcmp(&contents[0], kATxtContents, sizeof(kATxtContents)));
+  ASSERT_GT(0, ProcessZipEntryContents(handle, &data, Abort, NULL));
+
+  // An entry that's stored.
+  contents.clear();
+  ASSERT_EQ(0, FindEntry(handle, "b.txt", &data));
+  ASSERT_EQ(0, ProcessZipEntryContents(handle, &data, AppendToVector, &contents));
+  ASSERT_EQ(sizeof(kBTxtContents), contents.size());
+  ASSERT_EQ(0, memcmp(&contents[0], kBTxtContents, sizeof(kBTxtContents)));
+  ASSERT_GT(0, ProcessZipEntryContents(handle, &data, Abort, NULL));
+
+  CloseArchive(handle);
+}
+
+static void* ExtractRepeatedly(void* arg) {
+  ZipArchiveHandle handle = arg;
+  for (int i = 0; i < 200; ++i) {
+    ZipEntry data;
+    uint8_t buffer[sizeof(kATxtContents)];
+
+    if (FindEntry(handle, "a.txt", &data) ||
+        data.uncompressed_length != sizeof(kATxtContents) ||
+        ExtractToMemory(handle, &data, buffer, sizeof(kATxtContents)) ||
+        memcmp(buffer, kATxtContents, sizeof(kATxtContents))) {
+      return handle;
+    }
+
+    if (FindEntry(handle, "b.txt", &data) ||
+        data.uncompressed_length != sizeof(kBTxtContents) ||
+        ExtractToMemory(handle, &data, buffer, sizeof(kBTxtContents)) ||
+        memcmp(buffer, kBTxtContents, sizeof(kBTxtContents))) {
+      return handle;
+    }
+  }
+  return NULL;
+}
+
+TEST(ziparchive, ExtractToMemoryThreaded) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
+
+  static const size_t kThreads = 8;
+  pthread_t threads[kThreads];
+  for (size_t i = 0; i < kThreads; ++i) {
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, ExtractRepeatedly, handle));
+  }
+  for (size_t i = 0; i < kThreads; ++i) {
+    void* failed;
+    ASSERT_EQ(0, pthread_join(threads[i], &failed));
+    ASSERT_TRUE(failed == NULL);
+  }
+
+  CloseArchive(handle);
+}
+
+TEST(ziparchive, ExtractEntriesToMemory) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
+
+  static const size_t kCount = 64;
+  ZipEntry entries[kCount];
+  uint8_t* begins[kCount];
+  uint32_t sizes[kCount];
+  int32_t results[kCount];
+  for (size_t i = 0; i < kCount; ++i) {
+    ASSERT_EQ(0, FindEntry(handle, (i & 1) ? "b.txt" : "a.txt", &entries[i]));
+    sizes[i] = entries[i].uncompressed_length;
+    begins[i] = new uint8_t[sizes[i]];
+    results[i] = 1;
+  }
+
+  ASSERT_EQ(0, ExtractEntriesToMemory(handle, entries, begins, sizes,
+                                      results, kCount, 4));
+  for (size_t i = 0; i < kCount; ++i) {
+    ASSERT_EQ(0, results[i]);
+    if (i & 1) {
+      ASSERT_EQ(sizeof(kBTxtContents), sizes[i]);
+      ASSERT_EQ(0, memcmp(begins[i], kBTxtContents, sizes[i]));
+    } else {
+      ASSERT_EQ(sizeof(kATxtContents), sizes[i]);
+      ASSERT_EQ(0, memcmp(begins[i], kATxtContents, sizes[i]));
+    }
+  }
+
+  // A bad entry fails on its own, the others are still extracted.
+  entries[3].method = 0xffff;
+  ASSERT_GT(0, ExtractEntriesToMemory(handle, entries, begins, sizes,
+                                      results, 4, 2));
+  ASSERT_EQ(0, results[0]);
+  ASSERT_EQ(0, results[1]);
+  ASSERT_EQ(0, results[2]);
+  ASSERT_GT(0, results[3]);
+
+  for (size_t i = 0; i < kCount; ++i) {
+    delete[] begins[i];
+  }
+  CloseArchive(handle);
+}
+
 static const uint32_t kEmptyEntriesZip[] = {
       0x04034b50, 0x0000000a, 0x63600000, 0x00004438, 0x00000000, 0x00000000,
       0x00090000, 0x6d65001c, 0x2e797470, 0x55747874, 0x03000954, 0x52e25c13,
@@ -202,6 +344,40 @@ TEST(ziparchive, EmptyEntries) {
   close(output_fd);
 }
 
+TEST(ziparchive, CrcMismatch) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
+  ZipEntry data;
+  ASSERT_EQ(0, FindEntry(handle, "b.txt", &data));
+  const off64_t b_offset = data.offset;
+  const int input_fd = GetFileDescriptor(handle);
+  const off64_t file_size = lseek64(input_fd, 0, SEEK_END);
+  std::vector<uint8_t> file(file_size);
+  ASSERT_EQ(file_size, pread64(input_fd, &file[0], file_size, 0));
+  CloseArchive(handle);
+
+  // Change the contents of b.txt without updating its crc32.
+  file[b_offset] ^= 1;
+  char temp_file_pattern[] = "crc_mismatch_test_XXXXXX";
+  int fd = make_temporary_file(temp_file_pattern);
+  ASSERT_NE(-1, fd);
+  ASSERT_EQ(file_size, TEMP_FAILURE_RETRY(write(fd, &file[0], file_size)));
+
+  ASSERT_EQ(0, OpenArchiveFd(fd, "CrcMismatchTest", &handle));
+  ASSERT_EQ(0, FindEntry(handle, "b.txt", &data));
+  uint8_t buffer[sizeof(kBTxtContents)];
+  ASSERT_GT(0, ExtractToMemory(handle, &data, buffer, sizeof(buffer)));
+  std::vector<uint8_t> contents;
+  ASSERT_GT(0, ProcessZipEntryContents(handle, &data, AppendToVector, &contents));
+
+  // The other entries are unaffected.
+  ASSERT_EQ(0, FindEntry(handle, "a.txt", &data));
+  uint8_t a_buffer[sizeof(kATxtContents)];
+  ASSERT_EQ(0, ExtractToMemory(handle, &data, a_buffer, sizeof(a_buffer)));
+
+  CloseArchive(handle);
+}
+
 TEST(ziparchive, TrailerAfterEOCD) {
   char temp_file_pattern[] = "trailer_after_eocd_test_XXXXXX";
   int fd = make_temporary_file(temp_file_pattern);
@@ -256,6 +432,180 @@ TEST(ziparchive, ExtractToFile) {
   close(fd);
 }
 
+static void Append16(std::vector<uint8_t>* out, uint16_t value) {
+  out->push_back(value & 0xff);
+  out->push_back(value >> 8);
+}
+
+static void Append32(std::vector<uint8_t>* out, uint32_t value) {
+  Append16(out, value & 0xffff);
+  Append16(out, value >> 16);
+}
+
+struct DeflatedEntry {
+  std::string name;
+  std::vector<uint8_t> contents;
+};
+
+// Writes a zip archive to |fd| holding every entry of |entries|, deflated
+// with zlib. The entries in valid.zip are all too small to take the
+// windowed and mapped inflate paths, so these are built at run time.
+static bool WriteDeflatedZip(int fd, const std::vector<DeflatedEntry>& entries) {
+  std::vector<uint8_t> file;
+  std::vector<uint8_t> cd;
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const DeflatedEntry& entry = entries[i];
+    z_stream zstream;
+    memset(&zstream, 0, sizeof(zstream));
+    if (deflateInit2(&zstream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+      return false;
+    }
+    std::vector<uint8_t> compressed(deflateBound(&zstream, entry.contents.size()));
+    zstream.next_in = const_cast<uint8_t*>(entry.contents.data());
+    zstream.avail_in = entry.contents.size();
+    zstream.next_out = &compressed[0];
+    zstream.avail_out = compressed.size();
+    const int zerr = deflate(&zstream, Z_FINISH);
+    deflateEnd(&zstream);
+    if (zerr != Z_STREAM_END) {
+      return false;
+    }
+    compressed.resize(zstream.total_out);
+
+    const uint32_t crc = crc32(crc32(0L, Z_NULL, 0), entry.contents.data(),
+                               entry.contents.size());
+    const uint32_t local_offset = file.size();
+
+    Append32(&file, 0x04034b50);
+    Append16(&file, 20);                      // version needed
+    Append16(&file, 0);                       // flags
+    Append16(&file, 8);                       // deflated
+    Append16(&file, 0);                       // mod time
+    Append16(&file, 0x21);                    // mod date
+    Append32(&file, crc);
+    Append32(&file, compressed.size());
+    Append32(&file, entry.contents.size());
+    Append16(&file, entry.name.size());
+    Append16(&file, 0);                       // extra length
+    file.insert(file.end(), entry.name.begin(), entry.name.end());
+    file.insert(file.end(), compressed.begin(), compressed.end());
+
+    Append32(&cd, 0x02014b50);
+    Append16(&cd, 20);                        // version made by
+    Append16(&cd, 20);                        // version needed
+    Append16(&cd, 0);                         // flags
+    Append16(&cd, 8);                         // deflated
+    Append16(&cd, 0);                         // mod time
+    Append16(&cd, 0x21);                      // mod date
+    Append32(&cd, crc);
+    Append32(&cd, compressed.size());
+    Append32(&cd, entry.contents.size());
+    Append16(&cd, entry.name.size());
+    Append16(&cd, 0);                         // extra length
+    Append16(&cd, 0);                         // comment length
+    Append16(&cd, 0);                         // disk number
+    Append16(&cd, 0);                         // internal attributes
+    Append32(&cd, 0);                         // external attributes
+    Append32(&cd, local_offset);
+    cd.insert(cd.end(), entry.name.begin(), entry.name.end());
+  }
+
+  const uint32_t cd_offset = file.size();
+  file.insert(file.end(), cd.begin(), cd.end());
+  Append32(&file, 0x06054b50);
+  Append16(&file, 0);                         // disk number
+  Append16(&file, 0);                         // central directory disk
+  Append16(&file, entries.size());
+  Append16(&file, entries.size());
+  Append32(&file, cd.size());
+  Append32(&file, cd_offset);
+  Append16(&file, 0);                         // comment length
+
+  const ssize_t file_size = file.size();
+  return TEMP_FAILURE_RETRY(write(fd, &file[0], file_size)) == file_size;
+}
+
+TEST(ziparchive, LargeDeflatedEntries) {
+  std::vector<DeflatedEntry> entries(2);
+
+  // Compressible text that still spans several 32K output windows.
+  entries[0].name = "windowed.txt";
+  for (size_t i = 0; entries[0].contents.size() < 100 * 1024; ++i) {
+    char line[32];
+    snprintf(line, sizeof(line), "line %zu\n", i);
+    entries[0].contents.insert(entries[0].contents.end(), line, line + strlen(line));
+  }
+
+  // Noise that doesn't compress, so the compressed length is past the
+  // 256K above which the input is mapped rather than read.
+  entries[1].name = "mapped.bin";
+  entries[1].contents.resize(320 * 1024);
+  uint32_t seed = 1;
+  for (size_t i = 0; i < entries[1].contents.size(); ++i) {
+    seed = seed * 1103515245 + 12345;
+    entries[1].contents[i] = seed >> 24;
+  }
+
+  char temp_file_pattern[] = "large_deflated_test_XXXXXX";
+  int fd = make_temporary_file(temp_file_pattern);
+  ASSERT_NE(-1, fd);
+  ASSERT_TRUE(WriteDeflatedZip(fd, entries));
+
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveFd(fd, "LargeDeflatedTest", &handle));
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const std::vector<uint8_t>& expected = entries[i].contents;
+    ZipEntry data;
+    ASSERT_EQ(0, FindEntry(handle, entries[i].name.c_str(), &data));
+    ASSERT_EQ(kCompressDeflated, data.method);
+    ASSERT_EQ(expected.size(), data.uncompressed_length);
+    if (i == 1) {
+      ASSERT_LE(256u * 1024, data.compressed_length);
+    }
+
+    std::vector<uint8_t> buffer(data.uncompressed_length);
+    ASSERT_EQ(0, ExtractToMemory(handle, &data, &buffer[0], buffer.size()));
+    ASSERT_TRUE(expected == buffer);
+
+    std::vector<uint8_t> contents;
+    ASSERT_EQ(0, ProcessZipEntryContents(handle, &data, AppendToVector, &contents));
+    ASSERT_TRUE(expected == contents);
+    ASSERT_GT(0, ProcessZipEntryContents(handle, &data, Abort, NULL));
+  }
+
+  CloseArchive(handle);
+}
+
+TEST(ziparchive, EmptyDeflatedEntry) {
+  std::vector<DeflatedEntry> entries(1);
+  entries[0].name = "empty.txt";
+
+  char temp_file_pattern[] = "empty_deflated_test_XXXXXX";
+  int fd = make_temporary_file(temp_file_pattern);
+  ASSERT_NE(-1, fd);
+  ASSERT_TRUE(WriteDeflatedZip(fd, entries));
+
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveFd(fd, "EmptyDeflatedTest", &handle));
+
+  ZipEntry data;
+  ASSERT_EQ(0, FindEntry(handle, "empty.txt", &data));
+  ASSERT_EQ(kCompressDeflated, data.method);
+  ASSERT_EQ(0u, data.uncompressed_length);
+
+  // As into an empty vector's data(), there is no buffer at all.
+  ASSERT_EQ(0, ExtractToMemory(handle, &data, NULL, 0));
+
+  std::vector<uint8_t> contents;
+  ASSERT_EQ(0, ProcessZipEntryContents(handle, &data, AppendToVector, &contents));
+  ASSERT_TRUE(contents.empty());
+
+  CloseArchive(handle);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
 
@@ -5,10 +5,14 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES:= logcat.cpp event.logtags
 
-LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_SHARED_LIBRARIES := liblog libz
+
+LOCAL_C_INCLUDES := external/zlib
 
 LOCAL_MODULE := logcat
 
+LOCAL_REQUIRED_MODULES := event-log-tags.idx
+
 LOCAL_CFLAGS := -Werror
 
 include $(BUILD_EXECUTABLE)
@@ -11,6 +11,8 @@
 #include <signal.h>
 #include <time.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <arpa/inet.h>
@@ -23,6 +25,8 @@
 #include <log/logprint.h>
 #include <log/event_tag_map.h>
 
+#include <zlib.h>
+
 #define DEFAULT_LOG_ROTATE_SIZE_KBYTES 16
 #define DEFAULT_MAX_ROTATED_LOGS 4
 
@@ -64,11 +68,278 @@ static int g_devCount = 0;
 
 static EventTagMap* g_eventTagMap = NULL;
 
+// Formatted lines are gathered here and written out a chunk at a time,
+// when the buffer fills, before rotating, and when the next read would
+// wait, so that nothing is held back while following the log.
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+#define OUTPUT_FLUSH_ROOM (4 * 1024)
+static char g_outBuffer[OUTPUT_BUFFER_SIZE];
+static size_t g_outBufferLen = 0;
+
+static void writeOutput(const char *buf, size_t size)
+{
+    while (size) {
+        ssize_t ret = TEMP_FAILURE_RETRY(write(g_outFD, buf, size));
+        if (ret <= 0) {
+            perror("output error");
+            exit(-1);
+        }
+        buf += ret;
+        size -= ret;
+    }
+}
+
+static void flushOutput()
+{
+    size_t size = g_outBufferLen;
+
+    g_outBufferLen = 0;
+    writeOutput(g_outBuffer, size);
+}
+
+static void bufferOutput(const char *buf, size_t size)
+{
+    if (size > (sizeof(g_outBuffer) - g_outBufferLen)) {
+        flushOutput();
+        if (size > sizeof(g_outBuffer)) {
+            writeOutput(buf, size);
+            return;
+        }
+    }
+    memcpy(g_outBuffer + g_outBufferLen, buf, size);
+    g_outBufferLen += size;
+}
+
 static int openLogFile (const char *pathname)
 {
     return open(pathname, O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR);
 }
 
+// With -z rotated files are named by generation, <file>.<N> with N counting
+// up, so that a rotation is a single rename(). A thread gzips them into
+// <file>.<N>.gz.tmp, renamed to <file>.<N>.gz once complete; temporaries
+// left by an interrupted logcat are removed at start. At most
+// ROTATE_MAX_PENDING segments are queued for the thread, beyond that they
+// are left uncompressed rather than stall the reader.
+#define ROTATE_MAX_PENDING 2
+
+#define ROTATE_GZ_SUFFIX ".gz"
+#define ROTATE_TEMP_SUFFIX ".gz.tmp"
+
+static bool g_compressRotated = false;
+static unsigned long g_rotateGeneration = 0; // newest rotated file
+
+static pthread_mutex_t g_rotateLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_rotateCond = PTHREAD_COND_INITIALIZER;
+static unsigned long g_rotatePending[ROTATE_MAX_PENDING]; // [0] in progress
+static size_t g_rotatePendingCount = 0;
+static bool g_rotateExit = false;
+static bool g_rotateThreadStarted = false;
+static pthread_t g_rotateThread;
+
+static char *generationName(unsigned long generation, const char *suffix)
+{
+    char *name = NULL;
+
+    if (asprintf(&name, "%s.%lu%s", g_outputFileName, generation,
+                 suffix) < 0) {
+        return NULL;
+    }
+    return name;
+}
+
+static void removeGeneration(unsigned long generation)
+{
+    static const char *suffixes[] = { "", ROTATE_GZ_SUFFIX };
+
+    for (size_t i = 0; i < (sizeof(suffixes) / sizeof(suffixes[0])); ++i) {
+        char *name = generationName(generation, suffixes[i]);
+        if (name) {
+            unlink(name);
+            free(name);
+        }
+    }
+}
+
+// Caller holds g_rotateLock
+static bool expiredGeneration(unsigned long generation)
+{
+    return (g_maxRotatedLogs > 0)
+        && ((generation + g_maxRotatedLogs) <= g_rotateGeneration);
+}
+
+static bool compressFile(const char *from, const char *to)
+{
+    static char buf[64 * 1024];
+    bool ok = false;
+    ssize_t len;
+
+    int fd = open(from, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    int outFd = open(to, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    gzFile gz = (outFd < 0) ? NULL : gzdopen(outFd, "wb");
+    if (gz) {
+        ok = true;
+        while ((len = TEMP_FAILURE_RETRY(read(fd, buf, sizeof(buf)))) > 0) {
+            if (gzwrite(gz, buf, len) != len) {
+                ok = false;
+                break;
+            }
+        }
+        if (len < 0) {
+            ok = false;
+        }
+        if (gzclose(gz) != Z_OK) {
+            ok = false;
+        }
+    } else if (outFd >= 0) {
+        close(outFd);
+    }
+    close(fd);
+
+    return ok;
+}
+
+static void *compressThread(void * /*obj*/)
+{
+    pthread_mutex_lock(&g_rotateLock);
+    for (;;) {
+        while (!g_rotatePendingCount && !g_rotateExit) {
+            pthread_cond_wait(&g_rotateCond, &g_rotateLock);
+        }
+        if (!g_rotatePendingCount) {
+            break;
+        }
+        unsigned long generation = g_rotatePending[0];
+        pthread_mutex_unlock(&g_rotateLock);
+
+        char *from = generationName(generation, "");
+        char *temp = generationName(generation, ROTATE_TEMP_SUFFIX);
+        char *to = generationName(generation, ROTATE_GZ_SUFFIX);
+        if (from && temp && to) {
+            // never a partial <file>.<N>.gz, even if we are killed
+            if (compressFile(from, temp) && !rename(temp, to)) {
+                unlink(from);
+            } else {
+                unlink(temp);
+            }
+        }
+        free(from);
+        free(temp);
+        free(to);
+
+        pthread_mutex_lock(&g_rotateLock);
+        // rotated past while we were at it
+        if (expiredGeneration(generation)) {
+            removeGeneration(generation);
+        }
+        --g_rotatePendingCount;
+        memmove(g_rotatePending, g_rotatePending + 1,
+                g_rotatePendingCount * sizeof(g_rotatePending[0]));
+    }
+    pthread_mutex_unlock(&g_rotateLock);
+
+    return NULL;
+}
+
+// Carry on from the newest generation already next to the output file, and
+// remove the temporaries of compressions that were cut short
+static void scanGenerations()
+{
+    const char *base = strrchr(g_outputFileName, '/');
+    char *dir;
+
+    if (base) {
+        dir = strndup(g_outputFileName, base - g_outputFileName + 1);
+        ++base;
+    } else {
+        dir = strdup(".");
+        base = g_outputFileName;
+    }
+    if (!dir) {
+        return;
+    }
+
+    DIR *d = opendir(dir);
+    free(dir);
+    if (!d) {
+        return;
+    }
+
+    size_t len = strlen(base);
+    struct dirent *dp;
+    while ((dp = readdir(d))) {
+        if (strncmp(dp->d_name, base, len) || (dp->d_name[len] != '.')
+                || !isdigit(dp->d_name[len + 1])) {
+            continue;
+        }
+        char *cp;
+        unsigned long generation = strtoul(dp->d_name + len + 1, &cp, 10);
+        if (!strcmp(cp, ROTATE_TEMP_SUFFIX)) {
+            char *name = NULL;
+            if (asprintf(&name, "%.*s%s", (int)(base - g_outputFileName),
+                         g_outputFileName, dp->d_name) >= 0) {
+                unlink(name);
+                free(name);
+            }
+            continue;
+        }
+        if ((*cp && strcmp(cp, ROTATE_GZ_SUFFIX))
+                || (generation <= g_rotateGeneration)) {
+            continue;
+        }
+        g_rotateGeneration = generation;
+    }
+    closedir(d);
+}
+
+static void rotateLogsByGeneration()
+{
+    char *name;
+
+    pthread_mutex_lock(&g_rotateLock);
+
+    unsigned long generation = ++g_rotateGeneration;
+    name = generationName(generation, "");
+    if (!name || (rename(g_outputFileName, name) < 0)) {
+        perror("while rotating log files");
+    }
+    free(name);
+
+    if ((g_maxRotatedLogs > 0)
+            && (generation > (unsigned long)g_maxRotatedLogs)) {
+        removeGeneration(generation - g_maxRotatedLogs);
+    }
+
+    if (g_rotatePendingCount < ROTATE_MAX_PENDING) {
+        if (!g_rotateThreadStarted) {
+            g_rotateThreadStarted = !pthread_create(&g_rotateThread, NULL,
+                                                    compressThread, NULL);
+        }
+        if (g_rotateThreadStarted) {
+            g_rotatePending[g_rotatePendingCount++] = generation;
+            pthread_cond_signal(&g_rotateCond);
+        }
+    }
+
+    pthread_mutex_unlock(&g_rotateLock);
+}
+
+// Let the compression of what has been rotated finish
+static void finishRotation()
+{
+    if (!g_rotateThreadStarted) {
+        return;
+    }
+    pthread_mutex_lock(&g_rotateLock);
+    g_rotateExit = true;
+    pthread_cond_signal(&g_rotateCond);
+    pthread_mutex_unlock(&g_rotateLock);
+    pthread_join(g_rotateThread, NULL);
+}
+
 static void rotateLogs()
 {
     int err;
@@ -78,8 +349,20 @@ static void rotateLogs()
         return;
     }
 
+    flushOutput();
     close(g_outFD);
 
+    if (g_compressRotated) {
+        rotateLogsByGeneration();
+        g_outFD = openLogFile (g_outputFileName);
+        if (g_outFD < 0) {
+            perror ("couldn't open output file");
+            exit(-1);
+        }
+        g_outByteCount = 0;
+        return;
+    }
+
     for (int i = g_maxRotatedLogs ; i > 0 ; i--) {
         char *file0, *file1;
 
@@ -119,14 +402,60 @@ void printBinary(struct log_msg *buf)
     TEMP_FAILURE_RETRY(write(g_outFD, buf, size));
 }
 
+// Hand the filterspecs to logd as well, so that it only sends what is going
+// to be printed. They are still applied in processBuffer(), logd does not
+// filter the event log, and may not filter at all.
+static void setServerFilter(struct logger_list *logger_list, bool silent,
+                            int count, const char *const *specs)
+{
+    size_t len = silent ? 4 : 0;
+    for (int i = 0; i < count; ++i) {
+        len += strlen(specs[i]) + 1;
+    }
+    if (!len) {
+        return;
+    }
+
+    char *filter = (char *) malloc(len + 1);
+    if (!filter) {
+        return;
+    }
+    strcpy(filter, silent ? "*:s " : "");
+    for (int i = 0; i < count; ++i) {
+        strcat(filter, specs[i]);
+        strcat(filter, " ");
+    }
+    android_logger_list_set_filter(logger_list, filter);
+    free(filter);
+}
+
 static void processBuffer(log_device_t* dev, struct log_msg *buf)
 {
     int bytesWritten = 0;
     int err;
     AndroidLogEntry entry;
     char binaryMsgBuf[1024];
+    char *line;
+    size_t lineLen;
 
     if (dev->binary) {
+        // Most events format straight into the output buffer, the pending
+        // output is only written out early if that is what is in the way
+        bytesWritten = android_log_formatBinaryLogLine(g_logformat,
+                g_outBuffer + g_outBufferLen,
+                sizeof(g_outBuffer) - g_outBufferLen,
+                &buf->entry_v1, g_eventTagMap);
+        if ((bytesWritten == -ENOSPC) && g_outBufferLen) {
+            flushOutput();
+            bytesWritten = android_log_formatBinaryLogLine(g_logformat,
+                    g_outBuffer, sizeof(g_outBuffer),
+                    &buf->entry_v1, g_eventTagMap);
+        }
+        if (bytesWritten >= 0) {
+            g_outBufferLen += bytesWritten;
+            goto written;
+        }
+
         err = android_log_processBinaryLogBuffer(&buf->entry_v1, &entry,
                                                  g_eventTagMap,
                                                  binaryMsgBuf,
@@ -136,6 +465,7 @@ static void processBuffer(log_device_t* dev, struct log_msg *buf)
     } else {
         err = android_log_processLogBuffer(&buf->entry_v1, &entry);
     }
+    bytesWritten = 0;
     if (err < 0) {
         goto error;
     }
@@ -144,19 +474,29 @@ static void processBuffer(log_device_t* dev, struct log_msg *buf)
         if (false && g_devCount > 1) {
             binaryMsgBuf[0] = dev->label;
             binaryMsgBuf[1] = ' ';
-            bytesWritten = write(g_outFD, binaryMsgBuf, 2);
-            if (bytesWritten < 0) {
-                perror("output error");
-                exit(-1);
-            }
+            bufferOutput(binaryMsgBuf, 2);
         }
 
-        bytesWritten = android_log_printLogLine(g_logformat, g_outFD, &entry);
-
-        if (bytesWritten < 0) {
+        line = android_log_formatLogLine(g_logformat,
+                g_outBuffer + g_outBufferLen,
+                sizeof(g_outBuffer) - g_outBufferLen, &entry, &lineLen);
+        if (!line) {
             perror("output error");
             exit(-1);
         }
+        if (line == (g_outBuffer + g_outBufferLen)) {
+            g_outBufferLen += lineLen;
+        } else {
+            // too big for what is left of the buffer
+            bufferOutput(line, lineLen);
+            free(line);
+        }
+        bytesWritten = lineLen;
+    }
+
+written:
+    if ((sizeof(g_outBuffer) - g_outBufferLen) < OUTPUT_FLUSH_ROOM) {
+        flushOutput();
     }
 
     g_outByteCount += bytesWritten;
@@ -179,10 +519,7 @@ static void maybePrintStart(log_device_t* dev) {
             char buf[1024];
             snprintf(buf, sizeof(buf), "--------- beginning of %s\n",
                      dev->device);
-            if (write(g_outFD, buf, strlen(buf)) < 0) {
-                perror("output error");
-                exit(-1);
-            }
+            bufferOutput(buf, strlen(buf));
         }
     }
 }
@@ -219,6 +556,8 @@ static void show_help(const char *cmd)
                     "  -f <filename>   Log to file. Default to stdout\n"
                     "  -r [<kbytes>]   Rotate log every kbytes. (16 if unspecified). Requires -f\n"
                     "  -n <count>      Sets max number of rotated logs to <count>, default 4\n"
+                    "  -z              Number rotated logs <filename>.<N> counting up, and gzip\n"
+                    "                  them in the background. Requires -r\n"
                     "  -v <format>     Sets the log print format, where <format> is one of:\n\n"
                     "                  brief process tag thread raw time threadtime long\n\n"
                     "  -c              clear (flush) the entire log and exit\n"
@@ -326,6 +665,10 @@ int main(int argc, char **argv)
     struct logger_list *logger_list;
     unsigned int tail_lines = 0;
     log_time tail_time(log_time::EPOCH);
+    bool silent = false;
+    int filterCount = 0;
+    const char *const *filterSpecs = NULL;
+    const char *filterEnv = NULL;
 
     signal(SIGPIPE, exit);
 
@@ -339,7 +682,7 @@ int main(int argc, char **argv)
     for (;;) {
         int ret;
 
-        ret = getopt(argc, argv, "cdt:T:gG:sQf:r:n:v:b:BSpP:");
+        ret = getopt(argc, argv, "cdt:T:gG:sQf:r:n:v:zb:BSpP:");
 
         if (ret < 0) {
             break;
@@ -349,6 +692,7 @@ int main(int argc, char **argv)
             case 's':
                 // default to all silent
                 android_log_addFilterRule(g_logformat, "*:s");
+                silent = true;
             break;
 
             case 'c':
@@ -535,6 +879,10 @@ int main(int argc, char **argv)
                 android::g_maxRotatedLogs = atoi(optarg);
             break;
 
+            case 'z':
+                android::g_compressRotated = true;
+            break;
+
             case 'v':
                 err = setLogFormat (optarg);
                 if (err < 0) {
@@ -646,6 +994,15 @@ int main(int argc, char **argv)
         exit(-1);
     }
 
+    if (android::g_compressRotated && (android::g_logRotateSizeKBytes == 0)) {
+        fprintf(stderr,"-z requires -r as well\n");
+        android::show_help(argv[0]);
+        exit(-1);
+    }
+    if (android::g_compressRotated) {
+        android::scanGenerations();
+    }
+
     android::setupOutput();
 
     if (hasSetLogFormat == 0) {
@@ -667,12 +1024,17 @@ int main(int argc, char **argv)
             fprintf (stderr, "Invalid filter expression in -logcat option\n");
             exit(0);
         }
+        filterSpecs = &forceFilters;
+        filterCount = 1;
     } else if (argc == optind) {
         // Add from environment variable
         char *env_tags_orig = getenv("ANDROID_LOG_TAGS");
 
         if (env_tags_orig != NULL) {
             err = android_log_addFilterString(g_logformat, env_tags_orig);
+            filterEnv = env_tags_orig;
+            filterSpecs = &filterEnv;
+            filterCount = 1;
 
             if (err < 0) {
                 fprintf(stderr, "Invalid filter expression in"
@@ -692,6 +1054,8 @@ int main(int argc, char **argv)
                 exit(-1);
             }
         }
+        filterSpecs = argv + optind;
+        filterCount = argc - optind;
     }
 
     dev = devices;
@@ -700,6 +1064,9 @@ int main(int argc, char **argv)
     } else {
         logger_list = android_logger_list_alloc(mode, tail_lines, 0);
     }
+    if (!android::g_printBinary) {
+        android::setServerFilter(logger_list, silent, filterCount, filterSpecs);
+    }
     while (dev) {
         dev->logger_list = logger_list;
         dev->logger = android_logger_open(logger_list,
@@ -837,8 +1204,18 @@ int main(int argc, char **argv)
 
     while (1) {
         struct log_msg log_msg;
+
+        if (android::g_outBufferLen
+                && (android_logger_list_pending(logger_list) <= 0)) {
+            android::flushOutput();
+        }
+
         int ret = android_logger_list_read(logger_list, &log_msg);
 
+        if (ret <= 0) {
+            android::flushOutput();
+        }
+
         if (ret == 0) {
             fprintf(stderr, "read: Unexpected EOF!\n");
             exit(EXIT_FAILURE);
@@ -881,5 +1258,7 @@ int main(int argc, char **argv)
 
     android_logger_list_free(logger_list);
 
+    android::finishRotation();
+
     return 0;
 }
@@ -58,6 +58,7 @@ LOCAL_MODULE := $(test_module_prefix)unit-tests
 LOCAL_MODULE_TAGS := $(test_tags)
 LOCAL_ADDITIONAL_DEPENDENCIES := $(LOCAL_PATH)/Android.mk
 LOCAL_CFLAGS += $(test_c_flags)
-LOCAL_SHARED_LIBRARIES := liblog
+LOCAL_SHARED_LIBRARIES := liblog libz
+LOCAL_C_INCLUDES := external/zlib
 LOCAL_SRC_FILES := $(test_src_files)
 include $(BUILD_NATIVE_TEST)
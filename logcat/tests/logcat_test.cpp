@@ -15,6 +15,8 @@
  */
 
 #include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,6 +26,7 @@
 #include <log/log.h>
 #include <log/logger.h>
 #include <log/log_read.h>
+#include <zlib.h>
 
 // enhanced version of LOG_FAILURE_RETRY to add support for EAGAIN and
 // non-syscall libs. Since we are only using this in the emergency of
@@ -270,6 +273,73 @@ TEST(logcat, End_to_End) {
     ASSERT_EQ(1, count);
 }
 
+TEST(logcat, dump_events_multiline) {
+    pid_t pid = getpid();
+
+    // enough events to fill the output buffer several times over
+    static const unsigned count = 2000;
+    static const unsigned long long base = 0xDEADBEEF00000000ULL;
+
+    for (unsigned i = 0; i < count; ++i) {
+        unsigned long long v = base + i;
+        LOG_FAILURE_RETRY(__android_log_btwrite(0, EVENT_TYPE_LONG, &v, sizeof(v)));
+    }
+    LOG_FAILURE_RETRY(__android_log_print(ANDROID_LOG_INFO, "logcat.dump",
+                                          "first\nsecond\nthird"));
+    LOG_FAILURE_RETRY(__android_log_bswrite(0, "event first\nevent second"));
+
+    sleep(1);
+
+    FILE *fp;
+    ASSERT_TRUE(NULL != (fp = popen(
+      "logcat -b events -b main -v brief -d 2>/dev/null",
+      "r")));
+
+    char buffer[5120];
+
+    unsigned next = 0;
+    int out_of_order = 0;
+    int main_lines = 0;
+    int event_lines = 0;
+
+    while (fgets(buffer, sizeof(buffer), fp)) {
+        char *cp = strchr(buffer, '(');
+        int p;
+        unsigned long long v;
+
+        if (!cp || (1 != sscanf(cp, "( %d): ", &p)) || (p != pid)) {
+            continue;
+        }
+        cp = strstr(cp, "): ") + 3;
+
+        if (!strncmp(buffer, "I/[0]", 5)
+         && (1 == sscanf(cp, "%llu", &v))
+         && ((v & ~0xFFFFFFFFULL) == base)) {
+            if ((v - base) != next) {
+                ++out_of_order;
+            }
+            next = v - base + 1;
+        } else if (!strncmp(buffer, "I/logcat.dump(", 14)) {
+            static const char *lines[] = { "first\n", "second\n", "third\n" };
+            if ((main_lines < 3) && !strcmp(cp, lines[main_lines])) {
+                ++main_lines;
+            }
+        } else if (!strncmp(buffer, "I/[0]", 5)) {
+            static const char *lines[] = { "event first\n", "event second\n" };
+            if ((event_lines < 2) && !strcmp(cp, lines[event_lines])) {
+                ++event_lines;
+            }
+        }
+    }
+
+    pclose(fp);
+
+    EXPECT_EQ(0, out_of_order);
+    EXPECT_EQ(count, next);
+    EXPECT_EQ(3, main_lines);
+    EXPECT_EQ(2, event_lines);
+}
+
 TEST(logcat, get_size) {
     FILE *fp;
 
@@ -520,6 +590,93 @@ TEST(logcat, logrotate) {
     EXPECT_FALSE(system(command));
 }
 
+TEST(logcat, logrotate_compress) {
+    static const char form[] = "/data/local/tmp/logcat.logrotate.XXXXXX";
+    char buf[sizeof(form)];
+    ASSERT_TRUE(NULL != mkdtemp(strcpy(buf, form)));
+
+    // numbering carries on after log.txt.5, the temporary of a compression
+    // that was cut short is removed
+    static const unsigned long previous = 5;
+    static const unsigned long kept = 3;
+    char name[sizeof(buf) + 32];
+    snprintf(name, sizeof(name), "%s/log.txt.%lu", buf, previous);
+    FILE *fp = fopen(name, "w");
+    ASSERT_TRUE(NULL != fp);
+    fputs("previous\n", fp);
+    fclose(fp);
+    snprintf(name, sizeof(name), "%s/log.txt.%lu.gz.tmp", buf, previous - 1);
+    ASSERT_TRUE(NULL != (fp = fopen(name, "w")));
+    fclose(fp);
+
+    static const char comm[] = "logcat -b radio -b events -b system -b main"
+                                     " -d -f %s/log.txt -n %lu -r 1 -z";
+    char command[sizeof(buf) + sizeof(comm) + 32];
+    snprintf(command, sizeof(command), comm, buf, kept);
+
+    int ret;
+    EXPECT_FALSE((ret = system(command)));
+    if (!ret) {
+        DIR *dir = opendir(buf);
+        EXPECT_TRUE(NULL != dir);
+
+        unsigned long oldest = ULONG_MAX;
+        unsigned long newest = 0;
+        size_t count = 0;
+        size_t compressed = 0;
+        struct dirent *dp;
+        while (dir && (dp = readdir(dir))) {
+            static const char prefix[] = "log.txt.";
+            if (strncmp(dp->d_name, prefix, sizeof(prefix) - 1)) {
+                continue;
+            }
+            char *cp;
+            unsigned long generation = strtoul(dp->d_name + sizeof(prefix) - 1,
+                                               &cp, 10);
+            EXPECT_TRUE(!*cp || !strcmp(cp, ".gz")) << dp->d_name;
+            ++count;
+            if (generation < oldest) {
+                oldest = generation;
+            }
+            if (generation > newest) {
+                newest = generation;
+            }
+            if (strcmp(cp, ".gz")) {
+                continue;
+            }
+
+            // a complete gzip of at least the rotation size
+            ++compressed;
+            snprintf(name, sizeof(name), "%s/%s", buf, dp->d_name);
+            gzFile gz = gzopen(name, "rb");
+            EXPECT_TRUE(NULL != gz) << name;
+            if (!gz) {
+                continue;
+            }
+            char data[4096];
+            size_t size = 0;
+            int len;
+            while ((len = gzread(gz, data, sizeof(data))) > 0) {
+                size += len;
+            }
+            EXPECT_EQ(0, len) << name;
+            EXPECT_EQ(Z_OK, gzclose(gz)) << name;
+            EXPECT_LE(1024U, size) << name;
+        }
+        if (dir) {
+            closedir(dir);
+        }
+
+        // one file per generation, the newest few kept
+        EXPECT_LT(previous + kept, newest);
+        EXPECT_EQ(kept, count);
+        EXPECT_EQ(newest - kept + 1, oldest);
+        EXPECT_LT(0U, compressed);
+    }
+    snprintf(command, sizeof(command), "rm -rf %s", buf);
+    EXPECT_FALSE(system(command));
+}
+
 static void caught_blocking_clear(int /*signum*/)
 {
     unsigned long long v = 0xDEADBEEFA55C0000ULL;
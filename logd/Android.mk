@@ -12,10 +12,14 @@ LOCAL_SRC_FILES := \
     LogReader.cpp \
     FlushCommand.cpp \
     LogBuffer.cpp \
+    LogBufferRing.cpp \
+    LogBufferCold.cpp \
+    LogBufferSpill.cpp \
     LogBufferElement.cpp \
     LogTimes.cpp \
     LogStatistics.cpp \
     LogWhiteBlackList.cpp \
+    LogReaderFilter.cpp \
     libaudit.c \
     LogAudit.cpp \
     event.logtags
@@ -24,7 +28,10 @@ LOCAL_SHARED_LIBRARIES := \
     libsysutils \
     liblog \
     libcutils \
-    libutils
+    libutils \
+    libz
+
+LOCAL_C_INCLUDES := external/zlib
 
 LOCAL_CFLAGS := -Werror $(shell sed -n 's/^\([0-9]*\)[ \t]*auditd[ \t].*/-DAUDITD_LOG_TAG=\1/p' $(LOCAL_PATH)/event.logtags)
 
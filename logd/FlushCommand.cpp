@@ -27,15 +27,22 @@ FlushCommand::FlushCommand(LogReader &reader,
                            unsigned long tail,
                            unsigned int logMask,
                            pid_t pid,
-                           log_time start)
+                           log_time start,
+                           LogReaderFilter *filter)
         : mReader(reader)
         , mNonBlock(nonBlock)
         , mTail(tail)
         , mLogMask(logMask)
         , mPid(pid)
         , mStart(start)
+        , mFilter(filter)
 { }
 
+// the filter goes to the LogTimeEntry created, if any
+FlushCommand::~FlushCommand() {
+    delete mFilter;
+}
+
 // runSocketCommand is called once for every open client on the
 // log reader socket. Here we manage and associated the reader
 // client tracking and log region locks LastLogTimes list of
@@ -71,7 +78,9 @@ void FlushCommand::runSocketCommand(SocketClient *client) {
             LogTimeEntry::unlock();
             return;
         }
-        entry = new LogTimeEntry(mReader, client, mNonBlock, mTail, mLogMask, mPid, mStart);
+        entry = new LogTimeEntry(mReader, client, mNonBlock, mTail, mLogMask,
+                                 mPid, mStart, mFilter);
+        mFilter = NULL;
         times.push_back(entry);
     }
 
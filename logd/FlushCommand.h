@@ -32,6 +32,7 @@ class FlushCommand : public SocketClientCommand {
     unsigned int mLogMask;
     pid_t mPid;
     log_time mStart;
+    LogReaderFilter *mFilter;
 
 public:
     FlushCommand(LogReader &mReader,
@@ -39,7 +40,9 @@ public:
                  unsigned long tail = -1,
                  unsigned int logMask = -1,
                  pid_t pid = 0,
-                 log_time start = LogTimeEntry::EPOCH);
+                 log_time start = LogTimeEntry::EPOCH,
+                 LogReaderFilter *filter = NULL);
+    virtual ~FlushCommand();
     virtual void runSocketCommand(SocketClient *client);
 
     static bool hasReadLogs(SocketClient *client);
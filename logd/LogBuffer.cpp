@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/prctl.h>
 #include <sys/user.h>
 #include <time.h>
 #include <unistd.h>
@@ -32,10 +33,24 @@
 
 // Default
 #define LOG_BUFFER_SIZE (256 * 1024) // Tuned on a per-platform basis here?
-#define log_buffer_size(id) mMaxSize[id]
+#define log_buffer_size(id) mLogElements[id].capacity()
 #define LOG_BUFFER_MIN_SIZE (64 * 1024UL)
 #define LOG_BUFFER_MAX_SIZE (256 * 1024 * 1024UL)
 
+// Persistent copy of the logs
+#define LOG_SPILL_MIN_SIZE (256 * 1024UL)
+#define LOG_SPILL_MAX_SIZE (1024 * 1024 * 1024UL)
+#define LOG_SPILL_RETRY 5 // seconds, until /data is available
+
+// A run of identical entries is reported at least every so many copies,
+// and once its first withheld copy is this old
+#define LOG_REPEAT_MAX 65535
+#define LOG_REPEAT_MS 1000
+
+// Readers are sent at most this many entries, or bytes, per batch
+#define LOG_FLUSH_BATCH_COUNT 128
+#define LOG_FLUSH_BATCH_SIZE (64 * 1024)
+
 static bool valid_size(unsigned long value) {
     if ((value < LOG_BUFFER_MIN_SIZE) || (LOG_BUFFER_MAX_SIZE < value)) {
         return false;
@@ -62,7 +77,7 @@ static bool valid_size(unsigned long value) {
     return value <= maximum;
 }
 
-static unsigned long property_get_size(const char *key) {
+static unsigned long property_get_number(const char *key) {
     char property[PROPERTY_VALUE_MAX];
     property_get(key, property, "");
 
@@ -85,6 +100,12 @@ static unsigned long property_get_size(const char *key) {
         value = 0;
     }
 
+    return value;
+}
+
+static unsigned long property_get_size(const char *key) {
+    unsigned long value = property_get_number(key);
+
     if (!valid_size(value)) {
         value = 0;
     }
@@ -92,22 +113,71 @@ static unsigned long property_get_size(const char *key) {
     return value;
 }
 
-LogBuffer::LogBuffer(LastLogTimes *times)
-        : dgramQlenStatistics(false)
+static bool property_get_bool(const char *key, bool def) {
+    char property[PROPERTY_VALUE_MAX];
+    property_get(key, property, "");
+
+    if (!strcasecmp(property, "true")) {
+        return true;
+    }
+    if (!strcasecmp(property, "false")) {
+        return false;
+    }
+
+    return def;
+}
+
+LogBuffer::LogBuffer(LastLogTimes *times, const char *spillDir)
+        : mLastMonotonic(log_time::EPOCH)
+        , mSpillDir(spillDir)
+        , mSpillSize(0)
+        , mSpillPending(false)
+        , mSpillRetry(log_time::EPOCH)
+        , mStartMonotonic(CLOCK_MONOTONIC)
+        , dgramQlenStatistics(false)
         , mTimes(*times) {
-    pthread_mutex_init(&mLogElementsLock, NULL);
+    log_id_for_each(i) {
+        pthread_mutex_init(&mLogElementsLock[i], NULL);
+        // all history in the spill is from before we started
+        mEvicted[i] = mStartMonotonic;
+    }
+    pthread_mutex_init(&mMonotonicLock, NULL);
+    pthread_mutex_init(&mRepeatLock, NULL);
+    pthread_cond_init(&mRepeatCond, NULL);
+    mRepeatPending = false;
 
     static const char global_tuneable[] = "persist.logd.size"; // Settings App
     static const char global_default[] = "ro.logd.size";       // BoardConfig.mk
 
+    static const char compress_tuneable[] = "persist.logd.compress";
+    static const char compress_default[] = "ro.logd.compress";
+
+    bool dedup = property_get_bool("ro.logd.dedup", false);
+    dedup = property_get_bool("persist.logd.dedup", dedup);
+
     unsigned long default_size = property_get_size(global_tuneable);
     if (!default_size) {
         default_size = property_get_size(global_default);
     }
 
+    bool default_compress = property_get_bool(compress_default, false);
+    default_compress = property_get_bool(compress_tuneable, default_compress);
+
     log_id_for_each(i) {
         char key[PROP_NAME_MAX];
 
+        snprintf(key, sizeof(key), "%s.%s",
+                 compress_default, android_log_id_to_name(i));
+        mCompress[i] = property_get_bool(key, default_compress);
+        snprintf(key, sizeof(key), "%s.%s",
+                 compress_tuneable, android_log_id_to_name(i));
+        mCompress[i] = property_get_bool(key, mCompress[i]);
+
+        // binary payloads have no room for a note
+        mDedup[i] = dedup && (i != LOG_ID_EVENTS);
+        mRepeat[i].mValid = false;
+        mRepeat[i].mCount = 0;
+
         snprintf(key, sizeof(key), "%s.%s",
                  global_tuneable, android_log_id_to_name(i));
         unsigned long property_size = property_get_size(key);
@@ -130,6 +200,33 @@ LogBuffer::LogBuffer(LastLogTimes *times)
             setSize(i, LOG_BUFFER_MIN_SIZE);
         }
     }
+
+    // the properties are meant for logd, not for a LogBuffer of a test
+    if (mSpillDir) {
+        mSpillSize = property_get_number("persist.logd.spill");
+        if (!mSpillSize) {
+            mSpillSize = property_get_number("ro.logd.spill");
+        }
+    }
+    if (mSpillSize && (mSpillSize < LOG_SPILL_MIN_SIZE)) {
+        mSpillSize = LOG_SPILL_MIN_SIZE;
+    }
+    if (mSpillSize > LOG_SPILL_MAX_SIZE) {
+        mSpillSize = LOG_SPILL_MAX_SIZE;
+    }
+    mSpillPending = mSpillSize != 0;
+
+    if (dedup) {
+        pthread_attr_t attr;
+        pthread_t thread;
+
+        if (!pthread_attr_init(&attr)) {
+            if (!pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED)) {
+                pthread_create(&thread, &attr, repeatThread, this);
+            }
+            pthread_attr_destroy(&attr);
+        }
+    }
 }
 
 void LogBuffer::log(log_id_t log_id, log_time realtime,
@@ -138,102 +235,476 @@ void LogBuffer::log(log_id_t log_id, log_time realtime,
     if ((log_id >= LOG_ID_MAX) || (log_id < 0)) {
         return;
     }
-    LogBufferElement *elem = new LogBufferElement(log_id, realtime,
-                                                  uid, pid, tid, msg, len);
-
-    pthread_mutex_lock(&mLogElementsLock);
-
-    // Insert elements in time sorted order if possible
-    //  NB: if end is region locked, place element at end of list
-    LogBufferElementCollection::iterator it = mLogElements.end();
-    LogBufferElementCollection::iterator last = it;
-    while (--it != mLogElements.begin()) {
-        if ((*it)->getRealTime() <= realtime) {
-            // halves the peak performance, use with caution
-            if (dgramQlenStatistics) {
-                LogBufferElementCollection::iterator ib = it;
-                unsigned short buckets, num = 1;
-                for (unsigned short i = 0; (buckets = stats.dgramQlen(i)); ++i) {
-                    buckets -= num;
-                    num += buckets;
-                    while (buckets && (--ib != mLogElements.begin())) {
-                        --buckets;
-                    }
-                    if (buckets) {
-                        break;
-                    }
-                    stats.recordDiff(
-                        elem->getRealTime() - (*ib)->getRealTime(), i);
-                }
+
+    maybeOpenSpill();
+
+    pthread_mutex_lock(&mLogElementsLock[log_id]);
+    log_Locked(log_id, realtime, uid, pid, tid, msg, len);
+    pthread_mutex_unlock(&mLogElementsLock[log_id]);
+
+    maybePrefaultSpill();
+}
+
+void LogBuffer::log(const LogBufferEntry *entries, size_t count) {
+    unsigned int logMask = 0;
+    for (size_t i = 0; i < count; ++i) {
+        log_id_t log_id = entries[i].log_id;
+        if ((log_id < LOG_ID_MAX) && (log_id >= 0)) {
+            logMask |= 1 << log_id;
+        }
+    }
+
+    maybeOpenSpill();
+
+    lock(logMask);
+    for (size_t i = 0; i < count; ++i) {
+        const LogBufferEntry &e = entries[i];
+        if ((e.log_id < LOG_ID_MAX) && (e.log_id >= 0)) {
+            log_Locked(e.log_id, e.realtime, e.uid, e.pid, e.tid,
+                       e.msg, e.len);
+        }
+    }
+    unlock(logMask);
+
+    maybePrefaultSpill();
+}
+
+// mLogElementsLock[log_id] must be held when this function is called.
+void LogBuffer::log_Locked(log_id_t log_id, log_time realtime,
+                           uid_t uid, pid_t pid, pid_t tid,
+                           const char *msg, unsigned short len) {
+    // readers can not accept more than this in one entry
+    if (len > LOGGER_ENTRY_MAX_PAYLOAD) {
+        len = LOGGER_ENTRY_MAX_PAYLOAD;
+    }
+
+    if (mDedup[log_id] && repeat(log_id, realtime, uid, pid, tid, msg, len)) {
+        return;
+    }
+
+    store_Locked(log_id, realtime, uid, pid, tid, msg, len);
+}
+
+// mLogElementsLock[log_id] must be held when this function is called.
+void LogBuffer::store_Locked(log_id_t log_id, log_time realtime,
+                             uid_t uid, pid_t pid, pid_t tid,
+                             const char *msg, unsigned short len) {
+    maybePrune(log_id, LogBufferRing::recordSize(len));
+
+    // NB: stamped with the ring locked, a reader holding the lock has seen
+    // every element stamped before any that is still to come.
+    log_time monotonic = stamp(log_id, realtime, uid, pid, tid, msg, len);
+    if (mLogElements[log_id].append(log_id, monotonic, realtime,
+                                    uid, pid, tid, msg, len)) {
+        stats.add(len, log_id, uid, pid);
+    }
+}
+
+// A misbehaving client logging the same line over and over would push out
+// everyone else's history. Copies of the entry stored last for the log id
+// are withheld and counted instead, true if this is one. The run is
+// reported once a different entry arrives, every LOG_REPEAT_MAX copies, or
+// by repeatThread() within 2 * LOG_REPEAT_MS of the first withheld copy.
+// mLogElementsLock[log_id] must be held when this function is called.
+bool LogBuffer::repeat(log_id_t log_id, log_time realtime,
+                       uid_t uid, pid_t pid, pid_t tid,
+                       const char *msg, unsigned short len) {
+    Repeat &r = mRepeat[log_id];
+
+    if (r.mValid && (r.mUid == uid) && (r.mPid == pid) && (r.mLen == len)
+            && !memcmp(r.mMsg, msg, len)) {
+        r.mTid = tid;
+        r.mRealTime = realtime;
+        if (!r.mCount) {
+            r.mFirst = log_time(CLOCK_MONOTONIC);
+            pthread_mutex_lock(&mRepeatLock);
+            mRepeatPending = true;
+            pthread_cond_signal(&mRepeatCond);
+            pthread_mutex_unlock(&mRepeatLock);
+        }
+        if (++r.mCount >= LOG_REPEAT_MAX) {
+            reportRepeat(log_id);
+        }
+        return true;
+    }
+
+    reportRepeat(log_id);
+
+    r.mValid = true;
+    r.mUid = uid;
+    r.mPid = pid;
+    r.mLen = len;
+    memcpy(r.mMsg, msg, len);
+    return false;
+}
+
+// Store the withheld run: a note with the priority and tag of the entry
+// counting the copies in between, then the last copy as it was logged. With
+// the first copy already stored, readers see where the run started, how long
+// it was and when it ended.
+// mLogElementsLock[log_id] must be held when this function is called.
+void LogBuffer::reportRepeat(log_id_t log_id) {
+    Repeat &r = mRepeat[log_id];
+
+    if (!r.mCount) {
+        return;
+    }
+
+    if ((r.mCount > 1) && (r.mLen > 1)) {
+        static const size_t noteMax = 32;
+        char note[LOGGER_ENTRY_MAX_PAYLOAD];
+
+        // <prio> <tag> '\0' <note> '\0'
+        size_t tagLen = strnlen(r.mMsg + 1, r.mLen - 1);
+        if (tagLen > (sizeof(note) - 2 - noteMax)) {
+            tagLen = sizeof(note) - 2 - noteMax;
+        }
+        note[0] = r.mMsg[0];
+        memcpy(note + 1, r.mMsg + 1, tagLen);
+        note[1 + tagLen] = '\0';
+        size_t len = 2 + tagLen;
+        len += snprintf(note + len, noteMax, "identical %lu lines",
+                        r.mCount - 1) + 1;
+
+        store_Locked(log_id, r.mRealTime, r.mUid, r.mPid, r.mTid,
+                     note, len);
+    }
+
+    store_Locked(log_id, r.mRealTime, r.mUid, r.mPid, r.mTid,
+                 r.mMsg, r.mLen);
+    r.mCount = 0;
+}
+
+// Without a deadline the last copy of a run would only be stored once the
+// client logs something else, which may be never.
+void *LogBuffer::repeatThread(void *obj) {
+    prctl(PR_SET_NAME, "logd.repeat");
+
+    LogBuffer *me = reinterpret_cast<LogBuffer *>(obj);
+
+    for (;;) {
+        pthread_mutex_lock(&me->mRepeatLock);
+        while (!me->mRepeatPending) {
+            pthread_cond_wait(&me->mRepeatCond, &me->mRepeatLock);
+        }
+        me->mRepeatPending = false;
+        pthread_mutex_unlock(&me->mRepeatLock);
+
+        usleep(LOG_REPEAT_MS * 1000);
+
+        if (me->reportRepeats()) {
+            me->notifyReaders();
+        }
+    }
+
+    return NULL;
+}
+
+// Report the runs whose first withheld copy is LOG_REPEAT_MS old, and have
+// repeatThread() come back for the younger ones. True if any was reported.
+bool LogBuffer::reportRepeats() {
+    static const uint64_t age = LOG_REPEAT_MS * 1000000ULL;
+    bool reported = false;
+    bool pending = false;
+
+    log_id_for_each(i) {
+        if (!mDedup[i]) {
+            continue;
+        }
+        pthread_mutex_lock(&mLogElementsLock[i]);
+        Repeat &r = mRepeat[i];
+        if (r.mCount) {
+            if ((log_time(CLOCK_MONOTONIC) - r.mFirst).nsec() >= age) {
+                reportRepeat(i);
+                reported = true;
+            } else {
+                pending = true;
             }
-            break;
         }
-        last = it;
+        pthread_mutex_unlock(&mLogElementsLock[i]);
     }
 
-    if (last == mLogElements.end()) {
-        mLogElements.push_back(elem);
-    } else {
-        log_time end = log_time::EPOCH;
-        bool end_set = false;
-        bool end_always = false;
+    if (pending) {
+        pthread_mutex_lock(&mRepeatLock);
+        mRepeatPending = true;
+        pthread_mutex_unlock(&mRepeatLock);
+    }
+    return reported;
+}
 
-        LogTimeEntry::lock();
+// Wake the blocked readers, as LogReader::notifyNewLog() does for entries
+// that come in through the socket.
+void LogBuffer::notifyReaders() {
+    LogTimeEntry::lock();
+    for (LastLogTimes::iterator t = mTimes.begin(); t != mTimes.end(); ++t) {
+        (*t)->triggerReader_Locked();
+    }
+    LogTimeEntry::unlock();
+}
 
-        LastLogTimes::iterator t = mTimes.begin();
-        while(t != mTimes.end()) {
-            LogTimeEntry *entry = (*t);
-            if (entry->owned_Locked()) {
-                if (!entry->mNonBlock) {
-                    end_always = true;
-                    break;
-                }
-                if (!end_set || (end <= entry->mEnd)) {
-                    end = entry->mEnd;
-                    end_set = true;
-                }
+// Elements are stored in arrival order. Each gets a unique and increasing
+// monotonic time stamp, which readers use as their position. The spill
+// takes entries as they are stamped, so it is in the same order.
+log_time LogBuffer::stamp(log_id_t log_id, log_time realtime,
+                          uid_t uid, pid_t pid, pid_t tid,
+                          const char *msg, unsigned short len) {
+    pthread_mutex_lock(&mMonotonicLock);
+
+    log_time monotonic = stamp_Locked();
+
+    // halves the peak performance, use with caution
+    if (dgramQlenStatistics) {
+        stats.recordArrival(realtime);
+    }
+
+    if (mSpill.isOpen()) {
+        mSpill.append(log_id, monotonic, realtime, uid, pid, tid, msg, len);
+    }
+
+    pthread_mutex_unlock(&mMonotonicLock);
+
+    return monotonic;
+}
+
+// mMonotonicLock must be held when this function is called.
+log_time LogBuffer::stamp_Locked() {
+    log_time monotonic(CLOCK_MONOTONIC);
+
+    if (monotonic <= mLastMonotonic) {
+        monotonic = mLastMonotonic;
+        if (++monotonic.tv_nsec >= NS_PER_SEC) {
+            monotonic.tv_nsec = 0;
+            ++monotonic.tv_sec;
+        }
+    }
+    mLastMonotonic = monotonic;
+
+    return monotonic;
+}
+
+// Bring the spill segment that is to be used next into memory with no lock
+// held, so that appending to it under mMonotonicLock does not wait for the
+// disk.
+void LogBuffer::maybePrefaultSpill() {
+    if (!mSpillSize) {
+        return;
+    }
+
+    pthread_mutex_lock(&mMonotonicLock);
+    size_t segment = mSpill.takePrefault();
+    pthread_mutex_unlock(&mMonotonicLock);
+
+    if (segment < LogBufferSpill::segmentMax) {
+        mSpill.prefault(segment);
+    }
+}
+
+// The spill lives on /data, which is mounted well after logd starts, so
+// opening it is retried now and then. Entries still in the rings are then
+// copied to it first, the spill is in stamp order from there on.
+void LogBuffer::maybeOpenSpill() {
+    // NB: unlocked, a stale value only delays the attempt
+    if (!mSpillPending) {
+        return;
+    }
+
+    log_time now(CLOCK_MONOTONIC);
+    pthread_mutex_lock(&mMonotonicLock);
+    bool attempt = mSpillPending && (mSpillRetry <= now);
+    if (attempt) {
+        mSpillRetry = now;
+        mSpillRetry.tv_sec += LOG_SPILL_RETRY;
+    }
+    pthread_mutex_unlock(&mMonotonicLock);
+
+    // only one thread gets here at a time, the spill is not yet in use
+    if (!attempt || mSpill.open(mSpillDir, mSpillSize, mStartMonotonic)) {
+        return;
+    }
+
+    lock(-1);
+    pthread_mutex_lock(&mMonotonicLock);
+    mSpill.start();
+
+    LogBufferElement *e[LOG_ID_MAX];
+    log_id_for_each(i) {
+        e[i] = mLogElements[i].begin();
+    }
+    for (;;) {
+        LogBufferElement *element = NULL;
+        log_id_for_each(i) {
+            if (e[i] && (!element || (e[i]->getMonotonicTime()
+                                      < element->getMonotonicTime()))) {
+                element = e[i];
             }
-            t++;
+        }
+        if (!element) {
+            break;
+        }
+        log_id_t id = element->getLogId();
+        mSpill.append(id, element->getMonotonicTime(), element->getRealTime(),
+                      element->getUid(), element->getPid(), element->getTid(),
+                      element->getMsg(), element->getMsgLen());
+        e[id] = mLogElements[id].next(element);
+    }
+
+    mSpillPending = false;
+    pthread_mutex_unlock(&mMonotonicLock);
+    unlock(-1);
+}
+
+// For each log id in logMask, the position before which its entries are
+// not in memory but may be in the spill: the newest removed from memory, or
+// the oldest still there if that is older. Returns the highest of them.
+//
+// mLogElementsLock[] of the log ids must be held when this function is
+// called.
+log_time LogBuffer::spillLimits(unsigned int logMask, log_time *limit) {
+    log_time highest(log_time::EPOCH);
+    log_id_for_each(i) {
+        limit[i] = log_time::EPOCH;
+        if (!(logMask & (1 << i))) {
+            continue;
+        }
+
+        // just after the newest removed
+        limit[i] = mEvicted[i];
+        if (++limit[i].tv_nsec >= NS_PER_SEC) {
+            limit[i].tv_nsec = 0;
+            ++limit[i].tv_sec;
         }
 
-        if (end_always
-                || (end_set && (end >= (*last)->getMonotonicTime()))) {
-            mLogElements.push_back(elem);
+        if (!mCold[i].empty()) {
+            if (mCold[i].oldest() < limit[i]) {
+                limit[i] = mCold[i].oldest();
+            }
         } else {
-            mLogElements.insert(last,elem);
+            LogBufferElement *e = mLogElements[i].begin();
+            if (e && (e->getMonotonicTime() < limit[i])) {
+                limit[i] = e->getMonotonicTime();
+            }
         }
 
-        LogTimeEntry::unlock();
+        if (highest < limit[i]) {
+            highest = limit[i];
+        }
     }
+    return highest;
+}
 
-    stats.add(len, log_id, uid, pid);
-    maybePrune(log_id);
-    pthread_mutex_unlock(&mLogElementsLock);
+// lock the rings in logMask, always in log id order
+void LogBuffer::lock(unsigned int logMask) {
+    log_id_for_each(i) {
+        if (logMask & (1 << i)) {
+            pthread_mutex_lock(&mLogElementsLock[i]);
+        }
+    }
+}
+
+void LogBuffer::unlock(unsigned int logMask) {
+    log_id_for_each(i) {
+        if (logMask & (1 << i)) {
+            pthread_mutex_unlock(&mLogElementsLock[i]);
+        }
+    }
 }
 
-// If we're using more than 256K of memory for log entries, prune
-// at least 10% of the log entries.
+// Make room for a new record of size bytes. When the ring is full, prune
+// at least 10% of the log entries, by policy. Whatever is still in the way
+// is then retired from the front regardless of readers, so memory for each
+// log id is bounded by its ring size.
 //
-// mLogElementsLock must be held when this function is called.
-void LogBuffer::maybePrune(log_id_t id) {
-    size_t sizes = stats.sizes(id);
-    if (sizes > log_buffer_size(id)) {
-        size_t sizeOver90Percent = sizes - ((log_buffer_size(id) * 9) / 10);
+// mLogElementsLock[id] must be held when this function is called.
+void LogBuffer::maybePrune(log_id_t id, size_t size) {
+    LogBufferRing &ring = mLogElements[id];
+    if (ring.fits(size) || (size > ring.capacity())) {
+        return;
+    }
+
+    size_t sizes = ring.used() - ring.dropped() + size;
+    size_t size90Percent = (log_buffer_size(id) * 9) / 10;
+    if (sizes > size90Percent) {
         size_t elements = stats.elements(id);
-        unsigned long pruneRows = elements * sizeOver90Percent / sizes;
+        unsigned long pruneRows = elements * (sizes - size90Percent) / sizes;
         elements /= 10;
         if (pruneRows <= elements) {
             pruneRows = elements;
         }
-        prune(id, pruneRows);
+        // with a cold tier the oldest entries are kept, compressed
+        prune(id, pruneRows, AID_ROOT, !mCompress[id]);
+    }
+
+    if (mCompress[id]) {
+        while (!ring.fits(size) && freeze(id)) {
+            ;
+        }
+    }
+
+    if (!ring.fits(size)) {
+        ring.compact();
+    }
+
+    while (!ring.fits(size)) {
+        erase(ring.begin());
     }
 }
 
-// prune "pruneRows" of type "id" from the buffer.
+// remove element from its ring, returns the next element of the log id.
 //
-// mLogElementsLock must be held when this function is called.
-void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
+// mLogElementsLock[] of its log id must be held when this function is called.
+LogBufferElement *LogBuffer::erase(LogBufferElement *e) {
+    log_id_t id = e->getLogId();
+    stats.subtract(e->getMsgLen(), id, e->getUid(), e->getPid());
+    if (mEvicted[id] < e->getMonotonicTime()) {
+        mEvicted[id] = e->getMonotonicTime();
+    }
+    return mLogElements[id].erase(e);
+}
+
+// Move the oldest entries of "id" to its cold tier, up to a chunk or a
+// quarter of the ring. Returns false if nothing was moved.
+//
+// mLogElementsLock[id] must be held when this function is called.
+bool LogBuffer::freeze(log_id_t id) {
+    LogBufferRing &ring = mLogElements[id];
+    size_t target = ring.capacity() / 4;
+    if (target > LogBufferCold::chunkMax) {
+        target = LogBufferCold::chunkMax;
+    }
+
+    char *records = static_cast<char *>(malloc(target));
+    if (!records) {
+        return false;
+    }
+
+    // NB: statistics only account for the entries left in the ring
+    size_t size = 0;
+    LogBufferElement *e = ring.begin();
+    while (e) {
+        size_t len = LogBufferRing::recordSize(e->getMsgLen());
+        if ((size + len) > target) {
+            break;
+        }
+        memcpy(records + size, e, len);
+        size += len;
+        e = erase(e);
+    }
+
+    // entries the tier can not take are gone regardless, as when pruned
+    mCold[id].add(records, size);
+    free(records);
+
+    return size != 0;
+}
+
+// prune "pruneRows" of type "id" from the buffer. If age is false, only
+// the worst offender and blacklisted entries go, the oldest are left alone.
+//
+// mLogElementsLock[id] must be held when this function is called.
+void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid,
+                      bool age) {
     LogTimeEntry *oldest = NULL;
+    LogBufferRing &ring = mLogElements[id];
 
     LogTimeEntry::lock();
 
@@ -248,33 +719,21 @@ void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
         t++;
     }
 
-    LogBufferElementCollection::iterator it;
+    LogBufferElement *e;
 
     if (caller_uid != AID_ROOT) {
-        for(it = mLogElements.begin(); it != mLogElements.end();) {
-            LogBufferElement *e = *it;
-
+        for(e = ring.begin(caller_uid); e;) {
             if (oldest && (oldest->mStart <= e->getMonotonicTime())) {
                 break;
             }
 
-            if (e->getLogId() != id) {
-                ++it;
-                continue;
-            }
-
-            uid_t uid = e->getUid();
-
-            if (uid == caller_uid) {
-                it = mLogElements.erase(it);
-                stats.subtract(e->getMsgLen(), id, uid, e->getPid());
-                delete e;
-                pruneRows--;
-                if (pruneRows == 0) {
-                    break;
-                }
-            } else {
-                ++it;
+            // NB: erase() does not move elements, next is still good after
+            LogBufferElement *next = ring.nextUid(e);
+            erase(e);
+            e = next;
+            pruneRows--;
+            if (pruneRows == 0) {
+                break;
             }
         }
         LogTimeEntry::unlock();
@@ -289,51 +748,52 @@ void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
         size_t second_worst_sizes = 0;
 
         if ((id != LOG_ID_CRASH) && mPrune.worstUidEnabled()) {
-            LidStatistics &l = stats.id(id);
-            l.sort();
-            UidStatisticsCollection::iterator iu = l.begin();
-            if (iu != l.end()) {
-                UidStatistics *u = *iu;
-                worst = u->getUid();
-                worst_sizes = u->sizes();
-                if (++iu != l.end()) {
-                    second_worst_sizes = (*iu)->sizes();
-                }
-            }
+            worst = stats.id(id).worst(&worst_sizes, &second_worst_sizes);
         }
 
         bool kick = false;
-        for(it = mLogElements.begin(); it != mLogElements.end();) {
-            LogBufferElement *e = *it;
-
-            if (oldest && (oldest->mStart <= e->getMonotonicTime())) {
-                break;
-            }
-
-            if (e->getLogId() != id) {
-                ++it;
-                continue;
-            }
-
-            uid_t uid = e->getUid();
+        if (!mPrune.hasNaughty()) {
+            // only the worst offender is a candidate, follow its chain
+            for(e = (worst != (uid_t) -1) ? ring.begin(worst) : NULL; e;) {
+                if (oldest && (oldest->mStart <= e->getMonotonicTime())) {
+                    break;
+                }
 
-            if ((uid == worst) || mPrune.naughty(e)) { // Worst or BlackListed
-                it = mLogElements.erase(it);
                 unsigned short len = e->getMsgLen();
-                stats.subtract(len, id, uid, e->getPid());
-                delete e;
+                LogBufferElement *next = ring.nextUid(e);
+                erase(e);
+                e = next;
                 pruneRows--;
-                if (uid == worst) {
-                    kick = true;
-                    if ((pruneRows == 0) || (worst_sizes < second_worst_sizes)) {
+                kick = true;
+                if ((pruneRows == 0) || (worst_sizes < second_worst_sizes)) {
+                    break;
+                }
+                worst_sizes -= len;
+            }
+        } else {
+            for(e = ring.begin(); e;) {
+                if (oldest && (oldest->mStart <= e->getMonotonicTime())) {
+                    break;
+                }
+
+                uid_t uid = e->getUid();
+
+                if ((uid == worst) || mPrune.naughty(e)) { // Worst or BlackListed
+                    unsigned short len = e->getMsgLen();
+                    e = erase(e);
+                    pruneRows--;
+                    if (uid == worst) {
+                        kick = true;
+                        if ((pruneRows == 0) || (worst_sizes < second_worst_sizes)) {
+                            break;
+                        }
+                        worst_sizes -= len;
+                    } else if (pruneRows == 0) {
                         break;
                     }
-                    worst_sizes -= len;
-                } else if (pruneRows == 0) {
-                    break;
+                } else {
+                    e = ring.next(e);
                 }
-            } else {
-                ++it;
             }
         }
 
@@ -342,59 +802,42 @@ void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
         }
     }
 
-    bool whitelist = false;
-    it = mLogElements.begin();
-    while((pruneRows > 0) && (it != mLogElements.end())) {
-        LogBufferElement *e = *it;
-        if (e->getLogId() == id) {
-            if (oldest && (oldest->mStart <= e->getMonotonicTime())) {
-                if (!whitelist) {
-                    if (stats.sizes(id) > (2 * log_buffer_size(id))) {
-                        // kick a misbehaving log reader client off the island
-                        oldest->release_Locked();
-                    } else {
-                        oldest->triggerSkip_Locked(pruneRows);
-                    }
-                }
-                break;
-            }
+    if (!age) {
+        LogTimeEntry::unlock();
+        return;
+    }
 
-            if (mPrune.nice(e)) { // WhiteListed
-                whitelist = true;
-                it++;
-                continue;
+    // NB: the ring can not grow, a reader blocking pruning is merely asked
+    // to skip ahead, maybePrune() retires entries out from under it if need be.
+    bool whitelist = false;
+    e = ring.begin();
+    while((pruneRows > 0) && e) {
+        if (oldest && (oldest->mStart <= e->getMonotonicTime())) {
+            if (!whitelist) {
+                oldest->triggerSkip_Locked(pruneRows);
             }
+            break;
+        }
 
-            it = mLogElements.erase(it);
-            stats.subtract(e->getMsgLen(), id, e->getUid(), e->getPid());
-            delete e;
-            pruneRows--;
-        } else {
-            it++;
+        if (mPrune.nice(e)) { // WhiteListed
+            whitelist = true;
+            e = ring.next(e);
+            continue;
         }
+
+        e = erase(e);
+        pruneRows--;
     }
 
     if (whitelist && (pruneRows > 0)) {
-        it = mLogElements.begin();
-        while((it != mLogElements.end()) && (pruneRows > 0)) {
-            LogBufferElement *e = *it;
-            if (e->getLogId() == id) {
-                if (oldest && (oldest->mStart <= e->getMonotonicTime())) {
-                    if (stats.sizes(id) > (2 * log_buffer_size(id))) {
-                        // kick a misbehaving log reader client off the island
-                        oldest->release_Locked();
-                    } else {
-                        oldest->triggerSkip_Locked(pruneRows);
-                    }
-                    break;
-                }
-                it = mLogElements.erase(it);
-                stats.subtract(e->getMsgLen(), id, e->getUid(), e->getPid());
-                delete e;
-                pruneRows--;
-            } else {
-                it++;
+        e = ring.begin();
+        while(e && (pruneRows > 0)) {
+            if (oldest && (oldest->mStart <= e->getMonotonicTime())) {
+                oldest->triggerSkip_Locked(pruneRows);
+                break;
             }
+            e = erase(e);
+            pruneRows--;
         }
     }
 
@@ -403,16 +846,44 @@ void LogBuffer::prune(log_id_t id, unsigned long pruneRows, uid_t caller_uid) {
 
 // clear all rows of type "id" from the buffer.
 void LogBuffer::clear(log_id_t id, uid_t uid) {
-    pthread_mutex_lock(&mLogElementsLock);
+    pthread_mutex_lock(&mLogElementsLock[id]);
+    Repeat &r = mRepeat[id];
+    if ((uid == AID_ROOT) || (r.mValid && (r.mUid == uid))) {
+        r.mValid = false;
+        r.mCount = 0;
+    }
     prune(id, ULONG_MAX, uid);
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_mutex_lock(&mMonotonicLock);
+    if (mSpill.isOpen()) {
+        mSpill.clear(id, uid, stamp_Locked());
+    }
+    pthread_mutex_unlock(&mMonotonicLock);
+    if (uid != AID_ROOT) {
+        mCold[id].erase(uid);
+    } else {
+        // compressed entries a reader is yet to be sent are kept too
+        log_time oldest(UINT32_MAX, (uint32_t)0);
+        LogTimeEntry::lock();
+        LastLogTimes::iterator t = mTimes.begin();
+        while(t != mTimes.end()) {
+            LogTimeEntry *entry = (*t);
+            if (entry->owned_Locked() && (entry->mStart < oldest)) {
+                oldest = entry->mStart;
+            }
+            t++;
+        }
+        LogTimeEntry::unlock();
+        mCold[id].clear(oldest);
+    }
+    pthread_mutex_unlock(&mLogElementsLock[id]);
 }
 
 // get the used space associated with "id".
 unsigned long LogBuffer::getSizeUsed(log_id_t id) {
-    pthread_mutex_lock(&mLogElementsLock);
-    size_t retval = stats.sizes(id);
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_mutex_lock(&mLogElementsLock[id]);
+    size_t retval = mLogElements[id].used() - mLogElements[id].dropped()
+                  + mCold[id].used();
+    pthread_mutex_unlock(&mLogElementsLock[id]);
     return retval;
 }
 
@@ -422,77 +893,453 @@ int LogBuffer::setSize(log_id_t id, unsigned long size) {
     if (!valid_size(size)) {
         return -1;
     }
-    pthread_mutex_lock(&mLogElementsLock);
-    log_buffer_size(id) = size;
-    pthread_mutex_unlock(&mLogElementsLock);
-    return 0;
+    pthread_mutex_lock(&mLogElementsLock[id]);
+    size_t coldSize = mCompress[id] ? size / 2 : 0;
+    size -= coldSize;
+    LogBufferRing &ring = mLogElements[id];
+    while ((ring.used() - ring.dropped()) > size) {
+        erase(ring.begin());
+    }
+    int ret = ring.setCapacity(size);
+    if (!ret) {
+        mCold[id].setCapacity(coldSize);
+    }
+    pthread_mutex_unlock(&mLogElementsLock[id]);
+    return ret;
 }
 
 // get the total space allocated to "id"
 unsigned long LogBuffer::getSize(log_id_t id) {
-    pthread_mutex_lock(&mLogElementsLock);
-    size_t retval = log_buffer_size(id);
-    pthread_mutex_unlock(&mLogElementsLock);
+    pthread_mutex_lock(&mLogElementsLock[id]);
+    size_t retval = log_buffer_size(id) + mCold[id].capacity();
+    pthread_mutex_unlock(&mLogElementsLock[id]);
     return retval;
 }
 
+// Run the filter over the records staged by flushTo(), in order and with
+// no lock held, and lay out those it accepts in the batch. Each entry is
+// smaller than its record, so the batch can take all of them.
+static void filterStage(bool (*filter)(const LogBufferElement *element, void *arg),
+                        void *arg, const char *stage, size_t stageSize,
+                        char *batch, size_t &batchSize, struct iovec *iov,
+                        int &count, log_time &batchLast) {
+    for (size_t offset = 0; offset < stageSize; ) {
+        const LogBufferElement *element =
+            reinterpret_cast<const LogBufferElement *>(stage + offset);
+        offset += LogBufferRing::recordSize(element->getMsgLen());
+
+        if (!(*filter)(element, arg)) {
+            continue;
+        }
+        size_t len = element->flushTo(batch + batchSize);
+        iov[count].iov_base = batch + batchSize;
+        iov[count].iov_len = len;
+        ++count;
+        batchSize += (len + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+        batchLast = element->getMonotonicTime();
+    }
+}
+
+// Readers only visit the rings in their logMask. An unprivileged reader
+// follows the chain of its own UID in each ring rather than every element.
+// Only the rings in logMask are locked, and only while picking the next
+// element, writers to other log ids are never held up.
+//
+// Entries in a cold tier are older than any in its ring. Once a reader's
+// position reaches a compressed chunk, the reader inflates it into a private
+// copy with the locks dropped and is then sent entries from the copy.
+//
+// Entries that are no longer in memory are merged in from the spill, if
+// there is one.
+//
+// Matching elements are copied out as logger_entry_v3 packets into a
+// batch, which is sent with the locks dropped, in one system call. With a
+// filter, the elements are first copied out as they are, and the filter is
+// run on the copies with the locks dropped too; it may be costly (a regex)
+// and should not hold up writers.
 log_time LogBuffer::flushTo(
         SocketClient *reader, const log_time start, bool privileged,
+        unsigned int logMask,
         bool (*filter)(const LogBufferElement *element, void *arg), void *arg) {
-    LogBufferElementCollection::iterator it;
     log_time max = start;
+    log_time last = start;
     uid_t uid = reader->getUid();
 
-    pthread_mutex_lock(&mLogElementsLock);
-    for (it = mLogElements.begin(); it != mLogElements.end(); ++it) {
-        LogBufferElement *element = *it;
+    // Position in each ring: the last element at or before last, if any.
+    // Only trusted across an unlock while the ring has not moved it.
+    LogBufferElement *position[LOG_ID_MAX];
+    log_time positionTime[LOG_ID_MAX];
+    unsigned long generation[LOG_ID_MAX];
 
-        if (!privileged && (element->getUid() != uid)) {
-            continue;
+    // The chunk of each cold tier at our position
+    ColdCopy chunk[LOG_ID_MAX];
+
+    log_id_for_each(i) {
+        position[i] = NULL;
+        chunk[i].mSequence = 0;
+        chunk[i].mData = NULL;
+        chunk[i].mSize = 0;
+        chunk[i].mCursor = 0;
+        chunk[i].mDone = start;
+    }
+
+    // Our place in the spill, and a copy of the entry there
+    LogBufferSpill::Cursor spillCursor;
+    LogBufferSpill::rewind(spillCursor);
+    char *spilled = NULL;
+
+    // Private copies of elements, for use outside of mLogElementsLock
+    char *batch = NULL;
+    size_t batchSize = 0;
+    struct iovec iov[LOG_FLUSH_BATCH_COUNT];
+    int count = 0;
+    log_time batchLast = start;
+    // ... and of the elements still to be filtered, as records
+    char *stage = NULL;
+    size_t stageSize = 0;
+    int staged = 0;
+
+    lock(logMask);
+    for (;;) {
+        LogBufferElement *element = NULL;
+        bool copied = false; // element is not in a ring
+        bool inflated = false;
+
+        // entries no longer in memory come from the spill, if any
+        log_time limit[LOG_ID_MAX];
+        if (mSpillSize && (last < spillLimits(logMask, limit))) {
+            if (!spilled) {
+                spilled = static_cast<char *>(
+                    malloc(LogBufferSpill::elementMax));
+            }
+            if (spilled) {
+                pthread_mutex_lock(&mMonotonicLock);
+                element = mSpill.next(spillCursor, last, limit, logMask,
+                                      privileged, uid, spilled);
+                pthread_mutex_unlock(&mMonotonicLock);
+                copied = element != NULL;
+            }
         }
 
-        if (element->getMonotonicTime() <= start) {
-            continue;
+        // merge in the rings, oldest element first
+        log_id_for_each(i) {
+            if (!(logMask & (1 << i))) {
+                continue;
+            }
+            LogBufferElement *e = NULL;
+
+            // the oldest chunk with anything left for us
+            const LogBufferCold::Chunk *c;
+            ColdCopy &copy = chunk[i];
+            if (copy.mDone < last) {
+                copy.mDone = last;
+            }
+            while (!e && (c = mCold[i].find(copy.mDone))) {
+                if (c->mSequence != copy.mSequence) {
+                    if (inflate(c, copy, logMask)) {
+                        inflated = true;
+                        break;
+                    }
+                    continue; // could not be had, it is skipped
+                }
+                while (copy.mCursor < copy.mSize) {
+                    LogBufferElement *r = reinterpret_cast<LogBufferElement *>(
+                        copy.mData + copy.mCursor);
+                    if ((last < r->getMonotonicTime())
+                            && (privileged || (r->getUid() == uid))) {
+                        e = r;
+                        break;
+                    }
+                    copy.mCursor += LogBufferRing::recordSize(r->getMsgLen());
+                }
+                if (!e) {
+                    copy.mDone = c->mLast;
+                }
+            }
+            if (inflated) {
+                break;
+            }
+            if (e) {
+                if (!element
+                        || (e->getMonotonicTime() < element->getMonotonicTime())) {
+                    element = e;
+                    copied = true;
+                }
+                continue;
+            }
+
+            LogBufferRing &ring = mLogElements[i];
+            if (!position[i] || (generation[i] != ring.generation())
+                    || !ring.contains(positionTime[i])) {
+                // (re)establish our position from the index
+                generation[i] = ring.generation();
+                if (privileged) {
+                    position[i] = ring.seek(last);
+                } else {
+                    position[i] = NULL;
+                    for (e = ring.begin(uid);
+                            e && (e->getMonotonicTime() <= last);
+                            e = ring.nextUid(e)) {
+                        position[i] = e;
+                    }
+                }
+                if (position[i]) {
+                    positionTime[i] = position[i]->getMonotonicTime();
+                }
+            }
+            if (!position[i]) {
+                e = privileged ? ring.begin() : ring.begin(uid);
+            } else if (privileged) {
+                e = ring.next(position[i]);
+            } else {
+                e = ring.nextUid(position[i]);
+            }
+            if (e && (!element
+                    || (e->getMonotonicTime() < element->getMonotonicTime()))) {
+                element = e;
+                copied = false;
+            }
         }
 
-        // NB: calling out to another object with mLogElementsLock held (safe)
-        if (filter && !(*filter)(element, arg)) {
+        if (inflated) {
+            // the rings may have moved on meanwhile, look again
             continue;
         }
+        if (!element) {
+            break;
+        }
+
+        log_id_t id = element->getLogId();
+        last = element->getMonotonicTime();
+        if (!copied) {
+            position[id] = element;
+            positionTime[id] = last;
+        }
+
+        // the ring may reuse the element's storage once the lock is dropped
+        if (!batch) {
+            batch = static_cast<char *>(malloc(LOG_FLUSH_BATCH_SIZE));
+            if (filter && batch) {
+                stage = static_cast<char *>(malloc(LOG_FLUSH_BATCH_SIZE));
+            }
+            if (!batch || (filter && !stage)) {
+                unlock(logMask);
+                max = LogBufferElement::FLUSH_ERROR;
+                goto done;
+            }
+        }
+        if (filter) {
+            size_t size = LogBufferRing::recordSize(element->getMsgLen());
+            memcpy(stage + stageSize, element, size);
+            stageSize += size;
+            if ((++staged < LOG_FLUSH_BATCH_COUNT)
+                    && ((stageSize + LogBufferRing::recordSize(LOGGER_ENTRY_MAX_PAYLOAD))
+                            <= LOG_FLUSH_BATCH_SIZE)) {
+                continue;
+            }
+        } else {
+            size_t len = element->flushTo(batch + batchSize);
+            iov[count].iov_base = batch + batchSize;
+            iov[count].iov_len = len;
+            batchSize += (len + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+            batchLast = last;
+            if ((++count < LOG_FLUSH_BATCH_COUNT)
+                    && ((batchSize + LOGGER_ENTRY_MAX_LEN) <= LOG_FLUSH_BATCH_SIZE)) {
+                continue;
+            }
+        }
+
+        unlock(logMask);
 
-        pthread_mutex_unlock(&mLogElementsLock);
+        if (staged) {
+            filterStage(filter, arg, stage, stageSize,
+                        batch, batchSize, iov, count, batchLast);
+            stageSize = 0;
+            staged = 0;
+        }
 
         // range locking in LastLogTimes looks after us
-        max = element->flushTo(reader);
+        if (reader->sendPacketsv(iov, count)) {
+            max = LogBufferElement::FLUSH_ERROR;
+            goto done;
+        }
+        max = batchLast;
+        count = 0;
+        batchSize = 0;
+
+        lock(logMask);
+    }
+    unlock(logMask);
+
+    if (staged) {
+        filterStage(filter, arg, stage, stageSize,
+                    batch, batchSize, iov, count, batchLast);
+    }
 
-        if (max == element->FLUSH_ERROR) {
-            return max;
+    if (count) {
+        if (reader->sendPacketsv(iov, count)) {
+            max = LogBufferElement::FLUSH_ERROR;
+        } else {
+            max = batchLast;
         }
+    }
 
-        pthread_mutex_lock(&mLogElementsLock);
+done:
+    free(batch);
+    free(stage);
+    free(spilled);
+    log_id_for_each(i) {
+        free(chunk[i].mData);
     }
-    pthread_mutex_unlock(&mLogElementsLock);
 
     return max;
 }
 
+// Take a private copy of chunk c, and inflate it with the locks in logMask
+// dropped. A chunk that can not be inflated is left empty. Returns true if
+// the locks were dropped, the caller must then look at the rings afresh.
+bool LogBuffer::inflate(const LogBufferCold::Chunk *c, ColdCopy &copy,
+                        unsigned int logMask) {
+    copy.mSequence = c->mSequence;
+    copy.mSize = 0;
+    copy.mCursor = 0;
+    if (!copy.mData) {
+        copy.mData = static_cast<char *>(malloc(LogBufferCold::chunkMax));
+        if (!copy.mData) {
+            return false;
+        }
+    }
+    size_t size = c->mSize;
+    size_t compressedSize = c->mCompressedSize;
+    char *compressed = static_cast<char *>(malloc(compressedSize));
+    if (!compressed) {
+        return false;
+    }
+    memcpy(compressed, c->mData, compressedSize);
+
+    unlock(logMask);
+    if (LogBufferCold::inflate(compressed, compressedSize, copy.mData, size)) {
+        copy.mSize = size;
+    }
+    free(compressed);
+    lock(logMask);
+
+    return true;
+}
+
+// A reader asking for entries from start on, receives the first entry
+// logged at or after start, except that one logged exactly at start is
+// taken as already seen (a reader reconnecting with the time of the last
+// entry it got). Each ring finds its candidate with its realtime index, the
+// candidate logged first wins.
+bool LogBuffer::findStart(log_time &start, unsigned int logMask) {
+    bool found = false;
+    log_time monotonic;
+    log_time realtime;
+    char *buffer = NULL;
+
+    lock(logMask);
+
+    // candidates no longer in memory are in the spill, if any
+    char *spilled = mSpillSize
+        ? static_cast<char *>(malloc(LogBufferSpill::elementMax)) : NULL;
+    if (spilled) {
+        LogBufferSpill::Cursor cursor;
+        LogBufferSpill::rewind(cursor);
+        log_time limit[LOG_ID_MAX];
+        spillLimits(logMask, limit);
+        log_time last(log_time::EPOCH);
+        LogBufferElement *e;
+
+        pthread_mutex_lock(&mMonotonicLock);
+        while ((e = mSpill.next(cursor, last, limit, logMask, true, AID_ROOT,
+                                spilled))) {
+            if (start <= e->getRealTime()) {
+                found = true;
+                monotonic = e->getMonotonicTime();
+                realtime = e->getRealTime();
+                break;
+            }
+            last = e->getMonotonicTime();
+        }
+        pthread_mutex_unlock(&mMonotonicLock);
+        free(spilled);
+    }
+
+    log_id_for_each(i) {
+        if (!(logMask & (1 << i))) {
+            continue;
+        }
+        const LogBufferElement *e = NULL;
+
+        // the cold tier holds the older candidate, if any
+        const LogBufferCold::Chunk *c = mCold[i].findRealTime(start);
+        if (c && !buffer) {
+            buffer = static_cast<char *>(malloc(LogBufferCold::chunkMax));
+        }
+        if (c && buffer && LogBufferCold::inflate(c->mData, c->mCompressedSize,
+                                                  buffer, c->mSize)) {
+            for (size_t offset = 0; offset < c->mSize; ) {
+                const LogBufferElement *r =
+                    reinterpret_cast<const LogBufferElement *>(buffer + offset);
+                if (start <= r->getRealTime()) {
+                    e = r;
+                    break;
+                }
+                offset += LogBufferRing::recordSize(r->getMsgLen());
+            }
+        }
+        if (!e) {
+            e = mLogElements[i].findRealTime(start);
+        }
+
+        if (e && (!found || (e->getMonotonicTime() < monotonic))) {
+            found = true;
+            monotonic = e->getMonotonicTime();
+            realtime = e->getRealTime();
+        }
+    }
+    unlock(logMask);
+    free(buffer);
+
+    if (found) {
+        if (realtime != start) {
+            // just before found, time stamps are at least 1ns apart
+            monotonic -= log_time((uint32_t)0, (uint32_t)1);
+        }
+        start = monotonic;
+    }
+
+    return found;
+}
+
 void LogBuffer::formatStatistics(char **strp, uid_t uid, unsigned int logMask) {
     log_time oldest(CLOCK_MONOTONIC);
 
-    pthread_mutex_lock(&mLogElementsLock);
+    lock(-1);
 
     // Find oldest element in the log(s)
-    LogBufferElementCollection::iterator it;
-    for (it = mLogElements.begin(); it != mLogElements.end(); ++it) {
-        LogBufferElement *element = *it;
+    log_id_for_each(i) {
+        LogBufferElement *element = mLogElements[i].begin();
 
-        if ((logMask & (1 << element->getLogId()))) {
+        if ((logMask & (1 << i)) && element
+                && (element->getMonotonicTime() < oldest)) {
             oldest = element->getMonotonicTime();
-            break;
+        }
+        if ((logMask & (1 << i)) && !mCold[i].empty()
+                && (mCold[i].oldest() < oldest)) {
+            oldest = mCold[i].oldest();
         }
     }
 
     stats.format(strp, uid, logMask, oldest);
 
-    pthread_mutex_unlock(&mLogElementsLock);
+    unlock(-1);
+}
+
+uid_t LogBuffer::pidToUid(pid_t pid) {
+    lock(-1);
+    uid_t uid = stats.pidToUid(pid);
+    unlock(-1);
+    return uid;
 }
@@ -21,40 +21,100 @@
 
 #include <log/log.h>
 #include <sysutils/SocketClient.h>
-#include <utils/List.h>
 
 #include <private/android_filesystem_config.h>
 
 #include "LogBufferElement.h"
+#include "LogBufferCold.h"
+#include "LogBufferRing.h"
+#include "LogBufferSpill.h"
 #include "LogTimes.h"
 #include "LogStatistics.h"
 #include "LogWhiteBlackList.h"
 
-typedef android::List<LogBufferElement *> LogBufferElementCollection;
+// One log entry of a batch, as received from a writer
+struct LogBufferEntry {
+    log_id_t log_id;
+    log_time realtime;
+    uid_t uid;
+    pid_t pid;
+    pid_t tid;
+    const char *msg;
+    unsigned short len;
+};
 
 class LogBuffer {
-    LogBufferElementCollection mLogElements;
-    pthread_mutex_t mLogElementsLock;
+    // one ring per log id, sized to the log id's buffer size, each with its
+    // own lock. Locks are taken in log id order, writers only take one.
+    LogBufferRing mLogElements[LOG_ID_MAX];
+    pthread_mutex_t mLogElementsLock[LOG_ID_MAX];
+    // optionally the oldest records of each log id are compressed rather
+    // than discarded, the tier takes half of the log id's buffer size.
+    // Guarded by mLogElementsLock[] of the log id.
+    LogBufferCold mCold[LOG_ID_MAX];
+    bool mCompress[LOG_ID_MAX];
+
+    // time stamps are unique across all log ids
+    pthread_mutex_t mMonotonicLock;
+    log_time mLastMonotonic;
+
+    // optionally every entry is also kept on disk, in stamp order, and
+    // survives a restart. Guarded by mMonotonicLock.
+    LogBufferSpill mSpill;
+    const char *mSpillDir;
+    unsigned long mSpillSize;
+    bool mSpillPending;     // not yet opened
+    log_time mSpillRetry;
+    log_time mStartMonotonic;
+    // newest entry of each log id removed from memory, guarded by
+    // mLogElementsLock[] of the log id
+    log_time mEvicted[LOG_ID_MAX];
+
+    // consecutive identical entries of a log id, same uid, pid and payload,
+    // are counted rather than stored, see repeat(). Guarded by
+    // mLogElementsLock[] of the log id.
+    struct Repeat {
+        bool mValid;            // mMsg holds the last entry stored
+        uid_t mUid;
+        pid_t mPid;
+        pid_t mTid;             // of the last copy withheld
+        log_time mRealTime;     // of the last copy withheld
+        log_time mFirst;        // monotonic arrival of the first withheld
+        unsigned long mCount;   // copies withheld
+        unsigned short mLen;
+        char mMsg[LOGGER_ENTRY_MAX_PAYLOAD];
+    };
+    Repeat mRepeat[LOG_ID_MAX];
+    bool mDedup[LOG_ID_MAX];
+    // set when a run starts, repeatThread() reports the runs that are
+    // still pending once they are old enough. Guarded by mRepeatLock.
+    pthread_mutex_t mRepeatLock;
+    pthread_cond_t mRepeatCond;
+    bool mRepeatPending;
 
     LogStatistics stats;
     bool dgramQlenStatistics;
 
     PruneList mPrune;
 
-    unsigned long mMaxSize[LOG_ID_MAX];
-
 public:
     LastLogTimes &mTimes;
 
-    LogBuffer(LastLogTimes *times);
+    // The spill is kept in spillDir, if one is given and it is enabled
+    LogBuffer(LastLogTimes *times, const char *spillDir = NULL);
 
     void log(log_id_t log_id, log_time realtime,
              uid_t uid, pid_t pid, pid_t tid,
              const char *msg, unsigned short len);
+    // log entries in order, taking the lock of each log id once
+    void log(const LogBufferEntry *entries, size_t count);
     log_time flushTo(SocketClient *writer, const log_time start,
-                     bool privileged,
+                     bool privileged, unsigned int logMask,
                      bool (*filter)(const LogBufferElement *element, void *arg) = NULL,
                      void *arg = NULL);
+    // convert realtime start to a reader's monotonic start, false if no
+    // entry in logMask was logged at or after it
+    bool findStart(log_time &start, unsigned int logMask);
 
     void clear(log_id_t id, uid_t uid = AID_ROOT);
     unsigned long getSize(log_id_t id);
@@ -78,11 +138,47 @@ public:
 
     // helper
     char *pidToName(pid_t pid) { return stats.pidToName(pid); }
-    uid_t pidToUid(pid_t pid) { return stats.pidToUid(pid); }
+    uid_t pidToUid(pid_t pid);
 
 private:
-    void maybePrune(log_id_t id);
-    void prune(log_id_t id, unsigned long pruneRows, uid_t uid = AID_ROOT);
+    void log_Locked(log_id_t log_id, log_time realtime,
+                    uid_t uid, pid_t pid, pid_t tid,
+                    const char *msg, unsigned short len);
+    void store_Locked(log_id_t log_id, log_time realtime,
+                      uid_t uid, pid_t pid, pid_t tid,
+                      const char *msg, unsigned short len);
+    bool repeat(log_id_t log_id, log_time realtime,
+                uid_t uid, pid_t pid, pid_t tid,
+                const char *msg, unsigned short len);
+    void reportRepeat(log_id_t log_id);
+    static void *repeatThread(void *obj);
+    bool reportRepeats();
+    void notifyReaders();
+    void lock(unsigned int logMask);
+    void unlock(unsigned int logMask);
+    log_time stamp(log_id_t log_id, log_time realtime,
+                   uid_t uid, pid_t pid, pid_t tid,
+                   const char *msg, unsigned short len);
+    log_time stamp_Locked();
+    void maybeOpenSpill();
+    void maybePrefaultSpill();
+    log_time spillLimits(unsigned int logMask, log_time *limit);
+    void maybePrune(log_id_t id, size_t size);
+    void prune(log_id_t id, unsigned long pruneRows, uid_t uid = AID_ROOT,
+               bool age = true);
+    bool freeze(log_id_t id);
+
+    // a reader's inflated copy of a cold chunk, see flushTo()
+    struct ColdCopy {
+        unsigned long mSequence; // of the chunk, 0 if none
+        char *mData;
+        size_t mSize;
+        size_t mCursor;          // records before it have been visited
+        log_time mDone;          // chunks up to it have been visited
+    };
+    bool inflate(const LogBufferCold::Chunk *c, ColdCopy &copy,
+                 unsigned int logMask);
+    LogBufferElement *erase(LogBufferElement *e);
 
 };
 
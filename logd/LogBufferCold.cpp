@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "LogBufferCold.h"
+#include "LogBufferRing.h"
+
+LogBufferCold::LogBufferCold()
+        : mCapacity(0)
+        , mUsed(0)
+        , mSequence(0)
+{ }
+
+LogBufferCold::~LogBufferCold() {
+    setCapacity(0);
+}
+
+// Fill in a chunk for size bytes of records, deflating them into
+// a new allocation. Returns -1 if the records can not be deflated.
+static int deflateChunk(LogBufferCold::Chunk *c,
+                        const char *records, size_t size) {
+    c->mFirst = reinterpret_cast<const LogBufferElement *>(records)->getMonotonicTime();
+    c->mRealTimeMax = log_time::EPOCH;
+    for (size_t offset = 0; offset < size; ) {
+        const LogBufferElement *e =
+            reinterpret_cast<const LogBufferElement *>(records + offset);
+        c->mLast = e->getMonotonicTime();
+        if (c->mRealTimeMax < e->getRealTime()) {
+            c->mRealTimeMax = e->getRealTime();
+        }
+        offset += LogBufferRing::recordSize(e->getMsgLen());
+    }
+
+    uLongf len = compressBound(size);
+    char *data = static_cast<char *>(malloc(len));
+    if (!data) {
+        return -1;
+    }
+    // speed over ratio, this runs with the writer waiting
+    if (compress2(reinterpret_cast<Bytef *>(data), &len,
+                  reinterpret_cast<const Bytef *>(records), size,
+                  Z_BEST_SPEED) != Z_OK) {
+        free(data);
+        return -1;
+    }
+    char *shrunk = static_cast<char *>(realloc(data, len));
+    c->mData = shrunk ? shrunk : data;
+    c->mSize = size;
+    c->mCompressedSize = len;
+    return 0;
+}
+
+void LogBufferCold::setCapacity(size_t size) {
+    mCapacity = size;
+    evict();
+}
+
+// discard the oldest chunks until within capacity
+void LogBufferCold::evict() {
+    ChunkCollection::iterator it = mChunks.begin();
+    while ((mUsed > mCapacity) && (it != mChunks.end())) {
+        Chunk *c = *it;
+        mUsed -= c->mCompressedSize;
+        free(c->mData);
+        delete c;
+        it = mChunks.erase(it);
+    }
+}
+
+int LogBufferCold::add(const char *records, size_t size) {
+    if (!mCapacity || !size || (size > chunkMax)) {
+        return -1;
+    }
+
+    Chunk *c = new Chunk;
+    if (deflateChunk(c, records, size)) {
+        delete c;
+        return -1;
+    }
+    c->mSequence = ++mSequence;
+    mUsed += c->mCompressedSize;
+    mChunks.push_back(c);
+
+    evict();
+    return 0;
+}
+
+const LogBufferCold::Chunk *LogBufferCold::find(log_time monotonic) const {
+    ChunkCollection::const_iterator it;
+    for (it = mChunks.begin(); it != mChunks.end(); ++it) {
+        if (monotonic < (*it)->mLast) {
+            return *it;
+        }
+    }
+    return NULL;
+}
+
+const LogBufferCold::Chunk *LogBufferCold::findRealTime(log_time realtime) const {
+    ChunkCollection::const_iterator it;
+    for (it = mChunks.begin(); it != mChunks.end(); ++it) {
+        if (realtime <= (*it)->mRealTimeMax) {
+            return *it;
+        }
+    }
+    return NULL;
+}
+
+log_time LogBufferCold::oldest() const {
+    if (mChunks.empty()) {
+        return log_time::EPOCH;
+    }
+    return (*mChunks.begin())->mFirst;
+}
+
+void LogBufferCold::clear(log_time monotonic) {
+    ChunkCollection::iterator it = mChunks.begin();
+    while ((it != mChunks.end()) && ((*it)->mLast <= monotonic)) {
+        Chunk *c = *it;
+        mUsed -= c->mCompressedSize;
+        free(c->mData);
+        delete c;
+        it = mChunks.erase(it);
+    }
+}
+
+void LogBufferCold::erase(uid_t uid) {
+    char *buffer = NULL;
+
+    ChunkCollection::iterator it = mChunks.begin();
+    while (it != mChunks.end()) {
+        Chunk *c = *it;
+
+        if (!buffer) {
+            buffer = static_cast<char *>(malloc(chunkMax));
+            if (!buffer) {
+                return;
+            }
+        }
+        if (!inflate(c->mData, c->mCompressedSize, buffer, c->mSize)) {
+            ++it;
+            continue;
+        }
+
+        // squeeze out the records of uid, in place
+        size_t size = 0;
+        for (size_t offset = 0; offset < c->mSize; ) {
+            LogBufferElement *e =
+                reinterpret_cast<LogBufferElement *>(buffer + offset);
+            size_t len = LogBufferRing::recordSize(e->getMsgLen());
+            if (e->getUid() != uid) {
+                if (size != offset) {
+                    memmove(buffer + size, e, len);
+                }
+                size += len;
+            }
+            offset += len;
+        }
+        if (size == c->mSize) {
+            ++it;
+            continue;
+        }
+
+        mUsed -= c->mCompressedSize;
+        free(c->mData);
+        if (!size || deflateChunk(c, buffer, size)) {
+            delete c;
+            it = mChunks.erase(it);
+            continue;
+        }
+        c->mSequence = ++mSequence;
+        mUsed += c->mCompressedSize;
+        ++it;
+    }
+
+    free(buffer);
+}
+
+bool LogBufferCold::inflate(const char *data, size_t compressedSize,
+                            char *buffer, size_t size) {
+    uLongf len = size;
+    return (uncompress(reinterpret_cast<Bytef *>(buffer), &len,
+                       reinterpret_cast<const Bytef *>(data),
+                       compressedSize) == Z_OK)
+        && (len == size);
+}
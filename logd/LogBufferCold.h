@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_BUFFER_COLD_H__
+#define _LOGD_LOG_BUFFER_COLD_H__
+
+#include <sys/types.h>
+
+#include <log/log_read.h>
+#include <utils/List.h>
+
+// Compressed storage for the oldest records of one log id.
+//
+// When a LogBufferRing fills, LogBuffer moves a run of its oldest live
+// records, laid out exactly as in the ring, into a chunk here and deflates
+// it. Chunks are immutable and kept oldest first; every record in a chunk
+// is older than every record still in the ring. Once the compressed bytes
+// exceed capacity() the oldest chunks are discarded whole.
+//
+// Readers inflate a chunk into their own buffer when their position
+// reaches it, see LogBuffer::flushTo().
+//
+// No locking, the owner serializes all access.
+class LogBufferCold {
+public:
+    // uncompressed size limit of a chunk
+    static const size_t chunkMax = 64 * 1024;
+
+    struct Chunk {
+        unsigned long mSequence; // unique, changes if the chunk is rewritten
+        log_time mFirst;         // monotonic time of oldest record
+        log_time mLast;          // monotonic time of newest record
+        log_time mRealTimeMax;   // newest realtime of any record
+        size_t mSize;            // uncompressed
+        size_t mCompressedSize;
+        char *mData;
+    };
+
+private:
+    typedef android::List<Chunk *> ChunkCollection;
+
+    ChunkCollection mChunks; // oldest first
+    size_t mCapacity;
+    size_t mUsed;
+    unsigned long mSequence;
+
+    void evict();
+
+public:
+    LogBufferCold();
+    ~LogBufferCold();
+
+    // 0, the default, disables the tier
+    size_t capacity() const { return mCapacity; }
+    void setCapacity(size_t size);
+    size_t used() const { return mUsed; }
+    bool empty() const { return mChunks.empty(); }
+
+    // Deflate size bytes of records into a new, newest, chunk
+    int add(const char *records, size_t size);
+
+    // oldest chunk holding a record newer than monotonic, NULL if none
+    const Chunk *find(log_time monotonic) const;
+    // oldest chunk holding a record at or after realtime, NULL if none
+    const Chunk *findRealTime(log_time realtime) const;
+    // monotonic time of the oldest record, EPOCH if empty
+    log_time oldest() const;
+
+    // Drop the chunks with only records at or before monotonic
+    void clear(log_time monotonic);
+    // Rewrite chunks without the records of uid
+    void erase(uid_t uid);
+
+    // buffer must hold size bytes, the uncompressed size of data
+    static bool inflate(const char *data, size_t compressedSize,
+                        char *buffer, size_t size);
+};
+
+#endif // _LOGD_LOG_BUFFER_COLD_H__
@@ -26,7 +26,8 @@
 
 const log_time LogBufferElement::FLUSH_ERROR((uint32_t)0, (uint32_t)0);
 
-LogBufferElement::LogBufferElement(log_id_t log_id, log_time realtime,
+LogBufferElement::LogBufferElement(log_id_t log_id,
+                                   log_time monotonic, log_time realtime,
                                    uid_t uid, pid_t pid, pid_t tid,
                                    const char *msg, unsigned short len)
         : mLogId(log_id)
@@ -34,17 +35,14 @@ LogBufferElement::LogBufferElement(log_id_t log_id, log_time realtime,
         , mPid(pid)
         , mTid(tid)
         , mMsgLen(len)
-        , mMonotonicTime(CLOCK_MONOTONIC)
+        , mDropped(false)
+        , mMonotonicTime(monotonic)
         , mRealTime(realtime) {
-    mMsg = new char[len];
-    memcpy(mMsg, msg, len);
+    // storage for the payload was reserved by LogBufferRing::append()
+    memcpy(reinterpret_cast<char *>(this + 1), msg, len);
 }
 
-LogBufferElement::~LogBufferElement() {
-    delete [] mMsg;
-}
-
-log_time LogBufferElement::flushTo(SocketClient *reader) {
+size_t LogBufferElement::flushTo(char *buffer) const {
     struct logger_entry_v3 entry;
     memset(&entry, 0, sizeof(struct logger_entry_v3));
     entry.hdr_size = sizeof(struct logger_entry_v3);
@@ -55,14 +53,8 @@ log_time LogBufferElement::flushTo(SocketClient *reader) {
     entry.sec = mRealTime.tv_sec;
     entry.nsec = mRealTime.tv_nsec;
 
-    struct iovec iovec[2];
-    iovec[0].iov_base = &entry;
-    iovec[0].iov_len = sizeof(struct logger_entry_v3);
-    iovec[1].iov_base = mMsg;
-    iovec[1].iov_len = mMsgLen;
-    if (reader->sendDatav(iovec, 2)) {
-        return FLUSH_ERROR;
-    }
+    memcpy(buffer, &entry, sizeof(struct logger_entry_v3));
+    memcpy(buffer + sizeof(struct logger_entry_v3), getMsg(), mMsgLen);
 
-    return mMonotonicTime;
+    return sizeof(struct logger_entry_v3) + mMsgLen;
 }
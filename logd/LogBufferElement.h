@@ -22,32 +22,44 @@
 #include <log/log.h>
 #include <log/log_read.h>
 
+// A LogBufferElement is the header of a record in a LogBufferRing, the
+// message payload immediately follows it in the same allocation. Elements
+// are constructed in place and are never copied by value.
 class LogBufferElement {
+    friend class LogBufferRing;
+
     const log_id_t mLogId;
     const uid_t mUid;
     const pid_t mPid;
     const pid_t mTid;
-    char *mMsg;
     const unsigned short mMsgLen;
+    bool mDropped;
     const log_time mMonotonicTime;
     const log_time mRealTime;
+    uint32_t mUidNext; // maintained by LogBufferRing
 
 public:
-    LogBufferElement(log_id_t log_id, log_time realtime,
+    LogBufferElement(log_id_t log_id, log_time monotonic, log_time realtime,
                      uid_t uid, pid_t pid, pid_t tid,
                      const char *msg, unsigned short len);
-    virtual ~LogBufferElement();
 
     log_id_t getLogId() const { return mLogId; }
     uid_t getUid(void) const { return mUid; }
     pid_t getPid(void) const { return mPid; }
     pid_t getTid(void) const { return mTid; }
     unsigned short getMsgLen() const { return mMsgLen; }
+    const char *getMsg() const {
+        return reinterpret_cast<const char *>(this + 1);
+    }
+    bool isDropped() const { return mDropped; }
+    void setDropped() { mDropped = true; }
     log_time getMonotonicTime(void) const { return mMonotonicTime; }
     log_time getRealTime(void) const { return mRealTime; }
 
     static const log_time FLUSH_ERROR;
-    log_time flushTo(SocketClient *writer);
+    // Lay out as the logger_entry_v3 a reader receives, buffer must hold
+    // sizeof(logger_entry_v3) + getMsgLen(). Returns the length.
+    size_t flushTo(char *buffer) const;
 };
 
 #endif
@@ -0,0 +1,405 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+#include "LogBufferRing.h"
+
+LogBufferRing::LogBufferRing()
+        : mData(NULL)
+        , mCapacity(0)
+        , mHead(0)
+        , mTail(0)
+        , mWrap(0)
+        , mWrapped(false)
+        , mUsed(0)
+        , mDropped(0)
+        , mElements(0)
+        , mGeneration(0)
+        , mMarks(NULL)
+        , mMarksMax(0)
+        , mMarkFirst(0)
+        , mMarkCount(0)
+        , mRealTimeMax(log_time::EPOCH)
+{ }
+
+LogBufferRing::~LogBufferRing() {
+    free(mMarks);
+    free(mData);
+}
+
+size_t LogBufferRing::recordSize(unsigned short len) {
+    static const size_t align = __alignof__(LogBufferElement);
+    return (sizeof(LogBufferElement) + len + align - 1) & ~(align - 1);
+}
+
+size_t LogBufferRing::following(size_t offset) const {
+    offset += recordSize(at(offset)->getMsgLen());
+    if (mWrapped && (offset == mWrap)) {
+        offset = 0;
+    }
+    return offset;
+}
+
+bool LogBufferRing::fits(size_t size) const {
+    if (!mElements) {
+        return size <= mCapacity;
+    }
+    if (mWrapped) {
+        return (mTail + size) <= mHead;
+    }
+    return ((mTail + size) <= mCapacity) || (size <= mHead);
+}
+
+// Claim size bytes following the newest record
+bool LogBufferRing::reserve(size_t size, size_t &offset) {
+    if (!fits(size)) {
+        return false;
+    }
+    if (!mElements) {
+        mHead = mTail = 0;
+        mWrapped = false;
+    } else if (!mWrapped && ((mTail + size) > mCapacity)) {
+        mWrap = mTail;
+        mWrapped = true;
+        mTail = 0;
+    }
+    offset = mTail;
+    mTail += size;
+    mUsed += size;
+    ++mElements;
+    return true;
+}
+
+void LogBufferRing::index(size_t offset) {
+    LogBufferElement *e = at(offset);
+    e->mUidNext = none;
+
+    ssize_t index = mUids.indexOfKey(e->getUid());
+    if (index < 0) {
+        UidChain chain = { (uint32_t) offset, (uint32_t) offset };
+        mUids.add(e->getUid(), chain);
+    } else {
+        UidChain &chain = mUids.editValueAt(index);
+        at(chain.mLast)->mUidNext = offset;
+        chain.mLast = offset;
+    }
+
+    log_time realTimeMax = mRealTimeMax;
+    if (mRealTimeMax < e->getRealTime()) {
+        mRealTimeMax = e->getRealTime();
+    }
+
+    // A record landing below the newest mark has wrapped around
+    if (mMarkCount) {
+        size_t last = mark(mMarkCount - 1).mOffset;
+        if ((offset >= last) && ((offset / markBlock) == (last / markBlock))) {
+            return;
+        }
+    }
+    if (mMarkCount < mMarksMax) {
+        Mark &m = mark(mMarkCount++);
+        m.mMonotonic = e->getMonotonicTime();
+        m.mRealTimeMax = realTimeMax;
+        m.mOffset = offset;
+    }
+}
+
+void LogBufferRing::clearIndex() {
+    mUids.clear();
+    mMarkFirst = 0;
+    mMarkCount = 0;
+    mRealTimeMax = log_time::EPOCH;
+}
+
+// Index every record from mHead on, after records moved
+void LogBufferRing::reindex() {
+    clearIndex();
+    size_t offset = mHead;
+    for (size_t elements = mElements; elements; --elements) {
+        index(offset);
+        offset = following(offset);
+    }
+}
+
+LogBufferElement *LogBufferRing::append(log_id_t log_id, log_time monotonic,
+                                        log_time realtime, uid_t uid,
+                                        pid_t pid, pid_t tid,
+                                        const char *msg, unsigned short len) {
+    size_t offset;
+    if (!reserve(recordSize(len), offset)) {
+        return NULL;
+    }
+    LogBufferElement *e = new (mData + offset) LogBufferElement(log_id,
+                                                                monotonic,
+                                                                realtime,
+                                                                uid, pid, tid,
+                                                                msg, len);
+    index(offset);
+    return e;
+}
+
+// Retire the oldest record
+void LogBufferRing::popFront() {
+    LogBufferElement *e = at(mHead);
+    size_t size = recordSize(e->getMsgLen());
+    if (e->isDropped()) {
+        mDropped -= size;
+    }
+    mUsed -= size;
+
+    // the oldest record is also the oldest of its UID
+    ssize_t index = mUids.indexOfKey(e->getUid());
+    if (index >= 0) {
+        UidChain &chain = mUids.editValueAt(index);
+        if (chain.mFirst == chain.mLast) {
+            mUids.removeItemsAt(index);
+        } else {
+            chain.mFirst = e->mUidNext;
+        }
+    }
+    if (mMarkCount && (mark(0).mOffset == mHead)) {
+        mMarkFirst = (mMarkFirst + 1) % mMarksMax;
+        --mMarkCount;
+    }
+
+    if (--mElements == 0) {
+        mHead = mTail = 0;
+        mWrapped = false;
+        clearIndex();
+        return;
+    }
+    mHead = following(mHead);
+    if (mHead == 0) {
+        mWrapped = false;
+    }
+}
+
+LogBufferElement *LogBufferRing::begin() const {
+    if (!mElements) {
+        return NULL;
+    }
+    LogBufferElement *e = at(mHead);
+    return e->isDropped() ? next(e) : e;
+}
+
+LogBufferElement *LogBufferRing::next(const LogBufferElement *e) const {
+    size_t offset = following(offsetOf(e));
+    while (offset != mTail) {
+        e = at(offset);
+        if (!e->isDropped()) {
+            return const_cast<LogBufferElement *>(e);
+        }
+        offset = following(offset);
+    }
+    return NULL;
+}
+
+LogBufferElement *LogBufferRing::begin(uid_t uid) const {
+    ssize_t index = mUids.indexOfKey(uid);
+    if (index < 0) {
+        return NULL;
+    }
+    LogBufferElement *e = at(mUids.valueAt(index).mFirst);
+    return e->isDropped() ? nextUid(e) : e;
+}
+
+LogBufferElement *LogBufferRing::nextUid(const LogBufferElement *e) const {
+    uint32_t offset = e->mUidNext;
+    while (offset != none) {
+        e = at(offset);
+        if (!e->isDropped()) {
+            return const_cast<LogBufferElement *>(e);
+        }
+        offset = e->mUidNext;
+    }
+    return NULL;
+}
+
+LogBufferElement *LogBufferRing::seek(log_time monotonic) const {
+    if (!contains(monotonic)) {
+        return NULL;
+    }
+
+    // last mark at or before monotonic
+    size_t offset = mHead;
+    size_t low = 0;
+    size_t high = mMarkCount;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (mark(middle).mMonotonic <= monotonic) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low) {
+        offset = mark(low - 1).mOffset;
+    }
+
+    for (;;) {
+        size_t n = following(offset);
+        if ((n == mTail) || (monotonic < at(n)->getMonotonicTime())) {
+            return at(offset);
+        }
+        offset = n;
+    }
+}
+
+LogBufferElement *LogBufferRing::findRealTime(log_time realtime) const {
+    if (!mElements || (mRealTimeMax < realtime)) {
+        return NULL;
+    }
+
+    // first mark with a record at or after realtime before it
+    size_t low = 0;
+    size_t high = mMarkCount;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (mark(middle).mRealTimeMax < realtime) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    // everything before the previous mark is older
+    size_t offset = low ? mark(low - 1).mOffset : mHead;
+    do {
+        LogBufferElement *e = at(offset);
+        if (!e->isDropped() && (realtime <= e->getRealTime())) {
+            return e;
+        }
+        offset = following(offset);
+    } while (offset != mTail);
+
+    return NULL;
+}
+
+LogBufferElement *LogBufferRing::erase(LogBufferElement *e) {
+    LogBufferElement *n = next(e);
+    if (offsetOf(e) != mHead) {
+        e->setDropped();
+        mDropped += recordSize(e->getMsgLen());
+        return n;
+    }
+    do {
+        popFront();
+    } while (mElements && at(mHead)->isDropped());
+    return n;
+}
+
+// Slide every live record down towards mHead, in order, so that the space
+// held by dropped records becomes free space following mTail. The copy
+// destination never passes the record being read, and a record that fit in
+// the upper segment also fits at any lower offset in it, so no unread record
+// is overwritten.
+void LogBufferRing::compact() {
+    if (!mDropped) {
+        return;
+    }
+
+    size_t offset = mHead;
+    size_t size = recordSize(at(offset)->getMsgLen());
+    size_t elements = mElements;
+    bool wrapped = mWrapped;
+    size_t wrap = mWrap;
+
+    // mHead is never dropped, it stays where it is
+    mTail = mHead + size;
+    mWrapped = false;
+    mUsed = size;
+    mDropped = 0;
+    mElements = 1;
+
+    // NB: a moved record's old header may be overwritten, hence size is
+    // picked up before the move.
+    while (--elements) {
+        offset += size;
+        if (wrapped && (offset == wrap)) {
+            offset = 0;
+            wrapped = false;
+        }
+        LogBufferElement *e = at(offset);
+        size = recordSize(e->getMsgLen());
+        if (e->isDropped()) {
+            continue;
+        }
+        size_t destination;
+        reserve(size, destination);
+        if (destination != offset) {
+            memmove(mData + destination, e, size);
+        }
+    }
+
+    reindex();
+    ++mGeneration;
+}
+
+int LogBufferRing::setCapacity(size_t size) {
+    if (size == mCapacity) {
+        return 0;
+    }
+    if (mUsed - mDropped > size) {
+        return -1;
+    }
+
+    char *data = static_cast<char *>(malloc(size));
+    if (!data) {
+        return -1;
+    }
+    // a live record starts in at most every block, plus a partial block
+    // either side of the wrap
+    size_t marksMax = size / markBlock + 2;
+    Mark *marks = static_cast<Mark *>(malloc(marksMax * sizeof(Mark)));
+    if (!marks) {
+        free(data);
+        return -1;
+    }
+
+    size_t tail = 0;
+    size_t elements = 0;
+    for (LogBufferElement *e = begin(); e; e = next(e)) {
+        size_t len = recordSize(e->getMsgLen());
+        memcpy(data + tail, e, len);
+        tail += len;
+        ++elements;
+    }
+
+    free(mData);
+    mData = data;
+    mCapacity = size;
+    free(mMarks);
+    mMarks = marks;
+    mMarksMax = marksMax;
+    mHead = 0;
+    mTail = tail;
+    mWrap = 0;
+    mWrapped = false;
+    mUsed = tail;
+    mDropped = 0;
+    mElements = elements;
+
+    reindex();
+    ++mGeneration;
+    return 0;
+}
+
+bool LogBufferRing::contains(log_time monotonic) const {
+    return mElements && (at(mHead)->getMonotonicTime() <= monotonic);
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_BUFFER_RING_H__
+#define _LOGD_LOG_BUFFER_RING_H__
+
+#include <sys/types.h>
+
+#include <log/log.h>
+#include <log/log_read.h>
+#include <utils/KeyedVector.h>
+
+#include "LogBufferElement.h"
+
+// Contiguous storage for the records of one log id.
+//
+// Each record is a LogBufferElement header followed inline by its payload,
+// packed in arrival order. A record never straddles the end of the arena;
+// when one does not fit the remainder is left as slack and the record is
+// placed at the start (mWrapped). Records are retired in order by advancing
+// mHead. Records removed out of order are only marked dropped, their space
+// is recovered once mHead passes them, or at once by compact().
+//
+// Arrival order is also monotonic time order, LogBuffer::log() guarantees
+// every element a unique and increasing getMonotonicTime().
+//
+// Two indexes are kept alongside: the records of each UID are chained
+// oldest to newest, so work on one UID only touches that UID's records, and
+// the first record starting in each mark block is noted with its time stamp,
+// so seek() finds a time in the ring with a binary search and a walk of at
+// most a block. Both are rebuilt when records move.
+//
+// Realtime stamps come from the writers and arrive out of order. Each mark
+// also notes the newest realtime of all records before it, which never
+// decreases from mark to mark, so findRealTime() can binary search as well.
+//
+// No locking, the owner serializes all access.
+class LogBufferRing {
+    static const uint32_t none = (uint32_t) -1;
+    static const size_t markBlock = 4096;
+
+    struct UidChain {
+        uint32_t mFirst;
+        uint32_t mLast;
+    };
+
+    struct Mark {
+        log_time mMonotonic;
+        log_time mRealTimeMax; // of all records before this one
+        uint32_t mOffset;
+    };
+
+    char *mData;
+    size_t mCapacity;
+    size_t mHead;     // offset of oldest record
+    size_t mTail;     // offset following newest record
+    size_t mWrap;     // end of the upper segment, valid if mWrapped
+    bool mWrapped;    // records are at [mHead, mWrap) then [0, mTail)
+    size_t mUsed;     // bytes held by records, including dropped
+    size_t mDropped;  // bytes held by dropped records
+    size_t mElements; // records, including dropped
+    unsigned long mGeneration;
+
+    android::KeyedVector<uid_t, UidChain> mUids;
+
+    Mark *mMarks;      // circular, oldest first
+    size_t mMarksMax;
+    size_t mMarkFirst;
+    size_t mMarkCount;
+    log_time mRealTimeMax; // of all records indexed
+
+    LogBufferElement *at(size_t offset) const {
+        return reinterpret_cast<LogBufferElement *>(mData + offset);
+    }
+    size_t offsetOf(const LogBufferElement *e) const {
+        return reinterpret_cast<const char *>(e) - mData;
+    }
+    // offset of the record following offset, mTail if none
+    size_t following(size_t offset) const;
+    bool reserve(size_t size, size_t &offset);
+    void popFront();
+    // add the record at offset to the indexes, as the newest record
+    void index(size_t offset);
+    void clearIndex();
+    void reindex();
+    Mark &mark(size_t i) const {
+        return mMarks[(mMarkFirst + i) % mMarksMax];
+    }
+
+public:
+    LogBufferRing();
+    ~LogBufferRing();
+
+    static size_t recordSize(unsigned short len);
+
+    size_t capacity() const { return mCapacity; }
+    size_t used() const { return mUsed; }
+    size_t dropped() const { return mDropped; }
+    bool fits(size_t size) const;
+
+    // Resize, keeping all records. Caller first retires enough of them.
+    int setCapacity(size_t size);
+
+    // NULL if recordSize(len) does not fit
+    LogBufferElement *append(log_id_t log_id, log_time monotonic,
+                             log_time realtime, uid_t uid, pid_t pid,
+                             pid_t tid, const char *msg, unsigned short len);
+
+    // Iterate live records oldest first, NULL at the end
+    LogBufferElement *begin() const;
+    LogBufferElement *next(const LogBufferElement *e) const;
+
+    // Iterate the live records of one UID oldest first, NULL at the end
+    LogBufferElement *begin(uid_t uid) const;
+    LogBufferElement *nextUid(const LogBufferElement *e) const;
+
+    // The newest record, dropped or not, with getMonotonicTime() at or
+    // before monotonic. NULL if there is none, then all records follow it.
+    LogBufferElement *seek(log_time monotonic) const;
+
+    // The oldest live record with getRealTime() at or after realtime, NULL
+    // if there is none.
+    LogBufferElement *findRealTime(log_time realtime) const;
+
+    // Remove a live record, returns the next live record
+    LogBufferElement *erase(LogBufferElement *e);
+
+    // Squeeze out dropped records. Moves records, bumps generation().
+    void compact();
+
+    // Changes whenever records move. An element pointer or offset held
+    // across an unlock is only good if the generation is unchanged and
+    // contains(monotonic) still holds for its time stamp.
+    unsigned long generation() const { return mGeneration; }
+    bool contains(log_time monotonic) const;
+};
+
+#endif // _LOGD_LOG_BUFFER_RING_H__
@@ -0,0 +1,447 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <new>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <private/android_filesystem_config.h>
+
+#include "LogBufferSpill.h"
+
+#define SPILL_MAGIC 0x4c4c5053 // "SPLL"
+#define SPILL_VERSION 1
+#define SPILL_ALIGN 4096
+
+LogBufferSpill::LogBufferSpill()
+        : mSegmentSize(0)
+        , mCurrent(segmentMax)
+        , mPrefaulted(false)
+        , mSequence(0)
+        , mStart(log_time::EPOCH)
+        , mHistory(0) {
+    for (size_t i = 0; i < segmentMax; ++i) {
+        mSegments[i].mFd = -1;
+        mSegments[i].mData = NULL;
+        mSegments[i].mSequence = 0;
+    }
+}
+
+LogBufferSpill::~LogBufferSpill() {
+    close();
+}
+
+size_t LogBufferSpill::recordSize(unsigned short len) {
+    static const size_t align = __alignof__(SpillRecord);
+    return (sizeof(SpillRecord) + len + align - 1) & ~(align - 1);
+}
+
+const LogBufferSpill::SpillRecord *LogBufferSpill::valid(const Segment &s,
+                                                         size_t offset) const {
+    if ((offset + sizeof(SpillRecord)) > mSegmentSize) {
+        return NULL;
+    }
+    const SpillRecord *r = at(s, offset);
+    if ((r->mSequence != s.mSequence)
+            || (r->mLogId >= LOG_ID_MAX)
+            || (r->mLen > LOGGER_ENTRY_MAX_PAYLOAD)
+            || (r->mSize != recordSize(r->mLen))
+            || ((offset + r->mSize) > mSegmentSize)) {
+        return NULL;
+    }
+    return r;
+}
+
+// History keeps its order, one nanosecond apart, ending just before mStart
+log_time LogBufferSpill::position(const Segment &s, uint32_t index,
+                                  const SpillRecord *r) const {
+    if (!s.mHistory) {
+        return log_time(r->mMonotonicSec, r->mMonotonicNsec);
+    }
+    uint64_t before = mHistory - (s.mFirst + index);
+    return mStart - log_time((uint32_t)(before / NS_PER_SEC),
+                             (uint32_t)(before % NS_PER_SEC));
+}
+
+bool LogBufferSpill::cleared(const SpillRecord *r, log_time position) const {
+    const android::KeyedVector<uid_t, log_time> &c = mCleared[r->mLogId];
+    ssize_t index = c.indexOfKey(AID_ROOT);
+    if ((index >= 0) && (position <= c.valueAt(index))) {
+        return true;
+    }
+    index = c.indexOfKey(r->mUid);
+    return (index >= 0) && (position <= c.valueAt(index));
+}
+
+void LogBufferSpill::clearUpTo(log_id_t id, uid_t uid, log_time position) {
+    ssize_t index = mCleared[id].indexOfKey(uid);
+    if (index < 0) {
+        mCleared[id].add(uid, position);
+    } else if (mCleared[id].valueAt(index) < position) {
+        mCleared[id].replaceValueAt(index, position);
+    }
+}
+
+size_t LogBufferSpill::newer(size_t segment) const {
+    uint32_t sequence = mSegments[segment].mSequence;
+    size_t found = segmentMax;
+    for (size_t i = 0; i < segmentMax; ++i) {
+        uint32_t s = mSegments[i].mSequence;
+        if ((s > sequence)
+                && ((found == segmentMax) || (s < mSegments[found].mSequence))) {
+            found = i;
+        }
+    }
+    return found;
+}
+
+size_t LogBufferSpill::oldest() const {
+    size_t found = segmentMax;
+    for (size_t i = 0; i < segmentMax; ++i) {
+        uint32_t s = mSegments[i].mSequence;
+        if (s && ((found == segmentMax) || (s < mSegments[found].mSequence))) {
+            found = i;
+        }
+    }
+    return found;
+}
+
+int LogBufferSpill::open(const char *dir, size_t size, log_time start) {
+    close();
+
+    mSegmentSize = (size / segmentMax) & ~(SPILL_ALIGN - 1);
+    if (mSegmentSize < (sizeof(SpillHeader)
+                        + recordSize(LOGGER_ENTRY_MAX_PAYLOAD))) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < segmentMax; ++i) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/spill.%u", dir, (unsigned) i);
+
+        int fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0640);
+        if (fd < 0) {
+            close();
+            return -1;
+        }
+        Segment &s = mSegments[i];
+        s.mFd = fd;
+
+        struct stat st;
+        bool fresh = fstat(fd, &st) || (st.st_size != (off_t) mSegmentSize);
+        if (fresh && ftruncate(fd, mSegmentSize)) {
+            close();
+            return -1;
+        }
+        void *data = mmap(NULL, mSegmentSize, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            close();
+            return -1;
+        }
+        s.mData = static_cast<char *>(data);
+
+        // preallocate, the zeroes also mark the segment unused
+        if (fresh && fallocate(fd, 0, 0, mSegmentSize)) {
+            memset(s.mData, 0, mSegmentSize);
+        }
+
+        const SpillHeader *h = reinterpret_cast<const SpillHeader *>(s.mData);
+        s.mSequence = 0;
+        if ((h->mMagic == SPILL_MAGIC) && (h->mVersion == SPILL_VERSION)) {
+            s.mSequence = h->mSequence;
+        }
+        s.mUsed = sizeof(SpillHeader);
+        s.mRecords = 0;
+        s.mHistory = true;
+        s.mFirst = 0;
+        if (s.mSequence) {
+            const SpillRecord *r;
+            while ((r = valid(s, s.mUsed))) {
+                s.mUsed += r->mSize;
+                ++s.mRecords;
+            }
+        }
+        if (mSequence < s.mSequence) {
+            mSequence = s.mSequence;
+        }
+    }
+
+    // number the history oldest first, then replay the clears in it
+    mStart = start;
+    mHistory = 0;
+    for (size_t i = oldest(); i < segmentMax; i = newer(i)) {
+        mSegments[i].mFirst = mHistory;
+        mHistory += mSegments[i].mRecords;
+    }
+    if (mHistory >= start.nsec()) {
+        // can not be placed, forget it
+        for (size_t i = 0; i < segmentMax; ++i) {
+            mSegments[i].mSequence = 0;
+        }
+        mHistory = 0;
+    }
+    for (size_t i = oldest(); i < segmentMax; i = newer(i)) {
+        const Segment &s = mSegments[i];
+        size_t offset = sizeof(SpillHeader);
+        for (uint32_t index = 0; index < s.mRecords; ++index) {
+            const SpillRecord *r = at(s, offset);
+            if (r->mFlags & flagClear) {
+                clearUpTo(static_cast<log_id_t>(r->mLogId), r->mUid,
+                          position(s, index, r));
+            }
+            offset += r->mSize;
+        }
+    }
+
+    return 0;
+}
+
+void LogBufferSpill::close() {
+    for (size_t i = 0; i < segmentMax; ++i) {
+        Segment &s = mSegments[i];
+        if (s.mData) {
+            munmap(s.mData, mSegmentSize);
+            s.mData = NULL;
+        }
+        if (s.mFd >= 0) {
+            ::close(s.mFd);
+            s.mFd = -1;
+        }
+        s.mSequence = 0;
+    }
+    for (size_t i = 0; i < LOG_ID_MAX; ++i) {
+        mCleared[i].clear();
+    }
+    mCurrent = segmentMax;
+    mSequence = 0;
+    mHistory = 0;
+}
+
+// The records left from the earlier use of the segment carry an older
+// sequence, they end the segment as zeroes would.
+void LogBufferSpill::reset(size_t segment) {
+    Segment &s = mSegments[segment];
+    s.mSequence = ++mSequence;
+    s.mUsed = sizeof(SpillHeader);
+    s.mRecords = 0;
+    s.mHistory = false;
+    s.mFirst = 0;
+
+    SpillHeader *h = reinterpret_cast<SpillHeader *>(s.mData);
+    h->mMagic = SPILL_MAGIC;
+    h->mVersion = SPILL_VERSION;
+    h->mSequence = s.mSequence;
+}
+
+// an unused segment, else the oldest
+size_t LogBufferSpill::following() const {
+    for (size_t i = 0; i < segmentMax; ++i) {
+        if (!mSegments[i].mSequence) {
+            return i;
+        }
+    }
+    return oldest();
+}
+
+void LogBufferSpill::rotate() {
+    size_t segment = following();
+    reset(segment);
+    mCurrent = segment;
+    mPrefaulted = false;
+}
+
+size_t LogBufferSpill::takePrefault() {
+    if (!isOpen() || mPrefaulted
+            || (mSegments[mCurrent].mUsed < (mSegmentSize / 2))) {
+        return segmentMax;
+    }
+    mPrefaulted = true;
+    return following();
+}
+
+// Only reads every page: readers may still be sent entries from the
+// segment, it is left as it is until rotate() reaches it.
+void LogBufferSpill::prefault(size_t segment) const {
+    const volatile char *data = mSegments[segment].mData;
+    if (!data) {
+        return;
+    }
+    madvise(const_cast<char *>(data), mSegmentSize, MADV_WILLNEED);
+    for (size_t offset = 0; offset < mSegmentSize; offset += SPILL_ALIGN) {
+        (void) data[offset];
+    }
+}
+
+void LogBufferSpill::start() {
+    if (!isOpen() && mSegmentSize) {
+        rotate();
+    }
+}
+
+LogBufferSpill::SpillRecord *LogBufferSpill::reserve(size_t size) {
+    if ((mSegments[mCurrent].mUsed + size) > mSegmentSize) {
+        rotate();
+    }
+    Segment &s = mSegments[mCurrent];
+    SpillRecord *r = reinterpret_cast<SpillRecord *>(s.mData + s.mUsed);
+    s.mUsed += size;
+    ++s.mRecords;
+    return r;
+}
+
+void LogBufferSpill::append(log_id_t log_id, log_time monotonic,
+                            log_time realtime, uid_t uid, pid_t pid,
+                            pid_t tid, const char *msg, unsigned short len) {
+    size_t size = recordSize(len);
+    SpillRecord *r = reserve(size);
+    r->mSize = size;
+    r->mLen = len;
+    r->mLogId = log_id;
+    r->mFlags = 0;
+    r->mReserved = 0;
+    r->mUid = uid;
+    r->mPid = pid;
+    r->mTid = tid;
+    r->mRealTimeSec = realtime.tv_sec;
+    r->mRealTimeNsec = realtime.tv_nsec;
+    r->mMonotonicSec = monotonic.tv_sec;
+    r->mMonotonicNsec = monotonic.tv_nsec;
+    memcpy(r + 1, msg, len);
+
+    // a record cut short by a crash is not read back
+    __sync_synchronize();
+    r->mSequence = mSegments[mCurrent].mSequence;
+}
+
+void LogBufferSpill::clear(log_id_t log_id, uid_t uid, log_time monotonic) {
+    SpillRecord *r = reserve(recordSize(0));
+    memset(r, 0, sizeof(SpillRecord));
+    r->mSize = recordSize(0);
+    r->mLogId = log_id;
+    r->mFlags = flagClear;
+    r->mUid = uid;
+    r->mMonotonicSec = monotonic.tv_sec;
+    r->mMonotonicNsec = monotonic.tv_nsec;
+    __sync_synchronize();
+    r->mSequence = mSegments[mCurrent].mSequence;
+
+    clearUpTo(log_id, uid, monotonic);
+}
+
+// Place cursor at the start of the newest segment that starts at or
+// before last, else at the oldest.
+void LogBufferSpill::seek(Cursor &c, log_time last) const {
+    size_t segment = oldest();
+    for (size_t i = segment; i < segmentMax; i = newer(i)) {
+        const Segment &s = mSegments[i];
+        if (!s.mRecords) {
+            break;
+        }
+        const SpillRecord *r = at(s, sizeof(SpillHeader));
+        if (last < position(s, 0, r)) {
+            break;
+        }
+        segment = i;
+    }
+
+    c.mSegment = segment;
+    if (segment < segmentMax) {
+        c.mSequence = mSegments[segment].mSequence;
+        c.mOffset = sizeof(SpillHeader);
+        c.mIndex = 0;
+    }
+}
+
+// Whether reader may ever see record r at position p
+bool LogBufferSpill::visible(const SpillRecord *r, log_time p,
+                             unsigned int logMask, bool privileged,
+                             uid_t uid) const {
+    return !(r->mFlags & flagClear)
+        && (logMask & (1 << r->mLogId))
+        && (privileged || (r->mUid == uid))
+        && !cleared(r, p);
+}
+
+LogBufferElement *LogBufferSpill::next(Cursor &c, log_time last,
+                                       const log_time *limit,
+                                       unsigned int logMask,
+                                       bool privileged, uid_t uid,
+                                       char *buffer) const {
+    if (!isOpen()) {
+        return NULL;
+    }
+    if ((c.mSegment >= segmentMax)
+            || (mSegments[c.mSegment].mSequence != c.mSequence)) {
+        seek(c, last);
+    }
+
+    // no record at or after the highest limit is of interest
+    log_time bound(log_time::EPOCH);
+    for (size_t i = 0; i < LOG_ID_MAX; ++i) {
+        if ((logMask & (1 << i)) && (bound < limit[i])) {
+            bound = limit[i];
+        }
+    }
+
+    // The cursor passes the records the reader is done with. Those still
+    // in memory are looked beyond, the reader gets them from there.
+    bool done = true;
+    Cursor n = c;
+    while (n.mSegment < segmentMax) {
+        const Segment &s = mSegments[n.mSegment];
+        if (n.mOffset >= s.mUsed) {
+            size_t segment = newer(n.mSegment);
+            if (segment >= segmentMax) {
+                return NULL; // caught up, the cursor stays for more
+            }
+            n.mSegment = segment;
+            n.mSequence = mSegments[segment].mSequence;
+            n.mOffset = sizeof(SpillHeader);
+            n.mIndex = 0;
+            if (done) {
+                c = n;
+            }
+            continue;
+        }
+
+        const SpillRecord *r = at(s, n.mOffset);
+        log_time p = position(s, n.mIndex, r);
+        if (bound <= p) {
+            return NULL;
+        }
+        if ((last < p) && visible(r, p, logMask, privileged, uid)) {
+            if (p < limit[r->mLogId]) {
+                return new (buffer) LogBufferElement(
+                    static_cast<log_id_t>(r->mLogId), p,
+                    log_time(r->mRealTimeSec, r->mRealTimeNsec),
+                    r->mUid, r->mPid, r->mTid,
+                    reinterpret_cast<const char *>(r + 1), r->mLen);
+            }
+            done = false;
+        }
+        n.mOffset += r->mSize;
+        ++n.mIndex;
+        if (done) {
+            c = n;
+        }
+    }
+    return NULL;
+}
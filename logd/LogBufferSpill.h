@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_BUFFER_SPILL_H__
+#define _LOGD_LOG_BUFFER_SPILL_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <log/log.h>
+#include <log/log_read.h>
+#include <log/logger.h>
+#include <utils/KeyedVector.h>
+
+#include "LogBufferElement.h"
+
+// Persistent copy of every entry logged, in a set of preallocated segment
+// files that are used in turn.
+//
+// Entries are appended to the newest segment, in the order they were
+// stamped, through a shared mapping of the file: there is no system call per
+// entry, the kernel writes the pages back. Once the newest segment is full
+// the oldest one is reused, only its header is rewritten. The owner has it
+// brought into memory beforehand with prefault(), outside of its lock.
+//
+// A segment is a SpillHeader followed by records, each a SpillRecord and
+// then its payload. Every record carries the sequence of the segment it was
+// written in, so the zeroes after the last record, or what is left from an
+// earlier use of the file, end the segment when it is read back.
+//
+// Records found by open() are history from before logd started. They keep
+// their order and are given monotonic positions just ahead of start, before
+// any entry of this run. A clear is recorded in the stream as well, and
+// hides the entries before it, after a restart too.
+//
+// No locking, the owner serializes all access.
+class LogBufferSpill {
+public:
+    static const size_t segmentMax = 4;
+    // a buffer for next() must hold this many bytes
+    static const size_t elementMax =
+        sizeof(LogBufferElement) + LOGGER_ENTRY_MAX_PAYLOAD;
+
+    // A reader's place in the spill, see next()
+    struct Cursor {
+        size_t mSegment;    // segmentMax if not placed
+        uint32_t mSequence; // of the segment when placed
+        size_t mOffset;
+        uint32_t mIndex;    // of the record in the segment
+    };
+
+private:
+    struct SpillHeader {
+        uint32_t mMagic;
+        uint32_t mVersion;
+        uint32_t mSequence; // order of use, 0 if unused
+        uint32_t mReserved;
+    };
+
+    struct SpillRecord {
+        uint32_t mSequence; // of the segment, written last
+        uint16_t mSize;     // of the record, aligned
+        uint16_t mLen;      // of the payload
+        uint8_t mLogId;
+        uint8_t mFlags;
+        uint16_t mReserved;
+        uint32_t mUid;
+        int32_t mPid;
+        int32_t mTid;
+        uint32_t mRealTimeSec;
+        uint32_t mRealTimeNsec;
+        uint32_t mMonotonicSec;
+        uint32_t mMonotonicNsec;
+    };
+    static const uint8_t flagClear = 1; // not an entry, clears mLogId for mUid
+
+    struct Segment {
+        int mFd;
+        char *mData;
+        uint32_t mSequence;
+        size_t mUsed;       // offset following the last record
+        uint32_t mRecords;
+        bool mHistory;      // positions are assigned, see position()
+        uint64_t mFirst;    // history index of the first record
+    };
+
+    Segment mSegments[segmentMax];
+    size_t mSegmentSize;
+    size_t mCurrent;        // segment appended to, segmentMax if not started
+    bool mPrefaulted;       // the segment after mCurrent, see takePrefault()
+    uint32_t mSequence;     // of the newest segment
+    log_time mStart;
+    uint64_t mHistory;      // records found by open()
+
+    // entries up to the position are hidden, by log id and uid (AID_ROOT
+    // for all uids)
+    android::KeyedVector<uid_t, log_time> mCleared[LOG_ID_MAX];
+
+    static size_t recordSize(unsigned short len);
+    const SpillRecord *at(const Segment &s, size_t offset) const {
+        return reinterpret_cast<const SpillRecord *>(s.mData + offset);
+    }
+    // the record at offset if it is one, NULL at the end of the segment
+    const SpillRecord *valid(const Segment &s, size_t offset) const;
+    log_time position(const Segment &s, uint32_t index,
+                      const SpillRecord *r) const;
+    bool cleared(const SpillRecord *r, log_time position) const;
+    void clearUpTo(log_id_t id, uid_t uid, log_time position);
+    // next newer segment in use, segmentMax if none
+    size_t newer(size_t segment) const;
+    size_t oldest() const;
+    // segment to continue in once the current one is full
+    size_t following() const;
+    void reset(size_t segment);
+    void rotate();
+    SpillRecord *reserve(size_t size);
+    void seek(Cursor &c, log_time last) const;
+    bool visible(const SpillRecord *r, log_time p, unsigned int logMask,
+                 bool privileged, uid_t uid) const;
+
+public:
+    LogBufferSpill();
+    ~LogBufferSpill();
+
+    // Map size bytes of segment files in dir, and read back what they hold.
+    // History is placed just before start. Entries are only taken once
+    // start() is called.
+    int open(const char *dir, size_t size, log_time start);
+    void start();
+    void close();
+    bool isOpen() const { return mCurrent < segmentMax; }
+
+    void append(log_id_t log_id, log_time monotonic, log_time realtime,
+                uid_t uid, pid_t pid, pid_t tid,
+                const char *msg, unsigned short len);
+    // hide the entries of log_id, of uid unless AID_ROOT, up to monotonic
+    void clear(log_id_t log_id, uid_t uid, log_time monotonic);
+
+    // The segment to be used next, once the current one is half full and
+    // only once, segmentMax otherwise. The owner then passes it to
+    // prefault(), which only reads the mapping and may be called without
+    // serialization, so that append() does not wait for the disk.
+    size_t takePrefault();
+    void prefault(size_t segment) const;
+
+    static void rewind(Cursor &c) { c.mSegment = segmentMax; }
+    // The oldest entry after last that the reader may see, of a log id in
+    // logMask and before limit[] of its log id, constructed in buffer. NULL
+    // if none. Resumes from cursor.
+    LogBufferElement *next(Cursor &c, log_time last, const log_time *limit,
+                           unsigned int logMask, bool privileged, uid_t uid,
+                           char *buffer) const;
+};
+
+#endif // _LOGD_LOG_BUFFER_SPILL_H__
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <errno.h>
 #include <limits.h>
 #include <sys/prctl.h>
 #include <sys/socket.h>
@@ -35,39 +36,76 @@ LogListener::LogListener(LogBuffer *buf, LogReader *reader)
 bool LogListener::onDataAvailable(SocketClient *cli) {
     prctl(PR_SET_NAME, "logd.writer");
 
-    char buffer[sizeof_log_id_t + sizeof(uint16_t) + sizeof(log_time)
-        + LOGGER_ENTRY_MAX_PAYLOAD];
-    struct iovec iov = { buffer, sizeof(buffer) };
-    memset(buffer, 0, sizeof(buffer));
-
-    char control[CMSG_SPACE(sizeof(struct ucred))];
-    struct msghdr hdr = {
-        NULL,
-        0,
-        &iov,
-        1,
-        control,
-        sizeof(control),
-        0,
-    };
-
-    int socket = cli->getSocket();
-
-    ssize_t n = recvmsg(socket, &hdr, 0);
+    int count = receive(cli->getSocket());
+    if (count <= 0) {
+        return false;
+    }
+
+    size_t entries = 0;
+    for (int i = 0; i < count; ++i) {
+        if (parse(&mMsgs[i].msg_hdr, mMsgs[i].msg_len, mEntries[entries])) {
+            ++entries;
+        }
+    }
+    if (!entries) {
+        return false;
+    }
+
+    // one lock and one reader wakeup for the whole batch
+    logbuf->log(mEntries, entries);
+    reader->notifyNewLog();
+
+    return true;
+}
+
+// Receive whatever datagrams are queued, up to batchMax, at least one.
+// Returns the number received, or -1.
+int LogListener::receive(int socket) {
+    for (unsigned int i = 0; i < batchMax; ++i) {
+        mIov[i].iov_base = mBuffer[i];
+        mIov[i].iov_len = sizeof(mBuffer[i]);
+
+        struct msghdr &hdr = mMsgs[i].msg_hdr;
+        hdr.msg_name = NULL;
+        hdr.msg_namelen = 0;
+        hdr.msg_iov = &mIov[i];
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = mControl[i];
+        hdr.msg_controllen = sizeof(mControl[i]);
+        hdr.msg_flags = 0;
+        mMsgs[i].msg_len = 0;
+    }
+
+    // we were called because the socket is readable, never block for more
+    int count = recvmmsg(socket, mMsgs, batchMax, MSG_DONTWAIT, NULL);
+    if ((count >= 0) || (errno != ENOSYS)) {
+        return count;
+    }
+
+    // kernel predates recvmmsg, one at a time
+    ssize_t n = recvmsg(socket, &mMsgs[0].msg_hdr, 0);
+    if (n < 0) {
+        return -1;
+    }
+    mMsgs[0].msg_len = n;
+    return 1;
+}
+
+bool LogListener::parse(struct msghdr *hdr, ssize_t n, LogBufferEntry &entry) {
     if (n <= (ssize_t)(sizeof_log_id_t + sizeof(uint16_t) + sizeof(log_time))) {
         return false;
     }
 
     struct ucred *cred = NULL;
 
-    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr);
     while (cmsg != NULL) {
         if (cmsg->cmsg_level == SOL_SOCKET
                 && cmsg->cmsg_type  == SCM_CREDENTIALS) {
             cred = (struct ucred *)CMSG_DATA(cmsg);
             break;
         }
-        cmsg = CMSG_NXTHDR(&hdr, cmsg);
+        cmsg = CMSG_NXTHDR(hdr, cmsg);
     }
 
     if (cred == NULL) {
@@ -81,6 +119,8 @@ bool LogListener::onDataAvailable(SocketClient *cli) {
         return false;
     }
 
+    char *buffer = (char *)hdr->msg_iov->iov_base;
+
     // First log element is always log_id.
     log_id_t log_id = (log_id_t) *((typeof_log_id_t *) buffer);
     if (log_id < 0 || log_id >= LOG_ID_MAX) {
@@ -99,12 +139,16 @@ bool LogListener::onDataAvailable(SocketClient *cli) {
     msg += sizeof(log_time);
     n -= sizeof(log_time);
 
-    // NB: hdr.msg_flags & MSG_TRUNC is not tested, silently passing a
+    // NB: hdr->msg_flags & MSG_TRUNC is not tested, silently passing a
     // truncated message to the logs.
 
-    logbuf->log(log_id, realtime, cred->uid, cred->pid, tid, msg,
-        ((size_t) n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX);
-    reader->notifyNewLog();
+    entry.log_id = log_id;
+    entry.realtime = realtime;
+    entry.uid = cred->uid;
+    entry.pid = cred->pid;
+    entry.tid = tid;
+    entry.msg = msg;
+    entry.len = ((size_t) n <= USHRT_MAX) ? (unsigned short) n : USHRT_MAX;
 
     return true;
 }
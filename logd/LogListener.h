@@ -17,13 +17,28 @@
 #ifndef _LOGD_LOG_LISTENER_H__
 #define _LOGD_LOG_LISTENER_H__
 
+#include <sys/socket.h>
+
+#include <log/logger.h>
 #include <sysutils/SocketListener.h>
+
+#include "LogBuffer.h"
 #include "LogReader.h"
 
 class LogListener : public SocketListener {
     LogBuffer *logbuf;
     LogReader *reader;
 
+    // Datagrams are drained from the socket a batch at a time
+    static const unsigned int batchMax = 32;
+
+    char mBuffer[batchMax][sizeof_log_id_t + sizeof(uint16_t) + sizeof(log_time)
+        + LOGGER_ENTRY_MAX_PAYLOAD];
+    char mControl[batchMax][CMSG_SPACE(sizeof(struct ucred))];
+    struct iovec mIov[batchMax];
+    struct mmsghdr mMsgs[batchMax];
+    LogBufferEntry mEntries[batchMax];
+
 public:
     LogListener(LogBuffer *buf, LogReader *reader);
 
@@ -31,6 +46,8 @@ protected:
     virtual bool onDataAvailable(SocketClient *cli);
 
 private:
+    int receive(int socket);
+    bool parse(struct msghdr *hdr, ssize_t n, LogBufferEntry &entry);
     static int getLogSocket();
 };
 
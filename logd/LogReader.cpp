@@ -16,6 +16,8 @@
 
 #include <ctype.h>
 #include <poll.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/prctl.h>
 #include <sys/socket.h>
 
@@ -39,7 +41,7 @@ void LogReader::notifyNewLog() {
 bool LogReader::onDataAvailable(SocketClient *cli) {
     prctl(PR_SET_NAME, "logd.reader");
 
-    char buffer[255];
+    char buffer[1024];
 
     int len = read(cli->getSocket(), buffer, sizeof(buffer) - 1);
     if (len <= 0) {
@@ -48,9 +50,49 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
     }
     buffer[len] = '\0';
 
+    // selection evaluated here rather than by the reader, see
+    // LogReaderFilter. The expression takes the rest of the line.
+    LogReaderFilter *filter = NULL;
+    static const char _regex[] = " regex=";
+    char *cp = strstr(buffer, _regex);
+    if (cp) {
+        *cp = '\0';
+        filter = new LogReaderFilter();
+        if (filter->setRegex(cp + sizeof(_regex) - 1)) {
+            delete filter;
+            doSocketDelete(cli);
+            return false;
+        }
+    }
+
+    static const char _filter[] = " filter=";
+    static const char _uids[] = " uids=";
+    static const char *const selections[] = { _filter, _uids };
+    for (size_t i = 0; i < sizeof(selections) / sizeof(selections[0]); ++i) {
+        const char *key = selections[i];
+        cp = strstr(buffer, key);
+        if (!cp) {
+            continue;
+        }
+        if (!filter) {
+            filter = new LogReaderFilter();
+        }
+        cp += strlen(key);
+        char *value = strndup(cp, strcspn(cp, " "));
+        int ret = value ? ((key == _filter) ? filter->setTags(value)
+                                            : filter->setUids(value))
+                        : -1;
+        free(value);
+        if (ret) {
+            delete filter;
+            doSocketDelete(cli);
+            return false;
+        }
+    }
+
     unsigned long tail = 0;
     static const char _tail[] = " tail=";
-    char *cp = strstr(buffer, _tail);
+    cp = strstr(buffer, _tail);
     if (cp) {
         tail = atol(cp + sizeof(_tail) - 1);
     }
@@ -101,8 +143,12 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
     }
 
     // Convert realtime to monotonic time
+    bool found = true;
     if (start == log_time::EPOCH) {
         start = LogTimeEntry::EPOCH;
+    } else if (!pid && FlushCommand::hasReadLogs(cli)) {
+        // sees every entry, the realtime index answers without a scan
+        found = logbuf().findStart(start, logMask);
     } else {
         class LogFindStart {
             const pid_t mPid;
@@ -143,20 +189,22 @@ bool LogReader::onDataAvailable(SocketClient *cli) {
         } logFindStart(logMask, pid, start);
 
         logbuf().flushTo(cli, LogTimeEntry::EPOCH,
-                         FlushCommand::hasReadLogs(cli),
+                         FlushCommand::hasReadLogs(cli), logMask,
                          logFindStart.callback, &logFindStart);
+        found = logFindStart.found();
+    }
 
-        if (!logFindStart.found()) {
-            if (nonBlock) {
-                doSocketDelete(cli);
-                return false;
-            }
-            log_time now(CLOCK_MONOTONIC);
-            start = now;
+    if (!found) {
+        if (nonBlock) {
+            delete filter;
+            doSocketDelete(cli);
+            return false;
         }
+        log_time now(CLOCK_MONOTONIC);
+        start = now;
     }
 
-    FlushCommand command(*this, nonBlock, tail, logMask, pid, start);
+    FlushCommand command(*this, nonBlock, tail, logMask, pid, start, filter);
     command.runSocketCommand(cli);
     return true;
 }
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <log/logger.h>
+
+#include "LogReaderFilter.h"
+
+LogReaderFilter::LogReaderFilter()
+        : mHasTags(false)
+        , mGlobalPri(ANDROID_LOG_VERBOSE)
+        , mHasRegex(false)
+{ }
+
+LogReaderFilter::~LogReaderFilter() {
+    for (size_t i = 0; i < mTags.size(); ++i) {
+        free(mTags[i].mTag);
+    }
+    if (mHasRegex) {
+        regfree(&mRegex);
+    }
+}
+
+// Same as logcat, see android_log_addFilterRule()
+static android_LogPriority filterCharToPri(char c) {
+    c = tolower(c);
+
+    if ((c >= '0') && (c <= '9')) {
+        if (c >= ('0' + ANDROID_LOG_SILENT)) {
+            return ANDROID_LOG_VERBOSE;
+        }
+        return (android_LogPriority) (c - '0');
+    }
+    switch (c) {
+    case 'v': return ANDROID_LOG_VERBOSE;
+    case 'd': return ANDROID_LOG_DEBUG;
+    case 'i': return ANDROID_LOG_INFO;
+    case 'w': return ANDROID_LOG_WARN;
+    case 'e': return ANDROID_LOG_ERROR;
+    case 'f': return ANDROID_LOG_FATAL;
+    case 's': return ANDROID_LOG_SILENT;
+    case '*': return ANDROID_LOG_DEFAULT;
+    default:  return ANDROID_LOG_UNKNOWN;
+    }
+}
+
+int LogReaderFilter::setTags(const char *str) {
+    mHasTags = true;
+    while (*str) {
+        size_t len = strcspn(str, ",");
+        if (!len) {
+            ++str;
+            continue;
+        }
+
+        size_t tagLen = strcspn(str, ":,");
+        if (!tagLen) {
+            return -1;
+        }
+        android_LogPriority pri = ANDROID_LOG_DEFAULT;
+        if (tagLen < len) {
+            pri = filterCharToPri(str[tagLen + 1]);
+            if (pri == ANDROID_LOG_UNKNOWN) {
+                return -1;
+            }
+        }
+
+        if ((tagLen == 1) && (*str == '*')) {
+            mGlobalPri = (pri == ANDROID_LOG_DEFAULT) ? ANDROID_LOG_DEBUG : pri;
+        } else {
+            if (pri == ANDROID_LOG_DEFAULT) {
+                pri = ANDROID_LOG_VERBOSE;
+            }
+            // the last rule for a tag wins
+            size_t i;
+            for (i = 0; i < mTags.size(); ++i) {
+                if (!strncmp(mTags[i].mTag, str, tagLen)
+                        && !mTags[i].mTag[tagLen]) {
+                    mTags.editItemAt(i).mPri = pri;
+                    break;
+                }
+            }
+            if (i >= mTags.size()) {
+                TagRule rule;
+                rule.mTag = strndup(str, tagLen);
+                rule.mPri = pri;
+                mTags.push(rule);
+            }
+        }
+
+        str += len;
+    }
+    return 0;
+}
+
+int LogReaderFilter::setUids(const char *str) {
+    while (*str) {
+        char *cp;
+        unsigned long uid = strtoul(str, &cp, 10);
+        if ((cp == str) || ((*cp != ',') && (*cp != '\0'))) {
+            return -1;
+        }
+        mUids.push((uid_t) uid);
+        str = (*cp == ',') ? cp + 1 : cp;
+    }
+    return 0;
+}
+
+int LogReaderFilter::setRegex(const char *str) {
+    if (mHasRegex) {
+        regfree(&mRegex);
+        mHasRegex = false;
+    }
+    if (regcomp(&mRegex, str, REG_EXTENDED | REG_NOSUB)) {
+        return -1;
+    }
+    mHasRegex = true;
+    return 0;
+}
+
+android_LogPriority LogReaderFilter::priFor(const char *tag) const {
+    for (size_t i = 0; i < mTags.size(); ++i) {
+        if (!strcmp(tag, mTags[i].mTag)) {
+            return mTags[i].mPri;
+        }
+    }
+    return mGlobalPri;
+}
+
+bool LogReaderFilter::match(const LogBufferElement *element) const {
+    if (mUids.size()) {
+        uid_t uid = element->getUid();
+        size_t i;
+        for (i = 0; i < mUids.size(); ++i) {
+            if (mUids[i] == uid) {
+                break;
+            }
+        }
+        if (i >= mUids.size()) {
+            return false;
+        }
+    }
+
+    if (element->getLogId() == LOG_ID_EVENTS) {
+        return true;
+    }
+
+    // <priority> <tag> '\0' <message> '\0', not trusted to be terminated
+    char buffer[LOGGER_ENTRY_MAX_PAYLOAD + 1];
+    const char *msg = element->getMsg();
+    unsigned short len = element->getMsgLen();
+    if (len < 1) {
+        return false;
+    }
+    if (msg[len - 1]) {
+        memcpy(buffer, msg, len);
+        buffer[len] = '\0';
+        msg = buffer;
+    }
+
+    const char *tag = msg + 1;
+    if (mHasTags && (msg[0] < priFor(tag))) {
+        return false;
+    }
+
+    if (mHasRegex) {
+        size_t tagLen = strlen(tag);
+        const char *text = (tagLen + 2 < len) ? tag + tagLen + 1 : "";
+        if (regexec(&mRegex, text, 0, NULL, 0)) {
+            return false;
+        }
+    }
+
+    return true;
+}
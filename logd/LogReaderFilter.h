@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOGD_LOG_READER_FILTER_H__
+#define _LOGD_LOG_READER_FILTER_H__
+
+#include <regex.h>
+#include <sys/types.h>
+
+#include <android/log.h>
+#include <utils/Vector.h>
+
+#include "LogBufferElement.h"
+
+// Selection a reader asks for on the logdr socket, so that only the entries
+// it is going to print are sent to it:
+//
+//   filter=<tag>:<priority>[,...]  logcat filterspecs, "*" for all tags
+//   uids=<uid>[,...]               only entries of these uids
+//   regex=<expression>             only messages matching, POSIX extended
+//
+// Tag and message do not apply to the binary event log, its entries are
+// only subject to the uids. Immutable once set up, and is used without
+// locking by the reader thread.
+class LogReaderFilter {
+    struct TagRule {
+        char *mTag;
+        android_LogPriority mPri;
+    };
+
+    bool mHasTags;
+    android::Vector<TagRule> mTags;
+    android_LogPriority mGlobalPri;
+    android::Vector<uid_t> mUids;
+    regex_t mRegex;
+    bool mHasRegex;
+
+    android_LogPriority priFor(const char *tag) const;
+
+public:
+    LogReaderFilter();
+    ~LogReaderFilter();
+
+    // each returns 0, or -1 if str does not parse
+    int setTags(const char *str);
+    int setUids(const char *str);
+    int setRegex(const char *str);
+
+    bool match(const LogBufferElement *element) const;
+};
+
+#endif // _LOGD_LOG_READER_FILTER_H__
@@ -118,6 +118,7 @@ char *PidStatistics::pidToName(pid_t pid) {
 
 UidStatistics::UidStatistics(uid_t uid)
         : uid(uid)
+        , mHeapIndex(0)
         , mSizes(0)
         , mElements(0) {
     Pids.clear();
@@ -129,29 +130,40 @@ UidStatistics::~UidStatistics() {
         delete (*it);
         it = erase(it);
     }
+    PidIndex.clear();
+}
+
+PidStatistics *UidStatistics::find(pid_t pid) const {
+    return PidIndex.find(pid);
+}
+
+void UidStatistics::remove(PidStatistics *p) {
+    PidStatisticsCollection::iterator it;
+    for (it = begin(); it != end(); ++it) {
+        if (*it == p) {
+            erase(it);
+            break;
+        }
+    }
+    PidIndex.remove(p->getPid());
+    delete p;
 }
 
 void UidStatistics::add(unsigned short size, pid_t pid) {
     mSizes += size;
     ++mElements;
 
-    PidStatistics *p = NULL;
-    PidStatisticsCollection::iterator last;
-    PidStatisticsCollection::iterator it;
-    for (last = it = begin(); it != end(); last = it, ++it) {
-        p = *it;
-        if (pid == p->getPid()) {
-            p->add(size);
-            return;
+    PidStatistics *p = find(pid);
+    if (!p) {
+        p = new PidStatistics(pid, pidToName(pid));
+        // keep the gone entry last
+        PidStatisticsCollection::iterator last = end();
+        if ((last != begin()) && ((*--last)->getPid() == PidStatistics::gone)) {
+            insert(last, p);
+        } else {
+            push_back(p);
         }
-    }
-    // insert if the gone entry.
-    bool insert_before_last = (last != it) && p && (p->getPid() == p->gone);
-    p = new PidStatistics(pid, pidToName(pid));
-    if (insert_before_last) {
-        insert(last, p);
-    } else {
-        push_back(p);
+        PidIndex.add(pid, p);
     }
     p->add(size);
 }
@@ -160,32 +172,22 @@ void UidStatistics::subtract(unsigned short size, pid_t pid) {
     mSizes -= size;
     --mElements;
 
-    PidStatisticsCollection::iterator it;
-    for (it = begin(); it != end(); ++it) {
-        PidStatistics *p = *it;
-        if (pid == p->getPid()) {
-            if (p->subtract(size)) {
-                size_t szsTotal = p->sizesTotal();
-                size_t elsTotal = p->elementsTotal();
-                delete p;
-                erase(it);
-                it = end();
-                --it;
-                if (it == end()) {
-                    p = new PidStatistics(p->gone);
-                    push_back(p);
-                } else {
-                    p = *it;
-                    if (p->getPid() != p->gone) {
-                        p = new PidStatistics(p->gone);
-                        push_back(p);
-                    }
-                }
-                p->addTotal(szsTotal, elsTotal);
-            }
-            return;
-        }
+    PidStatistics *p = find(pid);
+    if (!p || !p->subtract(size)) {
+        return;
     }
+
+    // fold the totals of a pid that went away into the gone entry
+    size_t szsTotal = p->sizesTotal();
+    size_t elsTotal = p->elementsTotal();
+    remove(p);
+    p = find(PidStatistics::gone);
+    if (!p) {
+        p = new PidStatistics(PidStatistics::gone);
+        push_back(p);
+        PidIndex.add(PidStatistics::gone, p);
+    }
+    p->addTotal(szsTotal, elsTotal);
 }
 
 void UidStatistics::sort() {
@@ -216,14 +218,8 @@ size_t UidStatistics::sizes(pid_t pid) {
         return sizes();
     }
 
-    PidStatisticsCollection::iterator it;
-    for (it = begin(); it != end(); ++it) {
-        PidStatistics *p = *it;
-        if (pid == p->getPid()) {
-            return p->sizes();
-        }
-    }
-    return 0;
+    PidStatistics *p = find(pid);
+    return p ? p->sizes() : 0;
 }
 
 size_t UidStatistics::elements(pid_t pid) {
@@ -231,36 +227,34 @@ size_t UidStatistics::elements(pid_t pid) {
         return elements();
     }
 
-    PidStatisticsCollection::iterator it;
-    for (it = begin(); it != end(); ++it) {
-        PidStatistics *p = *it;
-        if (pid == p->getPid()) {
-            return p->elements();
-        }
-    }
-    return 0;
+    PidStatistics *p = find(pid);
+    return p ? p->elements() : 0;
 }
 
 size_t UidStatistics::sizesTotal(pid_t pid) {
+    if (pid != pid_all) {
+        PidStatistics *p = find(pid);
+        return p ? p->sizesTotal() : 0;
+    }
+
     size_t sizes = 0;
     PidStatisticsCollection::iterator it;
     for (it = begin(); it != end(); ++it) {
-        PidStatistics *p = *it;
-        if ((pid == pid_all) || (pid == p->getPid())) {
-            sizes += p->sizesTotal();
-        }
+        sizes += (*it)->sizesTotal();
     }
     return sizes;
 }
 
 size_t UidStatistics::elementsTotal(pid_t pid) {
+    if (pid != pid_all) {
+        PidStatistics *p = find(pid);
+        return p ? p->elementsTotal() : 0;
+    }
+
     size_t elements = 0;
     PidStatisticsCollection::iterator it;
     for (it = begin(); it != end(); ++it) {
-        PidStatistics *p = *it;
-        if ((pid == pid_all) || (pid == p->getPid())) {
-            elements += p->elementsTotal();
-        }
+        elements += (*it)->elementsTotal();
     }
     return elements;
 }
@@ -275,35 +269,75 @@ LidStatistics::~LidStatistics() {
         delete (*it);
         it = Uids.erase(it);
     }
+    UidIndex.clear();
+    Heap.clear();
 }
 
-void LidStatistics::add(unsigned short size, uid_t uid, pid_t pid) {
-    UidStatistics *u;
-    UidStatisticsCollection::iterator it;
-    UidStatisticsCollection::iterator last;
+UidStatistics *LidStatistics::find(uid_t uid) const {
+    return UidIndex.find(uid);
+}
+
+// u grew, move it towards the top
+void LidStatistics::heapUp(size_t i) {
+    UidStatistics **heap = Heap.editArray();
+    UidStatistics *u = heap[i];
+    size_t sizes = u->sizes();
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        UidStatistics *p = heap[parent];
+        if (p->sizes() >= sizes) {
+            break;
+        }
+        heap[i] = p;
+        p->mHeapIndex = i;
+        i = parent;
+    }
+    heap[i] = u;
+    u->mHeapIndex = i;
+}
+
+// u shrank, move it towards the bottom
+void LidStatistics::heapDown(size_t i) {
+    UidStatistics **heap = Heap.editArray();
+    UidStatistics *u = heap[i];
+    size_t sizes = u->sizes();
+    size_t n = Heap.size();
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= n) {
+            break;
+        }
+        if (((child + 1) < n)
+                && (heap[child + 1]->sizes() > heap[child]->sizes())) {
+            ++child;
+        }
+        UidStatistics *c = heap[child];
+        if (c->sizes() <= sizes) {
+            break;
+        }
+        heap[i] = c;
+        c->mHeapIndex = i;
+        i = child;
+    }
+    heap[i] = u;
+    u->mHeapIndex = i;
+}
 
+void LidStatistics::add(unsigned short size, uid_t uid, pid_t pid) {
     if (uid == (uid_t) -1) { // init
         uid = (uid_t) AID_ROOT;
     }
 
-    for (last = it = begin(); it != end(); last = it, ++it) {
-        u = *it;
-        if (uid == u->getUid()) {
-            u->add(size, pid);
-            if ((last != it) && ((*last)->sizesTotal() < u->sizesTotal())) {
-                Uids.erase(it);
-                Uids.insert(last, u);
-            }
-            return;
-        }
-    }
-    u = new UidStatistics(uid);
-    if ((last != it) && ((*last)->sizesTotal() < (size_t) size)) {
-        Uids.insert(last, u);
-    } else {
+    UidStatistics *u = find(uid);
+    if (!u) {
+        u = new UidStatistics(uid);
         Uids.push_back(u);
+        UidIndex.add(uid, u);
+        u->mHeapIndex = Heap.size();
+        Heap.push(u);
     }
     u->add(size, pid);
+    heapUp(u->mHeapIndex);
 }
 
 void LidStatistics::subtract(unsigned short size, uid_t uid, pid_t pid) {
@@ -311,14 +345,28 @@ void LidStatistics::subtract(unsigned short size, uid_t uid, pid_t pid) {
         uid = (uid_t) AID_ROOT;
     }
 
-    UidStatisticsCollection::iterator it;
-    for (it = begin(); it != end(); ++it) {
-        UidStatistics *u = *it;
-        if (uid == u->getUid()) {
-            u->subtract(size, pid);
-            return;
+    UidStatistics *u = find(uid);
+    if (u) {
+        u->subtract(size, pid);
+        heapDown(u->mHeapIndex);
+    }
+}
+
+uid_t LidStatistics::worst(size_t *sizes, size_t *second_sizes) const {
+    *sizes = 0;
+    *second_sizes = 0;
+    size_t n = Heap.size();
+    if (n == 0) {
+        return uid_all;
+    }
+    // the runner up is one of the children of the top
+    for (size_t i = 1; (i < n) && (i <= 2); ++i) {
+        if (Heap[i]->sizes() > *second_sizes) {
+            *second_sizes = Heap[i]->sizes();
         }
     }
+    *sizes = Heap[0]->sizes();
+    return Heap[0]->getUid();
 }
 
 void LidStatistics::sort() {
@@ -345,49 +393,57 @@ void LidStatistics::sort() {
 }
 
 size_t LidStatistics::sizes(uid_t uid, pid_t pid) {
+    if (uid != uid_all) {
+        UidStatistics *u = find(uid);
+        return u ? u->sizes(pid) : 0;
+    }
+
     size_t sizes = 0;
     UidStatisticsCollection::iterator it;
     for (it = begin(); it != end(); ++it) {
-        UidStatistics *u = *it;
-        if ((uid == uid_all) || (uid == u->getUid())) {
-            sizes += u->sizes(pid);
-        }
+        sizes += (*it)->sizes(pid);
     }
     return sizes;
 }
 
 size_t LidStatistics::elements(uid_t uid, pid_t pid) {
+    if (uid != uid_all) {
+        UidStatistics *u = find(uid);
+        return u ? u->elements(pid) : 0;
+    }
+
     size_t elements = 0;
     UidStatisticsCollection::iterator it;
     for (it = begin(); it != end(); ++it) {
-        UidStatistics *u = *it;
-        if ((uid == uid_all) || (uid == u->getUid())) {
-            elements += u->elements(pid);
-        }
+        elements += (*it)->elements(pid);
     }
     return elements;
 }
 
 size_t LidStatistics::sizesTotal(uid_t uid, pid_t pid) {
+    if (uid != uid_all) {
+        UidStatistics *u = find(uid);
+        return u ? u->sizesTotal(pid) : 0;
+    }
+
     size_t sizes = 0;
     UidStatisticsCollection::iterator it;
     for (it = begin(); it != end(); ++it) {
-        UidStatistics *u = *it;
-        if ((uid == uid_all) || (uid == u->getUid())) {
-            sizes += u->sizesTotal(pid);
-        }
+        sizes += (*it)->sizesTotal(pid);
     }
     return sizes;
 }
 
 size_t LidStatistics::elementsTotal(uid_t uid, pid_t pid) {
+    if (uid != uid_all) {
+        UidStatistics *u = find(uid);
+        return u ? u->elementsTotal(pid) : 0;
+    }
+
     size_t elements = 0;
     UidStatisticsCollection::iterator it;
     for (it = begin(); it != end(); ++it) {
-        UidStatistics *u = *it;
-        if ((uid == uid_all) || (uid == u->getUid())) {
-            elements += u->elementsTotal(pid);
-        }
+        elements += (*it)->elementsTotal(pid);
     }
     return elements;
 }
@@ -395,6 +451,8 @@ size_t LidStatistics::elementsTotal(uid_t uid, pid_t pid) {
 LogStatistics::LogStatistics()
         : mStatistics(false)
         , dgramQlenStatistics(false)
+        , mArrivalsIndex(0)
+        , mArrivalsCount(0)
         , start(CLOCK_MONOTONIC) {
     log_id_for_each(i) {
         mSizes[i] = 0;
@@ -461,6 +519,21 @@ void LogStatistics::recordDiff(log_time diff, unsigned short bucket) {
     }
 }
 
+// Record the time between this arrival and the arrival dgramQlen(bucket)
+// entries earlier, for each bucket.
+void LogStatistics::recordArrival(log_time realtime) {
+    unsigned short n;
+    for (unsigned short i = 0; (n = dgramQlen(i)) && (n <= mArrivalsCount); ++i) {
+        unsigned short j = (mArrivalsIndex + mArrivalsMax - n) % mArrivalsMax;
+        recordDiff(realtime - mArrivals[j], i);
+    }
+    mArrivals[mArrivalsIndex] = realtime;
+    mArrivalsIndex = (mArrivalsIndex + 1) % mArrivalsMax;
+    if (mArrivalsCount < mArrivalsMax) {
+        ++mArrivalsCount;
+    }
+}
+
 void LogStatistics::add(unsigned short size,
                         log_id_t log_id, uid_t uid, pid_t pid) {
     mSizes[log_id] += size;
@@ -17,15 +17,119 @@
 #ifndef _LOGD_LOG_STATISTICS_H__
 #define _LOGD_LOG_STATISTICS_H__
 
+#include <stdint.h>
 #include <sys/types.h>
 
 #include <log/log.h>
 #include <log/log_read.h>
 #include <utils/List.h>
+#include <utils/Vector.h>
 
 #define log_id_for_each(i) \
     for (log_id_t i = LOG_ID_MIN; i < LOG_ID_MAX; i = (log_id_t) (i + 1))
 
+// Open addressed hash of uid or pid to its statistics, linear probing. The
+// table only grows, when an insertion would fill more than half of it.
+template <typename TKey, typename TValue>
+class StatisticsIndex {
+    struct Slot {
+        TKey key;
+        TValue *value; // NULL if empty
+    };
+
+    Slot *mSlots;
+    size_t mMask;
+    size_t mCount;
+
+    size_t home(TKey key) const {
+        uint32_t hash = (uint32_t) key * 2654435761U;
+        return (hash ^ (hash >> 16)) & mMask;
+    }
+
+    void grow() {
+        Slot *old = mSlots;
+        size_t n = old ? (mMask + 1) : 0;
+        mMask = n ? ((n * 2) - 1) : 15;
+        mSlots = new Slot[mMask + 1];
+        for (size_t i = 0; i <= mMask; ++i) {
+            mSlots[i].value = NULL;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            if (old[i].value) {
+                size_t j = home(old[i].key);
+                while (mSlots[j].value) {
+                    j = (j + 1) & mMask;
+                }
+                mSlots[j] = old[i];
+            }
+        }
+        delete [] old;
+    }
+
+public:
+    StatisticsIndex() : mSlots(NULL), mMask(0), mCount(0) { }
+    ~StatisticsIndex() { delete [] mSlots; }
+
+    TValue *find(TKey key) const {
+        if (!mSlots) {
+            return NULL;
+        }
+        for (size_t i = home(key); mSlots[i].value; i = (i + 1) & mMask) {
+            if (mSlots[i].key == key) {
+                return mSlots[i].value;
+            }
+        }
+        return NULL;
+    }
+
+    // key must not be present
+    void add(TKey key, TValue *value) {
+        if (((mCount + 1) * 2) > (mSlots ? (mMask + 1) : 0)) {
+            grow();
+        }
+        size_t i = home(key);
+        while (mSlots[i].value) {
+            i = (i + 1) & mMask;
+        }
+        mSlots[i].key = key;
+        mSlots[i].value = value;
+        ++mCount;
+    }
+
+    void remove(TKey key) {
+        if (!mSlots) {
+            return;
+        }
+        size_t i = home(key);
+        for (; mSlots[i].value; i = (i + 1) & mMask) {
+            if (mSlots[i].key == key) {
+                break;
+            }
+        }
+        if (!mSlots[i].value) {
+            return;
+        }
+        // shift back the entries of the run that belong at or before the hole
+        for (size_t j = (i + 1) & mMask; mSlots[j].value; j = (j + 1) & mMask) {
+            size_t k = home(mSlots[j].key);
+            if (((j > i) && ((k <= i) || (k > j)))
+                    || ((j < i) && (k <= i) && (k > j))) {
+                mSlots[i] = mSlots[j];
+                i = j;
+            }
+        }
+        mSlots[i].value = NULL;
+        --mCount;
+    }
+
+    void clear() {
+        for (size_t i = 0; mSlots && (i <= mMask); ++i) {
+            mSlots[i].value = NULL;
+        }
+        mCount = 0;
+    }
+};
+
 class PidStatistics {
     const pid_t pid;
 
@@ -68,13 +172,21 @@ public:
 typedef android::List<PidStatistics *> PidStatisticsCollection;
 
 class UidStatistics {
+    friend class LidStatistics;
+
     const uid_t uid;
 
     PidStatisticsCollection Pids;
+    // same entries as Pids, looked up by pid
+    StatisticsIndex<pid_t, PidStatistics> PidIndex;
+    // place in the LidStatistics heap
+    size_t mHeapIndex;
 
     void insert(PidStatisticsCollection::iterator i, PidStatistics *p)
         { Pids.insert(i, p); }
     void push_back(PidStatistics *p) { Pids.push_back(p); }
+    PidStatistics *find(pid_t pid) const;
+    void remove(PidStatistics *p);
 
     size_t mSizes;
     size_t mElements;
@@ -113,8 +225,18 @@ public:
 
 typedef android::List<UidStatistics *> UidStatisticsCollection;
 
+// Uids, indexed by uid, and kept in a max-heap by current size so that the
+// worst offender is at hand without sorting. Statistics entries are never
+// released while logd runs, add() and subtract() only allocate for a uid or
+// pid not seen before.
 class LidStatistics {
     UidStatisticsCollection Uids;
+    StatisticsIndex<uid_t, UidStatistics> UidIndex;
+    android::Vector<UidStatistics *> Heap;
+
+    UidStatistics *find(uid_t uid) const;
+    void heapUp(size_t i);
+    void heapDown(size_t i);
 
 public:
     LidStatistics();
@@ -125,11 +247,15 @@ public:
 
     void add(unsigned short size, uid_t uid, pid_t pid);
     void subtract(unsigned short size, uid_t uid, pid_t pid);
-    void sort();
+    void sort(); // Uids by current size, for reporting
 
     static const pid_t pid_all = (pid_t) -1;
     static const uid_t uid_all = (uid_t) -1;
 
+    // uid with the largest current size, uid_all if none. Also reports its
+    // size and that of the runner up.
+    uid_t worst(size_t *sizes, size_t *second_sizes) const;
+
     size_t sizes(uid_t uid = uid_all, pid_t pid = pid_all);
     size_t elements(uid_t uid = uid_all, pid_t pid = pid_all);
 
@@ -150,6 +276,12 @@ class LogStatistics {
     static const unsigned short mBuckets[14];
     log_time mMinimum[sizeof(mBuckets) / sizeof(mBuckets[0])];
 
+    // recent arrivals, enough to span the largest bucket
+    static const unsigned short mArrivalsMax = 600;
+    log_time mArrivals[mArrivalsMax];
+    unsigned short mArrivalsIndex;
+    unsigned short mArrivalsCount;
+
 public:
     const log_time start;
 
@@ -162,6 +294,7 @@ public:
     static unsigned short dgramQlen(unsigned short bucket);
     unsigned long long minimum(unsigned short bucket);
     void recordDiff(log_time diff, unsigned short bucket);
+    void recordArrival(log_time realtime);
 
     void add(unsigned short size, log_id_t log_id, uid_t uid, pid_t pid);
     void subtract(unsigned short size, log_id_t log_id, uid_t uid, pid_t pid);
@@ -28,7 +28,7 @@ const struct timespec LogTimeEntry::EPOCH = { 0, 1 };
 LogTimeEntry::LogTimeEntry(LogReader &reader, SocketClient *client,
                            bool nonBlock, unsigned long tail,
                            unsigned int logMask, pid_t pid,
-                           log_time start)
+                           log_time start, LogReaderFilter *filter)
         : mRefCount(1)
         , mRelease(false)
         , mError(false)
@@ -36,6 +36,7 @@ LogTimeEntry::LogTimeEntry(LogReader &reader, SocketClient *client,
         , mReader(reader)
         , mLogMask(logMask)
         , mPid(pid)
+        , mFilter(filter)
         , skipAhead(0)
         , mCount(0)
         , mTail(tail)
@@ -48,6 +49,10 @@ LogTimeEntry::LogTimeEntry(LogReader &reader, SocketClient *client,
         pthread_cond_init(&threadTriggeredCondition, NULL);
 }
 
+LogTimeEntry::~LogTimeEntry() {
+    delete mFilter;
+}
+
 void LogTimeEntry::startReader_Locked(void) {
     pthread_attr_t attr;
 
@@ -134,9 +139,11 @@ void *LogTimeEntry::threadStart(void *obj) {
         unlock();
 
         if (me->mTail) {
-            logbuf.flushTo(client, start, privileged, FilterFirstPass, me);
+            logbuf.flushTo(client, start, privileged, me->mLogMask,
+                           FilterFirstPass, me);
         }
-        start = logbuf.flushTo(client, start, privileged, FilterSecondPass, me);
+        start = logbuf.flushTo(client, start, privileged, me->mLogMask,
+                               FilterSecondPass, me);
 
         lock();
 
@@ -158,18 +165,28 @@ void *LogTimeEntry::threadStart(void *obj) {
     return NULL;
 }
 
+// Whether the reader asked for element. Only immutable state is used, so
+// it is done outside of the lock, and the cheap tests go first. flushTo()
+// calls the filter callbacks below with no lock held.
+bool LogTimeEntry::selected(const LogTimeEntry *me, const LogBufferElement *element) {
+    return (me->mLogMask & (1 << element->getLogId()))
+        && (!me->mPid || (me->mPid == element->getPid()))
+        && (!me->mFilter || me->mFilter->match(element));
+}
+
 // A first pass to count the number of elements
 bool LogTimeEntry::FilterFirstPass(const LogBufferElement *element, void *obj) {
     LogTimeEntry *me = reinterpret_cast<LogTimeEntry *>(obj);
 
+    bool match = selected(me, element);
+
     LogTimeEntry::lock();
 
     if (me->mCount == 0) {
         me->mStart = element->getMonotonicTime();
     }
 
-    if ((!me->mPid || (me->mPid == element->getPid()))
-            && (me->mLogMask & (1 << element->getLogId()))) {
+    if (match) {
         ++me->mCount;
     }
 
@@ -182,6 +199,8 @@ bool LogTimeEntry::FilterFirstPass(const LogBufferElement *element, void *obj) {
 bool LogTimeEntry::FilterSecondPass(const LogBufferElement *element, void *obj) {
     LogTimeEntry *me = reinterpret_cast<LogTimeEntry *>(obj);
 
+    bool match = selected(me, element);
+
     LogTimeEntry::lock();
 
     if (me->skipAhead) {
@@ -196,11 +215,7 @@ bool LogTimeEntry::FilterSecondPass(const LogBufferElement *element, void *obj)
         goto skip;
     }
 
-    if ((me->mLogMask & (1 << element->getLogId())) == 0) {
-        goto skip;
-    }
-
-    if (me->mPid && (me->mPid != element->getPid())) {
+    if (!match) {
         goto skip;
     }
 
@@ -23,6 +23,8 @@
 #include <sysutils/SocketClient.h>
 #include <utils/List.h>
 
+#include "LogReaderFilter.h"
+
 class LogReader;
 
 class LogTimeEntry {
@@ -36,8 +38,10 @@ class LogTimeEntry {
     LogReader &mReader;
     static void *threadStart(void *me);
     static void threadStop(void *me);
+    static bool selected(const LogTimeEntry *me, const LogBufferElement *element);
     const unsigned int mLogMask;
     const pid_t mPid;
+    LogReaderFilter *const mFilter; // owned, NULL if none
     unsigned int skipAhead;
     unsigned long mCount;
     unsigned long mTail;
@@ -46,7 +50,8 @@ class LogTimeEntry {
 public:
     LogTimeEntry(LogReader &reader, SocketClient *client, bool nonBlock,
                  unsigned long tail, unsigned int logMask, pid_t pid,
-                 log_time start);
+                 log_time start, LogReaderFilter *filter = NULL);
+    ~LogTimeEntry();
 
     SocketClient *mClient;
     static const struct timespec EPOCH;
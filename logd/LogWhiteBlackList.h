@@ -62,6 +62,7 @@ public:
 
     bool naughty(LogBufferElement *element);
     bool nice(LogBufferElement *element);
+    bool hasNaughty() const { return !mNaughty.empty(); }
     bool worstUidEnabled() const { return mWorstUidEnabled; }
 
     // *strp is malloc'd, use free to release
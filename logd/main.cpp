@@ -145,9 +145,10 @@ int main() {
     LastLogTimes *times = new LastLogTimes();
 
     // LogBuffer is the object which is responsible for holding all
-    // log entries.
+    // log entries, and for the copy of them that persist.logd.spill
+    // keeps on /data.
 
-    LogBuffer *logBuf = new LogBuffer(times);
+    LogBuffer *logBuf = new LogBuffer(times, "/data/misc/logd");
 
     if (property_get_bool("logd.statistics.dgram_qlen", false)) {
         logBuf->enableDgramQlenStatistics();
@@ -23,6 +23,51 @@ LOCAL_PATH := $(call my-dir)
 test_module_prefix := logd-
 test_tags := tests
 
+benchmark_c_flags := \
+    -Isystem/core/liblog/tests \
+    -Isystem/core/logd \
+    -Wall -Wextra \
+    -Werror \
+    -fno-builtin \
+    -std=gnu++11
+
+# the storage engine is built in, no daemon is involved
+engine_src_files := \
+    ../LogBuffer.cpp \
+    ../LogBufferRing.cpp \
+    ../LogBufferCold.cpp \
+    ../LogBufferSpill.cpp \
+    ../LogBufferElement.cpp \
+    ../LogTimes.cpp \
+    ../LogStatistics.cpp \
+    ../LogWhiteBlackList.cpp \
+    ../LogReader.cpp \
+    ../LogReaderFilter.cpp \
+    ../FlushCommand.cpp \
+    ../LogCommand.cpp
+
+benchmark_src_files := \
+    ../../liblog/tests/benchmark_main.cpp \
+    logd_benchmark.cpp \
+    $(engine_src_files)
+
+# Build benchmarks for the device. Run with:
+#   adb shell logd-benchmarks
+include $(CLEAR_VARS)
+LOCAL_MODULE := $(test_module_prefix)benchmarks
+LOCAL_MODULE_TAGS := $(test_tags)
+LOCAL_ADDITIONAL_DEPENDENCIES := $(LOCAL_PATH)/Android.mk
+LOCAL_CFLAGS += $(benchmark_c_flags)
+LOCAL_C_INCLUDES += external/zlib
+LOCAL_SHARED_LIBRARIES += libsysutils liblog libcutils libutils libz libm
+LOCAL_SRC_FILES := $(benchmark_src_files)
+ifndef LOCAL_SDK_VERSION
+LOCAL_C_INCLUDES += bionic bionic/libstdc++/include external/stlport/stlport
+LOCAL_SHARED_LIBRARIES += libstlport
+endif
+LOCAL_MODULE_PATH := $(TARGET_OUT_DATA_NATIVE_TESTS)/$(LOCAL_MODULE)
+include $(BUILD_EXECUTABLE)
+
 # -----------------------------------------------------------------------------
 # Unit tests.
 # -----------------------------------------------------------------------------
@@ -48,6 +93,27 @@ LOCAL_MODULE := $(test_module_prefix)unit-tests
 LOCAL_MODULE_TAGS := $(test_tags)
 LOCAL_ADDITIONAL_DEPENDENCIES := $(LOCAL_PATH)/Android.mk
 LOCAL_CFLAGS += $(test_c_flags)
-LOCAL_SHARED_LIBRARIES := libcutils
+LOCAL_SHARED_LIBRARIES := libcutils liblog
 LOCAL_SRC_FILES := $(test_src_files)
 include $(BUILD_NATIVE_TEST)
+
+# -----------------------------------------------------------------------------
+# Storage engine tests, in process like the benchmarks.
+# -----------------------------------------------------------------------------
+
+engine_test_src_files := \
+    LogBufferCold_test.cpp \
+    LogBufferSpill_test.cpp \
+    $(engine_src_files)
+
+# Build tests for the storage engine. Run with:
+#   adb shell /data/nativetest/logd-engine-tests/logd-engine-tests
+include $(CLEAR_VARS)
+LOCAL_MODULE := $(test_module_prefix)engine-tests
+LOCAL_MODULE_TAGS := $(test_tags)
+LOCAL_ADDITIONAL_DEPENDENCIES := $(LOCAL_PATH)/Android.mk
+LOCAL_CFLAGS += $(test_c_flags) -Isystem/core/logd -std=gnu++11
+LOCAL_C_INCLUDES += external/zlib
+LOCAL_SHARED_LIBRARIES := libsysutils liblog libcutils libutils libz
+LOCAL_SRC_FILES := $(engine_test_src_files)
+include $(BUILD_NATIVE_TEST)
@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "LogBufferCold.h"
+#include "LogBufferElement.h"
+#include "LogBufferRing.h"
+
+class LogBufferColdTest : public ::testing::Test {
+protected:
+    LogBufferCold mCold;
+    union {
+        char mRecords[LogBufferCold::chunkMax];
+        uint64_t mAlign;
+    };
+    union {
+        char mInflated[LogBufferCold::chunkMax];
+        uint64_t mAlign2;
+    };
+
+    // Lay out records first to last as a LogBufferRing would: record n is
+    // monotonic n seconds, realtime 1000 + n, of uid 10000 + n % 3, with
+    // random payloads if noisy. Returns the size.
+    size_t build(unsigned first, unsigned last, bool noisy = false) {
+        size_t size = 0;
+        memset(mRecords, 0, sizeof(mRecords));
+        for (unsigned n = first; n <= last; ++n) {
+            char msg[200];
+            for (size_t i = 0; i < sizeof(msg); ++i) {
+                msg[i] = noisy ? rand() : ('a' + n % 26);
+            }
+            snprintf(msg, sizeof(msg), "%u", n);
+            size_t len = LogBufferRing::recordSize(sizeof(msg));
+            EXPECT_GE(sizeof(mRecords), size + len);
+            new (mRecords + size) LogBufferElement(LOG_ID_MAIN,
+                    log_time(n, 0), log_time(1000 + n, 0),
+                    10000 + n % 3, n, n, msg, sizeof(msg));
+            size += len;
+        }
+        return size;
+    }
+
+    // the chunk after c, oldest first
+    const LogBufferCold::Chunk *after(const LogBufferCold::Chunk *c) {
+        return mCold.find(c ? c->mLast : log_time::EPOCH);
+    }
+
+    // inflate c and check its records are in order, of monotonic first
+    // onwards, none of uid. Returns how many there are.
+    unsigned check(const LogBufferCold::Chunk *c, unsigned first, uid_t uid) {
+        EXPECT_TRUE(LogBufferCold::inflate(c->mData, c->mCompressedSize,
+                                           mInflated, c->mSize));
+        unsigned count = 0;
+        unsigned n = first;
+        for (size_t offset = 0; offset < c->mSize; ++count) {
+            const LogBufferElement *e =
+                reinterpret_cast<const LogBufferElement *>(mInflated + offset);
+            while ((10000 + n % 3) == uid) {
+                ++n;
+            }
+            EXPECT_EQ(n, e->getMonotonicTime().tv_sec);
+            EXPECT_EQ(1000 + n, e->getRealTime().tv_sec);
+            EXPECT_EQ(10000 + n % 3, e->getUid());
+            EXPECT_EQ(n, (unsigned) atoi(e->getMsg()));
+            offset += LogBufferRing::recordSize(e->getMsgLen());
+            ++n;
+        }
+        return count;
+    }
+};
+
+TEST_F(LogBufferColdTest, add_find) {
+    mCold.setCapacity(1024 * 1024);
+    EXPECT_TRUE(mCold.empty());
+
+    size_t size = build(1, 40);
+    ASSERT_EQ(0, mCold.add(mRecords, size));
+    const LogBufferCold::Chunk *c = mCold.find(log_time::EPOCH);
+    ASSERT_TRUE(c != NULL);
+    EXPECT_EQ(size, c->mSize);
+    EXPECT_EQ(log_time(1, 0), c->mFirst);
+    EXPECT_EQ(log_time(40, 0), c->mLast);
+    EXPECT_EQ(log_time(1040, 0), c->mRealTimeMax);
+    EXPECT_EQ(c->mCompressedSize, mCold.used());
+    EXPECT_GT(size, c->mCompressedSize);
+
+    ASSERT_TRUE(LogBufferCold::inflate(c->mData, c->mCompressedSize,
+                                       mInflated, c->mSize));
+    EXPECT_EQ(0, memcmp(mRecords, mInflated, size));
+
+    ASSERT_EQ(0, mCold.add(mRecords, build(41, 80)));
+    const LogBufferCold::Chunk *d = after(c);
+    ASSERT_TRUE(d != NULL);
+    EXPECT_NE(c->mSequence, d->mSequence);
+    EXPECT_EQ(c->mCompressedSize + d->mCompressedSize, mCold.used());
+    EXPECT_EQ(log_time(1, 0), mCold.oldest());
+
+    EXPECT_EQ(c, mCold.find(log_time(39, 0)));
+    EXPECT_EQ(d, mCold.find(log_time(40, 0)));
+    EXPECT_TRUE(NULL == mCold.find(log_time(80, 0)));
+    EXPECT_EQ(c, mCold.findRealTime(log_time(1040, 0)));
+    EXPECT_EQ(d, mCold.findRealTime(log_time(1041, 0)));
+    EXPECT_TRUE(NULL == mCold.findRealTime(log_time(1081, 0)));
+
+    EXPECT_EQ(40U, check(c, 1, 0));
+    EXPECT_EQ(40U, check(d, 41, 0));
+}
+
+TEST_F(LogBufferColdTest, erase) {
+    mCold.setCapacity(1024 * 1024);
+    for (unsigned first = 1; first <= 91; first += 30) {
+        ASSERT_EQ(0, mCold.add(mRecords, build(first, first + 29)));
+    }
+    unsigned long sequence = after(NULL)->mSequence;
+
+    // every chunk is rewritten without uid 10001, the others are kept
+    mCold.erase(10001);
+    size_t used = 0;
+    unsigned first = 1;
+    const LogBufferCold::Chunk *c;
+    for (c = after(NULL); c; c = after(c)) {
+        EXPECT_EQ(20U, check(c, first, 10001));
+        used += c->mCompressedSize;
+        first += 30;
+    }
+    EXPECT_EQ(121U, first);
+    EXPECT_EQ(used, mCold.used());
+    EXPECT_NE(sequence, after(NULL)->mSequence);
+
+    // a chunk left with no records goes
+    mCold.erase(10002);
+    mCold.erase(10000);
+    EXPECT_TRUE(mCold.empty());
+    EXPECT_EQ(0U, mCold.used());
+    EXPECT_TRUE(NULL == after(NULL));
+}
+
+TEST_F(LogBufferColdTest, evict) {
+    EXPECT_EQ(-1, mCold.add(mRecords, build(1, 10)));
+
+    // payloads that do not compress, so that a few chunks fill capacity
+    srand(1);
+    mCold.setCapacity(1024 * 1024);
+    size_t size = build(1, 100, true);
+    ASSERT_EQ(0, mCold.add(mRecords, size));
+    size_t chunk = mCold.used();
+    mCold.setCapacity(chunk * 3);
+    EXPECT_EQ(chunk, mCold.used());
+
+    unsigned first = 1;
+    for (unsigned n = 101; n <= 1000; n += 100) {
+        ASSERT_EQ(0, mCold.add(mRecords, build(n, n + 99, true)));
+        EXPECT_GE(mCold.capacity(), mCold.used());
+
+        // the oldest chunks are discarded whole, the newest is kept
+        unsigned oldest = mCold.oldest().tv_sec;
+        EXPECT_EQ(1U, oldest % 100);
+        EXPECT_LE(first, oldest);
+        first = oldest;
+        const LogBufferCold::Chunk *c = mCold.find(log_time(n, 0));
+        ASSERT_TRUE(c != NULL);
+        EXPECT_EQ(log_time(n + 99, 0), c->mLast);
+    }
+    EXPECT_LT(1U, first);
+
+    mCold.setCapacity(0);
+    EXPECT_TRUE(mCold.empty());
+    EXPECT_EQ(0U, mCold.used());
+}
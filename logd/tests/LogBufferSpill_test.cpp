@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <private/android_filesystem_config.h>
+
+#include "LogBufferSpill.h"
+
+// four segments of 8K, room for seven of the records below in each
+#define SPILL_SIZE (4 * 8192)
+#define PAYLOAD_LEN 1000
+
+class LogBufferSpillTest : public ::testing::Test {
+protected:
+    char mDir[PATH_MAX];
+    LogBufferSpill mSpill;
+    LogBufferSpill::Cursor mCursor;
+    log_time mLast;
+    log_time mLimit[LOG_ID_MAX];
+    union {
+        char mBuffer[LogBufferSpill::elementMax];
+        uint64_t mAlign;
+    };
+
+    virtual void SetUp() {
+        const char *tmp = getenv("TMPDIR");
+        snprintf(mDir, sizeof(mDir), "%s/logd-spill-XXXXXX",
+                 tmp ? tmp : "/data/local/tmp");
+        ASSERT_TRUE(mkdtemp(mDir) != NULL);
+        LogBufferSpill::rewind(mCursor);
+        mLast = log_time::EPOCH;
+        for (size_t i = 0; i < LOG_ID_MAX; ++i) {
+            mLimit[i] = log_time(UINT32_MAX, 0);
+        }
+    }
+
+    virtual void TearDown() {
+        mSpill.close();
+        for (size_t i = 0; i < LogBufferSpill::segmentMax; ++i) {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/spill.%u", mDir, (unsigned) i);
+            unlink(path);
+        }
+        rmdir(mDir);
+    }
+
+    // entry n: monotonic n seconds, realtime 1000 + n, payload tagged n
+    void append(unsigned n, log_id_t id = LOG_ID_MAIN, uid_t uid = 10000) {
+        char msg[PAYLOAD_LEN];
+        memset(msg, 'a' + n % 26, sizeof(msg));
+        snprintf(msg, sizeof(msg), "%u", n);
+        mSpill.append(id, log_time(n, 0), log_time(1000 + n, 0),
+                      uid, n, n, msg, sizeof(msg));
+    }
+
+    // the next entry the reader sees, its number, 0 if none
+    unsigned next(bool privileged = true, uid_t uid = 10000) {
+        LogBufferElement *e = mSpill.next(mCursor, mLast, mLimit,
+                                          (1 << LOG_ID_MAX) - 1,
+                                          privileged, uid, mBuffer);
+        if (!e) {
+            return 0;
+        }
+        EXPECT_LT(mLast, e->getMonotonicTime());
+        mLast = e->getMonotonicTime();
+
+        unsigned n = atoi(e->getMsg());
+        EXPECT_EQ(PAYLOAD_LEN, e->getMsgLen());
+        EXPECT_EQ((pid_t) n, e->getPid());
+        EXPECT_EQ(1000 + n, e->getRealTime().tv_sec);
+        EXPECT_EQ('a' + n % 26, e->getMsg()[PAYLOAD_LEN - 1]);
+        return n;
+    }
+};
+
+TEST_F(LogBufferSpillTest, reopen) {
+    static const unsigned count = 20;
+
+    ASSERT_EQ(0, mSpill.open(mDir, SPILL_SIZE, log_time(100, 0)));
+    mSpill.start();
+    for (unsigned n = 1; n <= count; ++n) {
+        append(n);
+    }
+    mSpill.close();
+
+    // history is placed one nanosecond apart, just before the new start
+    log_time start(200, 0);
+    ASSERT_EQ(0, mSpill.open(mDir, SPILL_SIZE, start));
+    mSpill.start();
+    for (unsigned n = 1; n <= count; ++n) {
+        EXPECT_EQ(n, next());
+        EXPECT_EQ(start - log_time(0, count + 1 - n), mLast);
+    }
+    EXPECT_EQ(0U, next());
+
+    // this run's entries follow the history
+    append(201);
+    append(202);
+    EXPECT_EQ(201U, next());
+    EXPECT_EQ(202U, next());
+    EXPECT_EQ(0U, next());
+}
+
+TEST_F(LogBufferSpillTest, clear_reopen) {
+    ASSERT_EQ(0, mSpill.open(mDir, SPILL_SIZE, log_time(100, 0)));
+    mSpill.start();
+    for (unsigned n = 1; n <= 4; ++n) {
+        append(n);
+        append(n + 10, LOG_ID_SYSTEM, 10000 + n % 2);
+    }
+    mSpill.clear(LOG_ID_MAIN, AID_ROOT, log_time(4, 0));
+    mSpill.clear(LOG_ID_SYSTEM, 10001, log_time(14, 0));
+    append(5);
+    append(15, LOG_ID_SYSTEM, 10001);
+    mSpill.close();
+
+    ASSERT_EQ(0, mSpill.open(mDir, SPILL_SIZE, log_time(200, 0)));
+    mSpill.start();
+    // main is cleared for all, system only for uid 10001
+    EXPECT_EQ(12U, next());
+    EXPECT_EQ(14U, next());
+    EXPECT_EQ(5U, next());
+    EXPECT_EQ(15U, next());
+    EXPECT_EQ(0U, next());
+
+    // and an unprivileged reader only sees its own
+    LogBufferSpill::rewind(mCursor);
+    mLast = log_time::EPOCH;
+    EXPECT_EQ(15U, next(false, 10001));
+    EXPECT_EQ(0U, next(false, 10001));
+}
+
+TEST_F(LogBufferSpillTest, cursor_rotation) {
+    ASSERT_EQ(0, mSpill.open(mDir, SPILL_SIZE, log_time(100, 0)));
+    mSpill.start();
+
+    unsigned n = 101;
+    for (; n <= 110; ++n) {
+        append(n);
+    }
+    EXPECT_EQ(101U, next());
+    EXPECT_EQ(102U, next());
+
+    // reuse every segment, the one the cursor is in as well
+    for (; n <= 160; ++n) {
+        append(n);
+    }
+
+    // a fresh reader finds where the spill now starts
+    LogBufferSpill::Cursor fresh;
+    LogBufferSpill::rewind(fresh);
+    LogBufferElement *e = mSpill.next(fresh, log_time::EPOCH, mLimit,
+                                      (1 << LOG_ID_MAX) - 1, true, 0,
+                                      mBuffer);
+    ASSERT_TRUE(e != NULL);
+    unsigned oldest = e->getMonotonicTime().tv_sec;
+    EXPECT_LT(110U, oldest);
+
+    // the old cursor resumes there, then carries on in order
+    for (unsigned expect = oldest; expect < n; ++expect) {
+        EXPECT_EQ(expect, next());
+    }
+    EXPECT_EQ(0U, next());
+
+    // and keeps its place once the spill rotates under it again
+    for (; n <= 200; ++n) {
+        append(n);
+        EXPECT_EQ(n, next());
+    }
+}
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <log/log.h>
+#include <log/logger.h>
+#include <sysutils/SocketClient.h>
+
+#include "benchmark.h"
+
+#include "LogBuffer.h"
+
+// The benchmarks below drive a private LogBuffer in-process, no logd
+// daemon or socket is involved, only the storage engine is measured.
+
+static LogBuffer *logbuf;
+
+static LogBuffer *benchmarkLogBuffer() {
+    if (!logbuf) {
+        logbuf = new LogBuffer(new LastLogTimes());
+        logbuf->enableStatistics();
+    }
+    logbuf->setSize(LOG_ID_MAIN, 256 * 1024);
+    logbuf->clear(LOG_ID_MAIN);
+    return logbuf;
+}
+
+static void fillMessage(char *msg, unsigned short len) {
+    // event style tag + priority + "tag\0message\0"
+    memset(msg, 'a', len);
+    msg[0] = ANDROID_LOG_INFO;
+    msg[4] = '\0';
+    msg[len - 1] = '\0';
+}
+
+/*
+ *	Measure the rate at which typical (~100 byte) entries are stored,
+ * including the amortized cost of pruning once the buffer is full.
+ */
+static void BM_logbuffer_log(int iters) {
+    LogBuffer *buf = benchmarkLogBuffer();
+    char msg[100];
+    fillMessage(msg, sizeof(msg));
+    log_time realtime(CLOCK_REALTIME);
+
+    StartBenchmarkTiming();
+
+    for (int i = 0; i < iters; ++i) {
+        buf->log(LOG_ID_MAIN, realtime, AID_SYSTEM + (i & 7), 1 + (i & 31),
+                 1, msg, sizeof(msg));
+    }
+
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_logbuffer_log);
+
+/*
+ *	Measure the latency of those entries that have to prune the full buffer
+ * to make room for themselves.
+ */
+static void BM_logbuffer_prune(int iters) {
+    LogBuffer *buf = benchmarkLogBuffer();
+    char msg[100];
+    fillMessage(msg, sizeof(msg));
+    log_time realtime(CLOCK_REALTIME);
+
+    for (int i = 0, j = 0; i < iters; ++j) {
+        unsigned long used = buf->getSizeUsed(LOG_ID_MAIN);
+        log_time begin(CLOCK_MONOTONIC);
+        buf->log(LOG_ID_MAIN, realtime, AID_SYSTEM + (j & 7), 1 + (j & 31),
+                 1, msg, sizeof(msg));
+        log_time end(CLOCK_MONOTONIC);
+
+        if (buf->getSizeUsed(LOG_ID_MAIN) < used) {
+            StartBenchmarkTiming(begin.nsec());
+            StopBenchmarkTiming(end.nsec());
+            ++i;
+        }
+    }
+}
+BENCHMARK(BM_logbuffer_prune);
+
+/*
+ *	Measure the rate at which a single client repeating the same line is
+ * absorbed, the copies are counted rather than stored.
+ */
+static void BM_logbuffer_log_repeat(int iters) {
+    LogBuffer *buf = benchmarkLogBuffer();
+    char msg[100];
+    fillMessage(msg, sizeof(msg));
+    log_time realtime(CLOCK_REALTIME);
+
+    StartBenchmarkTiming();
+
+    for (int i = 0; i < iters; ++i) {
+        buf->log(LOG_ID_MAIN, realtime, AID_SYSTEM, 1, 1, msg, sizeof(msg));
+    }
+
+    StopBenchmarkTiming();
+}
+BENCHMARK(BM_logbuffer_log_repeat);
+
+/*
+ *	Contention: the main thread logs as in BM_logbuffer_log while other
+ * threads keep the LogBuffer busy.
+ */
+static volatile bool contended;
+
+// log as fast as possible to the log id passed in arg
+static void *contendedWriter(void *arg) {
+    log_id_t id = static_cast<log_id_t>(reinterpret_cast<intptr_t>(arg));
+    char msg[100];
+    fillMessage(msg, sizeof(msg));
+    log_time realtime(CLOCK_REALTIME);
+
+    for (unsigned i = 0; contended; ++i) {
+        logbuf->log(id, realtime, AID_RADIO + (i & 7), 1 + (i & 31),
+                    1, msg, sizeof(msg));
+    }
+    return NULL;
+}
+
+// read everything that is logged, as logcat does
+static void *contendedReader(void *arg) {
+    SocketClient *client = reinterpret_cast<SocketClient *>(arg);
+    log_time start(LogTimeEntry::EPOCH);
+
+    while (contended) {
+        start = logbuf->flushTo(client, start, true, -1);
+        if (start == LogBufferElement::FLUSH_ERROR) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+// the far end of the reader's socket, discard what it is sent
+static void *contendedDrain(void *arg) {
+    int fd = static_cast<int>(reinterpret_cast<intptr_t>(arg));
+    log_msg log_msg;
+
+    while (recv(fd, &log_msg, sizeof(log_msg), 0) > 0) {
+        ;
+    }
+    return NULL;
+}
+
+static void BM_logbuffer_log_contended(int iters, bool writers, bool reader) {
+    LogBuffer *buf = benchmarkLogBuffer();
+    char msg[100];
+    fillMessage(msg, sizeof(msg));
+    log_time realtime(CLOCK_REALTIME);
+
+    static const log_id_t others[] = { LOG_ID_RADIO, LOG_ID_SYSTEM, LOG_ID_CRASH };
+    static const size_t num_others = sizeof(others) / sizeof(others[0]);
+    pthread_t threads[num_others + 2];
+    size_t num_threads = 0;
+    int sv[2] = { -1, -1 };
+    SocketClient *client = NULL;
+
+    contended = true;
+
+    if (writers) {
+        for (size_t i = 0; i < num_others; ++i) {
+            void *arg = reinterpret_cast<void *>(static_cast<intptr_t>(others[i]));
+            if (!pthread_create(&threads[num_threads], NULL,
+                                contendedWriter, arg)) {
+                ++num_threads;
+            }
+        }
+    }
+
+    if (reader && !socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv)) {
+        client = new SocketClient(sv[0], false);
+        void *arg = reinterpret_cast<void *>(static_cast<intptr_t>(sv[1]));
+        if (!pthread_create(&threads[num_threads], NULL, contendedDrain, arg)) {
+            ++num_threads;
+        }
+        if (!pthread_create(&threads[num_threads], NULL,
+                            contendedReader, client)) {
+            ++num_threads;
+        }
+    }
+
+    StartBenchmarkTiming();
+
+    for (int i = 0; i < iters; ++i) {
+        buf->log(LOG_ID_MAIN, realtime, AID_SYSTEM + (i & 7), 1 + (i & 31),
+                 1, msg, sizeof(msg));
+    }
+
+    StopBenchmarkTiming();
+
+    contended = false;
+    if (sv[0] >= 0) {
+        // wakes the drain thread once the reader has let go
+        shutdown(sv[0], SHUT_RDWR);
+    }
+    while (num_threads) {
+        pthread_join(threads[--num_threads], NULL);
+    }
+    if (sv[0] >= 0) {
+        client->decRef();
+        close(sv[0]);
+        close(sv[1]);
+    }
+}
+
+// Writers to other log ids
+static void BM_logbuffer_log_writers(int iters) {
+    BM_logbuffer_log_contended(iters, true, false);
+}
+BENCHMARK(BM_logbuffer_log_writers);
+
+// A reader following all log ids
+static void BM_logbuffer_log_reader(int iters) {
+    BM_logbuffer_log_contended(iters, false, true);
+}
+BENCHMARK(BM_logbuffer_log_reader);
+
+// Both of the above
+static void BM_logbuffer_log_writers_reader(int iters) {
+    BM_logbuffer_log_contended(iters, true, true);
+}
+BENCHMARK(BM_logbuffer_log_writers_reader);
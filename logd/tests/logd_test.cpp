@@ -19,9 +19,11 @@
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <gtest/gtest.h>
 
+#include "cutils/properties.h"
 #include "cutils/sockets.h"
 #include "log/log.h"
 #include "log/logger.h"
@@ -699,3 +701,215 @@ TEST(logd, benchmark) {
     // 50% threshold for SPAM filter (<20% typical, lots of engineering margin)
     ASSERT_GT(totalSize, nowSpamSize * 2);
 }
+
+// Measure how fast logd delivers the content of all of its buffers to a
+// "logcat -d" style reader. Entries are sent in batches, with a lock round
+// trip and a single sendmmsg per batch rather than per entry.
+TEST(logd, dump) {
+    int fd = socket_local_client("logdr",
+                                 ANDROID_SOCKET_NAMESPACE_RESERVED,
+                                 SOCK_SEQPACKET);
+    ASSERT_TRUE(fd >= 0);
+
+    struct sigaction ignore, old_sigaction;
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = caught_signal;
+    sigemptyset(&ignore.sa_mask);
+    sigaction(SIGALRM, &ignore, &old_sigaction);
+    unsigned int old_alarm = alarm(30);
+
+    log_time start(CLOCK_MONOTONIC);
+
+    static const char ask[] = "dumpAndClose lids=0,1,2,3,4";
+    ASSERT_EQ((ssize_t)sizeof(ask), write(fd, ask, sizeof(ask)));
+
+    unsigned long entries = 0;
+    unsigned long long bytes = 0;
+    log_msg msg;
+    ssize_t len;
+    while ((len = recv(fd, msg.buf, sizeof(msg), 0)) > 0) {
+        ++entries;
+        bytes += len;
+    }
+
+    log_time end(CLOCK_MONOTONIC);
+
+    alarm(old_alarm);
+    sigaction(SIGALRM, &old_sigaction, NULL);
+
+    close(fd);
+
+    ASSERT_LT(0UL, entries);
+
+    unsigned long long ns = (end - start).nsec();
+    if (!ns) {
+        ns = 1;
+    }
+    fprintf(stderr, "dump: %lu entries, %llu bytes in %llu.%06llums\n",
+            entries, bytes, ns / 1000000, ns % 1000000);
+    fprintf(stderr, "dump: %llu entries/s, %llu KB/s\n",
+            entries * 1000000000ULL / ns,
+            bytes * 1000000000ULL / ns / 1024);
+
+    // everything a full set of buffers could hold, in well under the alarm
+    EXPECT_GT(10000000000ULL, ns);
+}
+
+// Dump the main log and pass the text of each entry this process logged
+// with |tag| to |fn|, in the order logd sends them.
+static void dump_tagged(const char *tag,
+                        void (*fn)(const char *text, void *arg), void *arg) {
+    int fd = socket_local_client("logdr",
+                                 ANDROID_SOCKET_NAMESPACE_RESERVED,
+                                 SOCK_SEQPACKET);
+    ASSERT_TRUE(fd >= 0);
+
+    struct sigaction ignore, old_sigaction;
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = caught_signal;
+    sigemptyset(&ignore.sa_mask);
+    sigaction(SIGALRM, &ignore, &old_sigaction);
+    unsigned int old_alarm = alarm(30);
+
+    static const char ask[] = "dumpAndClose lids=0";
+    EXPECT_EQ((ssize_t)sizeof(ask), write(fd, ask, sizeof(ask)));
+
+    size_t tagLen = strlen(tag);
+    pid_t pid = getpid();
+    log_msg msg;
+    ssize_t len;
+    while ((len = recv(fd, msg.buf, sizeof(msg) - 1, 0)) > 0) {
+        msg.buf[len] = '\0';
+        // <prio> <tag> '\0' <text> '\0'
+        const char *payload = msg.msg();
+        if ((msg.entry.pid != pid)
+                || (msg.entry.len < (tagLen + 3))
+                || strcmp(payload + 1, tag)) {
+            continue;
+        }
+        (*fn)(payload + tagLen + 2, arg);
+    }
+
+    alarm(old_alarm);
+    sigaction(SIGALRM, &old_sigaction, NULL);
+
+    close(fd);
+}
+
+static bool dedup_enabled() {
+    char property[PROPERTY_VALUE_MAX];
+
+    // as logd reads them when it starts
+    bool dedup = false;
+    property_get("ro.logd.dedup", property, "");
+    if (!strcasecmp(property, "true")) {
+        dedup = true;
+    }
+    property_get("persist.logd.dedup", property, "");
+    if (!strcasecmp(property, "true")) {
+        dedup = true;
+    } else if (!strcasecmp(property, "false")) {
+        dedup = false;
+    }
+    return dedup;
+}
+
+struct repeat_run {
+    const char *text;
+    unsigned int copies;      // of text
+    unsigned int notes;       // "identical N lines"
+    unsigned long identical;  // N of the last note
+    bool ordered;             // no note first or last
+    bool last_copy;           // the latest entry is a copy of text
+};
+
+static void collect_repeat(const char *text, void *arg) {
+    repeat_run *r = reinterpret_cast<repeat_run *>(arg);
+    unsigned long identical;
+
+    if (!strcmp(text, r->text)) {
+        ++r->copies;
+        r->last_copy = true;
+    } else if (sscanf(text, "identical %lu lines", &identical) == 1) {
+        if (!r->copies || !r->last_copy) {
+            r->ordered = false;
+        }
+        ++r->notes;
+        r->identical = identical;
+        r->last_copy = false;
+    }
+}
+
+// logd may collapse identical lines (persist.logd.dedup). The run is then
+// the first copy, a note "identical N lines" and the last copy, and that
+// last copy is stored on its own in good time, not only once the client
+// logs something else. Without dedup every copy is stored.
+TEST(logd, repeat) {
+    static const unsigned int copies = 5;
+    char tag[32];
+    char text[64];
+    snprintf(tag, sizeof(tag), "logd.repeat.%d", getpid());
+    snprintf(text, sizeof(text), "repeat %llu",
+             (unsigned long long)log_time(CLOCK_MONOTONIC).nsec());
+
+    for (unsigned int i = 0; i < copies; ++i) {
+        ASSERT_LT(0, __android_log_buf_write(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                             tag, text));
+    }
+
+    // a withheld copy is reported within 2s
+    sleep(3);
+
+    repeat_run r = { text, 0, 0, 0, true, false };
+    dump_tagged(tag, collect_repeat, &r);
+
+    if (!dedup_enabled()) {
+        fprintf(stderr, "WARNING: persist.logd.dedup is off, "
+                        "only checking that nothing is collapsed\n");
+        EXPECT_EQ(copies, r.copies);
+        EXPECT_EQ(0U, r.notes);
+        return;
+    }
+
+    EXPECT_EQ(2U, r.copies);
+    EXPECT_EQ(1U, r.notes);
+    EXPECT_EQ(copies - 2, r.identical);
+    EXPECT_TRUE(r.ordered);
+    EXPECT_TRUE(r.last_copy);
+}
+
+struct dump_order {
+    unsigned int next;
+    bool ordered;
+};
+
+static void check_order(const char *text, void *arg) {
+    dump_order *o = reinterpret_cast<dump_order *>(arg);
+    if (strtoul(text, NULL, 10) != o->next) {
+        o->ordered = false;
+    }
+    ++o->next;
+}
+
+// Entries are sent to readers in batches, which must neither lose nor
+// reorder any of them.
+TEST(logd, dump_order) {
+    static const unsigned int count = 500;
+    char tag[32];
+    snprintf(tag, sizeof(tag), "logd.dump_order.%d", getpid());
+
+    for (unsigned int i = 0; i < count; ++i) {
+        char text[16];
+        snprintf(text, sizeof(text), "%u", i);
+        ASSERT_LT(0, __android_log_buf_write(LOG_ID_MAIN, ANDROID_LOG_INFO,
+                                             tag, text));
+    }
+
+    // let liblog and logd catch up
+    sleep(1);
+
+    dump_order o = { 0, true };
+    dump_tagged(tag, check_order, &o);
+    EXPECT_EQ(count, o.next);
+    EXPECT_TRUE(o.ordered);
+}
@@ -0,0 +1,79 @@
+#!/bin/bash
+#
+# Measures concurrent stat/open throughput through sdcard for a range of
+# handler thread counts.  Run as root on a host (or device) with /dev/fuse:
+#
+#   bench_lookup.sh <sdcard binary> <source dir> <mount point> [threads...]
+#
+# The source directory is filled with $FILES small files on the first run.
+# $PROCS processes then each stat, open and read every file $ROUNDS times
+# through a fresh mount, once per thread count (default: 1 2 4 8).  The
+# daemon runs as $SDCARD_UID:$SDCARD_GID (default media_rw).
+
+set -e
+
+if [ $# -lt 3 ]; then
+    echo "usage: $0 <sdcard binary> <source dir> <mount point> [threads...]" >&2
+    exit 1
+fi
+
+SDCARD=$1
+SOURCE=$2
+MOUNT=$3
+shift 3
+THREADS=${*:-1 2 4 8}
+FILES=${FILES:-2000}
+PROCS=${PROCS:-4}
+ROUNDS=${ROUNDS:-3}
+SDCARD_UID=${SDCARD_UID:-1023}
+SDCARD_GID=${SDCARD_GID:-1023}
+
+mkdir -p "$SOURCE/bench" "$MOUNT"
+if [ ! -e "$SOURCE/bench/f$((FILES - 1))" ]; then
+    for i in $(seq 0 $((FILES - 1))); do
+        echo $i > "$SOURCE/bench/f$i"
+    done
+fi
+
+# Only shell builtins in the loop, so that the time goes on stat and open
+# rather than on forking.
+worker() {
+    local round i line
+    for round in $(seq $ROUNDS); do
+        for i in $(seq 0 $((FILES - 1))); do
+            [ -f "$MOUNT/bench/f$i" ]
+            read -r line < "$MOUNT/bench/f$i"
+        done
+    done
+}
+
+echo "cpus: $(getconf _NPROCESSORS_ONLN) procs: $PROCS files: $FILES rounds: $ROUNDS"
+for t in $THREADS; do
+    "$SDCARD" -u $SDCARD_UID -g $SDCARD_GID -t $t "$SOURCE" "$MOUNT" &
+    pid=$!
+    for i in $(seq 50); do
+        mountpoint -q "$MOUNT" && break
+        sleep 0.1
+    done
+    if ! mountpoint -q "$MOUNT"; then
+        echo "$SDCARD did not mount $MOUNT" >&2
+        exit 1
+    fi
+
+    start=$(date +%s%N)
+    pids=
+    for p in $(seq 0 $((PROCS - 1))); do
+        worker &
+        pids="$pids $!"
+    done
+    wait $pids
+    end=$(date +%s%N)
+
+    kill $pid 2> /dev/null || true
+    wait $pid 2> /dev/null || true
+    umount "$MOUNT"
+
+    ops=$((PROCS * ROUNDS * FILES * 2))
+    ms=$(((end - start) / 1000000))
+    echo "threads $t: $ops ops in $ms ms, $((ops * 1000 / (ms + 1))) ops/s"
+done
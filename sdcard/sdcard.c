@@ -34,6 +34,7 @@
 #include <sys/statfs.h>
 #include <sys/time.h>
 #include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <cutils/fs.h>
@@ -103,24 +104,37 @@
 
 #define FUSE_UNKNOWN_INO 0xffffffff
 
-/* Maximum number of bytes to write in one request. */
+/* Default maximum number of bytes to write in one request, see -W. */
 #define MAX_WRITE (256 * 1024)
 
-/* Maximum number of bytes to read in one request. */
+/* Default maximum number of bytes to read in one request, see -R. */
 #define MAX_READ (128 * 1024)
 
-/* Largest possible request.
- * The request size is bounded by the maximum size of a FUSE_WRITE request because it has
- * the largest possible data payload. */
-#define MAX_REQUEST_SIZE (sizeof(struct fuse_in_header) + sizeof(struct fuse_write_in) + MAX_WRITE)
+/* Largest either can be raised to, as the kernel won't put more pages
+ * than this in one request. */
+#define MAX_IO_SIZE (256 * PAGESIZE)
 
-/* Default number of threads. */
+/* Default number of threads: one per CPU, within these bounds. */
 #define DEFAULT_NUM_THREADS 2
+#define MAX_DEFAULT_NUM_THREADS 8
 
 /* Pseudo-error constant used to indicate that no fuse status is needed
  * or that a reply has already been written. */
 #define NO_STATUS 1
 
+/* Directories with more cached children than this get a hash index. */
+#define CHILD_INDEX_THRESHOLD 32
+
+/* Number of names remembered as having no match in their directory, even
+ * ignoring case, and the longest name that is remembered. */
+#define NEG_CACHE_SIZE 256 /* power of two */
+#define NEG_CACHE_NAME_MAX 64
+
+/* Default number of seconds the kernel may cache entries and attributes,
+ * see -e and -a. Attributes are cached here for as long as well. */
+#define DEFAULT_ENTRY_TIMEOUT 10
+#define DEFAULT_ATTR_TIMEOUT 10
+
 /* Path to system-provided mapping of package name to appIds */
 static const char* const kPackagesListFile = "/data/system/packages.list";
 
@@ -158,10 +172,19 @@ typedef enum {
 
 struct handle {
     int fd;
+    struct node* node;
 };
 
 struct dirhandle {
     DIR *d;
+
+    /* Number of entries already returned. The FUSE offset of an entry is
+     * its position plus one, so the kernel resumes by asking for the
+     * offset of the last entry it took. */
+    __u64 pos;
+
+    /* Entry at |pos|, read from |d| but left out of the last reply. */
+    struct dirent *next;
 };
 
 struct node {
@@ -185,6 +208,13 @@ struct node {
     struct node *child;         /* first contained file by this dir */
     struct node *parent;        /* containing directory */
 
+    __u32 child_count;
+    struct child_index *index;  /* of children, once there are enough */
+    struct node *hash_next;     /* chains in the parent's index */
+    struct node *fold_hash_next;
+    __u32 hash;                 /* of name, as added to the parent */
+    __u32 fold_hash;            /* of name ignoring case */
+
     size_t namelen;
     char *name;
     /* If non-null, this is the real name of the file in the underlying storage.
@@ -198,6 +228,36 @@ struct node {
      * position. Used to support things like OBB. */
     char* graft_path;
     size_t graft_pathlen;
+
+    /* Attributes last read from the underlying file. They are good until
+     * |attr_expires| as long as |attr_gen| hasn't moved on from
+     * |attr_cached_gen|, which it does whenever the file is changed through
+     * us or the package list is reloaded. Guarded by |attr_lock|. */
+    struct fuse_attr attr;
+    __u64 attr_expires;
+    __u32 attr_gen;
+    __u32 attr_cached_gen;
+};
+
+/* Hash table of the children of a directory, chained through the child
+ * nodes themselves. Exact names serve LOOKUP; names folded to lower case
+ * let find_file_within() find a cached child that differs only by case
+ * without scanning the directory. */
+struct child_index {
+    __u32 mask;                 /* number of buckets - 1 */
+    struct node **buckets;
+    struct node **fold_buckets;
+};
+
+/* A name that no entry of a directory matches even ignoring case, good for
+ * as long as the directory's mtime stays the same. */
+struct neg_entry {
+    __u64 nid;
+    __u64 gen;
+    __u32 fold_hash;
+    time_t mtime;
+    long mtime_nsec;
+    char name[NEG_CACHE_NAME_MAX];
 };
 
 static int str_hash(void *key) {
@@ -219,7 +279,11 @@ static bool int_equals(void *keyA, void *keyB) {
 
 /* Global data structure shared by all fuse handlers. */
 struct fuse {
-    pthread_mutex_t lock;
+    /* Guards the node tree and the package maps. Functions named *_locked
+     * expect it held; looking nodes up, building their paths and taking
+     * references needs it shared, anything else that changes nodes or
+     * the maps needs it exclusive. */
+    pthread_rwlock_t lock;
 
     __u64 next_generation;
     int fd;
@@ -244,12 +308,38 @@ struct fuse {
      * inode numbers into 32 bit values on 64 bit kernels (see fuse_squash_ino
      * in fs/fuse/inode.c).
      *
-     * Accesses must be guarded by |lock|.
+     * Accesses must be guarded by |lock|, held exclusively.
      */
     __u32 inode_ctr;
 
+    /* Counts nodes added to a parent, so that a lookup which let go of
+     * |lock| can tell whether it may have missed one. Accesses must be
+     * guarded by |lock|, held exclusively. */
+    __u32 child_ctr;
+
+    /* Maximum READ and WRITE sizes agreed with the kernel. The largest
+     * possible request is bounded by the maximum size of a FUSE_WRITE
+     * request because it has the largest possible data payload. */
+    __u32 max_read;
+    __u32 max_write;
+    size_t max_request_size;
+
+    /* Seconds the kernel, and we, may cache entries and attributes. */
+    __u32 entry_timeout;
+    __u32 attr_timeout;
+
+    /* Guards the attribute cache fields of all nodes. Never held across a
+     * call that takes |lock|. */
+    pthread_mutex_t attr_lock;
+
     Hashmap* package_to_appid;
     Hashmap* appid_with_rw;
+
+    /* Names that find_file_within() searched for without finding a match,
+     * so that probing for missing files doesn't scan large directories
+     * over and over. Guarded by |neg_lock| alone. */
+    pthread_mutex_t neg_lock;
+    struct neg_entry neg_cache[NEG_CACHE_SIZE];
 };
 
 /* Private data used by a single fuse handler. */
@@ -257,12 +347,16 @@ struct fuse_handler {
     struct fuse* fuse;
     int token;
 
+    /* Pipe that READ and WRITE data is spliced through on its way between
+     * /dev/fuse and the file, or -1s if the kernel won't splice. |pipe_len|
+     * is how much of a WRITE payload is still waiting in it. */
+    int pipe[2];
+    size_t pipe_len;
+
     /* To save memory, we never use the contents of the request buffer and the read
      * buffer at the same time.  This allows us to share the underlying storage. */
-    union {
-        __u8 request_buffer[MAX_REQUEST_SIZE];
-        __u8 read_buffer[MAX_READ + PAGESIZE];
-    };
+    __u8* request_buffer;
+    __u8* read_buffer;
 };
 
 static inline void *id_to_ptr(__u64 nid)
@@ -275,9 +369,12 @@ static inline __u64 ptr_to_id(void *ptr)
     return (__u64) (uintptr_t) ptr;
 }
 
+/* Safe with the lock held shared: references are only ever dropped with
+ * it held exclusively, so the node can't go away under us, but other
+ * readers may be taking references at the same time. */
 static void acquire_node_locked(struct node* node)
 {
-    node->refcount++;
+    __sync_fetch_and_add(&node->refcount, 1);
     TRACE("ACQUIRE %p (%s) rc=%d\n", node, node->name, node->refcount);
 }
 
@@ -296,6 +393,7 @@ static void release_node_locked(struct node* node)
             memset(node->name, 0xef, node->namelen);
             free(node->name);
             free(node->actual_name);
+            free(node->index);
             memset(node, 0xfc, sizeof(*node));
             free(node);
         }
@@ -304,16 +402,99 @@ static void release_node_locked(struct node* node)
     }
 }
 
-static void add_node_to_parent_locked(struct node *node, struct node *parent) {
+static __u32 name_hash(const char* name, bool fold)
+{
+    const unsigned char* cp;
+    __u32 hash = 5381;
+
+    for (cp = (const unsigned char*) name; *cp; cp++) {
+        hash = hash * 33 + (fold ? tolower(*cp) : *cp);
+    }
+    return hash;
+}
+
+static void index_child_locked(struct child_index* index, struct node* child)
+{
+    struct node** bucket = &index->buckets[child->hash & index->mask];
+    child->hash_next = *bucket;
+    *bucket = child;
+
+    bucket = &index->fold_buckets[child->fold_hash & index->mask];
+    child->fold_hash_next = *bucket;
+    *bucket = child;
+}
+
+static void unindex_child_locked(struct child_index* index, struct node* child)
+{
+    struct node** np;
+
+    for (np = &index->buckets[child->hash & index->mask]; *np != child;
+            np = &(*np)->hash_next);
+    *np = child->hash_next;
+
+    for (np = &index->fold_buckets[child->fold_hash & index->mask]; *np != child;
+            np = &(*np)->fold_hash_next);
+    *np = child->fold_hash_next;
+}
+
+/* Replaces the index of a directory with one sized for its current
+ * children. On failure the old index, if any, is left in place. */
+static bool build_child_index_locked(struct node* node)
+{
+    struct child_index* index;
+    struct node* child;
+    __u32 size = CHILD_INDEX_THRESHOLD;
+
+    while (size < node->child_count) {
+        size *= 2;
+    }
+    index = calloc(1, sizeof(*index) + 2 * size * sizeof(struct node*));
+    if (!index) {
+        return false;
+    }
+    index->mask = size - 1;
+    index->buckets = (struct node**) (index + 1);
+    index->fold_buckets = index->buckets + size;
+    for (child = node->child; child; child = child->next) {
+        index_child_locked(index, child);
+    }
+    free(node->index);
+    node->index = index;
+    return true;
+}
+
+static void add_node_to_parent_locked(struct fuse* fuse,
+        struct node *node, struct node *parent) {
+    fuse->child_ctr++;
     node->parent = parent;
     node->next = parent->child;
     parent->child = node;
     acquire_node_locked(parent);
+
+    node->hash = name_hash(node->name, false);
+    node->fold_hash = name_hash(node->name, true);
+    parent->child_count++;
+    if (parent->child_count > CHILD_INDEX_THRESHOLD && (!parent->index
+            || parent->child_count > 2 * (parent->index->mask + 1))) {
+        if (build_child_index_locked(parent)) {
+            return;
+        }
+    }
+    if (parent->index) {
+        index_child_locked(parent->index, node);
+    }
 }
 
 static void remove_node_from_parent_locked(struct node* node)
 {
     if (node->parent) {
+        if (node->parent->index) {
+            unindex_child_locked(node->parent->index, node);
+        }
+        if (--node->parent->child_count < CHILD_INDEX_THRESHOLD / 2) {
+            free(node->parent->index);
+            node->parent->index = NULL;
+        }
         if (node->parent->child == node) {
             node->parent->child = node->parent->child->next;
         } else {
@@ -365,6 +546,126 @@ static ssize_t get_node_path_locked(struct node* node, char* buf, size_t bufsize
     return pathlen + namelen;
 }
 
+/* Copies the underlying name of a cached child of |node| that matches
+ * |name| ignoring case over |actual|, which holds a copy of |name|. */
+static bool find_cached_child_name_locked(struct node* node, const char* name,
+        __u32 fold_hash, char* actual)
+{
+    struct node* child;
+
+    if (node->index) {
+        child = node->index->fold_buckets[fold_hash & node->index->mask];
+    } else {
+        child = node->child;
+    }
+    for (; child; child = node->index ? child->fold_hash_next : child->next) {
+        if (!strcasecmp(name, child->name)) {
+            memcpy(actual, child->actual_name ? child->actual_name : child->name,
+                    child->namelen);
+            return true;
+        }
+    }
+    return false;
+}
+
+static struct neg_entry* neg_cache_slot(struct fuse* fuse, const struct node* parent,
+        __u32 fold_hash)
+{
+    return &fuse->neg_cache[(fold_hash + (__u32) parent->gen * 31) & (NEG_CACHE_SIZE - 1)];
+}
+
+static bool neg_cache_lookup(struct fuse* fuse, const struct node* parent,
+        const char* name, __u32 fold_hash, const struct stat* dir_stat)
+{
+    struct neg_entry* entry = neg_cache_slot(fuse, parent, fold_hash);
+    bool found;
+
+    pthread_mutex_lock(&fuse->neg_lock);
+    found = entry->nid == parent->nid && entry->gen == parent->gen
+            && entry->fold_hash == fold_hash
+            && entry->mtime == dir_stat->st_mtime
+            && entry->mtime_nsec == (long) dir_stat->st_mtime_nsec
+            && !strcasecmp(entry->name, name);
+    pthread_mutex_unlock(&fuse->neg_lock);
+    return found;
+}
+
+static void neg_cache_insert(struct fuse* fuse, const struct node* parent,
+        const char* name, __u32 fold_hash, const struct stat* dir_stat)
+{
+    struct neg_entry* entry = neg_cache_slot(fuse, parent, fold_hash);
+
+    if (strlen(name) >= sizeof(entry->name)) {
+        return;
+    }
+    pthread_mutex_lock(&fuse->neg_lock);
+    entry->nid = parent->nid;
+    entry->gen = parent->gen;
+    entry->fold_hash = fold_hash;
+    entry->mtime = dir_stat->st_mtime;
+    entry->mtime_nsec = dir_stat->st_mtime_nsec;
+    strcpy(entry->name, name);
+    pthread_mutex_unlock(&fuse->neg_lock);
+}
+
+/* Looks for an entry of |path| that matches |name| ignoring case, first
+ * among the cached children of |parent|, then among names already known
+ * to be missing, and only then by reading the directory. |actual| holds a
+ * copy of |name| and is overwritten with the entry's name if one is found.
+ * Called without |lock| held; |parent| is pinned by the request. */
+static void search_file_within(struct fuse* fuse, struct node* parent,
+        const char* path, const char* name, char* buf, char* actual)
+{
+    size_t namelen = strlen(name);
+    __u32 fold_hash = name_hash(name, true);
+    struct dirent* entry;
+    struct stat dir_stat;
+    bool have_stat;
+    time_t now;
+    DIR* dir;
+
+    pthread_rwlock_rdlock(&fuse->lock);
+    if (find_cached_child_name_locked(parent, name, fold_hash, actual)) {
+        pthread_rwlock_unlock(&fuse->lock);
+        if (!access(buf, F_OK)) {
+            return;
+        }
+        /* stale, the file was renamed or removed behind our back */
+        memcpy(actual, name, namelen);
+    } else {
+        pthread_rwlock_unlock(&fuse->lock);
+    }
+
+    /* Anything created in the directory after this stat moves its mtime
+     * on, which is what keeps a remembered miss honest. */
+    now = time(NULL);
+    have_stat = !stat(path, &dir_stat);
+    if (have_stat && neg_cache_lookup(fuse, parent, name, fold_hash, &dir_stat)) {
+        return;
+    }
+
+    dir = opendir(path);
+    if (!dir) {
+        ERROR("opendir %s failed: %s\n", path, strerror(errno));
+        return;
+    }
+    while ((entry = readdir(dir))) {
+        if (!strcasecmp(entry->d_name, name)) {
+            /* we have a match - replace the name, don't need to copy the null again */
+            memcpy(actual, entry->d_name, namelen);
+            closedir(dir);
+            return;
+        }
+    }
+    closedir(dir);
+
+    /* A directory changed within the last second may change again without
+     * its mtime moving, given the granularity of file system timestamps. */
+    if (have_stat && dir_stat.st_mtime < now - 1) {
+        neg_cache_insert(fuse, parent, name, fold_hash, &dir_stat);
+    }
+}
+
 /* Finds the absolute path of a file within a given directory.
  * Performs a case-insensitive search for the file and sets the buffer to the path
  * of the first matching file.  If 'search' is zero or if no match is found, sets
@@ -373,8 +674,8 @@ static ssize_t get_node_path_locked(struct node* node, char* buf, size_t bufsize
  * Populates 'buf' with the path and returns the actual name (within 'buf') on success,
  * or returns NULL if the path is too long for the provided buffer.
  */
-static char* find_file_within(const char* path, const char* name,
-        char* buf, size_t bufsize, int search)
+static char* find_file_within(struct fuse* fuse, struct node* parent,
+        const char* path, const char* name, char* buf, size_t bufsize, int search)
 {
     size_t pathlen = strlen(path);
     size_t namelen = strlen(name);
@@ -391,20 +692,7 @@ static char* find_file_within(const char* path, const char* name,
     memcpy(actual, name, namelen + 1);
 
     if (search && access(buf, F_OK)) {
-        struct dirent* entry;
-        DIR* dir = opendir(path);
-        if (!dir) {
-            ERROR("opendir %s failed: %s\n", path, strerror(errno));
-            return actual;
-        }
-        while ((entry = readdir(dir))) {
-            if (!strcasecmp(entry->d_name, name)) {
-                /* we have a match - replace the name, don't need to copy the null again */
-                memcpy(actual, entry->d_name, namelen);
-                break;
-            }
-        }
-        closedir(dir);
+        search_file_within(fuse, parent, path, name, buf, actual);
     }
     return actual;
 }
@@ -537,6 +825,21 @@ static void derive_permissions_locked(struct fuse* fuse, struct node *parent,
     }
 }
 
+/* Derives again everything below |parent|, after the package list they
+ * were derived from has changed. Their cached attributes carry the old
+ * owner and mode, so they go too. */
+static void derive_permissions_recursive_locked(struct fuse* fuse, struct node *parent) {
+    struct node *node;
+
+    for (node = parent->child; node; node = node->next) {
+        derive_permissions_locked(fuse, parent, node);
+        node->attr_gen++;
+        if (node->child) {
+            derive_permissions_recursive_locked(fuse, node);
+        }
+    }
+}
+
 /* Return if the calling UID holds sdcard_rw. */
 static bool get_caller_has_rw_locked(struct fuse* fuse, const struct fuse_in_header *hdr) {
     /* No additional permissions enforcement */
@@ -632,7 +935,7 @@ struct node *create_node_locked(struct fuse* fuse,
 
     derive_permissions_locked(fuse, parent, node);
     acquire_node_locked(node);
-    add_node_to_parent_locked(node, parent);
+    add_node_to_parent_locked(fuse, node, parent);
     return node;
 }
 
@@ -698,6 +1001,16 @@ static struct node* lookup_node_and_path_by_id_locked(struct fuse* fuse, __u64 n
 
 static struct node *lookup_child_by_name_locked(struct node *node, const char *name)
 {
+    if (node->index) {
+        __u32 hash = name_hash(name, false);
+        for (node = node->index->buckets[hash & node->index->mask]; node;
+                node = node->hash_next) {
+            if (node->hash == hash && !strcmp(name, node->name)) {
+                return node;
+            }
+        }
+        return 0;
+    }
     for (node = node->child; node; node = node->next) {
         /* use exact string comparison, nodes that differ by case
          * must be considered distinct even if they refer to the same
@@ -710,22 +1023,50 @@ static struct node *lookup_child_by_name_locked(struct node *node, const char *n
     return 0;
 }
 
-static struct node* acquire_or_create_child_locked(
-        struct fuse* fuse, struct node* parent,
-        const char* name, const char* actual_name)
+/* Needs the lock held only shared, so that the common case of finding a
+ * node that already exists doesn't hold up other lookups. */
+static struct node* acquire_child_locked(struct node* parent, const char* name)
 {
     struct node* child = lookup_child_by_name_locked(parent, name);
     if (child) {
         acquire_node_locked(child);
-    } else {
+    }
+    return child;
+}
+
+/* Looks for the child with |lock| held shared and only takes it exclusively
+ * to create a child that isn't there yet. Returns with |lock| held either
+ * way; the caller unlocks it. */
+static struct node* acquire_or_create_child(
+        struct fuse* fuse, struct node* parent,
+        const char* name, const char* actual_name)
+{
+    struct node* child;
+    __u32 child_ctr;
+
+    pthread_rwlock_rdlock(&fuse->lock);
+    child = acquire_child_locked(parent, name);
+    if (child) {
+        return child;
+    }
+    child_ctr = fuse->child_ctr;
+    pthread_rwlock_unlock(&fuse->lock);
+
+    pthread_rwlock_wrlock(&fuse->lock);
+    if (fuse->child_ctr != child_ctr) {
+        /* Someone else may have added it in the meantime. */
+        child = acquire_child_locked(parent, name);
+    }
+    if (!child) {
         child = create_node_locked(fuse, parent, name, actual_name);
     }
     return child;
 }
 
 static void fuse_init(struct fuse *fuse, int fd, const char *source_path,
-        gid_t write_gid, derive_t derive, bool split_perms) {
-    pthread_mutex_init(&fuse->lock, NULL);
+        gid_t write_gid, derive_t derive, bool split_perms,
+        __u32 max_read, __u32 max_write, __u32 entry_timeout, __u32 attr_timeout) {
+    pthread_rwlock_init(&fuse->lock, NULL);
 
     fuse->fd = fd;
     fuse->next_generation = 0;
@@ -733,6 +1074,19 @@ static void fuse_init(struct fuse *fuse, int fd, const char *source_path,
     fuse->split_perms = split_perms;
     fuse->write_gid = write_gid;
     fuse->inode_ctr = 1;
+    fuse->child_ctr = 0;
+
+    fuse->max_read = max_read;
+    fuse->max_write = max_write;
+    fuse->max_request_size = sizeof(struct fuse_in_header)
+            + sizeof(struct fuse_write_in) + max_write;
+
+    fuse->entry_timeout = entry_timeout;
+    fuse->attr_timeout = attr_timeout;
+    pthread_mutex_init(&fuse->attr_lock, NULL);
+
+    pthread_mutex_init(&fuse->neg_lock, NULL);
+    memset(fuse->neg_cache, 0, sizeof(fuse->neg_cache));
 
     memset(&fuse->root, 0, sizeof(fuse->root));
     fuse->root.nid = FUSE_ROOT_ID; /* 1 */
@@ -818,35 +1172,99 @@ static int fuse_reply_entry(struct fuse* fuse, __u64 unique,
         return -errno;
     }
 
-    pthread_mutex_lock(&fuse->lock);
-    node = acquire_or_create_child_locked(fuse, parent, name, actual_name);
+    node = acquire_or_create_child(fuse, parent, name, actual_name);
     if (!node) {
-        pthread_mutex_unlock(&fuse->lock);
+        pthread_rwlock_unlock(&fuse->lock);
         return -ENOMEM;
     }
     memset(&out, 0, sizeof(out));
     attr_from_stat(&out.attr, &s, node);
-    out.attr_valid = 10;
-    out.entry_valid = 10;
+    out.attr_valid = fuse->attr_timeout;
+    out.entry_valid = fuse->entry_timeout;
     out.nodeid = node->nid;
     out.generation = node->gen;
-    pthread_mutex_unlock(&fuse->lock);
+    pthread_rwlock_unlock(&fuse->lock);
     fuse_reply(fuse, unique, &out, sizeof(out));
     return NO_STATUS;
 }
 
-static int fuse_reply_attr(struct fuse* fuse, __u64 unique, const struct node* node,
-        const char* path)
+static __u64 monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (__u64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Copies out the cached attributes of |node|, if it has any still good,
+ * along with how many nanoseconds they have left. */
+static bool get_cached_attr(struct fuse* fuse, struct node* node, struct fuse_attr* attr,
+        __u64* remaining)
+{
+    __u64 now = monotonic_ns();
+    bool found;
+
+    pthread_mutex_lock(&fuse->attr_lock);
+    found = node->attr_expires > now && node->attr_cached_gen == node->attr_gen;
+    if (found) {
+        *attr = node->attr;
+        *remaining = node->attr_expires - now;
+    }
+    pthread_mutex_unlock(&fuse->attr_lock);
+    return found;
+}
+
+/* To be taken before the attributes are read from the file, so that a
+ * change that lands while they are being read keeps them out of the cache. */
+static __u32 get_attr_gen(struct fuse* fuse, struct node* node)
+{
+    __u32 gen;
+
+    pthread_mutex_lock(&fuse->attr_lock);
+    gen = node->attr_gen;
+    pthread_mutex_unlock(&fuse->attr_lock);
+    return gen;
+}
+
+static void cache_attr(struct fuse* fuse, struct node* node, __u32 gen,
+        const struct fuse_attr* attr)
+{
+    __u64 expires = monotonic_ns() + (__u64) fuse->attr_timeout * 1000000000;
+
+    pthread_mutex_lock(&fuse->attr_lock);
+    if (node->attr_gen == gen) {
+        node->attr = *attr;
+        node->attr_expires = expires;
+        node->attr_cached_gen = gen;
+    }
+    pthread_mutex_unlock(&fuse->attr_lock);
+}
+
+/* Called after changing the underlying file of |node|. */
+static void invalidate_attr(struct fuse* fuse, struct node* node)
+{
+    pthread_mutex_lock(&fuse->attr_lock);
+    node->attr_gen++;
+    pthread_mutex_unlock(&fuse->attr_lock);
+}
+
+/* Replies with the attributes of |node|, read through |fd| if it isn't -1
+ * and from |path| otherwise, and caches them. */
+static int fuse_reply_attr(struct fuse* fuse, __u64 unique, struct node* node,
+        const char* path, int fd)
 {
     struct fuse_attr_out out;
     struct stat s;
+    __u32 gen = get_attr_gen(fuse, node);
 
-    if (lstat(path, &s) < 0) {
+    if ((fd >= 0 ? fstat(fd, &s) : lstat(path, &s)) < 0) {
         return -errno;
     }
     memset(&out, 0, sizeof(out));
     attr_from_stat(&out.attr, &s, node);
-    out.attr_valid = 10;
+    out.attr_valid = fuse->attr_timeout;
+    if (fuse->attr_timeout) {
+        cache_attr(fuse, node, gen, &out.attr);
+    }
     fuse_reply(fuse, unique, &out, sizeof(out));
     return NO_STATUS;
 }
@@ -859,15 +1277,15 @@ static int handle_lookup(struct fuse* fuse, struct fuse_handler* handler,
     char child_path[PATH_MAX];
     const char* actual_name;
 
-    pthread_mutex_lock(&fuse->lock);
+    pthread_rwlock_rdlock(&fuse->lock);
     parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             parent_path, sizeof(parent_path));
     TRACE("[%d] LOOKUP %s @ %"PRIx64" (%s)\n", handler->token, name, hdr->nodeid,
         parent_node ? parent_node->name : "?");
-    pthread_mutex_unlock(&fuse->lock);
+    pthread_rwlock_unlock(&fuse->lock);
 
-    if (!parent_node || !(actual_name = find_file_within(parent_path, name,
-            child_path, sizeof(child_path), 1))) {
+    if (!parent_node || !(actual_name = find_file_within(fuse, parent_node,
+            parent_path, name, child_path, sizeof(child_path), 1))) {
         return -ENOENT;
     }
     if (!check_caller_access_to_name(fuse, hdr, parent_node, name, R_OK, false)) {
@@ -882,7 +1300,7 @@ static int handle_forget(struct fuse* fuse, struct fuse_handler* handler,
 {
     struct node* node;
 
-    pthread_mutex_lock(&fuse->lock);
+    pthread_rwlock_wrlock(&fuse->lock);
     node = lookup_node_by_id_locked(fuse, hdr->nodeid);
     TRACE("[%d] FORGET #%"PRIu64" @ %"PRIx64" (%s)\n", handler->token, req->nlookup,
             hdr->nodeid, node ? node->name : "?");
@@ -892,7 +1310,7 @@ static int handle_forget(struct fuse* fuse, struct fuse_handler* handler,
             release_node_locked(node);
         }
     }
-    pthread_mutex_unlock(&fuse->lock);
+    pthread_rwlock_unlock(&fuse->lock);
     return NO_STATUS; /* no reply */
 }
 
@@ -901,12 +1319,28 @@ static int handle_getattr(struct fuse* fuse, struct fuse_handler* handler,
 {
     struct node* node;
     char path[PATH_MAX];
+    struct fuse_attr_out out;
+    bool cached = false;
+    __u64 remaining = 0;
+    int fd = -1;
 
-    pthread_mutex_lock(&fuse->lock);
-    node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid, path, sizeof(path));
+    /* The kernel only passes a handle for regular files. */
+    if (req->getattr_flags & FUSE_GETATTR_FH) {
+        fd = ((struct handle*) id_to_ptr(req->fh))->fd;
+    }
+
+    memset(&out, 0, sizeof(out));
+    pthread_rwlock_rdlock(&fuse->lock);
+    node = lookup_node_by_id_locked(fuse, hdr->nodeid);
     TRACE("[%d] GETATTR flags=%x fh=%"PRIx64" @ %"PRIx64" (%s)\n", handler->token,
             req->getattr_flags, req->fh, hdr->nodeid, node ? node->name : "?");
-    pthread_mutex_unlock(&fuse->lock);
+    if (node) {
+        cached = get_cached_attr(fuse, node, &out.attr, &remaining);
+        if (!cached && fd < 0 && get_node_path_locked(node, path, sizeof(path)) < 0) {
+            node = NULL;
+        }
+    }
+    pthread_rwlock_unlock(&fuse->lock);
 
     if (!node) {
         return -ENOENT;
@@ -915,7 +1349,14 @@ static int handle_getattr(struct fuse* fuse, struct fuse_handler* handler,
         return -EACCES;
     }
 
-    return fuse_reply_attr(fuse, hdr->unique, node, path);
+    if (cached) {
+        /* The kernel may keep them only as long as we would have. */
+        out.attr_valid = remaining / 1000000000;
+        out.attr_valid_nsec = remaining % 1000000000;
+        fuse_reply(fuse, hdr->unique, &out, sizeof(out));
+        return NO_STATUS;
+    }
+    return fuse_reply_attr(fuse, hdr->unique, node, path, fd);
 }
 
 static int handle_setattr(struct fuse* fuse, struct fuse_handler* handler,
@@ -926,12 +1367,12 @@ static int handle_setattr(struct fuse* fuse, struct fuse_handler* handler,
     char path[PATH_MAX];
     struct timespec times[2];
 
-    pthread_mutex_lock(&fuse->lock);
+    pthread_rwlock_rdlock(&fuse->lock);
     has_rw = get_caller_has_rw_locked(fuse, hdr);
     node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid, path, sizeof(path));
     TRACE("[%d] SETATTR fh=%"PRIx64" valid=%x @ %"PRIx64" (%s)\n", handler->token,
             req->fh, req->valid, hdr->nodeid, node ? node->name : "?");
-    pthread_mutex_unlock(&fuse->lock);
+    pthread_rwlock_unlock(&fuse->lock);
 
     if (!node) {
         return -ENOENT;
@@ -975,10 +1416,12 @@ static int handle_setattr(struct fuse* fuse, struct fuse_handler* handler,
         TRACE("[%d] Calling utimensat on %s with atime %ld, mtime=%ld\n",
                 handler->token, path, times[0].tv_sec, times[1].tv_sec);
         if (utimensat(-1, path, times, 0) < 0) {
+            invalidate_attr(fuse, node);
             return -errno;
         }
     }
-    return fuse_reply_attr(fuse, hdr->unique, node, path);
+    invalidate_attr(fuse, node);
+    return fuse_reply_attr(fuse, hdr->unique, node, path, -1);
 }
 
 static int handle_mknod(struct fuse* fuse, struct fuse_handler* handler,
@@ -990,16 +1433,16 @@ static int handle_mknod(struct fuse* fuse, struct fuse_handler* handler,
     char child_path[PATH_MAX];
     const char* actual_name;
 
-    pthread_mutex_lock(&fuse->lock);
+    pthread_rwlock_rdlock(&fuse->lock);
     has_rw = get_caller_has_rw_locked(fuse, hdr);
     parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             parent_path, sizeof(parent_path));
     TRACE("[%d] MKNOD %s 0%o @ %"PRIx64" (%s)\n", handler->token,
             name, req->mode, hdr->nodeid, parent_node ? parent_node->name : "?");
-    pthread_mutex_unlock(&fuse->lock);
+    pthread_rwlock_unlock(&fuse->lock);
 
-    if (!parent_node || !(actual_name = find_file_within(parent_path, name,
-            child_path, sizeof(child_path), 1))) {
+    if (!parent_node || !(actual_name = find_file_within(fuse, parent_node,
+            parent_path, name, child_path, sizeof(child_path), 1))) {
         return -ENOENT;
     }
     if (!check_caller_access_to_name(fuse, hdr, parent_node, name, W_OK, has_rw)) {
@@ -1009,6 +1452,7 @@ static int handle_mknod(struct fuse* fuse, struct fuse_handler* handler,
     if (mknod(child_path, mode, req->rdev) < 0) {
         return -errno;
     }
+    invalidate_attr(fuse, parent_node);
     return fuse_reply_entry(fuse, hdr->unique, parent_node, name, actual_name, child_path);
 }
 
@@ -1021,16 +1465,16 @@ static int handle_mkdir(struct fuse* fuse, struct fuse_handler* handler,
     char child_path[PATH_MAX];
     const char* actual_name;
 
-    pthread_mutex_lock(&fuse->lock);
+    pthread_rwlock_rdlock(&fuse->lock);
     has_rw = get_caller_has_rw_locked(fuse, hdr);
     parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             parent_path, sizeof(parent_path));
     TRACE("[%d] MKDIR %s 0%o @ %"PRIx64" (%s)\n", handler->token,
             name, req->mode, hdr->nodeid, parent_node ? parent_node->name : "?");
-    pthread_mutex_unlock(&fuse->lock);
+    pthread_rwlock_unlock(&fuse->lock);
 
-    if (!parent_node || !(actual_name = find_file_within(parent_path, name,
-            child_path, sizeof(child_path), 1))) {
+    if (!parent_node || !(actual_name = find_file_within(fuse, parent_node,
+            parent_path, name, child_path, sizeof(child_path), 1))) {
         return -ENOENT;
     }
     if (!check_caller_access_to_name(fuse, hdr, parent_node, name, W_OK, has_rw)) {
@@ -1040,6 +1484,7 @@ static int handle_mkdir(struct fuse* fuse, struct fuse_handler* handler,
     if (mkdir(child_path, mode) < 0) {
         return -errno;
     }
+    invalidate_attr(fuse, parent_node);
 
     /* When creating /Android/data and /Android/obb, mark them as .nomedia */
     if (parent_node->perm == PERM_ANDROID && !strcasecmp(name, "data")) {
@@ -1070,16 +1515,16 @@ static int handle_unlink(struct fuse* fuse, struct fuse_handler* handler,
     char parent_path[PATH_MAX];
     char child_path[PATH_MAX];
 
-    pthread_mutex_lock(&fuse->lock);
+    pthread_rwlock_rdlock(&fuse->lock);
     has_rw = get_caller_has_rw_locked(fuse, hdr);
     parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             parent_path, sizeof(parent_path));
     TRACE("[%d] UNLINK %s @ %"PRIx64" (%s)\n", handler->token,
             name, hdr->nodeid, parent_node ? parent_node->name : "?");
-    pthread_mutex_unlock(&fuse->lock);
+    pthread_rwlock_unlock(&fuse->lock);
 
-    if (!parent_node || !find_file_within(parent_path, name,
-            child_path, sizeof(child_path), 1)) {
+    if (!parent_node || !find_file_within(fuse, parent_node,
+            parent_path, name, child_path, sizeof(child_path), 1)) {
         return -ENOENT;
     }
     if (!check_caller_access_to_name(fuse, hdr, parent_node, name, W_OK, has_rw)) {
@@ -1088,6 +1533,7 @@ static int handle_unlink(struct fuse* fuse, struct fuse_handler* handler,
     if (unlink(child_path) < 0) {
         return -errno;
     }
+    invalidate_attr(fuse, parent_node);
     return 0;
 }
 
@@ -1099,16 +1545,16 @@ static int handle_rmdir(struct fuse* fuse, struct fuse_handler* handler,
     char parent_path[PATH_MAX];
     char child_path[PATH_MAX];
 
-    pthread_mutex_lock(&fuse->lock);
+    pthread_rwlock_rdlock(&fuse->lock);
     has_rw = get_caller_has_rw_locked(fuse, hdr);
     parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             parent_path, sizeof(parent_path));
     TRACE("[%d] RMDIR %s @ %"PRIx64" (%s)\n", handler->token,
             name, hdr->nodeid, parent_node ? parent_node->name : "?");
-    pthread_mutex_unlock(&fuse->lock);
+    pthread_rwlock_unlock(&fuse->lock);
 
-    if (!parent_node || !find_file_within(parent_path, name,
-            child_path, sizeof(child_path), 1)) {
+    if (!parent_node || !find_file_within(fuse, parent_node,
+            parent_path, name, child_path, sizeof(child_path), 1)) {
         return -ENOENT;
     }
     if (!check_caller_access_to_name(fuse, hdr, parent_node, name, W_OK, has_rw)) {
@@ -1117,6 +1563,7 @@ static int handle_rmdir(struct fuse* fuse, struct fuse_handler* handler,
     if (rmdir(child_path) < 0) {
         return -errno;
     }
+    invalidate_attr(fuse, parent_node);
     return 0;
 }
 
@@ -1135,7 +1582,7 @@ static int handle_rename(struct fuse* fuse, struct fuse_handler* handler,
     const char* new_actual_name;
     int res;
 
-    pthread_mutex_lock(&fuse->lock);
+    pthread_rwlock_rdlock(&fuse->lock);
     has_rw = get_caller_has_rw_locked(fuse, hdr);
     old_parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
             old_parent_path, sizeof(old_parent_path));
@@ -1164,7 +1611,7 @@ static int handle_rename(struct fuse* fuse, struct fuse_handler* handler,
         goto lookup_error;
     }
     acquire_node_locked(child_node);
-    pthread_mutex_unlock(&fuse->lock);
+    pthread_rwlock_unlock(&fuse->lock);
 
     /* Special case for renaming a file where destination is same path
      * differing only by case.  In this case we don't want to look for a case
@@ -1172,8 +1619,8 @@ static int handle_rename(struct fuse* fuse, struct fuse_handler* handler,
      */
     int search = old_parent_node != new_parent_node
             || strcasecmp(old_name, new_name);
-    if (!(new_actual_name = find_file_within(new_parent_path, new_name,
-            new_child_path, sizeof(new_child_path), search))) {
+    if (!(new_actual_name = find_file_within(fuse, new_parent_node,
+            new_parent_path, new_name, new_child_path, sizeof(new_child_path), search))) {
         res = -ENOENT;
         goto io_error;
     }
@@ -1184,21 +1631,24 @@ static int handle_rename(struct fuse* fuse, struct fuse_handler* handler,
         res = -errno;
         goto io_error;
     }
+    invalidate_attr(fuse, old_parent_node);
+    invalidate_attr(fuse, new_parent_node);
+    invalidate_attr(fuse, child_node);
 
-    pthread_mutex_lock(&fuse->lock);
+    pthread_rwlock_wrlock(&fuse->lock);
     res = rename_node_locked(child_node, new_name, new_actual_name);
     if (!res) {
         remove_node_from_parent_locked(child_node);
-        add_node_to_parent_locked(child_node, new_parent_node);
+        add_node_to_parent_locked(fuse, child_node, new_parent_node);
     }
     goto done;
 
 io_error:
-    pthread_mutex_lock(&fuse->lock);
+    pthread_rwlock_wrlock(&fuse->lock);
 done:
     release_node_locked(child_node);
 lookup_error:
-    pthread_mutex_unlock(&fuse->lock);
+    pthread_rwlock_unlock(&fuse->lock);
     return res;
 }
 
@@ -1222,12 +1672,12 @@ static int handle_open(struct fuse* fuse, struct fuse_handler* handler,
     struct fuse_open_out out;
     struct handle *h;
 
-    pthread_mutex_lock(&fuse->lock);
+    pthread_rwlock_rdlock(&fuse->lock);
     has_rw = get_caller_has_rw_locked(fuse, hdr);
     node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid, path, sizeof(path));
     TRACE("[%d] OPEN 0%o @ %"PRIx64" (%s)\n", handler->token,
             req->flags, hdr->nodeid, node ? node->name : "?");
-    pthread_mutex_unlock(&fuse->lock);
+    pthread_rwlock_unlock(&fuse->lock);
 
     if (!node) {
         return -ENOENT;
@@ -1246,6 +1696,11 @@ static int handle_open(struct fuse* fuse, struct fuse_handler* handler,
         free(h);
         return -errno;
     }
+    /* The kernel holds on to the node for as long as the file is open. */
+    h->node = node;
+    if (req->flags & O_TRUNC) {
+        invalidate_attr(fuse, node);
+    }
     out.fh = ptr_to_id(h);
     out.open_flags = 0;
     out.padding = 0;
@@ -1253,6 +1708,178 @@ static int handle_open(struct fuse* fuse, struct fuse_handler* handler,
     return NO_STATUS;
 }
 
+static void close_pipe(struct fuse_handler* handler)
+{
+    close(handler->pipe[0]);
+    close(handler->pipe[1]);
+    handler->pipe[0] = handler->pipe[1] = -1;
+    handler->pipe_len = 0;
+}
+
+/* Reads exactly |len| bytes out of the handler's pipe. */
+static int read_pipe(struct fuse_handler* handler, void* buf, size_t len)
+{
+    while (len) {
+        ssize_t res = read(handler->pipe[0], buf, len);
+        if (res <= 0) {
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+            ERROR("[%d] pipe read failed: %s\n", handler->token,
+                    res ? strerror(errno) : "short");
+            return -1;
+        }
+        buf = (__u8*) buf + res;
+        len -= res;
+    }
+    return 0;
+}
+
+/* Reads the next request. With a pipe the request is spliced into it, and
+ * the payload of a WRITE is left there for handle_write() to splice on to
+ * the file; everything else is read into the request buffer. */
+static ssize_t read_request(struct fuse* fuse, struct fuse_handler* handler)
+{
+    const struct fuse_in_header* hdr = (void*) handler->request_buffer;
+    size_t head = sizeof(struct fuse_in_header) + sizeof(struct fuse_write_in);
+    ssize_t len;
+
+    if (handler->pipe[0] < 0) {
+        return read(fuse->fd, handler->request_buffer, fuse->max_request_size);
+    }
+    len = splice(fuse->fd, NULL, handler->pipe[1], NULL, fuse->max_request_size, 0);
+    if (len < 0 && errno == EINVAL) {
+        /* no splicing from /dev/fuse on this kernel */
+        close_pipe(handler);
+        return read(fuse->fd, handler->request_buffer, fuse->max_request_size);
+    }
+    if (len <= 0) {
+        return len;
+    }
+    if ((size_t) len < head) {
+        head = len;
+    }
+    if (read_pipe(handler, handler->request_buffer, head)) {
+        close_pipe(handler);
+        return -1;
+    }
+    if (head < sizeof(*hdr) || hdr->opcode != FUSE_WRITE) {
+        if (read_pipe(handler, handler->request_buffer + head, len - head)) {
+            close_pipe(handler);
+            return -1;
+        }
+    } else {
+        handler->pipe_len = len - head;
+    }
+    return len;
+}
+
+/* Throws away whatever is left in the pipe, should a request not have
+ * consumed all of its payload. */
+static void drain_pipe(struct fuse_handler* handler)
+{
+    while (handler->pipe_len) {
+        size_t len = handler->pipe_len;
+        if (len > handler->fuse->max_request_size) {
+            len = handler->fuse->max_request_size;
+        }
+        if (read_pipe(handler, handler->request_buffer, len)) {
+            /* can't tell where the next request starts, stop splicing */
+            close_pipe(handler);
+            return;
+        }
+        handler->pipe_len -= len;
+    }
+}
+
+/* Replies to a READ by splicing the data from the file into the pipe behind
+ * the reply header, then the lot on to /dev/fuse, so that it never passes
+ * through our buffers. A short read is patched up through the read buffer
+ * instead, as the header has to give the final length up front. Returns
+ * -ENOSYS if the file can't be spliced from, and nothing was sent. */
+static int splice_read(struct fuse* fuse, struct fuse_handler* handler,
+        __u64 unique, int fd, __u32 size, __u64 offset)
+{
+    struct fuse_out_header* out = (void*) handler->read_buffer;
+    off64_t off = offset;
+    size_t len = 0;
+    ssize_t res = 0;
+    int err = 0;
+
+    out->len = sizeof(*out) + size;
+    out->error = 0;
+    out->unique = unique;
+    if (write(handler->pipe[1], out, sizeof(*out)) != sizeof(*out)) {
+        return -ENOSYS;
+    }
+    while (len < size) {
+        res = splice(fd, &off, handler->pipe[1], NULL, size - len, SPLICE_F_MOVE);
+        if (res <= 0) {
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+            err = res ? errno : 0;
+            break;
+        }
+        len += res;
+    }
+    if (len == size) {
+        res = splice(handler->pipe[0], NULL, fuse->fd, NULL, sizeof(*out) + len,
+                SPLICE_F_MOVE);
+        if (res == (ssize_t) (sizeof(*out) + len)) {
+            return NO_STATUS;
+        }
+        if (res >= 0) {
+            /* the kernel takes a reply whole or not at all */
+            ERROR("*** REPLY FAILED *** short splice\n");
+            return NO_STATUS;
+        }
+    } else if (!len && (err == EINVAL || err == ENOSYS)) {
+        handler->pipe_len = sizeof(*out);
+        drain_pipe(handler);
+        return -ENOSYS;
+    }
+
+    handler->pipe_len = sizeof(*out) + len;
+    if (read_pipe(handler, handler->read_buffer, handler->pipe_len)) {
+        handler->pipe_len = 0;
+        return -EIO;
+    }
+    handler->pipe_len = 0;
+    if (!len && err) {
+        return -err;
+    }
+    fuse_reply(fuse, unique, handler->read_buffer + sizeof(*out), len);
+    return NO_STATUS;
+}
+
+/* Splices a WRITE payload from the pipe on to the file. Whatever the file
+ * won't take is left for handle_fuse_requests() to drain. Returns the
+ * number of bytes written, or -EINVAL if the file can't be spliced to
+ * (as when it was opened O_APPEND) and the payload is still in the pipe. */
+static int splice_write(struct fuse_handler* handler, int fd, __u64 offset)
+{
+    off64_t off = offset;
+    size_t len = 0;
+    ssize_t res;
+
+    while (handler->pipe_len) {
+        res = splice(handler->pipe[0], NULL, fd, &off, handler->pipe_len, SPLICE_F_MOVE);
+        if (res <= 0) {
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+            if (!len) {
+                return res ? -errno : -EIO;
+            }
+            break;
+        }
+        handler->pipe_len -= res;
+        len += res;
+    }
+    return len;
+}
+
 static int handle_read(struct fuse* fuse, struct fuse_handler* handler,
         const struct fuse_in_header* hdr, const struct fuse_read_in* req)
 {
@@ -1269,9 +1896,15 @@ static int handle_read(struct fuse* fuse, struct fuse_handler* handler,
 
     TRACE("[%d] READ %p(%d) %u@%"PRIu64"\n", handler->token,
             h, h->fd, size, (uint64_t) offset);
-    if (size > MAX_READ) {
+    if (size > fuse->max_read) {
         return -EINVAL;
     }
+    if (handler->pipe[0] >= 0) {
+        res = splice_read(fuse, handler, unique, h->fd, size, offset);
+        if (res != -ENOSYS) {
+            return res;
+        }
+    }
     res = pread64(h->fd, read_buffer, size, offset);
     if (res < 0) {
         return -errno;
@@ -1287,19 +1920,40 @@ static int handle_write(struct fuse* fuse, struct fuse_handler* handler,
     struct fuse_write_out out;
     struct handle *h = id_to_ptr(req->fh);
     int res;
-    __u8 aligned_buffer[req->size] __attribute__((__aligned__(PAGESIZE)));
-
-    if (req->flags & O_DIRECT) {
-        memcpy(aligned_buffer, buffer, req->size);
-        buffer = (const __u8*) aligned_buffer;
-    }
+    /* The request buffer starts on a page and the header fits in its first
+     * page, so a copied payload can go in the pages after it without
+     * clobbering req. */
+    __u8* aligned_buffer = handler->request_buffer + PAGESIZE;
 
     TRACE("[%d] WRITE %p(%d) %u@%"PRIu64"\n", handler->token,
             h, h->fd, req->size, req->offset);
-    res = pwrite64(h->fd, buffer, req->size, req->offset);
-    if (res < 0) {
-        return -errno;
+    if (req->size > fuse->max_write
+            || (handler->pipe_len && handler->pipe_len != req->size)) {
+        return -EINVAL;
+    }
+    res = -EINVAL; /* anything that can't be spliced is copied instead */
+    if (handler->pipe_len && !(req->flags & O_DIRECT)) {
+        res = splice_write(handler, h->fd, req->offset);
+    }
+    if (res == -EINVAL) {
+        if (handler->pipe_len) {
+            if (read_pipe(handler, aligned_buffer, req->size)) {
+                return -EIO;
+            }
+            handler->pipe_len = 0;
+            buffer = (const __u8*) aligned_buffer;
+        } else if (req->flags & O_DIRECT) {
+            memmove(aligned_buffer, buffer, req->size);
+            buffer = (const __u8*) aligned_buffer;
+        }
+        res = pwrite64(h->fd, buffer, req->size, req->offset);
+        if (res < 0) {
+            return -errno;
+        }
+    } else if (res < 0) {
+        return res;
     }
+    invalidate_attr(fuse, h->node);
     out.size = res;
     fuse_reply(fuse, hdr->unique, &out, sizeof(out));
     return NO_STATUS;
@@ -1313,10 +1967,10 @@ static int handle_statfs(struct fuse* fuse, struct fuse_handler* handler,
     struct fuse_statfs_out out;
     int res;
 
-    pthread_mutex_lock(&fuse->lock);
+    pthread_rwlock_rdlock(&fuse->lock);
     TRACE("[%d] STATFS\n", handler->token);
     res = get_node_path_locked(&fuse->root, path, sizeof(path));
-    pthread_mutex_unlock(&fuse->lock);
+    pthread_rwlock_unlock(&fuse->lock);
     if (res < 0) {
         return -ENOENT;
     }
@@ -1387,11 +2041,11 @@ static int handle_opendir(struct fuse* fuse, struct fuse_handler* handler,
     struct fuse_open_out out;
     struct dirhandle *h;
 
-    pthread_mutex_lock(&fuse->lock);
+    pthread_rwlock_rdlock(&fuse->lock);
     node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid, path, sizeof(path));
     TRACE("[%d] OPENDIR @ %"PRIx64" (%s)\n", handler->token,
             hdr->nodeid, node ? node->name : "?");
-    pthread_mutex_unlock(&fuse->lock);
+    pthread_rwlock_unlock(&fuse->lock);
 
     if (!node) {
         return -ENOENT;
@@ -1409,6 +2063,8 @@ static int handle_opendir(struct fuse* fuse, struct fuse_handler* handler,
         free(h);
         return -errno;
     }
+    h->pos = 0;
+    h->next = NULL;
     out.fh = ptr_to_id(h);
     out.open_flags = 0;
     out.padding = 0;
@@ -1416,34 +2072,167 @@ static int handle_opendir(struct fuse* fuse, struct fuse_handler* handler,
     return NO_STATUS;
 }
 
+/* Positions |h| after the first |offset| entries. The kernel normally
+ * carries on where the last reply ended, but goes back when it could not
+ * pass all of a reply on to its caller. */
+static void seek_dirhandle(struct dirhandle *h, __u64 offset)
+{
+    if (offset == 0 || offset < h->pos) {
+        /* rewinddir() might have been called above us, so rewind here too */
+        rewinddir(h->d);
+        h->pos = 0;
+        h->next = NULL;
+    }
+    while (h->pos < offset) {
+        if (!h->next && !(h->next = readdir(h->d))) {
+            break;
+        }
+        h->next = NULL;
+        h->pos++;
+    }
+}
+
+/* Returns the entry at the current position without consuming it. */
+static struct dirent *peek_dirhandle(struct dirhandle *h)
+{
+    if (!h->next) {
+        h->next = readdir(h->d);
+    }
+    return h->next;
+}
+
+static void consume_dirhandle(struct dirhandle *h)
+{
+    h->next = NULL;
+    h->pos++;
+}
+
 static int handle_readdir(struct fuse* fuse, struct fuse_handler* handler,
         const struct fuse_in_header* hdr, const struct fuse_read_in* req)
 {
-    char buffer[8192];
-    struct fuse_dirent *fde = (struct fuse_dirent*) buffer;
+    char buffer[8192] __attribute__((aligned(8)));
+    size_t size = req->size < sizeof(buffer) ? req->size : sizeof(buffer);
+    size_t len = 0;
     struct dirent *de;
     struct dirhandle *h = id_to_ptr(req->fh);
 
-    TRACE("[%d] READDIR %p\n", handler->token, h);
-    if (req->offset == 0) {
-        /* rewinddir() might have been called above us, so rewind here too */
-        TRACE("[%d] calling rewinddir()\n", handler->token);
-        rewinddir(h->d);
+    TRACE("[%d] READDIR %p @ %"PRIu64"\n", handler->token, h, req->offset);
+    seek_dirhandle(h, req->offset);
+
+    /* Return as many entries as fit, rather than one per request */
+    while ((de = peek_dirhandle(h))) {
+        struct fuse_dirent *fde = (struct fuse_dirent*) (buffer + len);
+        size_t namelen = strlen(de->d_name);
+        size_t reclen = FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET + namelen);
+
+        if (len + reclen > size) {
+            break;
+        }
+        consume_dirhandle(h);
+        memset(fde, 0, reclen);
+        fde->ino = FUSE_UNKNOWN_INO;
+        fde->off = h->pos;
+        fde->type = de->d_type;
+        fde->namelen = namelen;
+        memcpy(fde->name, de->d_name, namelen);
+        len += reclen;
+    }
+    if (!len) {
+        return de ? -EINVAL : 0;
+    }
+    fuse_reply(fuse, hdr->unique, buffer, len);
+    return NO_STATUS;
+}
+
+#ifdef FUSE_DO_READDIRPLUS
+/* Fills in |out| as a LOOKUP of |name| would, taking a reference on the
+ * node for the kernel. Otherwise |out| is left with no node, and the
+ * kernel falls back to a LOOKUP if it needs one. */
+static void lookup_direntplus(struct fuse* fuse, const struct fuse_in_header* hdr,
+        struct node* parent_node, const char* parent_path, const char* name,
+        struct fuse_entry_out* out)
+{
+    char child_path[PATH_MAX];
+    struct node* node;
+    struct stat s;
+
+    memset(out, 0, sizeof(*out));
+    if (!strcmp(name, ".") || !strcmp(name, "..")) {
+        return;
     }
-    de = readdir(h->d);
-    if (!de) {
-        return 0;
+    if (!check_caller_access_to_name(fuse, hdr, parent_node, name, R_OK, false)) {
+        return;
+    }
+    if (snprintf(child_path, sizeof(child_path), "%s/%s", parent_path, name)
+            >= (int) sizeof(child_path)) {
+        return;
+    }
+    if (lstat(child_path, &s) < 0) {
+        return;
     }
-    fde->ino = FUSE_UNKNOWN_INO;
-    /* increment the offset so we can detect when rewinddir() seeks back to the beginning */
-    fde->off = req->offset + 1;
-    fde->type = de->d_type;
-    fde->namelen = strlen(de->d_name);
-    memcpy(fde->name, de->d_name, fde->namelen + 1);
-    fuse_reply(fuse, hdr->unique, fde,
-            FUSE_DIRENT_ALIGN(sizeof(struct fuse_dirent) + fde->namelen));
+
+    node = acquire_or_create_child(fuse, parent_node, name, name);
+    if (node) {
+        attr_from_stat(&out->attr, &s, node);
+        out->attr_valid = fuse->attr_timeout;
+        out->entry_valid = fuse->entry_timeout;
+        out->nodeid = node->nid;
+        out->generation = node->gen;
+    }
+    pthread_rwlock_unlock(&fuse->lock);
+}
+
+/* READDIR with a LOOKUP of each entry, so that listing with attributes
+ * costs one request per reply rather than one per entry. */
+static int handle_readdirplus(struct fuse* fuse, struct fuse_handler* handler,
+        const struct fuse_in_header* hdr, const struct fuse_read_in* req)
+{
+    char buffer[8192] __attribute__((aligned(8)));
+    size_t size = req->size < sizeof(buffer) ? req->size : sizeof(buffer);
+    size_t len = 0;
+    struct dirent *de;
+    struct dirhandle *h = id_to_ptr(req->fh);
+    struct node* parent_node;
+    char parent_path[PATH_MAX];
+
+    pthread_rwlock_rdlock(&fuse->lock);
+    parent_node = lookup_node_and_path_by_id_locked(fuse, hdr->nodeid,
+            parent_path, sizeof(parent_path));
+    TRACE("[%d] READDIRPLUS %p @ %"PRIu64" (%s)\n", handler->token, h, req->offset,
+            parent_node ? parent_node->name : "?");
+    pthread_rwlock_unlock(&fuse->lock);
+
+    if (!parent_node) {
+        return -ENOENT;
+    }
+    seek_dirhandle(h, req->offset);
+
+    while ((de = peek_dirhandle(h))) {
+        struct fuse_direntplus *fdp = (struct fuse_direntplus*) (buffer + len);
+        size_t namelen = strlen(de->d_name);
+        size_t reclen = FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET_DIRENTPLUS + namelen);
+
+        if (len + reclen > size) {
+            break;
+        }
+        consume_dirhandle(h);
+        memset(fdp, 0, reclen);
+        lookup_direntplus(fuse, hdr, parent_node, parent_path, de->d_name,
+                &fdp->entry_out);
+        fdp->dirent.ino = fdp->entry_out.nodeid ? fdp->entry_out.attr.ino : FUSE_UNKNOWN_INO;
+        fdp->dirent.off = h->pos;
+        fdp->dirent.type = de->d_type;
+        fdp->dirent.namelen = namelen;
+        memcpy(fdp->dirent.name, de->d_name, namelen);
+        len += reclen;
+    }
+    if (!len) {
+        return de ? -EINVAL : 0;
+    }
+    fuse_reply(fuse, hdr->unique, buffer, len);
     return NO_STATUS;
 }
+#endif
 
 static int handle_releasedir(struct fuse* fuse, struct fuse_handler* handler,
         const struct fuse_in_header* hdr, const struct fuse_release_in* req)
@@ -1463,13 +2252,27 @@ static int handle_init(struct fuse* fuse, struct fuse_handler* handler,
 
     TRACE("[%d] INIT ver=%d.%d maxread=%d flags=%x\n",
             handler->token, req->major, req->minor, req->max_readahead, req->flags);
+    memset(&out, 0, sizeof(out));
     out.major = FUSE_KERNEL_VERSION;
     out.minor = FUSE_KERNEL_MINOR_VERSION;
     out.max_readahead = req->max_readahead;
     out.flags = FUSE_ATOMIC_O_TRUNC | FUSE_BIG_WRITES;
+#ifdef FUSE_DO_READDIRPLUS
+    /* Let the kernel read attributes along with entries when it expects
+     * them to be looked up, as for "ls -l". */
+    out.flags |= req->flags & (FUSE_DO_READDIRPLUS | FUSE_READDIRPLUS_AUTO);
+#endif
+#ifdef FUSE_MAX_PAGES
+    /* Without this the kernel caps requests at 32 pages. */
+    if (req->flags & FUSE_MAX_PAGES) {
+        __u32 max_io = fuse->max_read > fuse->max_write ? fuse->max_read : fuse->max_write;
+        out.flags |= FUSE_MAX_PAGES;
+        out.max_pages = max_io / PAGESIZE;
+    }
+#endif
     out.max_background = 32;
     out.congestion_threshold = 32;
-    out.max_write = MAX_WRITE;
+    out.max_write = fuse->max_write;
     fuse_reply(fuse, hdr->unique, &out, sizeof(out));
     return NO_STATUS;
 }
@@ -1579,6 +2382,13 @@ static int handle_fuse_request(struct fuse *fuse, struct fuse_handler* handler,
         return handle_readdir(fuse, handler, hdr, req);
     }
 
+#ifdef FUSE_DO_READDIRPLUS
+    case FUSE_READDIRPLUS: {
+        const struct fuse_read_in *req = data;
+        return handle_readdirplus(fuse, handler, hdr, req);
+    }
+#endif
+
     case FUSE_RELEASEDIR: { /* release_in -> */
         const struct fuse_release_in *req = data;
         return handle_releasedir(fuse, handler, hdr, req);
@@ -1601,8 +2411,7 @@ static void handle_fuse_requests(struct fuse_handler* handler)
 {
     struct fuse* fuse = handler->fuse;
     for (;;) {
-        ssize_t len = read(fuse->fd,
-                handler->request_buffer, sizeof(handler->request_buffer));
+        ssize_t len = read_request(fuse, handler);
         if (len < 0) {
             if (errno != EINTR) {
                 ERROR("[%d] handle_fuse_requests: errno=%d\n", handler->token, errno);
@@ -1626,6 +2435,7 @@ static void handle_fuse_requests(struct fuse_handler* handler)
         size_t data_len = len - sizeof(struct fuse_in_header);
         __u64 unique = hdr->unique;
         int res = handle_fuse_request(fuse, handler, hdr, data, data_len);
+        drain_pipe(handler);
 
         /* We do not access the request again after this point because the underlying
          * buffer storage may have been reused while processing the request. */
@@ -1639,6 +2449,36 @@ static void handle_fuse_requests(struct fuse_handler* handler)
     }
 }
 
+/* Sets up the buffers of a handler, and the pipe it splices through if the
+ * pipe can be made big enough to hold any request or reply.  The buffer is
+ * page aligned with a page ahead of the largest READ or WRITE payload, which
+ * handle_read and handle_write use for aligned data. */
+static int init_handler(struct fuse* fuse, struct fuse_handler* handler, int token)
+{
+    size_t size = PAGESIZE + (fuse->max_read > fuse->max_write
+            ? fuse->max_read : fuse->max_write);
+    void* buffer;
+    if (size < fuse->max_request_size) {
+        size = fuse->max_request_size;
+    }
+
+    handler->fuse = fuse;
+    handler->token = token;
+    handler->pipe_len = 0;
+    if (posix_memalign(&buffer, PAGESIZE, size)) {
+        return -ENOMEM;
+    }
+    handler->request_buffer = buffer;
+    handler->read_buffer = handler->request_buffer;
+
+    if (pipe(handler->pipe)) {
+        handler->pipe[0] = handler->pipe[1] = -1;
+    } else if (fcntl(handler->pipe[1], F_SETPIPE_SZ, size + PAGESIZE) < (int) (size + PAGESIZE)) {
+        close_pipe(handler);
+    }
+    return 0;
+}
+
 static void* start_handler(void* data)
 {
     struct fuse_handler* handler = data;
@@ -1660,7 +2500,7 @@ static bool remove_int_to_null(void *key, void *value, void *context) {
 }
 
 static int read_package_list(struct fuse *fuse) {
-    pthread_mutex_lock(&fuse->lock);
+    pthread_rwlock_wrlock(&fuse->lock);
 
     hashmapForEach(fuse->package_to_appid, remove_str_to_int, fuse->package_to_appid);
     hashmapForEach(fuse->appid_with_rw, remove_int_to_null, fuse->appid_with_rw);
@@ -1668,7 +2508,7 @@ static int read_package_list(struct fuse *fuse) {
     FILE* file = fopen(kPackagesListFile, "r");
     if (!file) {
         ERROR("failed to open package list: %s\n", strerror(errno));
-        pthread_mutex_unlock(&fuse->lock);
+        pthread_rwlock_unlock(&fuse->lock);
         return -1;
     }
 
@@ -1697,7 +2537,12 @@ static int read_package_list(struct fuse *fuse) {
             hashmapSize(fuse->package_to_appid),
             hashmapSize(fuse->appid_with_rw));
     fclose(file);
-    pthread_mutex_unlock(&fuse->lock);
+
+    pthread_mutex_lock(&fuse->attr_lock);
+    derive_permissions_recursive_locked(fuse, &fuse->root);
+    pthread_mutex_unlock(&fuse->attr_lock);
+
+    pthread_rwlock_unlock(&fuse->lock);
     return 0;
 }
 
@@ -1775,8 +2620,10 @@ static int ignite_fuse(struct fuse* fuse, int num_threads)
     }
 
     for (i = 0; i < num_threads; i++) {
-        handlers[i].fuse = fuse;
-        handlers[i].token = i;
+        if (init_handler(fuse, &handlers[i], i)) {
+            ERROR("cannot allocate storage for threads\n");
+            return -ENOMEM;
+        }
     }
 
     /* When deriving permissions, this thread is used to process inotify events,
@@ -1811,17 +2658,36 @@ static int usage()
             "    -u: specify UID to run as\n"
             "    -g: specify GID to run as\n"
             "    -w: specify GID required to write (default sdcard_rw, requires -d or -l)\n"
-            "    -t: specify number of threads to use (default %d)\n"
+            "    -t: specify number of threads to use (default one per CPU, %d to %d)\n"
+            "    -R: specify largest read request in KiB (default %d, at most %d)\n"
+            "    -W: specify largest write request in KiB (default %d, at most %d)\n"
+            "    -e: specify seconds the kernel may cache names (default %d)\n"
+            "    -a: specify seconds attributes may be cached (default %d)\n"
             "    -d: derive file permissions based on path\n"
             "    -l: derive file permissions based on legacy internal layout\n"
             "    -s: split derived permissions for pics, av\n"
-            "\n", DEFAULT_NUM_THREADS);
+            "\n", DEFAULT_NUM_THREADS, MAX_DEFAULT_NUM_THREADS,
+            MAX_READ / 1024, MAX_IO_SIZE / 1024, MAX_WRITE / 1024, MAX_IO_SIZE / 1024,
+            DEFAULT_ENTRY_TIMEOUT, DEFAULT_ATTR_TIMEOUT);
     return 1;
 }
 
+static int default_num_threads()
+{
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (cpus < DEFAULT_NUM_THREADS) {
+        return DEFAULT_NUM_THREADS;
+    }
+    if (cpus > MAX_DEFAULT_NUM_THREADS) {
+        return MAX_DEFAULT_NUM_THREADS;
+    }
+    return cpus;
+}
+
 static int run(const char* source_path, const char* dest_path, uid_t uid,
         gid_t gid, gid_t write_gid, int num_threads, derive_t derive,
-        bool split_perms) {
+        bool split_perms, __u32 max_read, __u32 max_write,
+        __u32 entry_timeout, __u32 attr_timeout) {
     int fd;
     char opts[256];
     int res;
@@ -1837,8 +2703,8 @@ static int run(const char* source_path, const char* dest_path, uid_t uid,
     }
 
     snprintf(opts, sizeof(opts),
-            "fd=%i,rootmode=40000,default_permissions,allow_other,user_id=%d,group_id=%d",
-            fd, uid, gid);
+            "fd=%i,rootmode=40000,default_permissions,allow_other,user_id=%d,group_id=%d,"
+            "max_read=%u", fd, uid, gid, max_read);
 
     res = mount("/dev/fuse", dest_path, "fuse", MS_NOSUID | MS_NODEV | MS_NOEXEC, opts);
     if (res < 0) {
@@ -1864,7 +2730,8 @@ static int run(const char* source_path, const char* dest_path, uid_t uid,
         goto error;
     }
 
-    fuse_init(&fuse, fd, source_path, write_gid, derive, split_perms);
+    fuse_init(&fuse, fd, source_path, write_gid, derive, split_perms, max_read, max_write,
+            entry_timeout, attr_timeout);
 
     umask(0);
     res = ignite_fuse(&fuse, num_threads);
@@ -1885,15 +2752,19 @@ int main(int argc, char **argv)
     uid_t uid = 0;
     gid_t gid = 0;
     gid_t write_gid = AID_SDCARD_RW;
-    int num_threads = DEFAULT_NUM_THREADS;
+    int num_threads = default_num_threads();
     derive_t derive = DERIVE_NONE;
     bool split_perms = false;
+    __u32 max_read = MAX_READ;
+    __u32 max_write = MAX_WRITE;
+    __u32 entry_timeout = DEFAULT_ENTRY_TIMEOUT;
+    __u32 attr_timeout = DEFAULT_ATTR_TIMEOUT;
     int i;
     struct rlimit rlim;
     int fs_version;
 
     int opt;
-    while ((opt = getopt(argc, argv, "u:g:w:t:dls")) != -1) {
+    while ((opt = getopt(argc, argv, "u:g:w:t:R:W:e:a:dls")) != -1) {
         switch (opt) {
             case 'u':
                 uid = strtoul(optarg, NULL, 10);
@@ -1907,6 +2778,18 @@ int main(int argc, char **argv)
             case 't':
                 num_threads = strtoul(optarg, NULL, 10);
                 break;
+            case 'R':
+                max_read = strtoul(optarg, NULL, 10) * 1024;
+                break;
+            case 'W':
+                max_write = strtoul(optarg, NULL, 10) * 1024;
+                break;
+            case 'e':
+                entry_timeout = strtoul(optarg, NULL, 10);
+                break;
+            case 'a':
+                attr_timeout = strtoul(optarg, NULL, 10);
+                break;
             case 'd':
                 derive = DERIVE_UNIFIED;
                 break;
@@ -1954,6 +2837,11 @@ int main(int argc, char **argv)
         ERROR("number of threads must be at least 1\n");
         return usage();
     }
+    if (max_read < PAGESIZE || max_read > MAX_IO_SIZE || max_read % PAGESIZE
+            || max_write < PAGESIZE || max_write > MAX_IO_SIZE || max_write % PAGESIZE) {
+        ERROR("request sizes must be whole pages, at most %d KiB\n", MAX_IO_SIZE / 1024);
+        return usage();
+    }
     if (split_perms && derive == DERIVE_NONE) {
         ERROR("cannot split permissions without deriving\n");
         return usage();
@@ -1970,6 +2858,7 @@ int main(int argc, char **argv)
         sleep(1);
     }
 
-    res = run(source_path, dest_path, uid, gid, write_gid, num_threads, derive, split_perms);
+    res = run(source_path, dest_path, uid, gid, write_gid, num_threads, derive, split_perms,
+            max_read, max_write, entry_timeout, attr_timeout);
     return res < 0 ? 1 : 0;
 }